@@ -19,6 +19,7 @@
 */
 
 #include <libpixi/pixi/simple.h>
+#include <libpixi/pixi/pwm-motion.h>
 #include <libpixi/util/command.h>
 #include <libpixi/util/string.h>
 #include <stdio.h>
@@ -31,27 +32,68 @@ const uint FrontLeft  = 7;
 const uint BackLeft   = 6;
 const uint FrontRight = 5;
 const uint BackRight  = 4;
+const uint MotorPwmMask = (1 << 7) | (1 << 6) | (1 << 5) | (1 << 4);
 
 typedef enum MotorDirection {
 	Forward = 0,
 	Reverse = 1
 } MotorDirection;
 
-const uint MotorDirectionValues[2] = {0, 0x8000};
+const int    MotorDirectionSigns[2] = {1, -1};
+const uint16 MotorReverseFlag       = 0x8000;
 
-static void prepare (void)
+// Ramp the motors, rather than stepping them, to spare the battery
+const double MotorAcceleration = 2000; // duty cycle per second^2
+const double MotorJerk         = 20000;
+
+static PwmMotion motion;
+
+static void closeDevices (void)
+{
+	gpioWritePin (MotorGpioController, MotorGpioPin, false);
+	adcClose();
+	pixiClose();
+}
+
+static int prepare (void)
 {
 	pixiOpenOrDie();
 	adcOpenOrDie();
 //	gpioSetPinMode (MotorGpioController, MotorGpioPin, ??);
 	gpioWritePin   (MotorGpioController, MotorGpioPin, true);
+
+	int result = pixi_pwmMotionInit (&motion, PwmMotionDefaultRate);
+	if (result < 0)
+	{
+		APP_ERROR(-result, "Cannot initialise motor ramping");
+		closeDevices();
+		return result;
+	}
+	motion.reverseFlag = MotorReverseFlag;
+	for (uint pwm = 0; pwm < PixiPwmCount; pwm++)
+	{
+		if (!(MotorPwmMask & (1 << pwm)))
+			continue;
+		pixi_pwmMotionSetLimits (&motion, pwm, 0, MotorAcceleration, MotorJerk);
+		pixi_pwmMotionSetPosition (&motion, pwm, 0);
+	}
+	result = pixi_pwmMotionStart (&motion);
+	if (result < 0)
+	{
+		APP_ERROR(-result, "Cannot start motor ramping");
+		pixi_pwmMotionFree (&motion);
+		closeDevices();
+	}
+	return result;
 }
 
 static void unprepare (void)
 {
-	gpioWritePin (MotorGpioController, MotorGpioPin, false);
-	adcClose();
-	pixiClose();
+	const int stopped[PixiPwmCount] = {0};
+	pixi_pwmMotionMoveTo (&motion, MotorPwmMask, stopped);
+	pixi_pwmMotionWait (&motion, MotorPwmMask, -1);
+	pixi_pwmMotionFree (&motion);
+	closeDevices();
 }
 
 static double readVoltage (void)
@@ -67,10 +109,14 @@ static void moveRover (MotorDirection leftSide, MotorDirection rightSide, double
 	APP_LOG_INFO ("moveRover left=%d right=%d speed=%f pwmSpeed=0x%4x", leftSide, rightSide, speed, pwmSpeed);
 
 	// each side must be synchronised, but each side the motors are opposed:
-	pwmWritePin (FrontRight, pwmSpeed + MotorDirectionValues[ rightSide]);
-	pwmWritePin (BackRight , pwmSpeed + MotorDirectionValues[!rightSide]);
-	pwmWritePin (BackLeft  , pwmSpeed + MotorDirectionValues[!leftSide ]);
-	pwmWritePin (FrontLeft , pwmSpeed + MotorDirectionValues[ leftSide ]); // Front left must be last!
+	int targets[PixiPwmCount] = {0};
+	targets[FrontRight] = pwmSpeed * MotorDirectionSigns[ rightSide];
+	targets[BackRight ] = pwmSpeed * MotorDirectionSigns[!rightSide];
+	targets[BackLeft  ] = pwmSpeed * MotorDirectionSigns[!leftSide ];
+	targets[FrontLeft ] = pwmSpeed * MotorDirectionSigns[ leftSide ];
+	// Each tick writes all four in one message, front left (the highest PWM) last
+	pixi_pwmMotionMoveTo (&motion, MotorPwmMask, targets);
+	pixi_pwmMotionWait (&motion, MotorPwmMask, -1);
 }
 
 static void moveForward  (double speed) {moveRover (Forward, Forward, speed);}
@@ -93,7 +139,9 @@ static int roverFn (const Command* command, uint argc, char* argv[])
 	const char* move = argv[1];
 	double speed = atof (argv[2]);
 
-	prepare();
+	int result = prepare();
+	if (result < 0)
+		return result;
 	APP_LOG_INFO("Power = %.3fv", readVoltage());
 	if      (pixi_strStartsWithI ("forward" , move)) moveForward  (speed);
 	else if (pixi_strStartsWithI ("backward", move)) moveBackward (speed);
@@ -123,7 +171,9 @@ static int roverDemoFn (const Command* command, uint argc, char* argv[])
 	if (argc > 1)
 		speed = atof (argv[1]);
 
-	prepare();
+	int result = prepare();
+	if (result < 0)
+		return result;
 	moveForward  (speed); rest();
 	moveBackward (speed); rest();
 	turnLeft     (speed); rest();
@@ -118,6 +118,7 @@ typedef struct State
 	int       cmdState;
 
 	char      display[DisplayLines][DisplayChars+1];
+	LcdFrameBuffer lcd;
 	uint      xPos;
 	uint      yPos;
 	uint      numKeys; // bitmap
@@ -130,21 +131,25 @@ static const char keyRight[] = {0x1b, 0x5b, 0x43, 0};
 static const char keyLeft[]  = {0x1b, 0x5b, 0x44, 0};
 
 
+/// Send the changes in the display text to the panel
+static void updatePanel (State* state)
+{
+	if (!state->usePixi)
+		return;
+	for (int i = 0; i < DisplayLines; i++)
+		memcpy (state->lcd.text[i], state->display[i], DisplayChars);
+	pixi_lcdFrameFlush (&state->lcd);
+}
+
+
 static void clearDisplay (State* state)
 {
 	APP_LOG_INFO("Clearing display");
 	memset (state->display, ' ', sizeof state->display);
 	state->xPos = 0;
 	state->yPos = 0;
-
-	if (state->usePixi)
-	{
-		// pixi_lcdClear seems to cause problems
-		pixi_lcdSetCursorPos (0, 0);
-		state->display[0][DisplayChars] = 0;
-		pixi_lcdWriteStr (state->display[0]);
-		pixi_lcdWriteStr (state->display[0]);
-	}
+	// pixi_lcdClear seems to cause problems, so just write spaces
+	updatePanel (state);
 }
 
 
@@ -194,13 +199,6 @@ static bool writeDisplayChar (State* state, byte ch)
 		state->xPos = x;
 		state->yPos = y;
 	}
-	if (state->usePixi)
-	{
-		char str[2] = {ch, 0};
-		if (ch == 0)
-			str[0] = ' ';
-		pixi_lcdWriteStr (str);
-	}
 	return update;
 }
 
@@ -212,20 +210,6 @@ static void eraseToLineEnd (State* state)
 	uint y = state->yPos;
 	uint len = DisplayChars - x;
 	memset (state->display[y] + x, ' ', len);
-	if (state->usePixi)
-	{
-		state->display[y][DisplayChars] = 0;
-		pixi_lcdWriteStr (state->display[y] + x);
-		pixi_lcdSetCursorPos (x, y);
-	}
-}
-
-
-static void sendGotoPos (State* state)
-{
-	if (!state->usePixi)
-		return;
-	pixi_lcdSetCursorPos (state->xPos, state->yPos);
 }
 
 static const char printableChars[] = " 0123456789ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz,./<>?;:'@#~][}{=-+_`!\"$^&*()";
@@ -310,7 +294,6 @@ static void readTelescope (State* state)
 
 		case GotoY:
 			state->yPos = (ch-1) % DisplayLines;
-			sendGotoPos (state);
 			APP_LOG_DEBUG("Moving to %u,%u", state->xPos, state->yPos);
 			break;
 
@@ -333,6 +316,7 @@ static void readTelescope (State* state)
 	}
 	if (displayUpdate)
 	{
+		updatePanel (state);
 		// nul terminate lines
 		for (int i = 0; i < DisplayLines; i++)
 			state->display[i][DisplayChars] = 0;
@@ -404,8 +388,8 @@ static void appendChar (State* state, char key)
 			system ("halt");
 			if (state->usePixi)
 			{
-				pixi_lcdSetCursorPos (0, 1);
-				pixi_lcdWriteStr ("Halting...");
+				pixi_lcdFrameWrite (&state->lcd, 0, 1, "Halting...");
+				pixi_lcdFrameFlush (&state->lcd);
 			}
 		}
 	}
@@ -607,6 +591,7 @@ static int remoteFn (const Command* command, uint argc, char* argv[])
 	else
 	{
 		state.usePixi = true;
+		pixi_lcdFrameInit (&state.lcd);
 		state.rotary1 = pixi_registerRead (Rotary1Register);
 		state.rotary2 = pixi_registerRead (Rotary2Register);
 	}
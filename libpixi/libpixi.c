@@ -55,6 +55,19 @@ int pixi_initLib (int expectedVersion)
 	return 0;
 }
 
+bool pixi_devicesHeld = false;
+
+void pixi_holdDevices (bool hold)
+{
+	pixi_devicesHeld = hold;
+	if (!hold)
+	{
+		pixi_pixiReleaseHold();
+		pixi_adcReleaseHold();
+		pixi_i2cBusReleaseHold();
+	}
+}
+
 const char* pixi_getLibVersion (void)
 {
 	return LIBPIXI_VERSION;
@@ -90,6 +90,12 @@ const char* pixi_getPiBoardRevision (void);
 ///	Return the board version based on @ref pixi_getPiBoardRevision()
 int pixi_getPiBoardVersion (void);
 
+///	While @c hold is true, the PiXi SPI channel, the ADC SPI channel and
+///	shared i2c buses stay open after their last close, so a process that
+///	runs many short operations only opens each of them once. Setting
+///	@c hold to false closes those that are no longer in use.
+void pixi_holdDevices (bool hold);
+
 ///@} defgroup
 
 LIBPIXI_END_DECLS
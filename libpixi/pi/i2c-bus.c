@@ -0,0 +1,326 @@
+/*
+    pixi-tools: a set of software to interface with the Raspberry Pi
+    and PiXi-200 hardware
+    Copyright (C) 2014 Simon Cantrill
+
+    pixi-tools is free software; you can redistribute it and/or
+    modify it under the terms of the GNU Lesser General Public
+    License as published by the Free Software Foundation; either
+    version 2.1 of the License, or (at your option) any later version.
+
+    This library is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+    Lesser General Public License for more details.
+
+    You should have received a copy of the GNU Lesser General Public
+    License along with this library; if not, write to the Free Software
+    Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+*/
+#include <libpixi/pi/i2c-bus.h>
+#include <libpixi/util/file.h>
+#include <libpixi/util/log.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <linux/i2c-dev.h>
+#include "../private.h"
+
+enum
+{
+	I2cBusChannels = 16
+};
+
+typedef struct I2cBus
+{
+	int             fd;
+	uint            openCount;
+	bool            held;      ///< openCount includes a reference for pixi_holdDevices
+	uint            sequence;
+	uint            queued;
+	I2cOperation*   queue[I2cBusMaxQueue];
+} I2cBus;
+
+static I2cBus buses[I2cBusChannels];
+static pthread_mutex_t busMutex = PTHREAD_MUTEX_INITIALIZER;
+
+extern const char i2cDevice[];
+
+
+int pixi_i2cBusOpen (uint channel, uint address, I2cDevice* device)
+{
+	LIBPIXI_PRECONDITION(channel < I2cBusChannels);
+	LIBPIXI_PRECONDITION(address < 1024);
+	LIBPIXI_PRECONDITION_NOT_NULL(device);
+
+	pthread_mutex_lock (&busMutex);
+	I2cBus* bus = &buses[channel];
+	int result = 0;
+	if (bus->openCount == 0)
+	{
+		char filename[40];
+		snprintf (filename, sizeof (filename), i2cDevice, channel);
+		result = pixi_open (filename, O_RDWR, 0);
+		if (result < 0)
+			LIBPIXI_ERROR_DEBUG(-result, "failed to open i2c device [%s] failed", filename);
+		else
+		{
+			LIBPIXI_LOG_DEBUG("Opened shared i2c bus name=%s fd=%d", filename, result);
+			bus->fd = result;
+			bus->queued = 0;
+			if (pixi_devicesHeld)
+			{
+				bus->held = true;
+				bus->openCount++;
+			}
+		}
+	}
+	if (result >= 0)
+	{
+		bus->openCount++;
+		memset (device, 0, sizeof (*device));
+		device->fd      = bus->fd;
+		device->address = address;
+		result = bus->fd;
+	}
+	pthread_mutex_unlock (&busMutex);
+	return result;
+}
+
+/// Drop a reference to @c bus, closing it if it was the last. Call with busMutex held.
+static int releaseBus (I2cBus* bus)
+{
+	if (--bus->openCount > 0)
+		return 0;
+	LIBPIXI_LOG_DEBUG("Closing shared i2c bus fd=%d", bus->fd);
+	if (bus->queued)
+		LIBPIXI_LOG_WARN("Discarding %u queued i2c operations", bus->queued);
+	int result = pixi_close (bus->fd);
+	bus->fd = -1;
+	bus->queued = 0;
+	return result;
+}
+
+int pixi_i2cBusClose (I2cDevice* device)
+{
+	LIBPIXI_PRECONDITION_NOT_NULL(device);
+	LIBPIXI_PRECONDITION(device->fd >= 0);
+
+	pthread_mutex_lock (&busMutex);
+	int result = -EBADF;
+	for (uint channel = 0; channel < I2cBusChannels; channel++)
+	{
+		I2cBus* bus = &buses[channel];
+		if (bus->openCount == 0 || bus->fd != device->fd)
+			continue;
+		result = releaseBus (bus);
+		break;
+	}
+	pthread_mutex_unlock (&busMutex);
+	if (result == -EBADF)
+		LIBPIXI_LOG_ERROR("i2c device fd=%d is not on a shared bus", device->fd);
+	*device = I2cDeviceInit;
+	return result;
+}
+
+void pixi_i2cBusReleaseHold (void)
+{
+	pthread_mutex_lock (&busMutex);
+	for (uint channel = 0; channel < I2cBusChannels; channel++)
+	{
+		I2cBus* bus = &buses[channel];
+		if (!bus->held)
+			continue;
+		bus->held = false;
+		releaseBus (bus);
+	}
+	pthread_mutex_unlock (&busMutex);
+}
+
+int pixi_i2cBusQueue (uint channel, I2cOperation* operation)
+{
+	LIBPIXI_PRECONDITION(channel < I2cBusChannels);
+	LIBPIXI_PRECONDITION_NOT_NULL(operation);
+	LIBPIXI_PRECONDITION_NOT_NULL(operation->messages);
+	LIBPIXI_PRECONDITION(operation->count > 0 && operation->count <= I2C_RDRW_IOCTL_MAX_MSGS);
+	for (uint i = 0; i < operation->count; i++)
+		LIBPIXI_PRECONDITION(operation->messages[i].address < 1024);
+
+	pthread_mutex_lock (&busMutex);
+	I2cBus* bus = &buses[channel];
+	int result = 0;
+	if (bus->openCount == 0)
+	{
+		LIBPIXI_LOG_ERROR("i2c bus %u is not open", channel);
+		result = -EBADF;
+	}
+	else if (bus->queued == I2cBusMaxQueue)
+		result = -EAGAIN;
+	else
+	{
+		operation->result   = -EINPROGRESS;
+		operation->sequence = bus->sequence++;
+		bus->queue[bus->queued++] = operation;
+	}
+	pthread_mutex_unlock (&busMutex);
+	return result;
+}
+
+/// Order by priority (highest first), then deadline (earliest first, none last),
+/// then the order they were queued
+static int compareOperations (const void* a, const void* b)
+{
+	const I2cOperation* opA = *(const I2cOperation* const*) a;
+	const I2cOperation* opB = *(const I2cOperation* const*) b;
+	if (opA->priority != opB->priority)
+		return opA->priority > opB->priority ? -1 : 1;
+	if (opA->deadlineNs != opB->deadlineNs)
+	{
+		if (opA->deadlineNs == 0)
+			return 1;
+		if (opB->deadlineNs == 0)
+			return -1;
+		return opA->deadlineNs < opB->deadlineNs ? -1 : 1;
+	}
+	return (int) (opA->sequence - opB->sequence);
+}
+
+static int transfer (int fd, I2cMessage* messages, uint count)
+{
+	I2cDevice device = I2C_DEVICE_INIT;
+	device.fd = fd;
+	return pixi_i2cMultiAddressOp (&device, messages, count);
+}
+
+int pixi_i2cBusFlush (uint channel)
+{
+	LIBPIXI_PRECONDITION(channel < I2cBusChannels);
+
+	pthread_mutex_lock (&busMutex);
+	I2cBus* bus = &buses[channel];
+	if (bus->openCount == 0)
+	{
+		pthread_mutex_unlock (&busMutex);
+		LIBPIXI_LOG_ERROR("i2c bus %u is not open", channel);
+		return -EBADF;
+	}
+	qsort (bus->queue, bus->queued, sizeof (bus->queue[0]), compareOperations);
+
+	I2cMessage messages[I2C_RDRW_IOCTL_MAX_MSGS];
+	uint failures = 0;
+	uint transfers = 0;
+	for (uint first = 0; first < bus->queued; )
+	{
+		// Take as many whole operations as fit in one transfer
+		uint count = 0;
+		uint last = first;
+		for ( ; last < bus->queued; last++)
+		{
+			const I2cOperation* op = bus->queue[last];
+			if (count + op->count > ARRAY_COUNT(messages))
+				break;
+			memcpy (messages + count, op->messages, op->count * sizeof (I2cMessage));
+			count += op->count;
+		}
+		int result = transfer (bus->fd, messages, count);
+		transfers++;
+		if (result < 0 && last - first > 1)
+		{
+			// The kernel doesn't say which message failed
+			for (uint i = first; i < last; i++)
+			{
+				I2cOperation* op = bus->queue[i];
+				op->result = transfer (bus->fd, op->messages, op->count);
+				if (op->result < 0)
+					failures++;
+			}
+			transfers += last - first;
+		}
+		else
+		{
+			for (uint i = first; i < last; i++)
+				bus->queue[i]->result = result;
+			if (result < 0)
+				failures++;
+		}
+		first = last;
+	}
+	LIBPIXI_LOG_TRACE("Flushed %u i2c operations in %u transfers, %u failed", bus->queued, transfers, failures);
+	bus->queued = 0;
+	pthread_mutex_unlock (&busMutex);
+	return failures;
+}
+
+int pixi_i2cBusTransfer (uint channel, I2cOperation* operation)
+{
+	int result = pixi_i2cBusQueue (channel, operation);
+	if (result >= 0)
+		result = pixi_i2cBusFlush (channel);
+	if (result < 0)
+		return result;
+	return operation->result;
+}
+
+/// Find the channel of the shared bus that @c device was opened on
+static int findChannel (const I2cDevice* device)
+{
+	pthread_mutex_lock (&busMutex);
+	int result = -EBADF;
+	for (uint channel = 0; channel < I2cBusChannels; channel++)
+	{
+		if (buses[channel].openCount > 0 && buses[channel].fd == device->fd)
+		{
+			result = channel;
+			break;
+		}
+	}
+	pthread_mutex_unlock (&busMutex);
+	if (result < 0)
+		LIBPIXI_LOG_ERROR("i2c device fd=%d is not on a shared bus", device->fd);
+	return result;
+}
+
+int pixi_i2cBusMultiAddressOp (I2cDevice* device, uint priority, I2cMessage* messages, uint count)
+{
+	LIBPIXI_PRECONDITION_NOT_NULL(device);
+	LIBPIXI_PRECONDITION(device->fd >= 0);
+
+	int channel = findChannel (device);
+	if (channel < 0)
+		return channel;
+
+	I2cOperation operation;
+	memset (&operation, 0, sizeof (operation));
+	operation.messages = messages;
+	operation.count    = count;
+	operation.priority = priority;
+	return pixi_i2cBusTransfer (channel, &operation);
+}
+
+int pixi_i2cBusWriteRead (I2cDevice* device, uint priority, const void* txBuffer, size_t txSize, void* rxBuffer, size_t rxSize)
+{
+	LIBPIXI_PRECONDITION_NOT_NULL(device);
+	LIBPIXI_PRECONDITION(device->address < 1024);
+
+	I2cMessage messages[2];
+	uint count = 0;
+	if (txBuffer)
+	{
+		messages[count].address = device->address;
+		messages[count].flags   = I2C_M_TEN;
+		messages[count].length  = txSize;
+		messages[count].buffer  = (void*) txBuffer;
+		count++;
+	}
+	if (rxBuffer)
+	{
+		messages[count].address = device->address;
+		messages[count].flags   = I2C_M_TEN | I2C_M_RD;
+		messages[count].length  = rxSize;
+		messages[count].buffer  = rxBuffer;
+		count++;
+	}
+	return pixi_i2cBusMultiAddressOp (device, priority, messages, count);
+}
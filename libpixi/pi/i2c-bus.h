@@ -0,0 +1,115 @@
+/*
+    pixi-tools: a set of software to interface with the Raspberry Pi
+    and PiXi-200 hardware
+    Copyright (C) 2014 Simon Cantrill
+
+    pixi-tools is free software; you can redistribute it and/or
+    modify it under the terms of the GNU Lesser General Public
+    License as published by the Free Software Foundation; either
+    version 2.1 of the License, or (at your option) any later version.
+
+    This library is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+    Lesser General Public License for more details.
+
+    You should have received a copy of the GNU Lesser General Public
+    License along with this library; if not, write to the Free Software
+    Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+*/
+#ifndef libpixi_pi_i2c_bus_h__included
+#define libpixi_pi_i2c_bus_h__included
+
+
+#include <libpixi/common.h>
+#include <libpixi/pi/i2c.h>
+
+LIBPIXI_BEGIN_DECLS
+
+///@defgroup PiI2cBus Raspberry Pi shared i2c bus
+/// One file descriptor per i2c bus, shared by every device on it (e.g. the
+/// PiXi DAC, MPU and magnetometer), and a scheduler that combines queued
+/// operations for any of those devices into a single I2C_RDWR transfer.
+///
+/// Operations are only combined when several are queued with
+/// @ref pixi_i2cBusQueue before a @ref pixi_i2cBusFlush. The libpixi DAC
+/// and MPU functions use @ref pixi_i2cBusWriteRead and
+/// @ref pixi_i2cBusMultiAddressOp, which send each operation straight
+/// away; they share the file descriptor and are ordered by priority only
+/// when they happen to be queued by other threads at the same time.
+///
+/// Devices opened with @ref pixi_i2cBusOpen work with the other i2c
+/// functions (@ref pixi_i2cWriteRead, @ref pixi_i2cMultiOp etc.), which
+/// always address each message, but must not be used with plain read()
+/// or write(), as the file descriptor has no fixed slave address.
+///@{
+
+enum
+{
+	I2cBusMaxQueue = 32, ///< maximum operations queued on a bus
+
+	I2cBusPriorityInput  = 0, ///< e.g. sensor reads
+	I2cBusPriorityOutput = 1  ///< e.g. DAC updates, which are sent ahead of reads
+};
+
+///	A set of messages to send as a unit, queued with @ref pixi_i2cBusQueue.
+typedef struct I2cOperation
+{
+	I2cMessage* messages;   ///< each message has its own address
+	uint        count;      ///< number of messages
+	uint        priority;   ///< higher priority operations are sent first
+	int64       deadlineNs; ///< within a priority, earlier deadlines are sent first; 0 for none
+	int         result;     ///< set when the operation completes: 0 on success, or -errno
+	uint        sequence;   ///< internal
+	intptr      _reserved[2];
+} I2cOperation;
+
+///	Open @c address on the i2c bus @c channel, sharing the bus's file
+///	descriptor with any other devices opened this way. When finished,
+///	call @ref pixi_i2cBusClose.
+///	@return >=0 on success, or -errno on error
+int pixi_i2cBusOpen (uint channel, uint address, I2cDevice* device);
+
+///	Close a device opened with @ref pixi_i2cBusOpen. The bus is closed
+///	when its last device is closed.
+///	@return 0 on success, or -errno on error
+int pixi_i2cBusClose (I2cDevice* device);
+
+///	Queue @c operation to be sent by the next @ref pixi_i2cBusFlush on
+///	@c channel. @c operation and its messages must remain valid until then.
+///	The bus must be open.
+///	@return 0 on success, -EAGAIN if the queue is full, or -errno on error
+int pixi_i2cBusQueue (uint channel, I2cOperation* operation);
+
+///	Send all queued operations on @c channel, ordered by priority then
+///	deadline, combining as many as possible into each I2C_RDWR transfer.
+///	Each operation's @c result is set. If a combined transfer fails, its
+///	operations are retried one at a time, to find which failed; so an
+///	operation's messages may be sent twice.
+///	@return number of failed operations, or -errno on error
+int pixi_i2cBusFlush (uint channel);
+
+///	Queue @c operation and flush the bus, along with anything else queued.
+///	This does not batch: the operation is sent before returning, usually
+///	in a transfer of its own. To combine operations, queue them and flush
+///	once.
+///	@return the operation's result
+int pixi_i2cBusTransfer (uint channel, I2cOperation* operation);
+
+///	As @ref pixi_i2cWriteRead, but sent as an operation of @c priority
+///	through the scheduler of the shared bus that @c device was opened on,
+///	using @ref pixi_i2cBusTransfer.
+///	@return 0 on success, or -errno on error
+int pixi_i2cBusWriteRead (I2cDevice* device, uint priority, const void* txBuffer, size_t txSize, void* rxBuffer, size_t rxSize);
+
+///	As @ref pixi_i2cMultiAddressOp, but sent as an operation of @c priority
+///	through the scheduler of the shared bus that @c device was opened on,
+///	using @ref pixi_i2cBusTransfer.
+///	@return 0 on success, or -errno on error
+int pixi_i2cBusMultiAddressOp (I2cDevice* device, uint priority, I2cMessage* messages, uint count);
+
+///@} defgroup
+
+LIBPIXI_END_DECLS
+
+#endif // !defined libpixi_pi_i2c_bus_h__included
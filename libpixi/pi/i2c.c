@@ -111,7 +111,7 @@ int pixi_i2cWriteRead (I2cDevice* device, const void* txBuffer, size_t txSize, v
 	return pixi_i2cMultiOp (device, messages, count);
 }
 
-int pixi_i2cMultiOp (I2cDevice* device, I2cMessage* messages, size_t count)
+static int i2cTransfer (int fd, I2cMessage* messages, size_t count)
 {
 	LIBPIXI_STATIC_ASSERT (sizeof (struct i2c_msg) == sizeof (I2cMessage), "struct i2c_msg must match I2cMessage");
 	LIBPIXI_STATIC_ASSERT (offsetof(struct i2c_msg, addr ) == offsetof(I2cMessage, address), "struct i2c_msg must match I2cMessage");
@@ -120,20 +120,12 @@ int pixi_i2cMultiOp (I2cDevice* device, I2cMessage* messages, size_t count)
 	LIBPIXI_STATIC_ASSERT (offsetof(struct i2c_msg, buf  ) == offsetof(I2cMessage, buffer ), "struct i2c_msg must match I2cMessage");
 	LIBPIXI_STATIC_ASSERT (I2C_M_RD == I2cMsgRead, "struct i2c_msg must match I2cMessage");
 
-	LIBPIXI_PRECONDITION_NOT_NULL(device);
-	LIBPIXI_PRECONDITION(device->fd >= 0);
-	LIBPIXI_PRECONDITION(device->address < 1024);
-	LIBPIXI_PRECONDITION_NOT_NULL(messages);
-
-	for (uint i = 0; i < count; i++)
-		messages[i].address = device->address;
-
 	struct i2c_rdwr_ioctl_data msgset = {
 		.msgs  = (struct i2c_msg*) messages,
 		.nmsgs = count
 	};
 
-	int result = ioctl (device->fd, I2C_RDWR, &msgset);
+	int result = ioctl (fd, I2C_RDWR, &msgset);
 	if (result < 0)
 	{
 		int err = errno;
@@ -143,14 +135,38 @@ int pixi_i2cMultiOp (I2cDevice* device, I2cMessage* messages, size_t count)
 	if (pixi_isLogLevelEnabled (LogLevelTrace))
 	{
 		char hex[4096];
-		LIBPIXI_LOG_TRACE("Completed %zu message i2c transfer for address 0x%02x", count, device->address);
+		LIBPIXI_LOG_TRACE("Completed %zu message i2c transfer", count);
 		for (uint i = 0; i < count; i++)
 		{
 			pixi_hexEncode (messages[i].buffer, messages[i].length, hex, sizeof(hex), ' ', "");
 			const char* type = (messages[i].flags & I2cMsgRead) ? "read" : "write";
-			LIBPIXI_LOG_TRACE("msg %u %-5s [%s]", i, type, hex);
+			LIBPIXI_LOG_TRACE("msg %u 0x%02x %-5s [%s]", i, messages[i].address, type, hex);
 		}
 	}
 	return 0;
 }
 
+int pixi_i2cMultiOp (I2cDevice* device, I2cMessage* messages, size_t count)
+{
+	LIBPIXI_PRECONDITION_NOT_NULL(device);
+	LIBPIXI_PRECONDITION(device->fd >= 0);
+	LIBPIXI_PRECONDITION(device->address < 1024);
+	LIBPIXI_PRECONDITION_NOT_NULL(messages);
+
+	for (uint i = 0; i < count; i++)
+		messages[i].address = device->address;
+
+	return i2cTransfer (device->fd, messages, count);
+}
+
+int pixi_i2cMultiAddressOp (I2cDevice* device, I2cMessage* messages, size_t count)
+{
+	LIBPIXI_PRECONDITION_NOT_NULL(device);
+	LIBPIXI_PRECONDITION(device->fd >= 0);
+	LIBPIXI_PRECONDITION_NOT_NULL(messages);
+
+	for (uint i = 0; i < count; i++)
+		LIBPIXI_PRECONDITION(messages[i].address < 1024);
+
+	return i2cTransfer (device->fd, messages, count);
+}
@@ -64,7 +64,7 @@ enum
 // Must match struct i2c_msg
 typedef struct I2cMessage
 {
-	uint16  address; ///< Set by pixi_i2cMultiOp()
+	uint16  address; ///< Set by pixi_i2cMultiOp(), or by the caller for pixi_i2cMultiAddressOp()
 	ushort  flags; ///< I2cMsgWrite or I2cMsgRead
 	ushort  length;
 	void*   buffer;
@@ -74,6 +74,13 @@ typedef struct I2cMessage
 ///	@return 0 on success, or -errno on error
 int pixi_i2cMultiOp (I2cDevice* device, I2cMessage* messages, size_t count);
 
+///	Perform a set of reads and/or writes, where each message keeps its own
+///	address. The messages are sent as one combined transfer on the bus
+///	that @c device was opened on, e.g. to follow writes to a device with
+///	a general call (address 0).
+///	@return 0 on success, or -errno on error
+int pixi_i2cMultiAddressOp (I2cDevice* device, I2cMessage* messages, size_t count);
+
 
 ///@} defgroup
 
@@ -110,7 +110,7 @@ int pixi_spiReadWrite (SpiDevice* device, const void* txBuffer, void* rxBuffer,
 		.cs_change     = 0
 	};
 
-	LIBPIXI_LOG_TRACE("pixi_spiReadWrite of fd=%d, bufferSize=%zu", device->fd, bufferSize);
+	LIBPIXI_LOG_DEFERRED_TRACE("pixi_spiReadWrite of fd=%d, bufferSize=%d", device->fd, (int) bufferSize);
 	int result = ioctl (device->fd, SPI_IOC_MESSAGE(1), &transfer);
 	if (result < 0)
 	{
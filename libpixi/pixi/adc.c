@@ -21,36 +21,72 @@
 #include <libpixi/pixi/adc.h>
 #include <libpixi/pixi/spi.h>
 #include <libpixi/util/bits.h>
+#include <libpixi/util/clock.h>
+#include <libpixi/util/filter.h>
 #include <libpixi/util/log.h>
-#include <libpixi/util/string.h>
+#include <stdlib.h>
+#include <string.h>
 #include <unistd.h>
+#include "../private.h"
 
 static int adcReadMCP3204 (uint adcChannel);
 static int adcReadADC128S022 (uint adcChannel);
+static int adcReadChannelsADC128S022 (const uint* channels, uint count, uint16* values);
 
 static int (*adcReadImpl) (uint adcChannel) = adcReadADC128S022;
+static int (*adcReadChannelsImpl) (const uint* channels, uint count, uint16* values) = adcReadChannelsADC128S022;
 static uint adcChannels = 8;
 
 static SpiDevice adcSpi = SPI_DEVICE_INIT;
+static uint adcOpenCount = 0;
+static bool adcHeld = false;
+
+/// Pack up to 4 bytes into an int for deferred logging
+static inline int packBytes (const uint8* bytes, uint count)
+{
+	uint packed = 0;
+	for (uint i = 0; i < count; i++)
+		packed = (packed << 8) | bytes[i];
+	return packed;
+}
 
 int pixi_adcOpen (void)
 {
-	// TODO: instead rejecting if previously open,
-	// do ref-counting of open count?
-	LIBPIXI_PRECONDITION(adcSpi.fd < 0);
-	int result = pixi_spiOpen (PixiAdcSpiChannel, PixiAdcSpiSpeed, &adcSpi);
-	if (result < 0)
-		LIBPIXI_ERROR(-result, "Cannot open SPI channel to PiXi ADC");
-	// TODO: work out which ADC it is
-	return result;
+	if (adcOpenCount == 0)
+	{
+		int result = pixi_spiOpen (PixiAdcSpiChannel, PixiAdcSpiSpeed, &adcSpi);
+		if (result < 0)
+		{
+			LIBPIXI_ERROR(-result, "Cannot open SPI channel to PiXi ADC");
+			return result;
+		}
+		// TODO: work out which ADC it is
+		if (pixi_devicesHeld)
+		{
+			adcHeld = true;
+			adcOpenCount++;
+		}
+	}
+	adcOpenCount++;
+	return 0;
 }
 
 int pixi_adcClose (void)
 {
-	LIBPIXI_PRECONDITION(adcSpi.fd >= 0);
+	LIBPIXI_PRECONDITION(adcOpenCount > 0);
+	if (--adcOpenCount > 0)
+		return 0;
 	return pixi_spiClose (&adcSpi);
 }
 
+void pixi_adcReleaseHold (void)
+{
+	if (!adcHeld)
+		return;
+	adcHeld = false;
+	pixi_adcClose();
+}
+
 static int adcReadMCP3204 (uint adcChannel)
 {
 	uint8 tx[3] = {
@@ -64,14 +100,7 @@ static int adcReadMCP3204 (uint adcChannel)
 		return result;
 
 	uint value = makeUint12 (rx[1], rx[2]);
-	if (pixi_isLogLevelEnabled (LogLevelError))
-	{
-		char txStr[10];
-		char rxStr[10];
-		pixi_hexEncode (tx, sizeof(tx), txStr, sizeof(txStr), ' ', "");
-		pixi_hexEncode (rx, sizeof(rx), rxStr, sizeof(rxStr), ' ', "");
-		LIBPIXI_LOG_DEBUG("pixi_adcRead result=%d, tx=%s rx=%s value=0x%08x value=%d", result, txStr, rxStr, value, value);
-	}
+	LIBPIXI_LOG_DEFERRED_DEBUG("pixi_adcRead result=%d, tx=%06x rx=%06x value=%d", result, packBytes (tx, sizeof (tx)), packBytes (rx, sizeof (rx)), value);
 	return value;
 }
 
@@ -81,7 +110,7 @@ static int adcReadADC128S022 (uint adcChannel)
 	// response is received in the following 2-byte sequence.
 	// So you can read eight channels in using a 10-byte read/write
 	// but you need 4 bytes to read a single channel.
-	// TODO: provide an API for efficient reading of multiple channels.
+	// See adcReadChannelsADC128S022 for reading multiple channels.
 	uint8 tx[4] = {
 		adcChannel << 3,
 		0,
@@ -94,15 +123,32 @@ static int adcReadADC128S022 (uint adcChannel)
 		return result;
 
 	uint value = makeUint12 (rx[2], rx[3]);
-	if (pixi_isLogLevelEnabled (LogLevelError))
+	LIBPIXI_LOG_DEFERRED_DEBUG("pixi_adcRead result=%d, tx=%08x rx=%08x value=%d", result, packBytes (tx, sizeof (tx)), packBytes (rx, sizeof (rx)), value);
+	return value;
+}
+
+static int adcReadChannelsADC128S022 (const uint* channels, uint count, uint16* values)
+{
+	// One 2-byte request per sample, plus a trailing 2 bytes to
+	// clock out the final response.
+	const uint size = 2 * (count + 1);
+	uint8 tx[size];
+	uint8 rx[size];
+	for (uint i = 0; i < count; i++)
 	{
-		char txStr[20];
-		char rxStr[20];
-		pixi_hexEncode (tx, sizeof(tx), txStr, sizeof(txStr), ' ', "");
-		pixi_hexEncode (rx, sizeof(rx), rxStr, sizeof(rxStr), ' ', "");
-		LIBPIXI_LOG_DEBUG("pixi_adcRead result=%d, tx=%s rx=%s value=0x%08x value=%d", result, txStr, rxStr, value, value);
+		tx[2*i]   = channels[i] << 3;
+		tx[2*i+1] = 0;
 	}
-	return value;
+	tx[size-2] = 0;
+	tx[size-1] = 0;
+	int result = pixi_spiReadWrite (&adcSpi, tx, rx, size);
+	if (result < 0)
+		return result;
+
+	for (uint i = 0; i < count; i++)
+		values[i] = makeUint12 (rx[2*i+2], rx[2*i+3]);
+	LIBPIXI_LOG_TRACE("adcReadChannels read %u samples", count);
+	return 0;
 }
 
 int pixi_adcRead (uint adcChannel)
@@ -125,3 +171,235 @@ int pixi_adcRead (uint adcChannel)
 	}
 	return result;
 }
+
+int pixi_adcReadChannels (const uint* channels, uint count, uint16* values)
+{
+	LIBPIXI_PRECONDITION(adcSpi.fd >= 0);
+	LIBPIXI_PRECONDITION_NOT_NULL(channels);
+	LIBPIXI_PRECONDITION_NOT_NULL(values);
+	LIBPIXI_PRECONDITION(count > 0 && count <= PixiAdcMaxBlock);
+	for (uint i = 0; i < count; i++)
+	{
+		if (channels[i] >= adcChannels)
+		{
+			LIBPIXI_LOG_ERROR("ADC channel number %u is not less than %u", channels[i], adcChannels);
+			return -EINVAL;
+		}
+	}
+
+	int result = adcReadChannelsImpl (channels, count, values);
+	// As for pixi_adcRead
+	char c;
+	read (adcSpi.fd, &c, 0);
+
+	if (result < 0)
+		LIBPIXI_ERROR(-result, "Error reading ADC channels");
+	return result;
+}
+
+int pixi_adcReadOversampled (uint adcChannel, uint extraBits)
+{
+	LIBPIXI_PRECONDITION(extraBits <= PixiAdcMaxExtraBits);
+
+	const uint count = 1u << (2 * extraBits);
+	uint channels[count];
+	uint16 values[count];
+	for (uint i = 0; i < count; i++)
+		channels[i] = adcChannel;
+
+	int result = pixi_adcReadChannels (channels, count, values);
+	if (result < 0)
+		return result;
+
+	CicFilter boxcar;
+	result = pixi_filterCicInit (&boxcar, 1, count, extraBits);
+	if (result < 0)
+		return result;
+	uint16 value = 0;
+	result = pixi_filterCicProcess (&boxcar, values, count, &value);
+	if (result < 0)
+		return result;
+	return value;
+}
+
+int pixi_adcCaptureInit (AdcCapture* capture, const uint* channels, uint channelCount, uint preTrigger, uint postTrigger)
+{
+	LIBPIXI_PRECONDITION_NOT_NULL(capture);
+	LIBPIXI_PRECONDITION_NOT_NULL(channels);
+	LIBPIXI_PRECONDITION(channelCount > 0 && channelCount <= PixiAdcMaxChannels);
+	LIBPIXI_PRECONDITION(postTrigger > 0);
+	for (uint i = 0; i < channelCount; i++)
+		LIBPIXI_PRECONDITION(channels[i] < adcChannels);
+
+	memset (capture, 0, sizeof (*capture));
+	const uint capacity = preTrigger + postTrigger;
+	capture->buffer = malloc (capacity * channelCount * sizeof (uint16));
+	if (!capture->buffer)
+	{
+		LIBPIXI_LOG_ERROR("Failed to allocate ADC capture buffer of %u frames", capacity);
+		return -ENOMEM;
+	}
+	memcpy (capture->channels, channels, channelCount * sizeof (*channels));
+	capture->channelCount = channelCount;
+	capture->preTrigger   = preTrigger;
+	capture->postTrigger  = postTrigger;
+	capture->mode         = AdcTriggerAbove;
+	capture->threshold    = 2048;
+	capture->state        = AdcCaptureIdle;
+	return 0;
+}
+
+void pixi_adcCaptureFree (AdcCapture* capture)
+{
+	if (!capture)
+		return;
+	free (capture->buffer);
+	capture->buffer = NULL;
+	capture->state  = AdcCaptureIdle;
+}
+
+int pixi_adcCaptureSetTrigger (AdcCapture* capture, uint triggerIndex, AdcTriggerMode mode, uint threshold, uint hysteresis)
+{
+	LIBPIXI_PRECONDITION_NOT_NULL(capture);
+	LIBPIXI_PRECONDITION(triggerIndex < capture->channelCount);
+	LIBPIXI_PRECONDITION(mode <= AdcTriggerFalling);
+	LIBPIXI_PRECONDITION(threshold < 4096);
+	LIBPIXI_PRECONDITION(hysteresis < 4096);
+
+	capture->triggerIndex = triggerIndex;
+	capture->mode         = mode;
+	capture->threshold    = threshold;
+	capture->hysteresis   = hysteresis;
+	capture->primed       = false;
+	return 0;
+}
+
+int pixi_adcCaptureArm (AdcCapture* capture)
+{
+	LIBPIXI_PRECONDITION_NOT_NULL(capture);
+	LIBPIXI_PRECONDITION_NOT_NULL(capture->buffer);
+
+	capture->writePos  = 0;
+	capture->filled    = 0;
+	capture->remaining = 0;
+	capture->primed    = false;
+	capture->state     = AdcCaptureArmed;
+	return 0;
+}
+
+static inline bool captureTriggered (AdcCapture* capture, uint value)
+{
+	const uint threshold = capture->threshold;
+	switch (capture->mode)
+	{
+	case AdcTriggerAbove:
+		return value >= threshold;
+	case AdcTriggerBelow:
+		return value <= threshold;
+	case AdcTriggerRising:
+		if (value + capture->hysteresis < threshold)
+			capture->primed = true;
+		else if (capture->primed && value >= threshold)
+			return true;
+		return false;
+	case AdcTriggerFalling:
+		if (value > threshold + capture->hysteresis)
+			capture->primed = true;
+		else if (capture->primed && value <= threshold)
+			return true;
+		return false;
+	}
+	return false;
+}
+
+int pixi_adcCaptureFeed (AdcCapture* capture, const uint16* frames, uint frameCount)
+{
+	LIBPIXI_PRECONDITION_NOT_NULL(capture);
+	LIBPIXI_PRECONDITION_NOT_NULL(capture->buffer);
+	LIBPIXI_PRECONDITION_NOT_NULL(frames);
+	LIBPIXI_PRECONDITION_MSG(capture->state != AdcCaptureIdle, "capture must be armed");
+
+	if (capture->state == AdcCaptureComplete)
+		return 1;
+
+	const uint width    = capture->channelCount;
+	const uint capacity = capture->preTrigger + capture->postTrigger;
+	for (uint f = 0; f < frameCount; f++)
+	{
+		const uint16* frame = frames + (f * width);
+		if (capture->state == AdcCaptureArmed && captureTriggered (capture, frame[capture->triggerIndex]))
+		{
+			capture->state     = AdcCaptureTriggered;
+			capture->remaining = capture->postTrigger;
+		}
+		memcpy (capture->buffer + (capture->writePos * width), frame, width * sizeof (*frame));
+		if (++capture->writePos == capacity)
+			capture->writePos = 0;
+		if (capture->filled < capacity)
+			capture->filled++;
+
+		if (capture->state == AdcCaptureTriggered && --capture->remaining == 0)
+		{
+			capture->state = AdcCaptureComplete;
+			return 1;
+		}
+	}
+	return 0;
+}
+
+int pixi_adcCaptureRun (AdcCapture* capture, int timeout)
+{
+	int result = pixi_adcCaptureArm (capture);
+	if (result < 0)
+		return result;
+
+	// Read as many whole frames as fit in one SPI transfer
+	const uint width = capture->channelCount;
+	const uint framesPerRead = PixiAdcMaxBlock / width;
+	uint channels[PixiAdcMaxBlock];
+	uint16 values[PixiAdcMaxBlock];
+	for (uint i = 0; i < framesPerRead * width; i++)
+		channels[i] = capture->channels[i % width];
+
+	const int64 start = pixi_clockGetNs();
+	const int64 end   = start + (timeout * (int64) 1000000);
+	uint64 frames = 0;
+	while (true)
+	{
+		result = pixi_adcReadChannels (channels, framesPerRead * width, values);
+		if (result < 0)
+			return result;
+		frames += framesPerRead;
+		result = pixi_adcCaptureFeed (capture, values, framesPerRead);
+
+		int64 now = pixi_clockGetNs();
+		capture->framePeriodNs = (now - start) / frames;
+		if (result != 0)
+			return result;
+		if (timeout >= 0 && now >= end)
+			return 0;
+	}
+}
+
+int pixi_adcCaptureGet (const AdcCapture* capture, uint16* frames, uint maxFrames, uint* triggerFrame)
+{
+	LIBPIXI_PRECONDITION_NOT_NULL(capture);
+	LIBPIXI_PRECONDITION_NOT_NULL(frames);
+	LIBPIXI_PRECONDITION_MSG(capture->state == AdcCaptureComplete, "capture must be complete");
+	LIBPIXI_PRECONDITION(maxFrames >= capture->filled);
+
+	const uint width    = capture->channelCount;
+	const uint capacity = capture->preTrigger + capture->postTrigger;
+	const uint filled   = capture->filled;
+	// The oldest frame is filled frames behind the write position
+	const uint oldest   = (capture->writePos + capacity - filled) % capacity;
+	uint first = capacity - oldest;
+	if (first > filled)
+		first = filled;
+	memcpy (frames, capture->buffer + (oldest * width), first * width * sizeof (*frames));
+	memcpy (frames + (first * width), capture->buffer, (filled - first) * width * sizeof (*frames));
+
+	if (triggerFrame)
+		*triggerFrame = filled - capture->postTrigger;
+	return filled;
+}
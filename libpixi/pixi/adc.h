@@ -33,14 +33,18 @@ LIBPIXI_BEGIN_DECLS
 enum
 {
 	PixiAdcMaxChannels = 8,
+	PixiAdcMaxBlock    = 1024, ///< maximum samples per @ref pixi_adcReadChannels call
+	PixiAdcMaxExtraBits = 4,
 };
 
 ///	Open the Pi SPI channel to the PiXi ADC. When finished,
-///	call pixi_closePixi().
+///	call pixi_adcClose(). Opens are counted, so the channel
+///	can be opened again while it is open.
 ///	@return 0 on success, or -errno on error
 int pixi_adcOpen (void);
 
-///	Close the Pi SPI channel to the PiXi ADC.
+///	Close the Pi SPI channel to the PiXi ADC, once each open has
+///	been matched by a close (see also @ref pixi_holdDevices).
 ///	@return 0 on success, or -errno on error
 int pixi_adcClose (void);
 
@@ -48,6 +52,100 @@ int pixi_adcClose (void);
 ///	@return >=0 on success, negative error code on error
 int pixi_adcRead (uint adcChannel);
 
+///	Read a block of samples in a single SPI transfer. @c channels lists
+///	the channel for each sample, and may repeat a channel to take
+///	several samples of it in quick succession.
+///	@param channels channel number of each sample
+///	@param count number of samples [1,PixiAdcMaxBlock]
+///	@param values receives the 12 bit unsigned sample values
+///	@return 0 on success, negative error code on error
+int pixi_adcReadChannels (const uint* channels, uint count, uint16* values);
+
+///	Read an ADC channel with @c extraBits more resolution than
+///	@ref pixi_adcRead by summing 4^extraBits samples taken in one block.
+///	@param extraBits [0,PixiAdcMaxExtraBits]
+///	@return >=0 value of (12 + @c extraBits) bits on success, negative error code on error
+int pixi_adcReadOversampled (uint adcChannel, uint extraBits);
+
+///	Trigger conditions for @ref AdcCapture
+typedef enum AdcTriggerMode
+{
+	AdcTriggerAbove,   ///< level: value >= threshold
+	AdcTriggerBelow,   ///< level: value <= threshold
+	AdcTriggerRising,  ///< edge: rises to threshold, having been below threshold - hysteresis
+	AdcTriggerFalling  ///< edge: falls to threshold, having been above threshold + hysteresis
+} AdcTriggerMode;
+
+typedef enum AdcCaptureState
+{
+	AdcCaptureIdle,
+	AdcCaptureArmed,     ///< filling the pre-trigger window, waiting for the trigger
+	AdcCaptureTriggered, ///< recording the post-trigger frames
+	AdcCaptureComplete   ///< buffer is frozen, ready for @ref pixi_adcCaptureGet
+} AdcCaptureState;
+
+///	Oscilloscope style capture of one or more ADC channels. Each frame
+///	holds one sample of every channel. Frames are kept in a ring until
+///	the trigger fires, after which a fixed number of frames is recorded
+///	and the buffer is frozen. The ring is allocated once by
+///	@ref pixi_adcCaptureInit, so capturing does no allocation.
+typedef struct AdcCapture
+{
+	uint            channels[PixiAdcMaxChannels]; ///< channel of each sample in a frame
+	uint            channelCount;
+	uint            preTrigger;     ///< frames kept from before the trigger
+	uint            postTrigger;    ///< frames recorded from the trigger onwards
+	uint            triggerIndex;   ///< index into @c channels of the trigger channel
+	AdcTriggerMode  mode;
+	uint16          threshold;
+	uint16          hysteresis;
+	AdcCaptureState state;
+	uint16*         buffer;         ///< internal: ring of (preTrigger + postTrigger) frames
+	uint            writePos;       ///< internal: next frame to write
+	uint            filled;         ///< internal: frames in the ring
+	uint            remaining;      ///< internal: post-trigger frames still to record
+	bool            primed;         ///< internal: edge trigger hysteresis state
+	uint            framePeriodNs;  ///< measured by @ref pixi_adcCaptureRun
+	intptr          _reserved[2];
+} AdcCapture;
+
+///	Prepare @c capture to record @c channelCount channels, with room for
+///	@c preTrigger + @c postTrigger frames. Until @ref pixi_adcCaptureSetTrigger
+///	is called, the trigger is the first channel being at or above half scale.
+///	Call @ref pixi_adcCaptureFree when finished.
+///	@return 0 on success, negative error code on error
+int pixi_adcCaptureInit (AdcCapture* capture, const uint* channels, uint channelCount, uint preTrigger, uint postTrigger);
+
+///	Release the buffer allocated by @ref pixi_adcCaptureInit
+void pixi_adcCaptureFree (AdcCapture* capture);
+
+///	Set the trigger condition
+///	@param triggerIndex index into the capture channel list of the channel to watch
+///	@return 0 on success, negative error code on error
+int pixi_adcCaptureSetTrigger (AdcCapture* capture, uint triggerIndex, AdcTriggerMode mode, uint threshold, uint hysteresis);
+
+///	Discard any captured data and wait for a new trigger.
+///	@return 0 on success, negative error code on error
+int pixi_adcCaptureArm (AdcCapture* capture);
+
+///	Add frames that have been acquired elsewhere, e.g. with @ref
+///	pixi_adcReadChannels, checking each for the trigger.
+///	@return 1 if the capture is complete, 0 if more frames are needed,
+///	negative error code on error
+int pixi_adcCaptureFeed (AdcCapture* capture, const uint16* frames, uint frameCount);
+
+///	Arm @c capture and read the ADC in blocks until the capture completes.
+///	Also sets @c framePeriodNs to the average time per frame.
+///	@param timeout how long to wait (milliseconds), <0 for no timeout.
+///	@return 1 if the capture completed, 0 on timeout, negative error code on error
+int pixi_adcCaptureRun (AdcCapture* capture, int timeout);
+
+///	Copy the frozen capture into @c frames, oldest first.
+///	@param frames room for @c maxFrames * channelCount samples
+///	@param triggerFrame if non-NULL, receives the index in @c frames of the trigger frame
+///	@return number of frames copied, negative error code on error
+int pixi_adcCaptureGet (const AdcCapture* capture, uint16* frames, uint maxFrames, uint* triggerFrame);
+
 ///@} defgroup
 
 LIBPIXI_END_DECLS
@@ -0,0 +1,345 @@
+/*
+    pixi-tools: a set of software to interface with the Raspberry Pi
+    and PiXi-200 hardware
+    Copyright (C) 2014 Simon Cantrill
+
+    pixi-tools is free software; you can redistribute it and/or
+    modify it under the terms of the GNU Lesser General Public
+    License as published by the Free Software Foundation; either
+    version 2.1 of the License, or (at your option) any later version.
+
+    This library is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+    Lesser General Public License for more details.
+
+    You should have received a copy of the GNU Lesser General Public
+    License along with this library; if not, write to the Free Software
+    Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+*/
+
+#include <libpixi/pixi/dac-player.h>
+#include <libpixi/util/clock.h>
+#include <libpixi/util/log.h>
+#include <errno.h>
+#include <math.h>
+#include <sched.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+static inline uint16 clipDac (double value)
+{
+	if (value < 0)
+		return 0;
+	if (value > 4095)
+		return 4095;
+	return (uint16) (value + 0.5);
+}
+
+int pixi_dacWaveGenerate (uint16* table, uint length, DacWaveform shape, uint amplitude, uint offset)
+{
+	LIBPIXI_PRECONDITION_NOT_NULL(table);
+	LIBPIXI_PRECONDITION(length > 0 && length <= DacPlayerMaxWavetable);
+	LIBPIXI_PRECONDITION(shape <= DacWaveSawtooth);
+
+	for (uint i = 0; i < length; i++)
+	{
+		double x = (double) i / length; // [0,1)
+		double y = 0;
+		switch (shape)
+		{
+		case DacWaveSine:     y = sin (2 * M_PI * x); break;
+		case DacWaveTriangle: y = x < 0.25 ? 4 * x : x < 0.75 ? 2 - (4 * x) : (4 * x) - 4; break;
+		case DacWaveSquare:   y = x < 0.5 ? 1 : -1; break;
+		case DacWaveSawtooth: y = x < 0.5 ? 2 * x : (2 * x) - 2; break;
+		}
+		table[i] = clipDac (offset + (y * amplitude));
+	}
+	return 0;
+}
+
+int pixi_dacPlayerInit (DacPlayer* player, uint rate)
+{
+	LIBPIXI_PRECONDITION_NOT_NULL(player);
+	LIBPIXI_PRECONDITION(rate > 0);
+
+	memset (player, 0, sizeof (*player));
+	player->rate = rate;
+	pthread_mutex_init (&player->mutex, NULL);
+	pthread_condattr_t attr;
+	pthread_condattr_init (&attr);
+	pthread_condattr_setclock (&attr, CLOCK_MONOTONIC);
+	pthread_cond_init (&player->cond, &attr);
+	pthread_condattr_destroy (&attr);
+	return 0;
+}
+
+void pixi_dacPlayerFree (DacPlayer* player)
+{
+	if (!player)
+		return;
+	if (player->threadStarted)
+		pixi_dacPlayerStop (player);
+	for (uint c = 0; c < PixiDacChannels; c++)
+		free (player->tables[c]);
+	pthread_cond_destroy (&player->cond);
+	pthread_mutex_destroy (&player->mutex);
+	memset (player, 0, sizeof (*player));
+}
+
+int pixi_dacPlayerSetWave (DacPlayer* player, uint channel, const uint16* table, uint length, double frequency)
+{
+	LIBPIXI_PRECONDITION_NOT_NULL(player);
+	LIBPIXI_PRECONDITION(channel < PixiDacChannels);
+	LIBPIXI_PRECONDITION(!table || (length > 0 && length <= DacPlayerMaxWavetable));
+	LIBPIXI_PRECONDITION(frequency >= 0);
+
+	uint16* copy = NULL;
+	if (table)
+	{
+		copy = malloc (length * sizeof (uint16));
+		if (!copy)
+			return -ENOMEM;
+		memcpy (copy, table, length * sizeof (uint16));
+	}
+	uint32 step = (uint32) fmod ((frequency / player->rate) * length * 65536.0, length * 65536.0);
+
+	pthread_mutex_lock (&player->mutex);
+	uint16* old = player->tables[channel];
+	player->tables[channel]  = copy;
+	player->lengths[channel] = copy ? length : 0;
+	player->phases[channel]  = 0;
+	player->steps[channel]   = step;
+	pthread_mutex_unlock (&player->mutex);
+
+	free (old);
+	return 0;
+}
+
+/// Fill @c frame with the next values to play. Called with the mutex held.
+static void nextFrame (DacPlayer* player, uint16* frame)
+{
+	if (player->streaming)
+	{
+		uint block = player->playBlock;
+		if (player->blockFrames[block] > 0)
+		{
+			memcpy (frame, &player->blocks[block][player->playFrame * PixiDacChannels], PixiDacChannels * sizeof (uint16));
+			if (++player->playFrame == player->blockFrames[block])
+			{
+				player->blockFrames[block] = 0;
+				player->playFrame = 0;
+				player->playBlock = block ^ 1;
+				pthread_cond_broadcast (&player->cond);
+			}
+		}
+		else
+			player->stats.underruns++;
+	}
+	for (uint c = 0; c < PixiDacChannels; c++)
+	{
+		const uint16* table = player->tables[c];
+		if (!table)
+			continue;
+		frame[c] = table[player->phases[c] >> 16];
+		player->phases[c] = (player->phases[c] + player->steps[c]) % (player->lengths[c] << 16);
+	}
+}
+
+/// Skip the waves forward by @c ticks frames. Called with the mutex held.
+static void skipFrames (DacPlayer* player, uint64 ticks)
+{
+	for (uint c = 0; c < PixiDacChannels; c++)
+	{
+		if (player->tables[c])
+			player->phases[c] = (player->phases[c] + (player->steps[c] * ticks)) % (player->lengths[c] << 16);
+	}
+}
+
+static void* playerThread (void* arg)
+{
+	DacPlayer* player = (DacPlayer*) arg;
+	const int64 period = 1000000000 / player->rate;
+	const int64 start  = pixi_clockGetNs();
+	uint64 tick = 0;
+	uint16 frame[PixiDacChannels];
+	memcpy (frame, player->idle, sizeof (frame));
+
+	pthread_mutex_lock (&player->mutex);
+	while (player->running)
+	{
+		// Prepare the frame before the deadline, so it's written on time
+		nextFrame (player, frame);
+		pthread_mutex_unlock (&player->mutex);
+
+		// Deadlines are computed from the tick count, so they don't drift
+		int64 deadline = start + (int64) ((tick * 1000000000) / player->rate);
+		pixi_clockSleepUntilNs (deadline);
+		int64 lateness = pixi_clockGetNs() - deadline;
+		int result = pixi_dacWriteChannels (frame);
+
+		pthread_mutex_lock (&player->mutex);
+		if (result < 0)
+		{
+			LIBPIXI_ERROR(-result, "DAC playback stopped");
+			player->error = result;
+			player->running = false;
+			pthread_cond_broadcast (&player->cond);
+			break;
+		}
+		player->stats.frames++;
+		if (lateness > player->stats.maxLatenessNs)
+			player->stats.maxLatenessNs = lateness;
+		tick++;
+		if (lateness > period)
+		{
+			// Too far behind to catch up; skip the missed ticks
+			uint64 missed = lateness / period;
+			player->stats.deadlineMisses += missed;
+			skipFrames (player, missed);
+			tick += missed;
+		}
+	}
+	pthread_mutex_unlock (&player->mutex);
+	return NULL;
+}
+
+int pixi_dacPlayerStart (DacPlayer* player)
+{
+	LIBPIXI_PRECONDITION_NOT_NULL(player);
+	LIBPIXI_PRECONDITION(!player->threadStarted);
+
+	player->running = true;
+	player->error   = 0;
+	int result = EPERM;
+	if (player->priority > 0)
+	{
+		pthread_attr_t attr;
+		struct sched_param param;
+		memset (&param, 0, sizeof (param));
+		param.sched_priority = player->priority;
+		pthread_attr_init (&attr);
+		pthread_attr_setinheritsched (&attr, PTHREAD_EXPLICIT_SCHED);
+		pthread_attr_setschedpolicy (&attr, SCHED_FIFO);
+		pthread_attr_setschedparam (&attr, &param);
+		result = pthread_create (&player->thread, &attr, playerThread, player);
+		pthread_attr_destroy (&attr);
+		if (result != 0)
+			LIBPIXI_ERROR_WARN(result, "Cannot start real-time DAC playback thread, using normal scheduling");
+	}
+	if (result != 0)
+		result = pthread_create (&player->thread, NULL, playerThread, player);
+	if (result != 0)
+	{
+		player->running = false;
+		LIBPIXI_ERROR(result, "Cannot start DAC playback thread");
+		return -result;
+	}
+	player->threadStarted = true;
+	LIBPIXI_LOG_DEBUG("Started DAC playback at %u frames/s", player->rate);
+	return 0;
+}
+
+int pixi_dacPlayerStop (DacPlayer* player)
+{
+	LIBPIXI_PRECONDITION_NOT_NULL(player);
+
+	pthread_mutex_lock (&player->mutex);
+	player->running = false;
+	pthread_cond_broadcast (&player->cond);
+	pthread_mutex_unlock (&player->mutex);
+	// The thread clears running itself on a write error, so join it
+	// whenever it was started
+	if (!player->threadStarted)
+		return player->error;
+	pthread_join (player->thread, NULL);
+	player->threadStarted = false;
+	LIBPIXI_LOG_DEBUG("Stopped DAC playback after %llu frames", (unsigned long long) player->stats.frames);
+	return player->error;
+}
+
+static void deadlineFromNow (struct timespec* deadline, int timeoutMs)
+{
+	int64 ns = pixi_clockGetNs() + (timeoutMs * (int64) 1000000);
+	deadline->tv_sec  = ns / 1000000000;
+	deadline->tv_nsec = ns % 1000000000;
+}
+
+int pixi_dacPlayerQueue (DacPlayer* player, const uint16* frames, uint count, int timeoutMs)
+{
+	LIBPIXI_PRECONDITION_NOT_NULL(player);
+	LIBPIXI_PRECONDITION_NOT_NULL(frames);
+
+	struct timespec deadline;
+	if (timeoutMs > 0)
+		deadlineFromNow (&deadline, timeoutMs);
+
+	uint queued = 0;
+	pthread_mutex_lock (&player->mutex);
+	player->streaming = true;
+	while (queued < count && player->error == 0)
+	{
+		uint block = player->fillBlock;
+		if (player->blockFrames[block] != 0)
+		{
+			// Both buffers are waiting to be played
+			if (timeoutMs == 0 || !player->running)
+				break;
+			int result = timeoutMs < 0
+				? pthread_cond_wait (&player->cond, &player->mutex)
+				: pthread_cond_timedwait (&player->cond, &player->mutex, &deadline);
+			if (result == ETIMEDOUT)
+				break;
+			continue;
+		}
+		uint n = count - queued;
+		if (n > DacPlayerBlockFrames)
+			n = DacPlayerBlockFrames;
+		memcpy (player->blocks[block], frames + (queued * PixiDacChannels), n * PixiDacChannels * sizeof (uint16));
+		player->blockFrames[block] = n;
+		player->fillBlock = block ^ 1;
+		queued += n;
+	}
+	int error = player->error;
+	pthread_mutex_unlock (&player->mutex);
+	return queued > 0 || error == 0 ? (int) queued : error;
+}
+
+int pixi_dacPlayerDrain (DacPlayer* player, int timeoutMs)
+{
+	LIBPIXI_PRECONDITION_NOT_NULL(player);
+
+	struct timespec deadline;
+	if (timeoutMs > 0)
+		deadlineFromNow (&deadline, timeoutMs);
+
+	int result = 0;
+	pthread_mutex_lock (&player->mutex);
+	while (player->running && (player->blockFrames[0] || player->blockFrames[1]))
+	{
+		if (timeoutMs == 0)
+			result = ETIMEDOUT;
+		else if (timeoutMs < 0)
+			result = pthread_cond_wait (&player->cond, &player->mutex);
+		else
+			result = pthread_cond_timedwait (&player->cond, &player->mutex, &deadline);
+		if (result == ETIMEDOUT)
+			break;
+	}
+	if (result != ETIMEDOUT)
+		result = player->error;
+	else
+		result = -ETIMEDOUT;
+	pthread_mutex_unlock (&player->mutex);
+	return result;
+}
+
+void pixi_dacPlayerGetStats (DacPlayer* player, DacPlayerStats* stats)
+{
+	if (!player || !stats)
+		return;
+	pthread_mutex_lock (&player->mutex);
+	*stats = player->stats;
+	pthread_mutex_unlock (&player->mutex);
+}
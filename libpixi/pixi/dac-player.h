@@ -0,0 +1,136 @@
+/*
+    pixi-tools: a set of software to interface with the Raspberry Pi
+    and PiXi-200 hardware
+    Copyright (C) 2014 Simon Cantrill
+
+    pixi-tools is free software; you can redistribute it and/or
+    modify it under the terms of the GNU Lesser General Public
+    License as published by the Free Software Foundation; either
+    version 2.1 of the License, or (at your option) any later version.
+
+    This library is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+    Lesser General Public License for more details.
+
+    You should have received a copy of the GNU Lesser General Public
+    License along with this library; if not, write to the Free Software
+    Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+*/
+
+#ifndef libpixi_pixi_dac_player_h__included
+#define libpixi_pixi_dac_player_h__included
+
+
+#include <libpixi/common.h>
+#include <libpixi/pixi/dac.h>
+#include <pthread.h>
+
+LIBPIXI_BEGIN_DECLS
+
+///@defgroup PiXiDacPlayer PiXi DAC waveform playback
+/// Plays waveforms on the DAC at a fixed frame rate from a background
+/// thread. Each channel either loops a wavetable at a given frequency,
+/// or plays frames streamed in by the application through a
+/// double-buffered queue (see @ref pixi_dacPlayerQueue).
+/// Each frame is written with @ref pixi_dacWriteChannels, so the DAC must
+/// be open (@ref pixi_dacOpen) while the player is running.
+///@{
+
+enum
+{
+	DacPlayerBlockFrames  = 256,  ///< frames per queue buffer
+	DacPlayerMaxWavetable = 4096  ///< maximum wavetable length
+};
+
+///	Generated wave shapes
+typedef enum DacWaveform
+{
+	DacWaveSine     = 0,
+	DacWaveTriangle = 1,
+	DacWaveSquare   = 2,
+	DacWaveSawtooth = 3
+} DacWaveform;
+
+///	Playback counters
+typedef struct DacPlayerStats
+{
+	uint64  frames;         ///< frames written to the DAC
+	uint64  underruns;      ///< ticks where the stream queue was empty
+	uint64  deadlineMisses; ///< ticks skipped because a write was more than a period late
+	int64   maxLatenessNs;  ///< worst delay between a deadline and its write starting
+} DacPlayerStats;
+
+typedef struct DacPlayer
+{
+	uint            rate;     ///< frames per second
+	int             priority; ///< SCHED_FIFO priority of the playback thread, 0 for normal scheduling
+	uint16          idle[PixiDacChannels]; ///< value of channels with no wave and no queued frames
+	uint16*         tables[PixiDacChannels];    ///< internal
+	uint            lengths[PixiDacChannels];   ///< internal
+	uint32          phases[PixiDacChannels];    ///< internal: 16.16 fixed point table index
+	uint32          steps[PixiDacChannels];     ///< internal: phase increment per frame
+	uint16          blocks[2][DacPlayerBlockFrames * PixiDacChannels]; ///< internal
+	uint            blockFrames[2];   ///< internal: frames in each queued block, 0 if free
+	uint            playBlock;        ///< internal
+	uint            playFrame;        ///< internal
+	uint            fillBlock;        ///< internal
+	bool            streaming;        ///< internal
+	bool            running;          ///< internal
+	bool            threadStarted;    ///< internal: the thread exists and must be joined
+	int             error;            ///< internal: write error that stopped playback
+	DacPlayerStats  stats;            ///< internal: use @ref pixi_dacPlayerGetStats
+	pthread_t       thread;           ///< internal
+	pthread_mutex_t mutex;            ///< internal
+	pthread_cond_t  cond;             ///< internal
+	intptr          _reserved[2];
+} DacPlayer;
+
+///	Fill @c table with one cycle of @c shape, centred on @c offset with
+///	a peak deviation of @c amplitude, clipped to the 12 bit DAC range.
+///	@return 0 on success, -errno on error
+int pixi_dacWaveGenerate (uint16* table, uint length, DacWaveform shape, uint amplitude, uint offset);
+
+///	Initialise @c player to play at @c rate frames per second.
+///	@return 0 on success, -errno on error
+int pixi_dacPlayerInit (DacPlayer* player, uint rate);
+
+///	Release resources held by @c player, stopping it if needed.
+void pixi_dacPlayerFree (DacPlayer* player);
+
+///	Loop @c table (copied) on @c channel at @c frequency cycles per second.
+///	Pass a NULL @c table to stop the wave on @c channel.
+///	@return 0 on success, -errno on error
+int pixi_dacPlayerSetWave (DacPlayer* player, uint channel, const uint16* table, uint length, double frequency);
+
+///	Start the playback thread. A SCHED_FIFO thread is used if
+///	@c player->priority is set and permitted, otherwise a normal thread.
+///	@return 0 on success, -errno on error
+int pixi_dacPlayerStart (DacPlayer* player);
+
+///	Stop the playback thread.
+///	@return 0 on success, -errno on error, including a DAC write error
+///	that stopped playback early
+int pixi_dacPlayerStop (DacPlayer* player);
+
+///	Queue @c count frames of PixiDacChannels values for playback on the
+///	channels without a wave. Waits for a free buffer for up to
+///	@c timeoutMs milliseconds (-1 to wait indefinitely, 0 to not wait).
+///	When the queue runs dry, the last value is held and an underrun counted.
+///	@return number of frames queued, or -errno on error
+int pixi_dacPlayerQueue (DacPlayer* player, const uint16* frames, uint count, int timeoutMs);
+
+///	Wait for up to @c timeoutMs milliseconds (-1 to wait indefinitely)
+///	until all queued frames have been played, or playback stops.
+///	@return 0 on success, -ETIMEDOUT on timeout, or the error that
+///	stopped playback
+int pixi_dacPlayerDrain (DacPlayer* player, int timeoutMs);
+
+///	Get a snapshot of the playback counters.
+void pixi_dacPlayerGetStats (DacPlayer* player, DacPlayerStats* stats);
+
+///@} defgroup
+
+LIBPIXI_END_DECLS
+
+#endif // !defined libpixi_pixi_dac_player_h__included
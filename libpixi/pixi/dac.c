@@ -19,34 +19,34 @@
 */
 
 #include <libpixi/pixi/dac.h>
-#include <libpixi/pi/i2c.h>
+#include <libpixi/pi/i2c-bus.h>
 #include <libpixi/util/file.h>
 #include <libpixi/util/log.h>
 #include <stdlib.h>
 
-static int dacI2c = -1;
+static I2cDevice dacI2c = I2C_DEVICE_INIT;
+static PixiDacLatchMode dacLatchMode = PixiDacLatchImmediate;
 
 int pixi_dacOpen (void)
 {
 	// TODO: instead rejecting if previously open,
 	// do ref-counting of open count?
-	LIBPIXI_PRECONDITION(dacI2c < 0);
-	int result = pixi_i2cOpen (PixiDacChannel, PixiDacAddress);
+	LIBPIXI_PRECONDITION(dacI2c.fd < 0);
+	int result = pixi_i2cBusOpen (PixiDacChannel, PixiDacAddress, &dacI2c);
 	if (result < 0)
 		LIBPIXI_ERROR(-result, "Cannot open i2c channel to PiXi DAC");
-	dacI2c = result;
 	return result;
 }
 
 int pixi_dacClose (void)
 {
-	LIBPIXI_PRECONDITION(dacI2c >= 0);
-	return pixi_close (dacI2c);
+	LIBPIXI_PRECONDITION(dacI2c.fd >= 0);
+	return pixi_i2cBusClose (&dacI2c);
 }
 
 int pixi_dacWriteValue (uint channel, uint value)
 {
-	LIBPIXI_PRECONDITION(dacI2c >= 0);
+	LIBPIXI_PRECONDITION(dacI2c.fd >= 0);
 	LIBPIXI_PRECONDITION(channel < PixiDacChannels);
 	LIBPIXI_PRECONDITION(value < 4096);
 
@@ -57,16 +57,71 @@ int pixi_dacWriteValue (uint channel, uint value)
 	};
 	LIBPIXI_LOG_TRACE("Setting DAC channel %u=%u", channel, value);
 	LIBPIXI_LOG_DEBUG("Writing to DAC i2c: %02x %02x %02x", buf[0], buf[1], buf[2]);
-	ssize_t count = pixi_write (dacI2c, buf, sizeof (buf));
-	if (count < 0)
+	int result = pixi_i2cBusWriteRead (&dacI2c, I2cBusPriorityOutput, buf, sizeof (buf), NULL, 0);
+	if (result < 0)
 	{
-		LIBPIXI_ERROR(-count, "Failed to write DAC value");
-		return count;
+		LIBPIXI_ERROR(-result, "Failed to write DAC value");
+		return result;
 	}
-	else if (count == 0)
+	return 0;
+}
+
+int pixi_dacSetLatchMode (PixiDacLatchMode mode)
+{
+	LIBPIXI_PRECONDITION(mode <= PixiDacLatchDeferred);
+	dacLatchMode = mode;
+	return 0;
+}
+
+int pixi_dacWriteChannels (const uint16* values)
+{
+	LIBPIXI_PRECONDITION(dacI2c.fd >= 0);
+	LIBPIXI_PRECONDITION_NOT_NULL(values);
+
+	// Fast write is 2 bytes per channel, but can't hold back the outputs.
+	// Otherwise use a multi-write with the UDAC bit set on every channel,
+	// followed (in the same transfer) by a general call software update.
+	byte buf[PixiDacChannels * 3];
+	byte update = PixiDacSoftwareUpdate;
+	I2cMessage messages[2] = {
+		{PixiDacAddress, I2cMsgWrite, 0, buf},
+		{PixiDacGeneralCall, I2cMsgWrite, 1, &update}
+	};
+	uint count = 1;
+	for (uint channel = 0; channel < PixiDacChannels; channel++)
 	{
-		LIBPIXI_LOG_ERROR("Short write of DAC value");
-		return -EIO;
+		uint value = values[channel];
+		LIBPIXI_PRECONDITION(value < 4096);
+		if (dacLatchMode == PixiDacLatchImmediate)
+		{
+			buf[messages[0].length++] = PixiDacFastWrite | ((value >> 8) & 0x0F);
+			buf[messages[0].length++] = value;
+		}
+		else
+		{
+			buf[messages[0].length++] = PixiDacMultiWrite + (channel << 1) + PixiDacUdac;
+			buf[messages[0].length++] = (value >> 8) & 0x0F;
+			buf[messages[0].length++] = value;
+		}
 	}
-	return 0;
+	if (dacLatchMode == PixiDacLatchTogether)
+		count = 2;
+
+	LIBPIXI_LOG_TRACE("Setting DAC channels %u %u %u %u", values[0], values[1], values[2], values[3]);
+	int result = pixi_i2cBusMultiAddressOp (&dacI2c, I2cBusPriorityOutput, messages, count);
+	if (result < 0)
+		LIBPIXI_ERROR(-result, "Failed to write DAC values");
+	return result;
+}
+
+int pixi_dacLatch (void)
+{
+	LIBPIXI_PRECONDITION(dacI2c.fd >= 0);
+
+	byte update = PixiDacSoftwareUpdate;
+	I2cMessage message = {PixiDacGeneralCall, I2cMsgWrite, 1, &update};
+	int result = pixi_i2cBusMultiAddressOp (&dacI2c, I2cBusPriorityOutput, &message, 1);
+	if (result < 0)
+		LIBPIXI_ERROR(-result, "Failed to latch DAC outputs");
+	return result;
 }
@@ -34,14 +34,26 @@ enum
 {
 	PixiDacChannel         = 1,
 	PixiDacAddress         = 0x60,
+	PixiDacGeneralCall     = 0x00, ///< i2c general call address
 	PixiDacChannels        = 4,
 };
 
 enum PixiDacCommands
 {
+	PixiDacFastWrite       = 0x00, ///< 2 bytes per channel, for all channels in turn
 	PixiDacMultiWrite      = 0x40, ///< + (channel < 1) + UDAC-bit, followed by 2 more bytes
+	PixiDacUdac            = 0x01, ///< UDAC-bit: don't update the output until latched
+	PixiDacSoftwareUpdate  = 0x08, ///< general call command: latch all outputs
 };
 
+///	When the outputs change after @ref pixi_dacWriteChannels
+typedef enum PixiDacLatchMode
+{
+	PixiDacLatchImmediate = 0, ///< fast write: each output changes as its value is received
+	PixiDacLatchTogether  = 1, ///< all outputs change together at the end of the write
+	PixiDacLatchDeferred  = 2  ///< outputs change on the next @ref pixi_dacLatch
+} PixiDacLatchMode;
+
 ///	Open the Pi i2c channel to the PiXi DAC. When finished,
 ///	call pixi_closePixi().
 ///	@return 0 on success, negative error code on error
@@ -55,6 +67,21 @@ int pixi_dacClose (void);
 ///	@return 0 on success, negative error code on error
 int pixi_dacWriteValue (uint channel, uint value);
 
+///	Set how @ref pixi_dacWriteChannels updates the outputs.
+///	The default is PixiDacLatchImmediate.
+///	@return 0 on success, negative error code on error
+int pixi_dacSetLatchMode (PixiDacLatchMode mode);
+
+///	Write all PixiDacChannels channels in a single i2c transfer.
+///	@param values one 12 bit value per channel
+///	@return 0 on success, negative error code on error
+int pixi_dacWriteChannels (const uint16* values);
+
+///	Latch values written in PixiDacLatchDeferred mode to the outputs,
+///	using the i2c general call software update.
+///	@return 0 on success, negative error code on error
+int pixi_dacLatch (void);
+
 ///@} defgroup
 
 LIBPIXI_END_DECLS
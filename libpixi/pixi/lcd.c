@@ -35,7 +35,10 @@ enum
 	LcdEntryModeSet = 0x0006,
 	LcdDisplayOn    = 0x000C,
 	LcdFunctionSet  = 0x0030,
-	LcdBrightness   = 0x0200
+	LcdBrightness   = 0x0200,
+	LcdSetAddress   = 0x0080,
+	LcdData         = 0x0200, ///< RS set: display data
+	LcdRowOffset    = 0x40    ///< display RAM address of the second row
 };
 
 int pixi_lcdEnable (void)
@@ -57,46 +60,119 @@ int pixi_lcdOpen (void)
 	return result;
 }
 
-static inline int lcdWrite (uint value)
+uint pixi_lcdCommandDelay (uint command)
 {
-	return pixi_registerWrite (LcdAddress, value);
+	// Only clear and cursor home (with RS clear) are slow
+	uint instruction = command & 0xFF;
+	if (!(command & LcdData) && instruction >= LcdClear && instruction <= (LcdCursorHome | 1))
+		return LcdLongDelayUsecs;
+	return LcdShortDelayUsecs;
+}
+
+enum
+{
+	LcdMaxBatch = 128
+};
+
+/// Panel writes, each followed by the time the panel needs to execute it
+typedef struct LcdBatch
+{
+	RegisterOp  ops[LcdMaxBatch];
+	uint16      delays[LcdMaxBatch];
+	uint        count;
+} LcdBatch;
+
+static inline void batchInit (LcdBatch* batch)
+{
+	memset (batch->ops, 0, sizeof (batch->ops));
+	batch->count = 0;
+}
+
+static int batchSend (LcdBatch* batch)
+{
+	if (batch->count == 0)
+		return 0;
+	int result = pixi_multiRegisterOpPaced (batch->ops, batch->delays, batch->count);
+	batch->count = 0;
+	return result;
+}
+
+/// Add a write of @c value to @c batch, sending the batch first if it's full
+static int batchAdd (LcdBatch* batch, uint value)
+{
+	int result = 0;
+	if (batch->count == LcdMaxBatch)
+		result = batchSend (batch);
+	RegisterOp* op = &batch->ops[batch->count];
+	op->address  = LcdAddress;
+	op->function = PixiSpiEnableWrite16;
+	op->value    = value;
+	batch->delays[batch->count] = pixi_lcdCommandDelay (value);
+	batch->count++;
+	return result;
+}
+
+static int lcdWrite (uint value)
+{
+	LcdBatch batch;
+	batchInit (&batch);
+	batchAdd (&batch, value);
+	return batchSend (&batch);
+}
+
+/// Send @c count values as one paced batch
+static int lcdWriteValues (const uint16* values, uint count)
+{
+	LcdBatch batch;
+	batchInit (&batch);
+	for (uint i = 0; i < count; i++)
+		batchAdd (&batch, values[i]);
+	return batchSend (&batch);
 }
 
 int pixi_lcdInit (void)
 {
-	int result = lcdWrite (LcdFunctionSet);
-	if (result < 0)
-		return result;
-	lcdWrite (LcdBrightness + 3);
-	lcdWrite (LcdClear);
-	lcdWrite (LcdCursorHome);
-	lcdWrite (LcdEntryModeSet);
-	return lcdWrite (LcdDisplayOn);
+	const uint16 values[] = {
+		LcdFunctionSet,
+		LcdBrightness + 3,
+		LcdClear,
+		LcdCursorHome,
+		LcdEntryModeSet,
+		LcdDisplayOn
+	};
+	return lcdWriteValues (values, ARRAY_COUNT(values));
 }
 
 int pixi_lcdInit1 (void)
 {
-	int result = lcdWrite (LcdFunctionSet);
-	if (result < 0)
-		return result;
-	lcdWrite (LcdBrightness);
-	lcdWrite (LcdClear);
-	lcdWrite (LcdCursorHome);
-	lcdWrite (LcdEntryModeSet);
-	return lcdWrite (0x000F);
+	const uint16 values[] = {
+		LcdFunctionSet,
+		LcdBrightness,
+		LcdClear,
+		LcdCursorHome,
+		LcdEntryModeSet,
+		0x000F
+	};
+	return lcdWriteValues (values, ARRAY_COUNT(values));
 }
 
 int pixi_lcdSetBrightness (uint value)
 {
-	lcdWrite (LcdFunctionSet);
-	return lcdWrite (LcdBrightness + (value & 0x03));
+	const uint16 values[] = {
+		LcdFunctionSet,
+		LcdBrightness + (value & 0x03)
+	};
+	return lcdWriteValues (values, ARRAY_COUNT(values));
 }
 
 int pixi_lcdClear (void)
 {
-	lcdWrite (LcdFunctionSet);
-	lcdWrite (LcdClear);
-	return lcdWrite (LcdCursorHome);
+	const uint16 values[] = {
+		LcdFunctionSet,
+		LcdClear,
+		LcdCursorHome
+	};
+	return lcdWriteValues (values, ARRAY_COUNT(values));
 }
 
 
@@ -105,7 +181,7 @@ int pixi_lcdSetCursorPos (uint x, uint y)
 	x &= 0x3F;
 	y &= 1;
 	LIBPIXI_LOG_DEBUG("Setting cursor position to: %d, %d", x, y);
-	uint value = 0x0080 + (y << 6) + x;
+	uint value = LcdSetAddress + (y * LcdRowOffset) + x;
 	return lcdWrite (value);
 }
 
@@ -114,12 +190,105 @@ int pixi_lcdWriteStr (const char* str)
 	LIBPIXI_PRECONDITION_NOT_NULL(str);
 
 	LIBPIXI_LOG_DEBUG("Writing str to LCD: [%s]", str);
-	uint len = strlen (str);
+	LcdBatch batch;
+	batchInit (&batch);
 	int result = 0;
-	for (uint i = 0; i < len; i++)
+	for (; *str && result >= 0; str++)
+		result = batchAdd (&batch, LcdData + (uint8_t) *str); // Set RS to '1' for display data & combine upper / lower bytes
+	if (result < 0)
+		return result;
+	return batchSend (&batch);
+}
+
+void pixi_lcdFrameInit (LcdFrameBuffer* frame)
+{
+	if (!frame)
 	{
-		uint value = 0x00000200 + (uint8_t) str[i]; // Set RS to '1' for display data & combine upper / lower bytes
-      	result = lcdWrite (value);
+		LIBPIXI_PRECONDITION_FAILURE("frame is NULL");
+		return;
 	}
-	return result;
+	memset (frame, 0, sizeof (*frame));
+	memset (frame->text, ' ', sizeof (frame->text));
+}
+
+void pixi_lcdFrameInvalidate (LcdFrameBuffer* frame)
+{
+	if (frame)
+		frame->valid = false;
+}
+
+int pixi_lcdFrameWrite (LcdFrameBuffer* frame, uint x, uint y, const char* str)
+{
+	LIBPIXI_PRECONDITION_NOT_NULL(frame);
+	LIBPIXI_PRECONDITION_NOT_NULL(str);
+	LIBPIXI_PRECONDITION(y < LcdRows);
+
+	uint count = 0;
+	for (; x < LcdColumns && str[count]; x++, count++)
+		frame->text[y][x] = str[count];
+	return count;
+}
+
+int pixi_lcdFrameSetText (LcdFrameBuffer* frame, const char* text)
+{
+	LIBPIXI_PRECONDITION_NOT_NULL(frame);
+	LIBPIXI_PRECONDITION_NOT_NULL(text);
+
+	memset (frame->text, ' ', sizeof (frame->text));
+	for (uint y = 0; y < LcdRows && *text; y++)
+	{
+		for (uint x = 0; *text && *text != '\n'; text++, x++)
+			if (x < LcdColumns)
+				frame->text[y][x] = *text;
+		if (*text == '\n')
+			text++;
+	}
+	return 0;
+}
+
+int pixi_lcdFrameFlush (LcdFrameBuffer* frame)
+{
+	LIBPIXI_PRECONDITION_NOT_NULL(frame);
+
+	// A run of changed characters costs a cursor move plus one write per
+	// character, so unchanged gaps of a single character are cheaper to
+	// rewrite than to skip. At most LcdColumns+1 writes per row.
+	LcdBatch batch;
+	batchInit (&batch);
+	for (uint y = 0; y < LcdRows; y++)
+	{
+		const char* text  = frame->text[y];
+		const char* shown = frame->shown[y];
+		int cursor = -1; // column the panel will write to next, if known
+		for (uint x = 0; x < LcdColumns; x++)
+		{
+			bool changed = !frame->valid || text[x] != shown[x];
+			if (!changed)
+			{
+				bool bridge = cursor == (int) x
+					&& x + 1 < LcdColumns
+					&& text[x+1] != shown[x+1];
+				if (!bridge)
+					continue;
+			}
+			if (cursor != (int) x)
+				batchAdd (&batch, LcdSetAddress + (y * LcdRowOffset) + x);
+			batchAdd (&batch, LcdData + (uint8) text[x]);
+			cursor = x + 1;
+		}
+	}
+	uint count = batch.count;
+	if (count == 0)
+		return 0;
+
+	LIBPIXI_LOG_DEBUG("Flushing LCD frame with %u writes", count);
+	int result = batchSend (&batch);
+	if (result < 0)
+	{
+		frame->valid = false;
+		return result;
+	}
+	memcpy (frame->shown, frame->text, sizeof (frame->shown));
+	frame->valid = true;
+	return count;
 }
@@ -54,6 +54,55 @@ int pixi_lcdSetCursorPos (uint x, uint y);
 ///	Append @c str to the panel text
 int pixi_lcdWriteStr (const char* str);
 
+enum
+{
+	LcdColumns = 40,
+	LcdRows    = 2,
+
+	LcdShortDelayUsecs = 40,   ///< execution time of most panel instructions
+	LcdLongDelayUsecs  = 1520  ///< execution time of clear and cursor home
+};
+
+///	The panel is write-only, so its busy flag can't be polled. Instead,
+///	each function here spaces its writes by the execution time of each
+///	instruction, within a single SPI message, so no extra sleeps are needed.
+///	@return the time in microseconds the panel needs to execute @c command,
+///	a value written to the LCD register
+uint pixi_lcdCommandDelay (uint command);
+
+///	In-memory copy of the panel text. The application changes @c text,
+///	directly or with the functions below, then @ref pixi_lcdFrameFlush
+///	sends only the characters that differ from what the panel shows.
+typedef struct LcdFrameBuffer
+{
+	char    text[LcdRows][LcdColumns];  ///< text to display (not nul terminated)
+	char    shown[LcdRows][LcdColumns]; ///< internal: text on the panel
+	bool    valid;                      ///< internal: @c shown matches the panel
+	intptr  _reserved[2];
+} LcdFrameBuffer;
+
+///	Initialise @c frame with blank text. The panel contents are unknown,
+///	so the first flush writes every character.
+void pixi_lcdFrameInit (LcdFrameBuffer* frame);
+
+///	Mark the panel contents as unknown, e.g. after @ref pixi_lcdClear,
+///	so the next flush writes every character.
+void pixi_lcdFrameInvalidate (LcdFrameBuffer* frame);
+
+///	Copy @c str to the text of @c frame at @c x, @c y, clipped to the line.
+///	@return number of characters copied, or -errno on error
+int pixi_lcdFrameWrite (LcdFrameBuffer* frame, uint x, uint y, const char* str);
+
+///	Replace the text of @c frame with @c text, whose lines are separated
+///	by '\n'. Lines are padded with spaces or truncated to fit.
+///	@return 0 on success, -errno on error
+int pixi_lcdFrameSetText (LcdFrameBuffer* frame, const char* text);
+
+///	Send the changed runs of @c frame to the panel, each as a cursor move
+///	followed by its characters, all in a single paced SPI message.
+///	@return number of register writes sent (0 if nothing changed), or -errno on error
+int pixi_lcdFrameFlush (LcdFrameBuffer* frame);
+
 ///@} defgroup
 
 LIBPIXI_END_DECLS
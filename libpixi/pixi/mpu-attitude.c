@@ -0,0 +1,273 @@
+/*
+    pixi-tools: a set of software to interface with the Raspberry Pi
+    and PiXi-200 hardware
+    Copyright (C) 2014 Simon Cantrill
+
+    pixi-tools is free software; you can redistribute it and/or
+    modify it under the terms of the GNU Lesser General Public
+    License as published by the Free Software Foundation; either
+    version 2.1 of the License, or (at your option) any later version.
+
+    This library is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+    Lesser General Public License for more details.
+
+    You should have received a copy of the GNU Lesser General Public
+    License along with this library; if not, write to the Free Software
+    Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+*/
+
+#include <libpixi/pixi/mpu-attitude.h>
+#include <libpixi/util/log.h>
+#include <math.h>
+#include <string.h>
+
+// Filters based on the AHRS algorithms published by Sebastian Madgwick
+// ("An efficient orientation filter for inertial and inertial/magnetic
+// sensor arrays", 2010), including his gyroscope bias drift compensation,
+// and Robert Mahony's nonlinear complementary filter.
+
+static inline float invSqrt (float x)
+{
+	return 1.0f / sqrtf (x);
+}
+
+static inline void normalise3 (float* x, float* y, float* z)
+{
+	float norm = invSqrt ((*x * *x) + (*y * *y) + (*z * *z));
+	*x *= norm;
+	*y *= norm;
+	*z *= norm;
+}
+
+static inline void normaliseQ (Quaternion* q)
+{
+	float norm = invSqrt ((q->w * q->w) + (q->x * q->x) + (q->y * q->y) + (q->z * q->z));
+	q->w *= norm;
+	q->x *= norm;
+	q->y *= norm;
+	q->z *= norm;
+}
+
+int pixi_attitudeInit (MpuAttitude* attitude, AttitudeAlgorithm algorithm, uint accelScale, uint gyroScale)
+{
+	LIBPIXI_PRECONDITION_NOT_NULL(attitude);
+	LIBPIXI_PRECONDITION(algorithm <= AttitudeMahony);
+	LIBPIXI_PRECONDITION(accelScale > 0);
+	LIBPIXI_PRECONDITION(gyroScale > 0);
+
+	memset (attitude, 0, sizeof (*attitude));
+	attitude->algorithm   = algorithm;
+	attitude->accelScale  = accelScale / 32768.0f;
+	attitude->gyroScale   = (gyroScale / 32768.0f) * (float) (M_PI / 180.0);
+	attitude->magScale[0] = 1.0f;
+	attitude->magScale[1] = 1.0f;
+	attitude->magScale[2] = 1.0f;
+	attitude->beta        = 0.1f;
+	attitude->zeta        = 0.002f;
+	attitude->kp          = 0.5f;
+	attitude->ki          = 0.01f;
+	attitude->q.w         = 1.0f;
+	return 0;
+}
+
+static void madgwickUpdate (MpuAttitude* attitude, float gx, float gy, float gz, float ax, float ay, float az, const float* m, float dt)
+{
+	Quaternion* q = &attitude->q;
+	const float q0 = q->w, q1 = q->x, q2 = q->y, q3 = q->z;
+	float s0 = 0, s1 = 0, s2 = 0, s3 = 0;
+
+	if (ax != 0.0f || ay != 0.0f || az != 0.0f)
+	{
+		normalise3 (&ax, &ay, &az);
+
+		const float _2q0 = 2.0f * q0, _2q1 = 2.0f * q1, _2q2 = 2.0f * q2, _2q3 = 2.0f * q3;
+		const float q0q0 = q0 * q0, q1q1 = q1 * q1, q2q2 = q2 * q2, q3q3 = q3 * q3;
+		if (m)
+		{
+			float mx = m[0], my = m[1], mz = m[2];
+			normalise3 (&mx, &my, &mz);
+
+			const float _2q0mx = 2.0f * q0 * mx, _2q0my = 2.0f * q0 * my, _2q0mz = 2.0f * q0 * mz;
+			const float _2q1mx = 2.0f * q1 * mx;
+			const float _2q0q2 = 2.0f * q0 * q2, _2q2q3 = 2.0f * q2 * q3;
+			const float q0q1 = q0 * q1, q0q2 = q0 * q2, q0q3 = q0 * q3;
+			const float q1q2 = q1 * q2, q1q3 = q1 * q3, q2q3 = q2 * q3;
+
+			// Direction of the earth's magnetic field
+			float hx = (mx * q0q0) - (_2q0my * q3) + (_2q0mz * q2) + (mx * q1q1) + (_2q1 * my * q2) + (_2q1 * mz * q3) - (mx * q2q2) - (mx * q3q3);
+			float hy = (_2q0mx * q3) + (my * q0q0) - (_2q0mz * q1) + (_2q1mx * q2) - (my * q1q1) + (my * q2q2) + (_2q2 * mz * q3) - (my * q3q3);
+			const float _2bx = sqrtf ((hx * hx) + (hy * hy));
+			const float _2bz = -(_2q0mx * q2) + (_2q0my * q1) + (mz * q0q0) + (_2q1mx * q3) - (mz * q1q1) + (_2q2 * my * q3) - (mz * q2q2) + (mz * q3q3);
+			const float _4bx = 2.0f * _2bx, _4bz = 2.0f * _2bz;
+
+			// Objective function errors
+			const float fax = (2.0f * q1q3) - _2q0q2 - ax;
+			const float fay = (2.0f * q0q1) + _2q2q3 - ay;
+			const float faz = 1.0f - (2.0f * q1q1) - (2.0f * q2q2) - az;
+			const float fmx = (_2bx * (0.5f - q2q2 - q3q3)) + (_2bz * (q1q3 - q0q2)) - mx;
+			const float fmy = (_2bx * (q1q2 - q0q3)) + (_2bz * (q0q1 + q2q3)) - my;
+			const float fmz = (_2bx * (q0q2 + q1q3)) + (_2bz * (0.5f - q1q1 - q2q2)) - mz;
+
+			// Gradient
+			s0 = (-_2q2 * fax) + (_2q1 * fay) - (_2bz * q2 * fmx) + ((-_2bx * q3) + (_2bz * q1)) * fmy + (_2bx * q2 * fmz);
+			s1 = (_2q3 * fax) + (_2q0 * fay) - (4.0f * q1 * faz) + (_2bz * q3 * fmx) + ((_2bx * q2) + (_2bz * q0)) * fmy + ((_2bx * q3) - (_4bz * q1)) * fmz;
+			s2 = (-_2q0 * fax) + (_2q3 * fay) - (4.0f * q2 * faz) + ((-_4bx * q2) - (_2bz * q0)) * fmx + ((_2bx * q1) + (_2bz * q3)) * fmy + ((_2bx * q0) - (_4bz * q2)) * fmz;
+			s3 = (_2q1 * fax) + (_2q2 * fay) + ((-_4bx * q3) + (_2bz * q1)) * fmx + ((-_2bx * q0) + (_2bz * q2)) * fmy + (_2bx * q1 * fmz);
+		}
+		else
+		{
+			const float _4q0 = 4.0f * q0, _4q1 = 4.0f * q1, _4q2 = 4.0f * q2;
+			const float _8q1 = 8.0f * q1, _8q2 = 8.0f * q2;
+			s0 = (_4q0 * q2q2) + (_2q2 * ax) + (_4q0 * q1q1) - (_2q1 * ay);
+			s1 = (_4q1 * q3q3) - (_2q3 * ax) + (4.0f * q0q0 * q1) - (_2q0 * ay) - _4q1 + (_8q1 * q1q1) + (_8q1 * q2q2) + (_4q1 * az);
+			s2 = (4.0f * q0q0 * q2) + (_2q0 * ax) + (_4q2 * q3q3) - (_2q3 * ay) - _4q2 + (_8q2 * q1q1) + (_8q2 * q2q2) + (_4q2 * az);
+			s3 = (4.0f * q1q1 * q3) - (_2q1 * ax) + (4.0f * q2q2 * q3) - (_2q2 * ay);
+		}
+		float norm = (s0 * s0) + (s1 * s1) + (s2 * s2) + (s3 * s3);
+		if (norm > 0.0f)
+		{
+			norm = invSqrt (norm);
+			s0 *= norm;
+			s1 *= norm;
+			s2 *= norm;
+			s3 *= norm;
+		}
+
+		// Gyroscope bias: the error direction is 2 q* x gradient
+		float* bias = attitude->gyroBias;
+		const float gain = 2.0f * attitude->zeta * dt;
+		bias[0] += gain * ((q0 * s1) - (q1 * s0) - (q2 * s3) + (q3 * s2));
+		bias[1] += gain * ((q0 * s2) + (q1 * s3) - (q2 * s0) - (q3 * s1));
+		bias[2] += gain * ((q0 * s3) - (q1 * s2) + (q2 * s1) - (q3 * s0));
+	}
+	gx -= attitude->gyroBias[0];
+	gy -= attitude->gyroBias[1];
+	gz -= attitude->gyroBias[2];
+
+	// Rate of change of the quaternion from the gyroscope, less the gradient step
+	const float beta = attitude->beta;
+	q->w += (0.5f * (-(q1 * gx) - (q2 * gy) - (q3 * gz)) - (beta * s0)) * dt;
+	q->x += (0.5f * ( (q0 * gx) + (q2 * gz) - (q3 * gy)) - (beta * s1)) * dt;
+	q->y += (0.5f * ( (q0 * gy) - (q1 * gz) + (q3 * gx)) - (beta * s2)) * dt;
+	q->z += (0.5f * ( (q0 * gz) + (q1 * gy) - (q2 * gx)) - (beta * s3)) * dt;
+	normaliseQ (q);
+}
+
+static void mahonyUpdate (MpuAttitude* attitude, float gx, float gy, float gz, float ax, float ay, float az, const float* m, float dt)
+{
+	Quaternion* q = &attitude->q;
+	const float q0 = q->w, q1 = q->x, q2 = q->y, q3 = q->z;
+	float ex = 0, ey = 0, ez = 0;
+
+	if (ax != 0.0f || ay != 0.0f || az != 0.0f)
+	{
+		normalise3 (&ax, &ay, &az);
+
+		const float q0q0 = q0 * q0, q0q1 = q0 * q1, q0q2 = q0 * q2, q0q3 = q0 * q3;
+		const float q1q1 = q1 * q1, q1q2 = q1 * q2, q1q3 = q1 * q3;
+		const float q2q2 = q2 * q2, q2q3 = q2 * q3, q3q3 = q3 * q3;
+
+		// Estimated direction of gravity (halved), and the error from the measurement
+		const float vx = q1q3 - q0q2;
+		const float vy = q0q1 + q2q3;
+		const float vz = q0q0 - 0.5f + q3q3;
+		ex = (ay * vz) - (az * vy);
+		ey = (az * vx) - (ax * vz);
+		ez = (ax * vy) - (ay * vx);
+
+		if (m)
+		{
+			float mx = m[0], my = m[1], mz = m[2];
+			normalise3 (&mx, &my, &mz);
+
+			// Reference direction of the earth's magnetic field
+			const float hx = 2.0f * ((mx * (0.5f - q2q2 - q3q3)) + (my * (q1q2 - q0q3)) + (mz * (q1q3 + q0q2)));
+			const float hy = 2.0f * ((mx * (q1q2 + q0q3)) + (my * (0.5f - q1q1 - q3q3)) + (mz * (q2q3 - q0q1)));
+			const float bx = sqrtf ((hx * hx) + (hy * hy));
+			const float bz = 2.0f * ((mx * (q1q3 - q0q2)) + (my * (q2q3 + q0q1)) + (mz * (0.5f - q1q1 - q2q2)));
+
+			// Estimated direction of the magnetic field (halved)
+			const float wx = (bx * (0.5f - q2q2 - q3q3)) + (bz * (q1q3 - q0q2));
+			const float wy = (bx * (q1q2 - q0q3)) + (bz * (q0q1 + q2q3));
+			const float wz = (bx * (q0q2 + q1q3)) + (bz * (0.5f - q1q1 - q2q2));
+			ex += (my * wz) - (mz * wy);
+			ey += (mz * wx) - (mx * wz);
+			ez += (mx * wy) - (my * wx);
+		}
+
+		// The integral feedback is the gyroscope bias estimate
+		float* bias = attitude->gyroBias;
+		const float gain = 2.0f * attitude->ki * dt;
+		bias[0] -= gain * ex;
+		bias[1] -= gain * ey;
+		bias[2] -= gain * ez;
+	}
+	const float kp = 2.0f * attitude->kp;
+	gx += (kp * ex) - attitude->gyroBias[0];
+	gy += (kp * ey) - attitude->gyroBias[1];
+	gz += (kp * ez) - attitude->gyroBias[2];
+
+	const float h = 0.5f * dt;
+	q->w += h * (-(q1 * gx) - (q2 * gy) - (q3 * gz));
+	q->x += h * ( (q0 * gx) + (q2 * gz) - (q3 * gy));
+	q->y += h * ( (q0 * gy) - (q1 * gz) + (q3 * gx));
+	q->z += h * ( (q0 * gz) + (q1 * gy) - (q2 * gx));
+	normaliseQ (q);
+}
+
+int pixi_attitudeUpdate (MpuAttitude* attitude, const MpuMotion* motion, const MpuAxes* mag, int64 timestampNs)
+{
+	LIBPIXI_PRECONDITION_NOT_NULL(attitude);
+	LIBPIXI_PRECONDITION_NOT_NULL(motion);
+
+	int64 elapsed = timestampNs - attitude->lastTimeNs;
+	bool first = attitude->updates++ == 0;
+	attitude->lastTimeNs = timestampNs;
+	if (first || elapsed <= 0)
+		return 0;
+	const float dt = elapsed * 1e-9f;
+
+	const float gs = attitude->gyroScale;
+	const float as = attitude->accelScale;
+	float gx = gs * motion->gyro.x;
+	float gy = gs * motion->gyro.y;
+	float gz = gs * motion->gyro.z;
+	float ax = as * motion->accel.x;
+	float ay = as * motion->accel.y;
+	float az = as * motion->accel.z;
+
+	// The magnetometer's x and y axes are swapped relative to the
+	// accelerometer and gyroscope, and its z axis is reversed
+	float m[3];
+	const float* mp = NULL;
+	if (mag && (mag->x != 0 || mag->y != 0 || mag->z != 0))
+	{
+		m[0] =  attitude->magScale[1] * mag->y;
+		m[1] =  attitude->magScale[0] * mag->x;
+		m[2] = -attitude->magScale[2] * mag->z;
+		mp = m;
+	}
+
+	if (attitude->algorithm == AttitudeMahony)
+		mahonyUpdate (attitude, gx, gy, gz, ax, ay, az, mp, dt);
+	else
+		madgwickUpdate (attitude, gx, gy, gz, ax, ay, az, mp, dt);
+	return 0;
+}
+
+void pixi_attitudeGetEuler (const MpuAttitude* attitude, EulerAngles* angles)
+{
+	if (!attitude || !angles)
+		return;
+	const Quaternion* q = &attitude->q;
+	float sinPitch = 2.0f * ((q->w * q->y) - (q->z * q->x));
+	if (sinPitch > 1.0f)
+		sinPitch = 1.0f;
+	else if (sinPitch < -1.0f)
+		sinPitch = -1.0f;
+	angles->roll  = atan2f (2.0f * ((q->w * q->x) + (q->y * q->z)), 1.0f - (2.0f * ((q->x * q->x) + (q->y * q->y))));
+	angles->pitch = asinf (sinPitch);
+	angles->yaw   = atan2f (2.0f * ((q->w * q->z) + (q->x * q->y)), 1.0f - (2.0f * ((q->y * q->y) + (q->z * q->z))));
+}
@@ -0,0 +1,98 @@
+/*
+    pixi-tools: a set of software to interface with the Raspberry Pi
+    and PiXi-200 hardware
+    Copyright (C) 2014 Simon Cantrill
+
+    pixi-tools is free software; you can redistribute it and/or
+    modify it under the terms of the GNU Lesser General Public
+    License as published by the Free Software Foundation; either
+    version 2.1 of the License, or (at your option) any later version.
+
+    This library is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+    Lesser General Public License for more details.
+
+    You should have received a copy of the GNU Lesser General Public
+    License along with this library; if not, write to the Free Software
+    Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+*/
+
+#ifndef libpixi_pixi_mpu_attitude_h__included
+#define libpixi_pixi_mpu_attitude_h__included
+
+
+#include <libpixi/common.h>
+#include <libpixi/pixi/mpu.h>
+
+LIBPIXI_BEGIN_DECLS
+
+///@defgroup PiXiMpuAttitude PiXi MPU attitude estimation
+/// Sensor fusion of MPU gyroscope, accelerometer and (optionally)
+/// magnetometer samples into an orientation, using single precision
+/// floating point. Two filters are provided: Madgwick's gradient descent
+/// filter and Mahony's complementary filter. Both track the gyroscope
+/// bias while running.
+///@{
+
+typedef enum AttitudeAlgorithm
+{
+	AttitudeMadgwick = 0,
+	AttitudeMahony   = 1
+} AttitudeAlgorithm;
+
+///	Orientation of the sensor frame relative to the earth frame
+typedef struct Quaternion
+{
+	float   w;
+	float   x;
+	float   y;
+	float   z;
+} Quaternion;
+
+///	Orientation as aerospace sequence (yaw, pitch, roll) angles, in radians
+typedef struct EulerAngles
+{
+	float   roll;
+	float   pitch;
+	float   yaw;
+} EulerAngles;
+
+typedef struct MpuAttitude
+{
+	AttitudeAlgorithm algorithm;
+	float       accelScale;   ///< g per raw accelerometer unit
+	float       gyroScale;    ///< radians/s per raw gyroscope unit
+	float       magScale[3];  ///< per-axis magnetometer adjustment (e.g. from @ref mpuMagGetScale)
+	float       beta;         ///< Madgwick: gradient descent gain
+	float       zeta;         ///< Madgwick: gyroscope bias tracking gain
+	float       kp;           ///< Mahony: proportional gain
+	float       ki;           ///< Mahony: integral (bias tracking) gain
+	Quaternion  q;            ///< current orientation
+	float       gyroBias[3];  ///< estimated gyroscope bias, radians/s
+	int64       lastTimeNs;   ///< timestamp of the last update
+	uint64      updates;      ///< number of updates
+	intptr      _reserved[2];
+} MpuAttitude;
+
+///	Initialise @c attitude with default gains for @c algorithm.
+///	@param accelScale accelerometer full scale (g), see @ref pixi_mpuGetAccelScale
+///	@param gyroScale gyroscope full scale (degrees/s), see @ref pixi_mpuGetGyroScale
+///	@return 0 on success, -errno on error
+int pixi_attitudeInit (MpuAttitude* attitude, AttitudeAlgorithm algorithm, uint accelScale, uint gyroScale);
+
+///	Update the orientation with a sample taken at @c timestampNs
+///	(e.g. from @ref pixi_clockGetNs). The first update only sets the
+///	time. @c mag may be NULL, in which case yaw is from the gyroscope alone.
+///	Magnetometer axes are converted to the accelerometer's frame.
+///	@return 0 on success, -errno on error
+int pixi_attitudeUpdate (MpuAttitude* attitude, const MpuMotion* motion, const MpuAxes* mag, int64 timestampNs);
+
+///	Convert the current orientation to Euler angles.
+void pixi_attitudeGetEuler (const MpuAttitude* attitude, EulerAngles* angles);
+
+///@} defgroup
+
+LIBPIXI_END_DECLS
+
+#endif // !defined libpixi_pixi_mpu_attitude_h__included
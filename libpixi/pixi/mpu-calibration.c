@@ -0,0 +1,587 @@
+/*
+    pixi-tools: a set of software to interface with the Raspberry Pi
+    and PiXi-200 hardware
+    Copyright (C) 2014 Simon Cantrill
+
+    pixi-tools is free software; you can redistribute it and/or
+    modify it under the terms of the GNU Lesser General Public
+    License as published by the Free Software Foundation; either
+    version 2.1 of the License, or (at your option) any later version.
+
+    This library is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+    Lesser General Public License for more details.
+
+    You should have received a copy of the GNU Lesser General Public
+    License along with this library; if not, write to the Free Software
+    Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+*/
+#include <libpixi/pixi/mpu-calibration.h>
+#include <libpixi/util/file.h>
+#include <libpixi/util/log.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#if defined __ARM_NEON__ || defined __ARM_NEON
+#	include <arm_neon.h>
+#	define CALIBRATION_NEON 1
+#else
+#	define CALIBRATION_NEON 0
+#endif
+
+enum
+{
+	CorrectBlock = 64 ///< samples converted to float per pass
+};
+
+static MpuCalibration installedCalibration;
+static bool calibrationInstalled = false;
+
+static const char* const sectionNames[] = {"accel", "gyro", "mag"};
+
+
+void pixi_mpuCorrectionReset (MpuCorrection* correction)
+{
+	if (!correction)
+		return;
+	memset (correction, 0, sizeof (*correction));
+	correction->matrix[0] = 1;
+	correction->matrix[4] = 1;
+	correction->matrix[8] = 1;
+}
+
+void pixi_mpuCalibrationReset (MpuCalibration* calibration)
+{
+	if (!calibration)
+		return;
+	memset (calibration, 0, sizeof (*calibration));
+	pixi_mpuCorrectionReset (&calibration->accel);
+	pixi_mpuCorrectionReset (&calibration->gyro);
+	pixi_mpuCorrectionReset (&calibration->mag);
+}
+
+int pixi_mpuEstimateGyroBias (const MpuMotion* motions, uint count, MpuCorrection* correction)
+{
+	LIBPIXI_PRECONDITION_NOT_NULL(motions);
+	LIBPIXI_PRECONDITION_NOT_NULL(correction);
+	LIBPIXI_PRECONDITION(count > 0);
+
+	int64 sum[3] = {0, 0, 0};
+	for (uint i = 0; i < count; i++)
+	{
+		sum[0] += motions[i].gyro.x;
+		sum[1] += motions[i].gyro.y;
+		sum[2] += motions[i].gyro.z;
+	}
+	pixi_mpuCorrectionReset (correction);
+	for (uint a = 0; a < 3; a++)
+		correction->offset[a] = (float) (-(double) sum[a] / count);
+	return 0;
+}
+
+// Ellipsoid fitting
+
+/// Solve the @c n x @c n system @c a x = @c b in place (x is left in @c b),
+/// by Gaussian elimination with partial pivoting.
+static int solveLinear (double* a, double* b, uint n)
+{
+	for (uint col = 0; col < n; col++)
+	{
+		uint pivot = col;
+		for (uint row = col + 1; row < n; row++)
+			if (fabs (a[row*n + col]) > fabs (a[pivot*n + col]))
+				pivot = row;
+		if (fabs (a[pivot*n + col]) < 1e-12)
+			return -EINVAL;
+		if (pivot != col)
+		{
+			for (uint k = 0; k < n; k++)
+			{
+				double t = a[col*n + k];
+				a[col*n + k] = a[pivot*n + k];
+				a[pivot*n + k] = t;
+			}
+			double t = b[col];
+			b[col] = b[pivot];
+			b[pivot] = t;
+		}
+		for (uint row = col + 1; row < n; row++)
+		{
+			double f = a[row*n + col] / a[col*n + col];
+			for (uint k = col; k < n; k++)
+				a[row*n + k] -= f * a[col*n + k];
+			b[row] -= f * b[col];
+		}
+	}
+	for (uint row = n; row-- > 0; )
+	{
+		double sum = b[row];
+		for (uint k = row + 1; k < n; k++)
+			sum -= a[row*n + k] * b[k];
+		b[row] = sum / a[row*n + row];
+	}
+	return 0;
+}
+
+/// Eigen-decomposition of the symmetric 3x3 matrix @c a (destroyed),
+/// using Jacobi rotations. Eigenvectors are the columns of @c v.
+static void eigenSymmetric3 (double a[9], double values[3], double v[9])
+{
+	for (uint i = 0; i < 9; i++)
+		v[i] = (i % 4 == 0) ? 1 : 0;
+
+	for (uint sweep = 0; sweep < 50; sweep++)
+	{
+		double off = fabs (a[1]) + fabs (a[2]) + fabs (a[5]);
+		if (off < 1e-15 * (fabs (a[0]) + fabs (a[4]) + fabs (a[8])))
+			break;
+		for (uint p = 0; p < 2; p++)
+		{
+			for (uint q = p + 1; q < 3; q++)
+			{
+				double apq = a[p*3 + q];
+				if (apq == 0)
+					continue;
+				double theta = (a[q*3 + q] - a[p*3 + p]) / (2 * apq);
+				double t = (theta >= 0 ? 1 : -1) / (fabs (theta) + sqrt (theta * theta + 1));
+				double c = 1 / sqrt (t * t + 1);
+				double s = t * c;
+				for (uint k = 0; k < 3; k++)
+				{
+					// rotate columns p and q
+					double akp = a[k*3 + p];
+					double akq = a[k*3 + q];
+					a[k*3 + p] = c * akp - s * akq;
+					a[k*3 + q] = s * akp + c * akq;
+				}
+				for (uint k = 0; k < 3; k++)
+				{
+					// then rows p and q
+					double apk = a[p*3 + k];
+					double aqk = a[q*3 + k];
+					a[p*3 + k] = c * apk - s * aqk;
+					a[q*3 + k] = s * apk + c * aqk;
+				}
+				for (uint k = 0; k < 3; k++)
+				{
+					double vkp = v[k*3 + p];
+					double vkq = v[k*3 + q];
+					v[k*3 + p] = c * vkp - s * vkq;
+					v[k*3 + q] = s * vkp + c * vkq;
+				}
+			}
+		}
+	}
+	values[0] = a[0];
+	values[1] = a[4];
+	values[2] = a[8];
+}
+
+int pixi_mpuFitEllipsoid (const int16* xyz, uint count, uint stride, float radius, MpuCorrection* correction)
+{
+	LIBPIXI_PRECONDITION_NOT_NULL(xyz);
+	LIBPIXI_PRECONDITION_NOT_NULL(correction);
+	LIBPIXI_PRECONDITION(stride >= 3);
+	LIBPIXI_PRECONDITION(radius >= 0);
+	if (count < 9)
+	{
+		LIBPIXI_LOG_ERROR("Ellipsoid fit needs at least 9 samples, not %u", count);
+		return -EINVAL;
+	}
+
+	// Centre and scale the samples to keep the normal equations well conditioned
+	double mean[3] = {0, 0, 0};
+	for (uint i = 0; i < count; i++)
+		for (uint a = 0; a < 3; a++)
+			mean[a] += xyz[i*stride + a];
+	for (uint a = 0; a < 3; a++)
+		mean[a] /= count;
+	double maxAbs = 0;
+	for (uint i = 0; i < count; i++)
+		for (uint a = 0; a < 3; a++)
+			maxAbs = fmax (maxAbs, fabs (xyz[i*stride + a] - mean[a]));
+	if (maxAbs == 0)
+	{
+		LIBPIXI_LOG_ERROR("Ellipsoid fit samples are all the same");
+		return -EINVAL;
+	}
+	const double scale = 1 / maxAbs;
+
+	// Least squares fit of
+	// Ax^2 + By^2 + Cz^2 + 2Dxy + 2Exz + 2Fyz + 2Gx + 2Hy + 2Iz = 1
+	double normal[9*9];
+	double rhs[9];
+	memset (normal, 0, sizeof (normal));
+	memset (rhs, 0, sizeof (rhs));
+	for (uint i = 0; i < count; i++)
+	{
+		const int16* sample = xyz + i*stride;
+		double x = (sample[0] - mean[0]) * scale;
+		double y = (sample[1] - mean[1]) * scale;
+		double z = (sample[2] - mean[2]) * scale;
+		double d[9] = {x*x, y*y, z*z, 2*x*y, 2*x*z, 2*y*z, 2*x, 2*y, 2*z};
+		for (uint r = 0; r < 9; r++)
+		{
+			rhs[r] += d[r];
+			for (uint c = r; c < 9; c++)
+				normal[r*9 + c] += d[r] * d[c];
+		}
+	}
+	for (uint r = 1; r < 9; r++)
+		for (uint c = 0; c < r; c++)
+			normal[r*9 + c] = normal[c*9 + r];
+	if (solveLinear (normal, rhs, 9) < 0)
+	{
+		LIBPIXI_LOG_ERROR("Ellipsoid fit is singular; samples need to cover more orientations");
+		return -EINVAL;
+	}
+	const double* p = rhs;
+	const double m[9] = {
+		p[0], p[3], p[4],
+		p[3], p[1], p[5],
+		p[4], p[5], p[2]
+	};
+
+	// Centre is -M^-1 v
+	double mc[9];
+	double centre[3] = {-p[6], -p[7], -p[8]};
+	memcpy (mc, m, sizeof (mc));
+	if (solveLinear (mc, centre, 3) < 0)
+	{
+		LIBPIXI_LOG_ERROR("Ellipsoid fit has no centre");
+		return -EINVAL;
+	}
+	double k = 1;
+	for (uint r = 0; r < 3; r++)
+		for (uint c = 0; c < 3; c++)
+			k += centre[r] * m[r*3 + c] * centre[c];
+
+	// Shape matrix of the centred ellipsoid in raw units
+	double shape[9];
+	for (uint i = 0; i < 9; i++)
+		shape[i] = m[i] / k * scale * scale;
+	double values[3];
+	double v[9];
+	eigenSymmetric3 (shape, values, v);
+	if (k <= 0 || values[0] <= 0 || values[1] <= 0 || values[2] <= 0)
+	{
+		LIBPIXI_LOG_ERROR("Ellipsoid fit is not an ellipsoid; samples need to cover more orientations");
+		return -EINVAL;
+	}
+	// Semi-axis lengths are 1/sqrt(eigenvalue)
+	double r = radius;
+	if (r == 0)
+		r = pow (values[0] * values[1] * values[2], -1.0 / 6);
+
+	// W = V diag(sqrt(eigenvalue) * r) V^T maps the ellipsoid on to the sphere
+	double w[9];
+	for (uint row = 0; row < 3; row++)
+	{
+		for (uint col = 0; col < 3; col++)
+		{
+			double sum = 0;
+			for (uint e = 0; e < 3; e++)
+				sum += v[row*3 + e] * sqrt (values[e]) * r * v[col*3 + e];
+			w[row*3 + col] = sum;
+		}
+	}
+	double rawCentre[3];
+	for (uint a = 0; a < 3; a++)
+		rawCentre[a] = mean[a] + centre[a] / scale;
+	for (uint row = 0; row < 3; row++)
+	{
+		double offset = 0;
+		for (uint col = 0; col < 3; col++)
+		{
+			correction->matrix[row*3 + col] = (float) w[row*3 + col];
+			offset -= w[row*3 + col] * rawCentre[col];
+		}
+		correction->offset[row] = (float) offset;
+	}
+	LIBPIXI_LOG_DEBUG("Ellipsoid fit: centre=[%.1f %.1f %.1f] semi-axes=[%.1f %.1f %.1f]",
+		rawCentre[0], rawCentre[1], rawCentre[2],
+		1 / sqrt (values[0]), 1 / sqrt (values[1]), 1 / sqrt (values[2]));
+	return 0;
+}
+
+// Applying corrections
+
+/// out = matrix * in + offset, for @c count samples held as separate
+/// x, y and z arrays.
+static void correctBlock (const MpuCorrection* correction, float* x, float* y, float* z, uint count)
+{
+	const float* mx = correction->matrix;
+	const float* off = correction->offset;
+	uint i = 0;
+#if CALIBRATION_NEON
+	for ( ; i + 4 <= count; i += 4)
+	{
+		float32x4_t vx = vld1q_f32 (x + i);
+		float32x4_t vy = vld1q_f32 (y + i);
+		float32x4_t vz = vld1q_f32 (z + i);
+		float32x4_t ox = vdupq_n_f32 (off[0]);
+		float32x4_t oy = vdupq_n_f32 (off[1]);
+		float32x4_t oz = vdupq_n_f32 (off[2]);
+		ox = vmlaq_n_f32 (ox, vx, mx[0]);
+		oy = vmlaq_n_f32 (oy, vx, mx[3]);
+		oz = vmlaq_n_f32 (oz, vx, mx[6]);
+		ox = vmlaq_n_f32 (ox, vy, mx[1]);
+		oy = vmlaq_n_f32 (oy, vy, mx[4]);
+		oz = vmlaq_n_f32 (oz, vy, mx[7]);
+		ox = vmlaq_n_f32 (ox, vz, mx[2]);
+		oy = vmlaq_n_f32 (oy, vz, mx[5]);
+		oz = vmlaq_n_f32 (oz, vz, mx[8]);
+		vst1q_f32 (x + i, ox);
+		vst1q_f32 (y + i, oy);
+		vst1q_f32 (z + i, oz);
+	}
+#endif
+	for ( ; i < count; i++)
+	{
+		float vx = x[i], vy = y[i], vz = z[i];
+		x[i] = off[0] + mx[0] * vx + mx[1] * vy + mx[2] * vz;
+		y[i] = off[1] + mx[3] * vx + mx[4] * vy + mx[5] * vz;
+		z[i] = off[2] + mx[6] * vx + mx[7] * vy + mx[8] * vz;
+	}
+}
+
+static inline int16 saturateInt16 (float value)
+{
+	if (value >= 32767)
+		return 32767;
+	if (value <= -32768)
+		return -32768;
+	return (int16) lrintf (value);
+}
+
+void pixi_mpuCorrectAxes (const MpuCorrection* correction, int16* xyz, uint count, uint stride)
+{
+	if (!correction || !xyz || stride < 3)
+	{
+		LIBPIXI_PRECONDITION_FAILURE("correction and xyz must not be NULL, stride must be at least 3");
+		return;
+	}
+
+	float x[CorrectBlock];
+	float y[CorrectBlock];
+	float z[CorrectBlock];
+	for (uint start = 0; start < count; start += CorrectBlock)
+	{
+		uint n = count - start;
+		if (n > CorrectBlock)
+			n = CorrectBlock;
+		int16* block = xyz + start*stride;
+		for (uint i = 0; i < n; i++)
+		{
+			x[i] = block[i*stride + 0];
+			y[i] = block[i*stride + 1];
+			z[i] = block[i*stride + 2];
+		}
+		correctBlock (correction, x, y, z, n);
+		for (uint i = 0; i < n; i++)
+		{
+			block[i*stride + 0] = saturateInt16 (x[i]);
+			block[i*stride + 1] = saturateInt16 (y[i]);
+			block[i*stride + 2] = saturateInt16 (z[i]);
+		}
+	}
+}
+
+void pixi_mpuCorrectMotion (const MpuCalibration* calibration, MpuMotion* motions, uint count)
+{
+	if (!calibration || !motions)
+	{
+		LIBPIXI_PRECONDITION_FAILURE("calibration and motions must not be NULL");
+		return;
+	}
+
+	const uint stride = sizeof (MpuMotion) / sizeof (int16);
+	if (calibration->sensors & MpuCalibrateAccel)
+		pixi_mpuCorrectAxes (&calibration->accel, &motions->accel.x, count, stride);
+	if (calibration->sensors & MpuCalibrateGyro)
+		pixi_mpuCorrectAxes (&calibration->gyro, &motions->gyro.x, count, stride);
+}
+
+void pixi_mpuSetCalibration (const MpuCalibration* calibration)
+{
+	calibrationInstalled = (calibration != NULL);
+	if (calibration)
+		installedCalibration = *calibration;
+}
+
+const MpuCalibration* pixi_mpuGetCalibration (void)
+{
+	return calibrationInstalled ? &installedCalibration : NULL;
+}
+
+// Persistence
+
+static MpuCorrection* getCorrection (MpuCalibration* calibration, uint index)
+{
+	MpuCorrection* corrections[] = {&calibration->accel, &calibration->gyro, &calibration->mag};
+	return corrections[index];
+}
+
+static char* trim (char* str)
+{
+	while (*str == ' ' || *str == '\t')
+		str++;
+	char* end = str + strlen (str);
+	while (end > str && (end[-1] == ' ' || end[-1] == '\t' || end[-1] == '\r'))
+		*--end = 0;
+	return str;
+}
+
+/// Parse up to @c max floats from @c str
+static uint parseFloats (const char* str, float* values, uint max)
+{
+	uint count = 0;
+	while (count < max)
+	{
+		char* end;
+		float value = strtof (str, &end);
+		if (end == str)
+			break;
+		values[count++] = value;
+		str = end;
+	}
+	return count;
+}
+
+int pixi_mpuLoadCalibration (const char* filename, MpuCalibration* calibration)
+{
+	LIBPIXI_PRECONDITION_NOT_NULL(filename);
+	LIBPIXI_PRECONDITION_NOT_NULL(calibration);
+
+	Buffer buffer;
+	int result = pixi_fileLoadContents (filename, &buffer);
+	if (result < 0)
+	{
+		LIBPIXI_ERROR(-result, "Cannot load MPU calibration file [%s]", filename);
+		return result;
+	}
+	// The contents are not terminated
+	char* text = malloc (buffer.size + 1);
+	if (!text)
+	{
+		free (buffer.memory);
+		return -ENOMEM;
+	}
+	memcpy (text, buffer.memory, buffer.size);
+	text[buffer.size] = 0;
+	free (buffer.memory);
+
+	pixi_mpuCalibrationReset (calibration);
+	int section = -1;
+	uint lineNumber = 0;
+	char* next = text;
+	while (next && result >= 0)
+	{
+		char* line = next;
+		next = strchr (line, '\n');
+		if (next)
+			*next++ = 0;
+		lineNumber++;
+		char* comment = strchr (line, '#');
+		if (comment)
+			*comment = 0;
+		line = trim (line);
+		if (!*line)
+			continue;
+
+		if (line[0] == '[')
+		{
+			char* close = strchr (line, ']');
+			if (close)
+				*close = 0;
+			section = -1;
+			for (uint i = 0; i < ARRAY_COUNT(sectionNames); i++)
+				if (0 == strcmp (line + 1, sectionNames[i]))
+					section = i;
+			if (section < 0)
+				LIBPIXI_LOG_WARN("%s:%u: ignoring unknown section [%s]", filename, lineNumber, line + 1);
+			else
+				calibration->sensors |= 1 << section;
+			continue;
+		}
+		if (section < 0)
+			continue;
+
+		char* equals = strchr (line, '=');
+		if (!equals)
+		{
+			LIBPIXI_LOG_ERROR("%s:%u: expected key = values", filename, lineNumber);
+			result = -EINVAL;
+			break;
+		}
+		*equals = 0;
+		const char* key = trim (line);
+		MpuCorrection* correction = getCorrection (calibration, section);
+		float* values = NULL;
+		uint expected = 0;
+		if (0 == strcmp (key, "matrix"))
+		{
+			values   = correction->matrix;
+			expected = ARRAY_COUNT(correction->matrix);
+		}
+		else if (0 == strcmp (key, "offset"))
+		{
+			values   = correction->offset;
+			expected = ARRAY_COUNT(correction->offset);
+		}
+		else
+		{
+			LIBPIXI_LOG_WARN("%s:%u: ignoring unknown key [%s]", filename, lineNumber, key);
+			continue;
+		}
+		float parsed[9];
+		if (parseFloats (equals + 1, parsed, expected) != expected)
+		{
+			LIBPIXI_LOG_ERROR("%s:%u: %s needs %u values", filename, lineNumber, key, expected);
+			result = -EINVAL;
+			break;
+		}
+		memcpy (values, parsed, expected * sizeof (float));
+	}
+	free (text);
+	return result < 0 ? result : 0;
+}
+
+int pixi_mpuSaveCalibration (const char* filename, const MpuCalibration* calibration)
+{
+	LIBPIXI_PRECONDITION_NOT_NULL(filename);
+	LIBPIXI_PRECONDITION_NOT_NULL(calibration);
+
+	char text[2048];
+	int len = snprintf (text, sizeof (text), "# PiXi MPU calibration: corrected = matrix * raw + offset\n");
+	for (uint i = 0; i < ARRAY_COUNT(sectionNames); i++)
+	{
+		if (!(calibration->sensors & (1 << i)))
+			continue;
+		const MpuCorrection* c = getCorrection ((MpuCalibration*) calibration, i);
+		len += snprintf (text + len, sizeof (text) - len,
+			"\n[%s]\nmatrix = %.9g %.9g %.9g  %.9g %.9g %.9g  %.9g %.9g %.9g\noffset = %.9g %.9g %.9g\n",
+			sectionNames[i],
+			c->matrix[0], c->matrix[1], c->matrix[2],
+			c->matrix[3], c->matrix[4], c->matrix[5],
+			c->matrix[6], c->matrix[7], c->matrix[8],
+			c->offset[0], c->offset[1], c->offset[2]);
+	}
+
+	int fd = pixi_open (filename, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+	if (fd < 0)
+	{
+		LIBPIXI_ERROR(-fd, "Cannot create MPU calibration file [%s]", filename);
+		return fd;
+	}
+	ssize_t result = pixi_write (fd, text, len);
+	int closed = pixi_close (fd);
+	if (result >= 0 && closed < 0)
+		result = closed;
+	return result < 0 ? (int) result : 0;
+}
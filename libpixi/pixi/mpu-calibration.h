@@ -0,0 +1,114 @@
+/*
+    pixi-tools: a set of software to interface with the Raspberry Pi
+    and PiXi-200 hardware
+    Copyright (C) 2014 Simon Cantrill
+
+    pixi-tools is free software; you can redistribute it and/or
+    modify it under the terms of the GNU Lesser General Public
+    License as published by the Free Software Foundation; either
+    version 2.1 of the License, or (at your option) any later version.
+
+    This library is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+    Lesser General Public License for more details.
+
+    You should have received a copy of the GNU Lesser General Public
+    License along with this library; if not, write to the Free Software
+    Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+*/
+#ifndef libpixi_pixi_mpu_calibration_h__included
+#define libpixi_pixi_mpu_calibration_h__included
+
+
+#include <libpixi/common.h>
+#include <libpixi/pixi/mpu.h>
+
+LIBPIXI_BEGIN_DECLS
+
+///@defgroup PiXiMpuCalibration PiXi MPU sensor calibration
+/// Estimation, storage and application of corrections for the MPU
+/// gyroscope (bias), accelerometer (offset and scale) and magnetometer
+/// (hard and soft iron). Each correction is a 3x3 matrix plus an offset
+/// applied to the raw values: corrected = matrix * raw + offset.
+///
+/// Once installed with @ref pixi_mpuSetCalibration, corrections are
+/// applied by the MPU read functions (@ref pixi_mpuReadMotion,
+/// @ref pixi_mpuReadFifo, @ref pixi_mpuReadMag etc.), so applications
+/// see corrected values. @ref pixi_mpuOpen installs the calibration in the
+/// file named by the LIBPIXI_MPU_CALIBRATION environment variable, if set.
+///@{
+
+enum MpuCalibrationSensors
+{
+	MpuCalibrateAccel = 0x01,
+	MpuCalibrateGyro  = 0x02,
+	MpuCalibrateMag   = 0x04
+};
+
+///	Correction for one 3 axis sensor, in raw units
+typedef struct MpuCorrection
+{
+	float   matrix[9];  ///< row major
+	float   offset[3];
+} MpuCorrection;
+
+typedef struct MpuCalibration
+{
+	uint            sensors; ///< MpuCalibrationSensors that have a correction
+	MpuCorrection   accel;
+	MpuCorrection   gyro;
+	MpuCorrection   mag;
+	intptr          _reserved[2];
+} MpuCalibration;
+
+///	Set @c correction to the identity (no correction).
+void pixi_mpuCorrectionReset (MpuCorrection* correction);
+
+///	Set @c calibration to have no corrections.
+void pixi_mpuCalibrationReset (MpuCalibration* calibration);
+
+///	Estimate the gyroscope bias from @c count samples taken while the
+///	sensor is stationary.
+///	@return 0 on success, -errno on error
+int pixi_mpuEstimateGyroBias (const MpuMotion* motions, uint count, MpuCorrection* correction);
+
+///	Fit an ellipsoid to @c count 3 axis samples, and compute the correction
+///	that maps it to a sphere centred on the origin. The samples should cover
+///	as many orientations as possible. For the accelerometer, use a @c radius
+///	of 1g in raw units; for the magnetometer, a @c radius of 0 keeps the
+///	ellipsoid's volume.
+///	@param xyz first sample's x value; y and z must follow
+///	@param stride distance between samples, in int16s (e.g. 3 for MpuAxes, 7 for MpuMotion)
+///	@return 0 on success, -errno on error (-EINVAL if the fit is not an ellipsoid)
+int pixi_mpuFitEllipsoid (const int16* xyz, uint count, uint stride, float radius, MpuCorrection* correction);
+
+///	Apply @c correction in place to @c count 3 axis samples.
+///	Results are rounded and saturated to int16.
+///	@param stride distance between samples, in int16s
+void pixi_mpuCorrectAxes (const MpuCorrection* correction, int16* xyz, uint count, uint stride);
+
+///	Apply the corrections in @c calibration to @c count motion samples.
+void pixi_mpuCorrectMotion (const MpuCalibration* calibration, MpuMotion* motions, uint count);
+
+///	Install @c calibration for the MPU read functions to apply.
+///	NULL removes any calibration, so raw values are returned.
+void pixi_mpuSetCalibration (const MpuCalibration* calibration);
+
+///	Get the installed calibration, or NULL if there is none.
+const MpuCalibration* pixi_mpuGetCalibration (void);
+
+///	Load @c calibration from the ini style file @c filename.
+///	Sensors missing from the file have no correction.
+///	@return 0 on success, -errno on error
+int pixi_mpuLoadCalibration (const char* filename, MpuCalibration* calibration);
+
+///	Save @c calibration to the ini style file @c filename.
+///	@return 0 on success, -errno on error
+int pixi_mpuSaveCalibration (const char* filename, const MpuCalibration* calibration);
+
+///@} defgroup
+
+LIBPIXI_END_DECLS
+
+#endif // !defined libpixi_pixi_mpu_calibration_h__included
@@ -19,25 +19,75 @@
 */
 
 #include <libpixi/pixi/mpu.h>
-#include <libpixi/pi/i2c.h>
+#include <libpixi/pixi/mpu-calibration.h>
+#include <libpixi/pi/gpio.h>
+#include <libpixi/pi/i2c-bus.h>
+#include <libpixi/util/clock.h>
 #include <libpixi/util/bits.h>
 #include <libpixi/util/file.h>
 #include <libpixi/util/log.h>
 #include <endian.h>
 #include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
 
 
 static I2cDevice mpuI2c = I2C_DEVICE_INIT;
 static I2cDevice mpuMagI2c = I2C_DEVICE_INIT;
+static uint mpuMagMode = MpuMagPowerDownMode;
+static bool mpuMag16Bit = false; ///< the magnetometer output is 16 bit (AK8963 only)
+static int  mpuMagAk8963 = -1;   ///< cached result of isAk8963
+
+static int magIsAk8963 (void);
+static bool mpuAuxMagEnabled = false;
+static uint mpuFifoEnabled = 0;   ///< MpuFifoEnableBits
+static uint mpuFifoFrameSize = 0; ///< bytes per FIFO sample
+
+/// Apply the installed calibration for @c sensors (MpuCalibrationSensors)
+/// to @c count motion samples
+static void correctMotion (MpuMotion* motions, uint count, uint sensors)
+{
+	const MpuCalibration* calibration = pixi_mpuGetCalibration();
+	if (!calibration)
+		return;
+	const uint stride = sizeof (MpuMotion) / sizeof (int16);
+	sensors &= calibration->sensors;
+	if (sensors & MpuCalibrateAccel)
+		pixi_mpuCorrectAxes (&calibration->accel, &motions->accel.x, count, stride);
+	if (sensors & MpuCalibrateGyro)
+		pixi_mpuCorrectAxes (&calibration->gyro, &motions->gyro.x, count, stride);
+}
+
+static void correctMag (MpuAxes* axes)
+{
+	const MpuCalibration* calibration = pixi_mpuGetCalibration();
+	if (calibration && (calibration->sensors & MpuCalibrateMag))
+		pixi_mpuCorrectAxes (&calibration->mag, &axes->x, 1, 3);
+}
+
+static void loadCalibration (void)
+{
+	const char* filename = getenv ("LIBPIXI_MPU_CALIBRATION");
+	if (!filename || !*filename)
+		return;
+	MpuCalibration calibration;
+	if (pixi_mpuLoadCalibration (filename, &calibration) >= 0)
+	{
+		LIBPIXI_LOG_DEBUG("Using MPU calibration from [%s]", filename);
+		pixi_mpuSetCalibration (&calibration);
+	}
+}
 
 int pixi_mpuOpen (void)
 {
 	// TODO: instead rejecting if previously open,
 	// do ref-counting of open count?
 	LIBPIXI_PRECONDITION(mpuI2c.fd < 0);
-	int result = pixi_i2cOpen2 (MpuChannel, MpuAddress, &mpuI2c);
+	int result = pixi_i2cBusOpen (MpuChannel, MpuAddress, &mpuI2c);
 	if (result < 0)
 		LIBPIXI_ERROR(-result, "Cannot open i2c channel to PiXi MPU");
+	else
+		loadCalibration();
 	return result;
 }
 
@@ -46,7 +96,8 @@ int pixi_mpuClose (void)
 	LIBPIXI_PRECONDITION(mpuI2c.fd >= 0);
 	if (mpuMagI2c.fd >= 0)
 		pixi_mpuMagClose();
-	return pixi_i2cClose (&mpuI2c);
+	mpuMagAk8963 = -1;
+	return pixi_i2cBusClose (&mpuI2c);
 }
 
 int pixi_mpuMagOpen (void)
@@ -60,7 +111,7 @@ int pixi_mpuMagOpen (void)
 	if (result < 0)
 		LIBPIXI_ERROR(-result, "Failed to enable MPU bypass mode (for magnetometer)");
 	else
-		result = pixi_i2cOpen2 (MpuChannel, MpuMagAddress, &mpuMagI2c);
+		result = pixi_i2cBusOpen (MpuChannel, MpuMagAddress, &mpuMagI2c);
 	return result;
 }
 
@@ -72,7 +123,7 @@ int pixi_mpuMagClose (void)
 	if (result < 0)
 		LIBPIXI_ERROR(-result, "Failed to disable MPU bypass mode (for magnetometer)");
 
-	return pixi_i2cClose (&mpuMagI2c);
+	return pixi_i2cBusClose (&mpuMagI2c);
 }
 
 static int readRegisters (I2cDevice* device, uint address1, void* buffer, size_t size)
@@ -84,13 +135,13 @@ static int readRegisters (I2cDevice* device, uint address1, void* buffer, size_t
 	LIBPIXI_PRECONDITION_NOT_NULL(buffer);
 
 	byte request = address1;
-	int result = pixi_i2cWriteRead (device,
+	int result = pixi_i2cBusWriteRead (device, I2cBusPriorityInput,
 		&request, sizeof (request),
 		buffer, size
 		);
 	if (result < 0)
 	{
-		LIBPIXI_ERROR(-result, "pixi_i2cWriteRead failed for MPU");
+		LIBPIXI_ERROR(-result, "pixi_i2cBusWriteRead failed for MPU");
 		return result;
 	}
 
@@ -142,16 +193,11 @@ int pixi_mpuWriteRegister (uint address, uint value)
 	LIBPIXI_PRECONDITION(address < 128);
 
 	byte buf[] = {address, value};
-	ssize_t count = pixi_write (mpuI2c.fd, buf, sizeof (buf));
-	if (count < 0)
-	{
-		LIBPIXI_ERROR(-count, "Failed to write MPU register");
-		return count;
-	}
-	else if (count == 0)
+	int result = pixi_i2cBusWriteRead (&mpuI2c, I2cBusPriorityInput, buf, sizeof (buf), NULL, 0);
+	if (result < 0)
 	{
-		LIBPIXI_LOG_ERROR("Short write of MPU register");
-		return -EIO;
+		LIBPIXI_ERROR(-result, "Failed to write MPU register");
+		return result;
 	}
 	return 0;
 }
@@ -219,7 +265,11 @@ int pixi_mpuSetAccelScale (uint scale)
 int pixi_mpuReadAccel (MpuAxes* axes)
 {
 	LIBPIXI_PRECONDITION_NOT_NULL(axes);
-	return pixi_mpuReadRegisters16 (MpuAccelXHigh, &axes->x, sizeof (*axes) / sizeof (int16));
+	int result = pixi_mpuReadRegisters16 (MpuAccelXHigh, &axes->x, sizeof (*axes) / sizeof (int16));
+	const MpuCalibration* calibration = pixi_mpuGetCalibration();
+	if (result >= 0 && calibration && (calibration->sensors & MpuCalibrateAccel))
+		pixi_mpuCorrectAxes (&calibration->accel, &axes->x, 1, 3);
+	return result;
 }
 
 int pixi_mpuGetGyroScale()
@@ -250,13 +300,20 @@ int pixi_mpuSetGyroScale (uint scale)
 int pixi_mpuReadGyro (MpuAxes* axes)
 {
 	LIBPIXI_PRECONDITION_NOT_NULL(axes);
-	return pixi_mpuReadRegisters16 (MpuGyroXHigh, &axes->x, sizeof (*axes) / sizeof (int16));
+	int result = pixi_mpuReadRegisters16 (MpuGyroXHigh, &axes->x, sizeof (*axes) / sizeof (int16));
+	const MpuCalibration* calibration = pixi_mpuGetCalibration();
+	if (result >= 0 && calibration && (calibration->sensors & MpuCalibrateGyro))
+		pixi_mpuCorrectAxes (&calibration->gyro, &axes->x, 1, 3);
+	return result;
 }
 
 int pixi_mpuReadMotion (MpuMotion* motion)
 {
 	LIBPIXI_PRECONDITION_NOT_NULL(motion);
-	return pixi_mpuReadRegisters16 (MpuAccelXHigh, &motion->accel.x, sizeof (*motion) / sizeof (int16));
+	int result = pixi_mpuReadRegisters16 (MpuAccelXHigh, &motion->accel.x, sizeof (*motion) / sizeof (int16));
+	if (result >= 0)
+		correctMotion (motion, 1, MpuCalibrateAccel | MpuCalibrateGyro);
+	return result;
 }
 
 int pixi_mpuReadMagAdjust (MpuAxes* axes)
@@ -275,38 +332,443 @@ int pixi_mpuReadMagAdjust (MpuAxes* axes)
 	return 0;
 }
 
+/// Magnetometer status and values, as read from MpuMagStatus1
+typedef struct MagData
+{
+	uint8   status1;
+	uint8   axes[6]; ///< little-endian
+	uint8   status2;
+} MagData;
+
+static void magDataToAxes (const MagData* data, MpuAxes* axes)
+{
+	axes->x = int16FromLE (&data->axes[0]);
+	axes->y = int16FromLE (&data->axes[2]);
+	axes->z = int16FromLE (&data->axes[4]);
+}
+
 int pixi_mpuReadMag (MpuAxes* axes)
 {
 	LIBPIXI_PRECONDITION_MSG(mpuMagI2c.fd >= 0, "MPU MAG must be open");
 	LIBPIXI_PRECONDITION_NOT_NULL(axes);
 
-	// write data read request to control
-	uint8 control[] = {MpuMagControl, MpuMagSingleMeasurementMode};
-	int result = pixi_i2cWriteRead (&mpuMagI2c, control, sizeof (control), NULL, 0);
+	MagData data;
+	if (mpuMagMode & (MpuMagContinuous8HzMode | MpuMagContinuous100HzMode))
+	{
+		// The registers hold the latest measurement. Reading through
+		// status 2 releases them for the next one.
+		int result = pixi_mpuMagReadRegisters (MpuMagStatus1, &data, sizeof (data));
+		if (result < 0)
+			return result;
+		magDataToAxes (&data, axes);
+		if (mpuMag16Bit)
+			correctMag (axes);
+		return 0;
+	}
+
+	// write data read request to control, using the same output
+	// width as the auxiliary reads that calibration is captured with
+	int ak8963 = magIsAk8963();
+	if (ak8963 < 0)
+		return ak8963;
+	uint8 control[] = {MpuMagControl, MpuMagSingleMeasurementMode | (ak8963 ? MpuMag16BitOutput : 0)};
+	int result = pixi_i2cBusWriteRead (&mpuMagI2c, I2cBusPriorityInput, control, sizeof (control), NULL, 0);
 	if (result < 0)
 		return result;
+	mpuMag16Bit = ak8963;
 
 	// Read status and values at the same time.
-	struct {
-		uint8 info; // alignment
-		uint8 status1;
-		MpuAxes axes;
-	} values;
 	// Data is typically ready on seventh read
 	for (int i = 0; i < 20; i++)
 	{
-		result = pixi_mpuMagReadRegisters (MpuMagStatus1, &values.status1, sizeof (values) - sizeof (values.info));
+		result = pixi_mpuMagReadRegisters (MpuMagStatus1, &data, sizeof (data) - sizeof (data.status2));
 		if (result < 0)
 			return result;
-		if (values.status1 & MpuMagDataReady)
+		if (data.status1 & MpuMagDataReady)
 		{
-			// OK, Pi is little-endian, but be explicit
-			axes->x = le16toh (values.axes.x);
-			axes->y = le16toh (values.axes.y);
-			axes->z = le16toh (values.axes.z);
+			magDataToAxes (&data, axes);
+			correctMag (axes);
 			return 0;
 		}
 	}
 	LIBPIXI_LOG_ERROR("Timed out trying to read MPU MAG values");
 	return -ETIMEDOUT;
 }
+
+/// The MPU-9150 has an AK8975 magnetometer, the MPU-9250 an AK8963.
+static int isAk8963 (void)
+{
+	int result = pixi_mpuReadRegister (MpuWhoAmI);
+	if (result < 0)
+		return result;
+	return result != MpuAddress;
+}
+
+static int magIsAk8963 (void)
+{
+	if (mpuMagAk8963 < 0)
+		mpuMagAk8963 = isAk8963();
+	return mpuMagAk8963;
+}
+
+double pixi_mpuMagMicroTeslaPerLsb (void)
+{
+	if (magIsAk8963() <= 0)
+		return 0.3;
+	return mpuMag16Bit ? 0.15 : 0.6;
+}
+
+static int magWriteControl (uint mode)
+{
+	uint8 control[] = {MpuMagControl, mode};
+	return pixi_i2cBusWriteRead (&mpuMagI2c, I2cBusPriorityInput, control, sizeof (control), NULL, 0);
+}
+
+int pixi_mpuMagSetMode (uint mode)
+{
+	LIBPIXI_PRECONDITION_MSG(mpuMagI2c.fd >= 0, "MPU MAG must be open");
+
+	uint baseMode = mode & ~MpuMag16BitOutput;
+	if (mode != baseMode || baseMode == MpuMagContinuous8HzMode || baseMode == MpuMagContinuous100HzMode)
+	{
+		int result = magIsAk8963();
+		if (result < 0)
+			return result;
+		if (!result)
+		{
+			LIBPIXI_LOG_DEBUG("Magnetometer mode 0x%02x needs an AK8963", mode);
+			return -ENOTSUP;
+		}
+	}
+	// Mode changes must go through power down
+	int result = magWriteControl (MpuMagPowerDownMode);
+	if (result >= 0 && baseMode != MpuMagPowerDownMode)
+	{
+		usleep (100);
+		result = magWriteControl (mode);
+	}
+	if (result < 0)
+	{
+		LIBPIXI_ERROR(-result, "Failed to set MPU MAG mode");
+		return result;
+	}
+	mpuMagMode  = baseMode;
+	mpuMag16Bit = (mode & MpuMag16BitOutput) != 0;
+	return 0;
+}
+
+int pixi_mpuEnableAuxMag (void)
+{
+	LIBPIXI_PRECONDITION(mpuI2c.fd >= 0);
+	LIBPIXI_PRECONDITION_MSG(mpuMagI2c.fd < 0, "MPU MAG must not be open");
+
+	int ak8963 = magIsAk8963();
+	if (ak8963 < 0)
+		return ak8963;
+
+	int result = 0;
+	uint delay = 0;
+	if (ak8963)
+	{
+		// Set continuous mode directly, then hand the bus to the MPU
+		result = pixi_mpuMagOpen();
+		if (result >= 0)
+		{
+			result = pixi_mpuMagSetMode (MpuMagContinuous100HzMode | MpuMag16BitOutput);
+			pixi_mpuMagClose();
+		}
+	}
+	else
+	{
+		// Slave 1 requests a single measurement after each read by slave 0.
+		// The AK8975 needs up to 9ms per measurement, so slow the slave
+		// accesses to at most 100Hz.
+		int divider = pixi_mpuReadRegister (MpuSampleRateDivider);
+		int config  = pixi_mpuReadRegister (MpuConfig);
+		if (divider < 0 || config < 0)
+			return divider < 0 ? divider : config;
+		uint rate = ((config & 0x07) == 0 ? 8000 : 1000) / (1 + divider);
+		delay = (rate + 99) / 100;
+		delay = delay > 32 ? 31 : delay > 0 ? delay - 1 : 0;
+		result = pixi_mpuWriteRegister (MpuI2cSlave1Address, MpuMagAddress);
+		if (result >= 0)
+			result = pixi_mpuWriteRegister (MpuI2cSlave1Register, MpuMagControl);
+		if (result >= 0)
+			result = pixi_mpuWriteRegister (MpuI2cSlave1DataOut, MpuMagSingleMeasurementMode);
+		if (result >= 0)
+			result = pixi_mpuWriteRegister (MpuI2cSlave1Control, 0x81); // enable, 1 byte
+	}
+	// Slave 0 reads status 1, the values and status 2 into EXT_SENS_DATA_00..07
+	if (result >= 0)
+		result = pixi_mpuWriteRegister (MpuI2cSlave0Address, 0x80 | MpuMagAddress); // read
+	if (result >= 0)
+		result = pixi_mpuWriteRegister (MpuI2cSlave0Register, MpuMagStatus1);
+	if (result >= 0)
+		result = pixi_mpuWriteRegister (MpuI2cSlave0Control, 0x80 | sizeof (MagData));
+	if (result >= 0)
+		result = pixi_mpuWriteRegister (MpuI2cSlave4Control, delay);
+	if (result >= 0)
+		result = pixi_mpuWriteRegister (MpuI2cMasterDelayControl, delay ? 0x83 : 0x80);
+	if (result >= 0)
+		result = pixi_mpuWriteRegister (MpuI2cMasterControl, 0x40 | 0x0D); // wait for data, 400kHz
+	if (result >= 0)
+		result = pixi_mpuWriteRegisterMasked (MpuUserControl, MpuUserI2cMasterEnable, MpuUserI2cMasterEnable);
+	if (result < 0)
+	{
+		LIBPIXI_ERROR(-result, "Failed to set up MPU auxiliary i2c master for magnetometer");
+		return result;
+	}
+	mpuAuxMagEnabled = true;
+	LIBPIXI_LOG_DEBUG("MPU auxiliary i2c master reading %s magnetometer", ak8963 ? "AK8963" : "AK8975");
+	return 0;
+}
+
+int pixi_mpuDisableAuxMag (void)
+{
+	LIBPIXI_PRECONDITION(mpuI2c.fd >= 0);
+
+	mpuAuxMagEnabled = false;
+	int result = pixi_mpuWriteRegisterMasked (MpuUserControl, 0, MpuUserI2cMasterEnable);
+	if (result >= 0)
+		result = pixi_mpuWriteRegister (MpuI2cSlave0Control, 0);
+	if (result >= 0)
+		result = pixi_mpuWriteRegister (MpuI2cSlave1Control, 0);
+	return result < 0 ? result : 0;
+}
+
+int pixi_mpuReadMotionMag (MpuMotion* motion, MpuAxes* mag)
+{
+	LIBPIXI_PRECONDITION_NOT_NULL(motion);
+	LIBPIXI_PRECONDITION_NOT_NULL(mag);
+	LIBPIXI_PRECONDITION_MSG(mpuAuxMagEnabled, "MPU auxiliary magnetometer must be enabled");
+
+	struct {
+		int16   motion[7];
+		MagData mag;
+	} data;
+	LIBPIXI_STATIC_ASSERT(sizeof (data) == 22, "accel, temp, gyro and EXT_SENS_DATA_00..07 are contiguous");
+	int result = pixi_mpuReadRegisters (MpuAccelXHigh, &data, sizeof (data));
+	if (result < 0)
+		return result;
+
+	int16* values = &motion->accel.x;
+	for (uint i = 0; i < 7; i++)
+		values[i] = be16toh (data.motion[i]);
+	magDataToAxes (&data.mag, mag);
+	correctMotion (motion, 1, MpuCalibrateAccel | MpuCalibrateGyro);
+	correctMag (mag);
+	return 0;
+}
+
+static uint fifoFrameSize (uint fifoEnable)
+{
+	uint size = 0;
+	if (fifoEnable & MpuFifoAccel) size += 6;
+	if (fifoEnable & MpuFifoTemp)  size += 2;
+	if (fifoEnable & MpuFifoGyroX) size += 2;
+	if (fifoEnable & MpuFifoGyroY) size += 2;
+	if (fifoEnable & MpuFifoGyroZ) size += 2;
+	return size;
+}
+
+/// Only the FIFO bits of MpuUserControl are changed, leaving the I2C master
+/// enabled for auxiliary magnetometer reads.
+static int resetFifo (void)
+{
+	const uint mask = MpuUserFifoEn | MpuUserFifoReset;
+	int result = pixi_mpuWriteRegisterMasked (MpuUserControl, MpuUserFifoReset, mask);
+	if (result >= 0 && mpuFifoEnabled)
+		result = pixi_mpuWriteRegisterMasked (MpuUserControl, MpuUserFifoEn, mask);
+	return result;
+}
+
+int pixi_mpuConfigureFifo (uint fifoEnable, uint sampleRateDivider, uint dlpf)
+{
+	LIBPIXI_PRECONDITION(mpuI2c.fd >= 0);
+	LIBPIXI_PRECONDITION(fifoEnable != 0);
+	LIBPIXI_PRECONDITION((fifoEnable & ~MpuFifoMotion) == 0);
+	LIBPIXI_PRECONDITION(sampleRateDivider < 256);
+	LIBPIXI_PRECONDITION(dlpf < 7);
+
+	mpuFifoEnabled = 0;
+	int result = pixi_mpuWriteRegister (MpuFifoEnable, 0);
+	if (result >= 0)
+		result = pixi_mpuWriteRegister (MpuSampleRateDivider, sampleRateDivider);
+	if (result >= 0)
+		result = pixi_mpuWriteRegisterMasked (MpuConfig, dlpf, 0x07);
+	if (result >= 0)
+		result = pixi_mpuWriteRegister (MpuFifoEnable, fifoEnable);
+	if (result < 0)
+	{
+		LIBPIXI_ERROR(-result, "Failed to configure MPU FIFO");
+		return result;
+	}
+	mpuFifoEnabled   = fifoEnable;
+	mpuFifoFrameSize = fifoFrameSize (fifoEnable);
+	LIBPIXI_LOG_DEBUG("MPU FIFO enabled=0x%02x frame-size=%u divider=%u dlpf=%u",
+		fifoEnable, mpuFifoFrameSize, sampleRateDivider, dlpf);
+	return resetFifo();
+}
+
+int pixi_mpuDisableFifo (void)
+{
+	LIBPIXI_PRECONDITION(mpuI2c.fd >= 0);
+
+	mpuFifoEnabled = 0;
+	int result = pixi_mpuWriteRegister (MpuFifoEnable, 0);
+	if (result >= 0)
+		result = pixi_mpuWriteRegisterMasked (MpuUserControl, MpuUserFifoReset, MpuUserFifoEn | MpuUserFifoReset);
+	return result;
+}
+
+int pixi_mpuReadFifoCount (void)
+{
+	int result = pixi_mpuReadRegister16 (MpuFifoCountHigh);
+	if (result < 0)
+		return result;
+	return result & 0x1fff;
+}
+
+/// Spread the big-endian values of @c count FIFO samples in @c raw out
+/// into @c motions. Works from the end, so @c raw may alias @c motions.
+static void unpackFifo (const uint8* raw, uint count, MpuMotion* motions)
+{
+	const uint frameSize = mpuFifoFrameSize;
+	for (uint i = count; i-- > 0; )
+	{
+		const uint8* in = raw + (i * frameSize);
+		int16 values[7] = {0,0,0,0,0,0,0};
+		if (mpuFifoEnabled & MpuFifoAccel)
+		{
+			values[0] = makeInt16 (in[0], in[1]);
+			values[1] = makeInt16 (in[2], in[3]);
+			values[2] = makeInt16 (in[4], in[5]);
+			in += 6;
+		}
+		for (uint v = 3; v < 7; v++)
+		{
+			static const uint8 bits[] = {MpuFifoTemp, MpuFifoGyroX, MpuFifoGyroY, MpuFifoGyroZ};
+			if (mpuFifoEnabled & bits[v-3])
+			{
+				values[v] = makeInt16 (in[0], in[1]);
+				in += 2;
+			}
+		}
+		memcpy (&motions[i], values, sizeof (values));
+	}
+}
+
+int pixi_mpuReadFifo (MpuMotion* motions, uint maxCount)
+{
+	LIBPIXI_STATIC_ASSERT(sizeof (MpuMotion) == 14, "MpuMotion must match the register layout");
+	LIBPIXI_PRECONDITION(mpuI2c.fd >= 0);
+	LIBPIXI_PRECONDITION_NOT_NULL(motions);
+	LIBPIXI_PRECONDITION_MSG(mpuFifoEnabled != 0, "MPU FIFO must be configured");
+
+	int bytes = pixi_mpuReadFifoCount();
+	if (bytes < 0)
+		return bytes;
+
+	const uint frameSize = mpuFifoFrameSize;
+	if (bytes > MpuFifoSize - (int) frameSize)
+	{
+		// The FIFO may be full, so check for overflow (and clear the flag)
+		int status = pixi_mpuReadRegister (MpuIntStatus);
+		if (status < 0)
+			return status;
+		if (status & MpuIntFifoOverflow)
+		{
+			LIBPIXI_LOG_WARN("MPU FIFO overflow, discarding %d bytes", bytes);
+			int result = resetFifo();
+			return result < 0 ? result : -EOVERFLOW;
+		}
+	}
+
+	uint count = bytes / frameSize;
+	if (count > maxCount)
+		count = maxCount;
+	if (count == 0)
+		return 0;
+
+	// Read straight into the output, then unpack in place
+	byte request = MpuFifoReadWrite;
+	uint8* raw = (uint8*) motions;
+	int result = pixi_i2cBusWriteRead (&mpuI2c, I2cBusPriorityInput, &request, sizeof (request), raw, count * frameSize);
+	if (result < 0)
+	{
+		LIBPIXI_ERROR(-result, "Failed to read MPU FIFO");
+		return result;
+	}
+	if (mpuFifoEnabled == MpuFifoMotion)
+	{
+		int16* values = (int16*) motions;
+		for (uint i = 0; i < count * 7; i++)
+			values[i] = be16toh (values[i]);
+	}
+	else
+		unpackFifo (raw, count, motions);
+
+	// Only correct sensors that are fully present in the FIFO
+	uint sensors = 0;
+	if (mpuFifoEnabled & MpuFifoAccel)
+		sensors |= MpuCalibrateAccel;
+	if ((mpuFifoEnabled & MpuFifoGyro) == MpuFifoGyro)
+		sensors |= MpuCalibrateGyro;
+	correctMotion (motions, count, sensors);
+
+	LIBPIXI_LOG_TRACE("Read %u samples from MPU FIFO (%d bytes available)", count, bytes);
+	return count;
+}
+
+int pixi_mpuEnableInterrupt (uint interrupts)
+{
+	LIBPIXI_PRECONDITION(mpuI2c.fd >= 0);
+	LIBPIXI_PRECONDITION((interrupts & ~(MpuIntDataReady | MpuIntI2cMaster | MpuIntFifoOverflow)) == 0);
+
+	// Active high, push-pull, latched, cleared by any read.
+	// Leave the bypass setting (used for the magnetometer) alone.
+	const uint mask = MpuIntCfgLevel | MpuIntCfgOpen | MpuIntCfgLatchEn | MpuIntCfgReadClear;
+	int result = pixi_mpuWriteRegisterMasked (MpuIntBypassConfig, MpuIntCfgLatchEn | MpuIntCfgReadClear, mask);
+	if (result >= 0)
+		result = pixi_mpuWriteRegister (MpuIntEnable, interrupts);
+	if (result >= 0)
+		result = pixi_mpuReadRegister (MpuIntStatus); // clear anything pending
+	if (result < 0)
+	{
+		LIBPIXI_ERROR(-result, "Failed to enable MPU interrupts");
+		return result;
+	}
+	LIBPIXI_LOG_DEBUG("MPU interrupts enabled=0x%02x", interrupts);
+	return 0;
+}
+
+int pixi_mpuOpenInterruptPin (uint pin)
+{
+	int fd = pixi_piGpioChipOpenPin (pin);
+	if (fd < 0)
+		return fd;
+	int result = pixi_piGpioSysSetPinEdge (pin, EdgeRising);
+	if (result < 0)
+	{
+		LIBPIXI_ERROR(-result, "Failed to set MPU interrupt pin edge");
+		pixi_close (fd);
+		return result;
+	}
+	return fd;
+}
+
+int pixi_mpuWaitMotion (int pinFd, int timeout, MpuMotion* motion, int64* timestampNs)
+{
+	LIBPIXI_PRECONDITION(pinFd >= 0);
+	LIBPIXI_PRECONDITION_NOT_NULL(motion);
+
+	int result = pixi_piGpioWait (pinFd, timeout);
+	if (result <= 0)
+		return result;
+	if (timestampNs)
+		*timestampNs = pixi_clockGetNs();
+
+	// Reading the data also clears the latched interrupt
+	result = pixi_mpuReadMotion (motion);
+	return result < 0 ? result : 1;
+}
@@ -36,14 +36,31 @@ enum
 	MpuChannel    = 1,
 	MpuAddress    = 0x68,
 	MpuMagAddress = 0x0C,
+	MpuFifoSize   = 1024, ///< bytes
 };
 
 enum MpuRegister
 {
+	MpuSampleRateDivider   = 0x19,
+	MpuConfig              = 0x1A, ///< bits 0-2: digital low pass filter (DLPF)
 	MpuGyroConfig          = 0x1B,
 	MpuAccelConfig         = 0x1C,
 
+	MpuFifoEnable          = 0x23,
+
+	/// Auxiliary i2c master
+	MpuI2cMasterControl    = 0x24,
+	MpuI2cSlave0Address    = 0x25,
+	MpuI2cSlave0Register   = 0x26,
+	MpuI2cSlave0Control    = 0x27,
+	MpuI2cSlave1Address    = 0x28,
+	MpuI2cSlave1Register   = 0x29,
+	MpuI2cSlave1Control    = 0x2A,
+	MpuI2cSlave4Control    = 0x34,
+
 	MpuIntBypassConfig     = 0x37,
+	MpuIntEnable           = 0x38,
+	MpuIntStatus           = 0x3A,
 
 	/// Big-endian signed 16 bit
 	MpuAccelXHigh          = 0x3B,
@@ -63,7 +80,20 @@ enum MpuRegister
 	MpuGyroZHigh,
 	MpuGyroZLow,
 
+	/// Data read by the auxiliary i2c master slaves
+	MpuExtSensData00       = 0x49,
+
+	MpuI2cSlave1DataOut    = 0x64,
+	MpuI2cMasterDelayControl = 0x67,
+
+	MpuUserControl         = 0x6a,
 	MpuPowerManagement1    = 0x6b,
+
+	/// Big-endian unsigned 16 bit
+	MpuFifoCountHigh       = 0x72,
+	MpuFifoCountLow,
+	MpuFifoReadWrite       = 0x74,
+	MpuWhoAmI              = 0x75,
 };
 
 enum MpuMagRegister
@@ -79,6 +109,7 @@ enum MpuMagRegister
 	MpuMagYHigh,
 	MpuMagZLow,
 	MpuMagZHigh,
+	MpuMagStatus2        = 0x09,
 
 	MpuMagControl        = 0x0a,
 
@@ -98,12 +129,47 @@ enum MpuIntBypass
 	MpuIntCfgLevel      = 0x80,
 };
 
+enum MpuIntBits
+{
+	MpuIntDataReady    = 0x01,
+	MpuIntI2cMaster    = 0x08,
+	MpuIntFifoOverflow = 0x10,
+};
+
+///	Values written to the FIFO at each sample, in this order
+///	(which is register order): accel, temp, gyro x/y/z, slaves.
+enum MpuFifoEnableBits
+{
+	MpuFifoSlave0  = 0x01,
+	MpuFifoSlave1  = 0x02,
+	MpuFifoSlave2  = 0x04,
+	MpuFifoAccel   = 0x08,
+	MpuFifoGyroZ   = 0x10,
+	MpuFifoGyroY   = 0x20,
+	MpuFifoGyroX   = 0x40,
+	MpuFifoTemp    = 0x80,
+	MpuFifoGyro    = MpuFifoGyroX | MpuFifoGyroY | MpuFifoGyroZ,
+	MpuFifoMotion  = MpuFifoAccel | MpuFifoTemp | MpuFifoGyro, ///< same layout as MpuMotion
+};
+
+enum MpuUserControlBits
+{
+	MpuUserSignalReset     = 0x01,
+	MpuUserI2cMasterReset  = 0x02,
+	MpuUserFifoReset       = 0x04,
+	MpuUserI2cMasterEnable = 0x20,
+	MpuUserFifoEn          = 0x40,
+};
+
 enum MpuMagOperationMode
 {
 	MpuMagPowerDownMode         = 0x00,
 	MpuMagSingleMeasurementMode = 0x01,
+	MpuMagContinuous8HzMode     = 0x02, ///< AK8963 only
+	MpuMagContinuous100HzMode   = 0x06, ///< AK8963 only
 	MpuMagSelfTestMode          = 0x08,
 	MpuMagFuseRomAccessMode     = 0x0F,
+	MpuMag16BitOutput           = 0x10, ///< AK8963 only, combine with a mode
 };
 
 enum MpuMagStatus1Bits
@@ -111,6 +177,11 @@ enum MpuMagStatus1Bits
 	MpuMagDataReady = 0x01
 };
 
+enum MpuMagStatus2Bits
+{
+	MpuMagOverflow  = 0x08
+};
+
 typedef struct MpuAxes
 {
 	int16   x;
@@ -216,6 +287,50 @@ int pixi_mpuReadGyro (MpuAxes* axes);
 ///	@return 0 on success, or negative error code
 int pixi_mpuReadMotion (MpuMotion* motion);
 
+///	Set the sample rate and digital low pass filter, then reset and
+///	enable the FIFO to collect the values selected by @c fifoEnable.
+///	@param fifoEnable combination of MpuFifoEnableBits (slaves are not supported)
+///	@param sampleRateDivider the sample rate is the gyro output rate / (1 + sampleRateDivider)
+///	@param dlpf low pass filter setting [0,6]. The gyro output rate is 8kHz for 0, otherwise 1kHz.
+///	@return 0 on success, or negative error code
+int pixi_mpuConfigureFifo (uint fifoEnable, uint sampleRateDivider, uint dlpf);
+
+///	Stop collecting values in the FIFO.
+///	@return 0 on success, or negative error code
+int pixi_mpuDisableFifo (void);
+
+///	Read the number of bytes in the FIFO.
+///	@return byte count on success, or negative error code
+int pixi_mpuReadFifoCount (void);
+
+///	Read up to @c maxCount samples from the FIFO, using one burst read.
+///	Values not enabled in the FIFO are set to zero.
+///	If the FIFO has overflowed, its contents are discarded, the FIFO is
+///	reset and -EOVERFLOW is returned; subsequent reads continue from the reset.
+///	@return number of samples read, or negative error code
+int pixi_mpuReadFifo (MpuMotion* motions, uint maxCount);
+
+///	Enable MPU interrupts on its INT pin. The pin is configured active
+///	high and latched until the next register read, so each interrupt
+///	gives one rising edge.
+///	@param interrupts combination of MpuIntBits, or 0 to disable
+///	@return 0 on success, or negative error code
+int pixi_mpuEnableInterrupt (uint interrupts);
+
+///	Prepare the Pi GPIO @c pin connected to the MPU INT pin for waiting
+///	on rising edges. Close the returned file descriptor when finished.
+///	@return file descriptor on success, or negative error code
+int pixi_mpuOpenInterruptPin (uint pin);
+
+///	Sleep until the next MPU interrupt on @c pinFd (from
+///	@ref pixi_mpuOpenInterruptPin), then read the motion values.
+///	Use with MpuIntDataReady enabled to read each sample as it's ready.
+///	@param timeout maximum time to wait (milliseconds), <0 for no timeout
+///	@param timestampNs if not NULL, receives the time of the interrupt
+///	(@ref pixi_clockGetNs)
+///	@return 1 if @c motion was read, 0 on timeout, or negative error code
+int pixi_mpuWaitMotion (int pinFd, int timeout, MpuMotion* motion, int64* timestampNs);
+
 static inline double mpuTemperatureToDegrees (int16 rawValue) {
 	return (rawValue / 340.0) + 35.0;
 }
@@ -229,10 +344,43 @@ int pixi_mpuReadMagAdjust (MpuAxes* axes);
 
 ///	Read current magnetometer values. The magnetometer must
 ///	have been opened (@ref pixi_mpuMagOpen).
-///	This reads the raw values, which must be adjusted
+///	This reads the raw values, which must be adjusted.
+///	Single measurements use 16 bit output on the AK8963, as the
+///	auxiliary reads do, so a magnetometer calibration applies to both.
+///	It isn't applied in a continuous mode without MpuMag16BitOutput.
 ///	@return 0 on success, or negative error code
 int pixi_mpuReadMag (MpuAxes* axes);
 
+///	Magnetometer sensitivity of the raw values last read, in uT per LSB
+///	(0.3 for the AK8975, 0.15 or 0.6 for 16 or 14 bit AK8963 output)
+double pixi_mpuMagMicroTeslaPerLsb (void);
+
+///	Set the magnetometer operation mode, one of MpuMagOperationMode.
+///	The continuous modes are only supported by the AK8963 (MPU-9250).
+///	In a continuous mode, @ref pixi_mpuReadMag returns the latest
+///	measurement using a single read. The magnetometer must have been
+///	opened (@ref pixi_mpuMagOpen).
+///	@return 0 on success, -ENOTSUP if the mode isn't supported, or negative error code
+int pixi_mpuMagSetMode (uint mode);
+
+///	Read the magnetometer through the MPU's auxiliary i2c master, so that
+///	it's sampled along with the motion values into the EXT_SENS_DATA
+///	registers. Measurements are taken at up to 100Hz, using continuous
+///	mode on the AK8963, or a single measurement request on each access
+///	on the AK8975. Use @ref pixi_mpuReadMotionMag to read the values.
+///	The magnetometer must not be open using @ref pixi_mpuMagOpen.
+///	@return 0 on success, or negative error code
+int pixi_mpuEnableAuxMag (void);
+
+///	Stop reading the magnetometer through the auxiliary i2c master.
+///	@return 0 on success, or negative error code
+int pixi_mpuDisableAuxMag (void);
+
+///	Read the gyroscope, accelerometer, temperature and latest magnetometer
+///	values in one burst read. Requires @ref pixi_mpuEnableAuxMag.
+///	@return 0 on success, or negative error code
+int pixi_mpuReadMotionMag (MpuMotion* motion, MpuAxes* mag);
+
 ///	Get the scale factor for a magnetometer value
 ///	@param adjustment an adjustment obtained from @ref pixi_mpuReadMagAdjust
 static inline double mpuMagGetScale (int adjustment) {
@@ -0,0 +1,486 @@
+/*
+    pixi-tools: a set of software to interface with the Raspberry Pi
+    and PiXi-200 hardware
+    Copyright (C) 2014 Simon Cantrill
+
+    pixi-tools is free software; you can redistribute it and/or
+    modify it under the terms of the GNU Lesser General Public
+    License as published by the Free Software Foundation; either
+    version 2.1 of the License, or (at your option) any later version.
+
+    This library is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+    Lesser General Public License for more details.
+
+    You should have received a copy of the GNU Lesser General Public
+    License along with this library; if not, write to the Free Software
+    Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+*/
+
+#include <libpixi/pixi/pwm-motion.h>
+#include <libpixi/util/log.h>
+#include <errno.h>
+#include <math.h>
+#include <sched.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/eventfd.h>
+#include <sys/timerfd.h>
+
+enum
+{
+	MaxDuty    = 1023,
+	AllPwmMask = (1 << PixiPwmCount) - 1
+};
+
+int pixi_pwmMotionInit (PwmMotion* motion, uint rate)
+{
+	LIBPIXI_PRECONDITION_NOT_NULL(motion);
+	LIBPIXI_PRECONDITION(rate > 0 && rate <= 1000000);
+
+	memset (motion, 0, sizeof (*motion));
+	motion->rate = rate;
+	motion->timerFd = timerfd_create (CLOCK_MONOTONIC, TFD_CLOEXEC);
+	if (motion->timerFd < 0)
+	{
+		int err = errno;
+		LIBPIXI_ERRNO_ERROR("Cannot create PWM motion timer");
+		return -err;
+	}
+	motion->doneFd = eventfd (0, EFD_CLOEXEC | EFD_NONBLOCK);
+	if (motion->doneFd < 0)
+	{
+		int err = errno;
+		LIBPIXI_ERRNO_ERROR("Cannot create PWM motion event");
+		close (motion->timerFd);
+		return -err;
+	}
+	pthread_mutex_init (&motion->mutex, NULL);
+	pthread_condattr_t attr;
+	pthread_condattr_init (&attr);
+	pthread_condattr_setclock (&attr, CLOCK_MONOTONIC);
+	pthread_cond_init (&motion->cond, &attr);
+	pthread_condattr_destroy (&attr);
+	return 0;
+}
+
+void pixi_pwmMotionFree (PwmMotion* motion)
+{
+	if (!motion)
+		return;
+	if (motion->threadStarted)
+		pixi_pwmMotionStop (motion);
+	close (motion->timerFd);
+	close (motion->doneFd);
+	pthread_cond_destroy (&motion->cond);
+	pthread_mutex_destroy (&motion->mutex);
+	memset (motion, 0, sizeof (*motion));
+	motion->timerFd = -1;
+	motion->doneFd  = -1;
+}
+
+int pixi_pwmMotionSetLimits (PwmMotion* motion, uint channel, double maxVelocity, double maxAcceleration, double maxJerk)
+{
+	LIBPIXI_PRECONDITION_NOT_NULL(motion);
+	LIBPIXI_PRECONDITION(channel < PixiPwmCount);
+	LIBPIXI_PRECONDITION(maxVelocity >= 0 && maxAcceleration >= 0 && maxJerk >= 0);
+
+	pthread_mutex_lock (&motion->mutex);
+	PwmMotionChannel* ch = &motion->channels[channel];
+	ch->maxVelocity     = maxVelocity;
+	ch->maxAcceleration = maxAcceleration;
+	ch->maxJerk         = maxJerk;
+	pthread_mutex_unlock (&motion->mutex);
+	return 0;
+}
+
+int pixi_pwmMotionSetPosition (PwmMotion* motion, uint channel, int dutyCycle)
+{
+	LIBPIXI_PRECONDITION_NOT_NULL(motion);
+	LIBPIXI_PRECONDITION(channel < PixiPwmCount);
+	LIBPIXI_PRECONDITION(dutyCycle >= -MaxDuty && dutyCycle <= MaxDuty);
+
+	pthread_mutex_lock (&motion->mutex);
+	PwmMotionChannel* ch = &motion->channels[channel];
+	ch->target       = dutyCycle;
+	ch->position     = dutyCycle;
+	ch->velocity     = 0;
+	ch->acceleration = 0;
+	ch->output       = dutyCycle; // written, and completed, on the next tick
+	motion->controlMask |= 1u << channel;
+	motion->movingMask  |= 1u << channel;
+	pthread_cond_broadcast (&motion->cond);
+	pthread_mutex_unlock (&motion->mutex);
+	return 0;
+}
+
+int pixi_pwmMotionMoveTo (PwmMotion* motion, uint mask, const int* targets)
+{
+	LIBPIXI_PRECONDITION_NOT_NULL(motion);
+	LIBPIXI_PRECONDITION_NOT_NULL(targets);
+	LIBPIXI_PRECONDITION(mask <= AllPwmMask);
+
+	for (uint c = 0; c < PixiPwmCount; c++)
+	{
+		if ((mask & (1u << c)) && (targets[c] < -MaxDuty || targets[c] > MaxDuty))
+		{
+			LIBPIXI_PRECONDITION_FAILURE("target out of range");
+			return -EINVAL;
+		}
+	}
+	pthread_mutex_lock (&motion->mutex);
+	for (uint c = 0; c < PixiPwmCount; c++)
+	{
+		if (!(mask & (1u << c)))
+			continue;
+		PwmMotionChannel* ch = &motion->channels[c];
+		ch->target = targets[c];
+	}
+	motion->controlMask |= mask;
+	motion->movingMask  |= mask;
+	pthread_cond_broadcast (&motion->cond);
+	pthread_mutex_unlock (&motion->mutex);
+	return 0;
+}
+
+int pixi_pwmMotionCancel (PwmMotion* motion, uint mask)
+{
+	LIBPIXI_PRECONDITION_NOT_NULL(motion);
+
+	pthread_mutex_lock (&motion->mutex);
+	mask &= motion->movingMask;
+	for (uint c = 0; c < PixiPwmCount; c++)
+	{
+		if (!(mask & (1u << c)))
+			continue;
+		PwmMotionChannel* ch = &motion->channels[c];
+		ch->target       = ch->position;
+		ch->velocity     = 0;
+		ch->acceleration = 0;
+	}
+	pthread_mutex_unlock (&motion->mutex);
+	return 0;
+}
+
+int pixi_pwmMotionWait (PwmMotion* motion, uint mask, int timeoutMs)
+{
+	LIBPIXI_PRECONDITION_NOT_NULL(motion);
+
+	struct timespec deadline;
+	if (timeoutMs > 0)
+	{
+		clock_gettime (CLOCK_MONOTONIC, &deadline);
+		deadline.tv_sec  += timeoutMs / 1000;
+		deadline.tv_nsec += (timeoutMs % 1000) * 1000000;
+		if (deadline.tv_nsec >= 1000000000)
+		{
+			deadline.tv_sec++;
+			deadline.tv_nsec -= 1000000000;
+		}
+	}
+	int result = 0;
+	pthread_mutex_lock (&motion->mutex);
+	while ((motion->movingMask & mask) && result == 0)
+	{
+		if (motion->error)
+			result = motion->error;
+		else if (timeoutMs == 0 || !motion->running)
+			result = -ETIMEDOUT;
+		else if (timeoutMs < 0)
+			pthread_cond_wait (&motion->cond, &motion->mutex);
+		else if (pthread_cond_timedwait (&motion->cond, &motion->mutex, &deadline) == ETIMEDOUT)
+			result = -ETIMEDOUT;
+	}
+	pthread_mutex_unlock (&motion->mutex);
+	return result;
+}
+
+int pixi_pwmMotionGetFd (const PwmMotion* motion)
+{
+	LIBPIXI_PRECONDITION_NOT_NULL(motion);
+	return motion->doneFd;
+}
+
+/// Distance covered by constant @c jerk for @c t seconds, from speed
+/// @c v and acceleration @c a
+static inline double rampDistance (double v, double a, double jerk, double t)
+{
+	return (v * t) + (a * t * t / 2) + (jerk * t * t * t / 6);
+}
+
+/// Shortest distance in which speed @c v, with acceleration @c a, can be
+/// brought to rest: the deceleration ramps up at jerk @c J to at most
+/// @c A, is held, then ramps back to 0 as the speed runs out
+static double stoppingDistance (double v, double a, double A, double J)
+{
+	if (a < 0 && v <= a * a / (2 * J))
+		return rampDistance (v, a, J, -a / J); // already braking hard enough
+
+	// The peak deceleration of a triangular profile, unless limited
+	double peak = fmin (A, sqrt ((J * v) + (a * a / 2)));
+	double t1 = (a + peak) / J;
+	double distance = rampDistance (v, a, -J, t1);
+	double v1 = v + (a * t1) - (J * t1 * t1 / 2);
+	double v2 = peak * peak / (2 * J); // speed lost by the final ramp
+	if (v1 > v2)
+		distance += ((v1 * v1) - (v2 * v2)) / (2 * peak);
+	return distance + rampDistance (v2, -peak, J, peak / J);
+}
+
+/// Step the acceleration of a jerk limited move @c error from its target.
+/// @return the velocity after @c dt seconds
+static double jerkLimitedVelocity (PwmMotionChannel* ch, double error, double dt)
+{
+	// Work in the direction of the target
+	double dir = error < 0 ? -1 : 1;
+	double v = ch->velocity * dir;
+	double a = ch->acceleration * dir;
+	double A = ch->maxAcceleration;
+	double J = ch->maxJerk;
+	double maxVelocity = ch->maxVelocity > 0 ? ch->maxVelocity : INFINITY;
+
+	// Brake once the stopping distance, allowing for this tick, reaches
+	// the target, otherwise ramp up to the maximum velocity
+	double wanted;
+	if (v > 0 && stoppingDistance (v, a, A, J) + (v * dt) >= fabs (error))
+		wanted = (a < 0 && v <= a * a / (2 * J)) ? 0 : -A;
+	else if (v > maxVelocity)
+		wanted = -A;
+	else if (a > 0 && v + (a * a / (2 * J)) >= maxVelocity)
+		wanted = 0;
+	else
+		wanted = A;
+
+	double change = J * dt;
+	a = fmax (a - change, fmin (a + change, wanted));
+	ch->acceleration = a * dir;
+	return (v + (a * dt)) * dir;
+}
+
+/// Advance @c ch by @c dt seconds.
+/// @return true when it has reached its target
+static bool stepChannel (PwmMotionChannel* ch, double dt)
+{
+	double error = ch->target - ch->position;
+	if (ch->maxVelocity <= 0 && ch->maxAcceleration <= 0)
+	{
+		ch->position = ch->target;
+		return true;
+	}
+
+	double velocity;
+	if (ch->maxAcceleration > 0 && ch->maxJerk > 0)
+		velocity = jerkLimitedVelocity (ch, error, dt);
+	else
+	{
+		// The fastest speed from which the channel can still stop at the target
+		double speed = INFINITY;
+		if (ch->maxAcceleration > 0)
+			speed = sqrt (2 * ch->maxAcceleration * fabs (error));
+		if (ch->maxVelocity > 0 && speed > ch->maxVelocity)
+			speed = ch->maxVelocity;
+		double wanted = copysign (speed, error);
+
+		velocity = wanted;
+		if (ch->maxAcceleration > 0)
+		{
+			double acceleration = (wanted - ch->velocity) / dt;
+			acceleration = fmax (-ch->maxAcceleration, fmin (ch->maxAcceleration, acceleration));
+			ch->acceleration = acceleration;
+			velocity = ch->velocity + (acceleration * dt);
+		}
+	}
+	ch->position += (ch->velocity + velocity) * dt / 2;
+	ch->velocity  = velocity;
+
+	// Done when the target is reached or passed, or close enough to
+	// round to it while crawling
+	double remaining = ch->target - ch->position;
+	bool done = (remaining * error <= 0)
+		|| (fabs (remaining) < 0.5 && fabs (velocity * dt) < 0.5);
+	if (done)
+	{
+		ch->position     = ch->target;
+		ch->velocity     = 0;
+		ch->acceleration = 0;
+	}
+	return done;
+}
+
+static inline uint16 registerValue (const PwmMotion* motion, int duty)
+{
+	if (duty >= 0)
+		return duty;
+	if (motion->reverseFlag)
+		return (-duty) | motion->reverseFlag;
+	return 0;
+}
+
+/// Restart the timer, so the next tick is a full period away
+static void armTimer (PwmMotion* motion)
+{
+	struct itimerspec spec;
+	memset (&spec, 0, sizeof (spec));
+	long period = 1000000000 / motion->rate;
+	spec.it_interval.tv_sec  = period / 1000000000;
+	spec.it_interval.tv_nsec = period % 1000000000;
+	spec.it_value = spec.it_interval;
+	timerfd_settime (motion->timerFd, 0, &spec, NULL);
+}
+
+/// Stop the timer, so it doesn't keep expiring while there is no motion
+static void disarmTimer (PwmMotion* motion)
+{
+	struct itimerspec spec;
+	memset (&spec, 0, sizeof (spec));
+	timerfd_settime (motion->timerFd, 0, &spec, NULL);
+}
+
+static void* motionThread (void* arg)
+{
+	PwmMotion* motion = (PwmMotion*) arg;
+	const double period = 1.0 / motion->rate;
+	bool idle = true;
+
+	pthread_mutex_lock (&motion->mutex);
+	while (motion->running)
+	{
+		if (!motion->movingMask)
+		{
+			// Nothing to do, so don't tick until there is
+			if (!idle)
+				disarmTimer (motion);
+			idle = true;
+			pthread_cond_wait (&motion->cond, &motion->mutex);
+			continue;
+		}
+		if (idle)
+		{
+			armTimer (motion);
+			idle = false;
+		}
+		pthread_mutex_unlock (&motion->mutex);
+
+		uint64 expirations = 0;
+		ssize_t count = read (motion->timerFd, &expirations, sizeof (expirations));
+
+		pthread_mutex_lock (&motion->mutex);
+		if (count != sizeof (expirations) || expirations == 0)
+			continue;
+		motion->ticks += expirations;
+		motion->missedTicks += expirations - 1;
+		if (expirations > motion->rate)
+			expirations = motion->rate; // don't spend long catching up
+
+		// Write every controlled channel, not just the changed ones, so
+		// the highest is always written last (e.g. the rover's controller
+		// latches on PWM 7)
+		uint16 values[PixiPwmCount];
+		uint writeMask = motion->controlMask;
+		uint doneMask  = 0;
+		for (uint c = 0; c < PixiPwmCount; c++)
+		{
+			if (!(writeMask & (1u << c)))
+				continue;
+			PwmMotionChannel* ch = &motion->channels[c];
+			if (motion->movingMask & (1u << c))
+			{
+				bool done = false;
+				for (uint64 i = 0; i < expirations && !done; i++)
+					done = stepChannel (ch, period);
+				if (done)
+					doneMask |= 1u << c;
+				ch->output = lround (ch->position);
+			}
+			values[c] = registerValue (motion, ch->output);
+		}
+		pthread_mutex_unlock (&motion->mutex);
+
+		int result = writeMask ? pixi_pwmWriteChannels (writeMask, values) : 0;
+
+		pthread_mutex_lock (&motion->mutex);
+		if (result < 0)
+		{
+			LIBPIXI_ERROR(-result, "PWM motion stopped");
+			motion->error   = result;
+			motion->running = false;
+			pthread_cond_broadcast (&motion->cond);
+			break;
+		}
+		if (doneMask)
+		{
+			// A move made since this tick started may have reset a target
+			for (uint c = 0; c < PixiPwmCount; c++)
+			{
+				const PwmMotionChannel* ch = &motion->channels[c];
+				if ((doneMask & (1u << c)) && ch->position != ch->target)
+					doneMask &= ~(1u << c);
+			}
+			motion->movingMask &= ~doneMask;
+			uint64 one = 1;
+			if (write (motion->doneFd, &one, sizeof (one)) < 0)
+				LIBPIXI_ERRNO_ERROR("Cannot signal PWM motion completion");
+			pthread_cond_broadcast (&motion->cond);
+		}
+	}
+	pthread_mutex_unlock (&motion->mutex);
+	return NULL;
+}
+
+int pixi_pwmMotionStart (PwmMotion* motion)
+{
+	LIBPIXI_PRECONDITION_NOT_NULL(motion);
+	LIBPIXI_PRECONDITION(!motion->threadStarted);
+
+	motion->running = true;
+	motion->error   = 0;
+	int result = EPERM;
+	if (motion->priority > 0)
+	{
+		pthread_attr_t attr;
+		struct sched_param param;
+		memset (&param, 0, sizeof (param));
+		param.sched_priority = motion->priority;
+		pthread_attr_init (&attr);
+		pthread_attr_setinheritsched (&attr, PTHREAD_EXPLICIT_SCHED);
+		pthread_attr_setschedpolicy (&attr, SCHED_FIFO);
+		pthread_attr_setschedparam (&attr, &param);
+		result = pthread_create (&motion->thread, &attr, motionThread, motion);
+		pthread_attr_destroy (&attr);
+		if (result != 0)
+			LIBPIXI_ERROR_WARN(result, "Cannot start real-time PWM motion thread, using normal scheduling");
+	}
+	if (result != 0)
+		result = pthread_create (&motion->thread, NULL, motionThread, motion);
+	if (result != 0)
+	{
+		motion->running = false;
+		LIBPIXI_ERROR(result, "Cannot start PWM motion thread");
+		return -result;
+	}
+	motion->threadStarted = true;
+	LIBPIXI_LOG_DEBUG("Started PWM motion at %u ticks/s", motion->rate);
+	return 0;
+}
+
+int pixi_pwmMotionStop (PwmMotion* motion)
+{
+	LIBPIXI_PRECONDITION_NOT_NULL(motion);
+
+	pthread_mutex_lock (&motion->mutex);
+	motion->running = false;
+	pthread_cond_broadcast (&motion->cond);
+	pthread_mutex_unlock (&motion->mutex);
+	// The thread clears running itself on a write error, so join it
+	// whenever it was started
+	if (!motion->threadStarted)
+		return motion->error;
+	pthread_join (motion->thread, NULL);
+	motion->threadStarted = false;
+	LIBPIXI_LOG_DEBUG("Stopped PWM motion after %llu ticks (%llu missed)",
+		(unsigned long long) motion->ticks, (unsigned long long) motion->missedTicks);
+	return motion->error;
+}
@@ -0,0 +1,133 @@
+/*
+    pixi-tools: a set of software to interface with the Raspberry Pi
+    and PiXi-200 hardware
+    Copyright (C) 2014 Simon Cantrill
+
+    pixi-tools is free software; you can redistribute it and/or
+    modify it under the terms of the GNU Lesser General Public
+    License as published by the Free Software Foundation; either
+    version 2.1 of the License, or (at your option) any later version.
+
+    This library is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+    Lesser General Public License for more details.
+
+    You should have received a copy of the GNU Lesser General Public
+    License along with this library; if not, write to the Free Software
+    Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+*/
+
+#ifndef libpixi_pixi_pwm_motion_h__included
+#define libpixi_pixi_pwm_motion_h__included
+
+
+#include <libpixi/common.h>
+#include <libpixi/pixi/pwm.h>
+#include <pthread.h>
+
+LIBPIXI_BEGIN_DECLS
+
+///@defgroup PiXiPwmMotion PiXi PWM motion profiles
+/// Ramps PWM duty cycles towards their targets from a background thread,
+/// limiting the rate of change (velocity), its acceleration and its jerk,
+/// so motors don't see sudden steps. A timerfd drives a fixed tick rate,
+/// and all the channels it controls are written with one
+/// @ref pixi_pwmWriteChannels per tick, highest PWM last, so the PiXi
+/// must be open while the engine is running.
+/// Moves don't block: use @ref pixi_pwmMotionWait, or poll the file
+/// descriptor from @ref pixi_pwmMotionGetFd, to learn when they complete.
+///@{
+
+enum
+{
+	PwmMotionDefaultRate = 500 ///< ticks per second
+};
+
+///	Motion limits and state of a single PWM channel. Duty cycles are
+///	signed; see @ref PwmMotion::reverseFlag.
+typedef struct PwmMotionChannel
+{
+	double  maxVelocity;     ///< duty change per second, 0 for no limit
+	double  maxAcceleration; ///< duty change per second^2, 0 for no limit
+	double  maxJerk;         ///< duty change per second^3, 0 for no limit
+	double  target;          ///< internal
+	double  position;        ///< internal
+	double  velocity;        ///< internal
+	double  acceleration;    ///< internal
+	int     output;          ///< internal: last duty cycle written
+} PwmMotionChannel;
+
+typedef struct PwmMotion
+{
+	uint             rate;        ///< ticks per second
+	int              priority;    ///< SCHED_FIFO priority of the tick thread, 0 for normal scheduling
+	uint16           reverseFlag; ///< ORed into the register value of a negative duty cycle (e.g. 0x8000 for the rover motor controllers); if 0, negative duty cycles are written as 0
+	PwmMotionChannel channels[PixiPwmCount]; ///< internal: use @ref pixi_pwmMotionSetLimits
+	uint             controlMask; ///< internal: channels written by the engine
+	uint             movingMask;  ///< internal: channels not yet at their target
+	uint64           ticks;       ///< internal
+	uint64           missedTicks; ///< internal
+	int              timerFd;     ///< internal
+	int              doneFd;      ///< internal
+	bool             running;     ///< internal
+	bool             threadStarted; ///< internal: the thread exists and must be joined
+	int              error;       ///< internal: write error that stopped the engine
+	pthread_t        thread;      ///< internal
+	pthread_mutex_t  mutex;       ///< internal
+	pthread_cond_t   cond;        ///< internal
+	intptr           _reserved[2];
+} PwmMotion;
+
+///	Initialise @c motion to tick @c rate times per second.
+///	@return 0 on success, -errno on error
+int pixi_pwmMotionInit (PwmMotion* motion, uint rate);
+
+///	Release resources held by @c motion, stopping it if needed.
+void pixi_pwmMotionFree (PwmMotion* motion);
+
+///	Set the limits of PWM @c channel. Each limit is in duty cycle
+///	units ([0,1023]) per second, per second^2 and per second^3; 0 means unlimited.
+///	@return 0 on success, -errno on error
+int pixi_pwmMotionSetLimits (PwmMotion* motion, uint channel, double maxVelocity, double maxAcceleration, double maxJerk);
+
+///	Set the current duty cycle of @c channel without ramping, e.g. to
+///	match the state of the hardware before the first move.
+///	@return 0 on success, -errno on error
+int pixi_pwmMotionSetPosition (PwmMotion* motion, uint channel, int dutyCycle);
+
+///	Start moving the PWMs selected by @c mask (bit n selects PWM n)
+///	towards new duty cycles, replacing any move in progress.
+///	@param targets PixiPwmCount signed duty cycles [-1023,1023], indexed by PWM
+///	@return 0 on success, -errno on error
+int pixi_pwmMotionMoveTo (PwmMotion* motion, uint mask, const int* targets);
+
+///	Cancel the moves of the PWMs selected by @c mask. They are held at
+///	their current duty cycle.
+///	@return 0 on success, -errno on error
+int pixi_pwmMotionCancel (PwmMotion* motion, uint mask);
+
+///	Wait for up to @c timeoutMs milliseconds (-1 to wait indefinitely,
+///	0 to just check) for the moves of the PWMs in @c mask to complete.
+///	@return 0 if complete, -ETIMEDOUT if not, or -errno on error
+int pixi_pwmMotionWait (PwmMotion* motion, uint mask, int timeoutMs);
+
+///	Get a file descriptor that becomes readable when moves complete,
+///	for use with poll/select. Read 8 bytes from it to reset it.
+int pixi_pwmMotionGetFd (const PwmMotion* motion);
+
+///	Start the tick thread. A SCHED_FIFO thread is used if
+///	@c motion->priority is set and permitted, otherwise a normal thread.
+///	@return 0 on success, -errno on error
+int pixi_pwmMotionStart (PwmMotion* motion);
+
+///	Stop the tick thread, leaving the PWMs at their current duty cycles.
+///	@return 0 on success, -errno on error, including a PWM write error
+///	that stopped the engine early
+int pixi_pwmMotionStop (PwmMotion* motion);
+
+///@} defgroup
+
+LIBPIXI_END_DECLS
+
+#endif // !defined libpixi_pixi_pwm_motion_h__included
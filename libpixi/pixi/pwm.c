@@ -38,3 +38,35 @@ int pixi_pwmWritePinPercent (uint pwm, double dutyCycle)
 	uint cycle = dutyCycle * 1023.0;
 	return pixi_pwmWritePin (pwm, cycle);
 }
+
+static int writeRegisters (uint firstRegister, uint mask, const uint16* values)
+{
+	LIBPIXI_PRECONDITION_NOT_NULL(values);
+	LIBPIXI_PRECONDITION(mask < (1u << PixiPwmCount));
+
+	RegisterOp ops[PixiPwmCount];
+	memset (ops, 0, sizeof (ops));
+	uint count = 0;
+	for (uint pwm = 0; pwm < PixiPwmCount; pwm++)
+	{
+		if (!(mask & (1u << pwm)))
+			continue;
+		ops[count].address  = firstRegister + pwm;
+		ops[count].function = PixiSpiEnableWrite16;
+		ops[count].value    = values[pwm];
+		count++;
+	}
+	if (count == 0)
+		return 0;
+	return pixi_multiRegisterOp (ops, count);
+}
+
+int pixi_pwmWriteChannels (uint mask, const uint16* values)
+{
+	return writeRegisters (Pixi_PWM0_control, mask, values);
+}
+
+int pixi_pwmWriteConfigs (uint mask, const uint16* values)
+{
+	return writeRegisters (Pixi_PWM0_config, mask, values);
+}
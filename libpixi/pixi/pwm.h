@@ -21,6 +21,22 @@ int pixi_pwmWritePin (uint pwm, uint dutyCycle);
 ///	@return 0 on success, -errno on error
 int pixi_pwmWritePinPercent (uint pwm, double dutyCycle);
 
+enum
+{
+	PixiPwmCount = 8
+};
+
+///	Write the control registers of the PWMs selected by @c mask (bit n
+///	selects PWM n) in a single SPI message. The registers are written in
+///	ascending PWM order, so the highest selected PWM is always written last.
+///	@param values PixiPwmCount values, indexed by PWM; unselected entries are ignored
+///	@return 0 on success, -errno on error
+int pixi_pwmWriteChannels (uint mask, const uint16* values);
+
+///	As @ref pixi_pwmWriteChannels, but for the PWM config registers.
+///	@return 0 on success, -errno on error
+int pixi_pwmWriteConfigs (uint mask, const uint16* values);
+
 ///@} defgroup
 
 LIBPIXI_END_DECLS
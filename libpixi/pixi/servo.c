@@ -0,0 +1,131 @@
+/*
+    pixi-tools: a set of software to interface with the Raspberry Pi
+    and PiXi-200 hardware
+    Copyright (C) 2014 Simon Cantrill
+
+    pixi-tools is free software; you can redistribute it and/or
+    modify it under the terms of the GNU Lesser General Public
+    License as published by the Free Software Foundation; either
+    version 2.1 of the License, or (at your option) any later version.
+
+    This library is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+    Lesser General Public License for more details.
+
+    You should have received a copy of the GNU Lesser General Public
+    License along with this library; if not, write to the Free Software
+    Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+*/
+
+#include <libpixi/pixi/servo.h>
+#include <libpixi/pixi/pwm-motion.h>
+#include <libpixi/util/log.h>
+#include <errno.h>
+#include <math.h>
+#include <string.h>
+
+enum
+{
+	MaxPwmValue = 1023 ///< PWM value of a 100% duty cycle
+};
+
+void pixi_servoInit (ServoSet* servos)
+{
+	if (!servos)
+	{
+		LIBPIXI_PRECONDITION_FAILURE("servos is NULL");
+		return;
+	}
+	memset (servos, 0, sizeof (*servos));
+}
+
+int pixi_servoConfigure (ServoSet* servos, uint channel, uint minPulseUs, uint maxPulseUs, uint periodUs)
+{
+	LIBPIXI_PRECONDITION_NOT_NULL(servos);
+	LIBPIXI_PRECONDITION(channel < PixiPwmCount);
+	LIBPIXI_PRECONDITION(periodUs > 0);
+	LIBPIXI_PRECONDITION(minPulseUs <= periodUs && maxPulseUs <= periodUs);
+
+	// minPulseUs > maxPulseUs is allowed, for a servo mounted in reverse
+	uint16* values = servos->values[channel];
+	for (uint angle = 0; angle <= ServoMaxAngle; angle++)
+	{
+		double pulseUs = minPulseUs + (((double) maxPulseUs - minPulseUs) * angle / ServoMaxAngle);
+		values[angle] = (uint16) ((pulseUs * MaxPwmValue / periodUs) + 0.5);
+	}
+	servos->mask |= 1u << channel;
+	LIBPIXI_LOG_DEBUG("Servo on PWM %u: %u..%u counts", channel, values[0], values[ServoMaxAngle]);
+	return 0;
+}
+
+int pixi_servoConfigureDefault (ServoSet* servos, uint channel)
+{
+	return pixi_servoConfigure (servos, channel, ServoDefaultMinPulseUs, ServoDefaultMaxPulseUs, ServoDefaultPeriodUs);
+}
+
+int pixi_servoAngleToValue (const ServoSet* servos, uint channel, uint angle)
+{
+	LIBPIXI_PRECONDITION_NOT_NULL(servos);
+	LIBPIXI_PRECONDITION(channel < PixiPwmCount);
+	LIBPIXI_PRECONDITION(servos->mask & (1u << channel));
+	LIBPIXI_PRECONDITION(angle <= ServoMaxAngle);
+
+	return servos->values[channel][angle];
+}
+
+int pixi_servoSetMotion (ServoSet* servos, PwmMotion* motion, double maxDegreesPerSecond, double maxDegreesPerSecond2)
+{
+	LIBPIXI_PRECONDITION_NOT_NULL(servos);
+	LIBPIXI_PRECONDITION(!motion || maxDegreesPerSecond > 0);
+	LIBPIXI_PRECONDITION(maxDegreesPerSecond2 >= 0);
+
+	servos->motion = motion;
+	if (!motion)
+		return 0;
+	for (uint c = 0; c < PixiPwmCount; c++)
+	{
+		if (!(servos->mask & (1u << c)))
+			continue;
+		// The engine works in PWM values, so scale by this servo's values per degree
+		const uint16* values = servos->values[c];
+		double perDegree = fabs ((double) values[ServoMaxAngle] - values[0]) / ServoMaxAngle;
+		int result = pixi_pwmMotionSetLimits (motion, c, maxDegreesPerSecond * perDegree, maxDegreesPerSecond2 * perDegree, 0);
+		if (result < 0)
+			return result;
+	}
+	return 0;
+}
+
+int pixi_servoMove (const ServoSet* servos, uint mask, const uint16* angles)
+{
+	LIBPIXI_PRECONDITION_NOT_NULL(servos);
+	LIBPIXI_PRECONDITION_NOT_NULL(angles);
+	LIBPIXI_PRECONDITION((mask & servos->mask) == mask);
+
+	uint16 values[PixiPwmCount];
+	int targets[PixiPwmCount];
+	for (uint c = 0; c < PixiPwmCount; c++)
+	{
+		if (!(mask & (1u << c)))
+			continue;
+		uint angle = angles[c] <= ServoMaxAngle ? angles[c] : ServoMaxAngle;
+		values[c]  = servos->values[c][angle];
+		targets[c] = values[c];
+	}
+	PwmMotion* motion = servos->motion;
+	if (motion)
+	{
+		// Other threads may change the mask; SetPosition takes the lock itself
+		pthread_mutex_lock (&motion->mutex);
+		uint controlMask = motion->controlMask;
+		pthread_mutex_unlock (&motion->mutex);
+		for (uint c = 0; c < PixiPwmCount; c++)
+		{
+			if ((mask & (1u << c)) && !(controlMask & (1u << c)))
+				pixi_pwmMotionSetPosition (motion, c, targets[c]);
+		}
+		return pixi_pwmMotionMoveTo (motion, mask, targets);
+	}
+	return pixi_pwmWriteChannels (mask, values);
+}
@@ -0,0 +1,92 @@
+/*
+    pixi-tools: a set of software to interface with the Raspberry Pi
+    and PiXi-200 hardware
+    Copyright (C) 2014 Simon Cantrill
+
+    pixi-tools is free software; you can redistribute it and/or
+    modify it under the terms of the GNU Lesser General Public
+    License as published by the Free Software Foundation; either
+    version 2.1 of the License, or (at your option) any later version.
+
+    This library is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+    Lesser General Public License for more details.
+
+    You should have received a copy of the GNU Lesser General Public
+    License along with this library; if not, write to the Free Software
+    Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+*/
+
+#ifndef libpixi_pixi_servo_h__included
+#define libpixi_pixi_servo_h__included
+
+
+#include <libpixi/common.h>
+#include <libpixi/pixi/pwm.h>
+
+LIBPIXI_BEGIN_DECLS
+
+struct PwmMotion;
+
+///@defgroup PiXiServo PiXi servo outputs
+/// Drives hobby servos from the PiXi PWMs. Each channel is calibrated
+/// with its pulse widths, from which a table of PWM register values per
+/// degree is built, so a move is just a table lookup per servo plus one
+/// @ref pixi_pwmWriteChannels. One degree is finer than the PWM
+/// resolution (about 1.8 degrees per count for a 20ms period).
+///@{
+
+enum
+{
+	ServoMaxAngle          = 180,  ///< angles are whole degrees [0,ServoMaxAngle]
+	ServoDefaultMinPulseUs = 500,  ///< pulse width at 0 degrees
+	ServoDefaultMaxPulseUs = 2500, ///< pulse width at ServoMaxAngle degrees
+	ServoDefaultPeriodUs   = 20000 ///< PWM period
+};
+
+typedef struct ServoSet
+{
+	uint    mask;       ///< internal: calibrated channels
+	uint16  values[PixiPwmCount][ServoMaxAngle + 1]; ///< internal: PWM value per degree
+	struct PwmMotion* motion; ///< internal: see @ref pixi_servoSetMotion
+	intptr  _reserved[2];
+} ServoSet;
+
+///	Initialise @c servos with no calibrated channels.
+void pixi_servoInit (ServoSet* servos);
+
+///	Calibrate PWM @c channel as a servo, whose pulse is @c minPulseUs
+///	microseconds wide at 0 degrees and @c maxPulseUs at ServoMaxAngle,
+///	with a PWM period of @c periodUs, and build its lookup table.
+///	@return 0 on success, -errno on error
+int pixi_servoConfigure (ServoSet* servos, uint channel, uint minPulseUs, uint maxPulseUs, uint periodUs);
+
+///	Calibrate PWM @c channel with the default pulse widths and period.
+///	@return 0 on success, -errno on error
+int pixi_servoConfigureDefault (ServoSet* servos, uint channel);
+
+///	Get the PWM register value for @c angle degrees on @c channel.
+///	@return the value, or -errno on error
+int pixi_servoAngleToValue (const ServoSet* servos, uint channel, uint angle);
+
+///	Slew limit the servos through @c motion (which must be running) at up
+///	to @c maxDegreesPerSecond, with the given acceleration (0 for none).
+///	Moves then return straight away; use @ref pixi_pwmMotionWait to wait
+///	for them. The first move of each servo jumps straight to its angle,
+///	since the starting position is unknown.
+///	Pass a NULL @c motion to write moves directly again.
+///	@return 0 on success, -errno on error
+int pixi_servoSetMotion (ServoSet* servos, struct PwmMotion* motion, double maxDegreesPerSecond, double maxDegreesPerSecond2);
+
+///	Move the servos selected by @c mask (bit n selects PWM n) to new
+///	angles, all in a single SPI message.
+///	@param angles PixiPwmCount angles in degrees, indexed by PWM
+///	@return 0 on success, -errno on error
+int pixi_servoMove (const ServoSet* servos, uint mask, const uint16* angles);
+
+///@} defgroup
+
+LIBPIXI_END_DECLS
+
+#endif // !defined libpixi_pixi_servo_h__included
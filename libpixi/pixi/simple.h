@@ -122,6 +122,11 @@ static inline int pwmWritePinPercent (uint pin, double dutyCycle) {
 	return pixi_pwmWritePinPercent (pin, dutyCycle);
 }
 
+///	Wrapper for @ref pixi_pwmWriteChannels
+static inline int pwmWriteChannels (uint mask, const uint16* values) {
+	return pixi_pwmWriteChannels (mask, values);
+}
+
 ///	Wrapper for @ref pixi_adcRead
 static inline int adcRead (uint adcChannel) {
 	return pixi_adcRead (adcChannel);
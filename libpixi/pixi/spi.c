@@ -23,26 +23,48 @@
 #include <linux/spi/spidev.h>
 #include <string.h>
 #include <sys/ioctl.h>
+#include "../private.h"
 
 static SpiDevice pixiSpi = SPI_DEVICE_INIT;
+static uint pixiOpenCount = 0;
+static bool pixiHeld = false;
 
 int pixi_openPixi (void)
 {
-	// TODO: instead rejecting if previously open,
-	// do ref-counting of open count?
-	LIBPIXI_PRECONDITION(pixiSpi.fd < 0);
-	int result = pixi_spiOpen (PixiSpiChannel, PixiSpiSpeed, &pixiSpi);
-	if (result < 0)
-		LIBPIXI_ERROR(-result, "Cannot open SPI channel to pixi");
-	return result;
+	if (pixiOpenCount == 0)
+	{
+		int result = pixi_spiOpen (PixiSpiChannel, PixiSpiSpeed, &pixiSpi);
+		if (result < 0)
+		{
+			LIBPIXI_ERROR(-result, "Cannot open SPI channel to pixi");
+			return result;
+		}
+		if (pixi_devicesHeld)
+		{
+			pixiHeld = true;
+			pixiOpenCount++;
+		}
+	}
+	pixiOpenCount++;
+	return 0;
 }
 
 int pixi_closePixi (void)
 {
-	LIBPIXI_PRECONDITION(pixiSpi.fd >= 0);
+	LIBPIXI_PRECONDITION(pixiOpenCount > 0);
+	if (--pixiOpenCount > 0)
+		return 0;
 	return pixi_spiClose (&pixiSpi);
 }
 
+void pixi_pixiReleaseHold (void)
+{
+	if (!pixiHeld)
+		return;
+	pixiHeld = false;
+	pixi_closePixi();
+}
+
 static int readWriteValue16 (uint function, uint address, uint16 value)
 {
 	uint8_t buffer[4] = {
@@ -60,14 +82,14 @@ static int readWriteValue16 (uint function, uint address, uint16 value)
 int pixi_registerRead (uint address)
 {
 	int result = readWriteValue16 (PixiSpiEnableRead16, address, 0);
-	LIBPIXI_LOG_DEBUG("pixi_registerRead address=0x%02x result=%d", address, result);
+	LIBPIXI_LOG_DEFERRED_DEBUG("pixi_registerRead address=0x%02x result=%d", address, result);
 	return result;
 }
 
 int pixi_registerWrite (uint address, ushort value)
 {
 	int result = readWriteValue16 (PixiSpiEnableWrite16, address, value);
-	LIBPIXI_LOG_DEBUG("pixi_registerWrite address=0x%02x value=0x%04x result=%d", address, value, result);
+	LIBPIXI_LOG_DEFERRED_DEBUG("pixi_registerWrite address=0x%02x value=0x%04x result=%d", address, value, result);
 	return result;
 }
 
@@ -84,6 +106,11 @@ int pixi_registerWriteMasked (uint address, ushort value, ushort mask)
 }
 
 int pixi_multiRegisterOp (RegisterOp* operations, uint opCount)
+{
+	return pixi_multiRegisterOpPaced (operations, NULL, opCount);
+}
+
+int pixi_multiRegisterOpPaced (RegisterOp* operations, const uint16* delayUsecs, uint opCount)
 {
 	LIBPIXI_PRECONDITION(pixiSpi.fd >= 0);
 	LIBPIXI_PRECONDITION_NOT_NULL(operations);
@@ -100,10 +127,12 @@ int pixi_multiRegisterOp (RegisterOp* operations, uint opCount)
 		transfers[i].len           = 4;
 		transfers[i].speed_hz      = pixiSpi.speed;
 		transfers[i].delay_usecs   = pixiSpi.delay;
+		if (delayUsecs && delayUsecs[i] > pixiSpi.delay)
+			transfers[i].delay_usecs = delayUsecs[i];
 		transfers[i].bits_per_word = pixiSpi.bitsPerWord;
 		transfers[i].cs_change     = 1;
 	}
-	LIBPIXI_LOG_TRACE("pixi_multiRegisterOp of fd=%d, count=%u", pixiSpi.fd, opCount);
+	LIBPIXI_LOG_DEFERRED_TRACE("pixi_multiRegisterOp of fd=%d, count=%u", pixiSpi.fd, opCount);
 	int result = ioctl (pixiSpi.fd, SPI_IOC_MESSAGE(opCount), &transfers);
 	if (result < 0)
 	{
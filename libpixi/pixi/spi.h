@@ -44,11 +44,13 @@ enum
 };
 
 ///	Open the Pi SPI channel to the pixi. When finished,
-///	call pixi_closePixi().
+///	call pixi_closePixi(). Opens are counted, so the channel
+///	can be opened again while it is open.
 ///	@return 0 on success, or -errno on error
 int pixi_openPixi (void);
 
-///	Close the Pi SPI channel to the pixi.
+///	Close the Pi SPI channel to the pixi, once each open has been
+///	matched by a close (see also @ref pixi_holdDevices).
 ///	@return 0 on success, or -errno on error
 int pixi_closePixi (void);
 
@@ -79,6 +81,12 @@ typedef struct RegisterOp
 ///	@return 0 on success, or -errno on error
 int pixi_multiRegisterOp (RegisterOp* operations, uint opCount);
 
+///	As @ref pixi_multiRegisterOp, but wait for @c delayUsecs[i] microseconds
+///	after operation @c i, before starting the next. For devices behind the
+///	PiXi that need time to execute each write, e.g. the LCD panel.
+///	@return 0 on success, or -errno on error
+int pixi_multiRegisterOpPaced (RegisterOp* operations, const uint16* delayUsecs, uint opCount);
+
 ///@} defgroup
 
 LIBPIXI_END_DECLS
@@ -20,6 +20,13 @@
 
 #include <libpixi/pixi/uart.h>
 #include <libpixi/pixi/simple.h>
+#include <libpixi/pi/gpio.h>
+#include <libpixi/util/file.h>
+#include <poll.h>
+#include <string.h>
+#include <sys/eventfd.h>
+#include <time.h>
+#include <unistd.h>
 
 enum
 {
@@ -71,24 +78,94 @@ int pixi_uartSetBaudRate (Uart* uart)
 	return setControlReg (uart, control & ~DivisorLatchAccess);
 }
 
+static uint fifoTriggerBits (uint level)
+{
+	switch (level)
+	{
+	case 1:  return RxFifoTriggerLevel1Byte;
+	case 4:  return RxFifoTriggerLevel4Byte;
+	case 8:  return RxFifoTriggerLevel8Byte;
+	case 14: return RxFifoTriggerLevel14Byte;
+	}
+	return -1;
+}
+
+/// Enable and clear the FIFOs. The receive data interrupt is enabled only
+/// so that InterruptIdReg reports when the trigger level is reached; it's
+/// polled by pixi_uartProcess.
+static void resetFifos (Uart* uart)
+{
+	setUartReg (uart, FifoControlReg, fifoTriggerBits (uart->fifoTrigger) | EnableFifos | RxFifoReset | TxFifoReset);
+	setUartReg (uart, InterruptEnableReg, EnableRxDataInterrupt);
+	uart->status      = EmptyTxHoldingReg | EmptyTxReg;
+	uart->interruptId = NoInterruptPending;
+}
+
+int pixi_uartSetFifoTrigger (Uart* uart, uint level)
+{
+	LIBPIXI_PRECONDITION_NOT_NULL(uart);
+	LIBPIXI_PRECONDITION(fifoTriggerBits (level) != (uint) -1);
+
+	uart->fifoTrigger = level;
+	int result = setUartReg (uart, FifoControlReg, fifoTriggerBits (level) | EnableFifos);
+	if (result < 0)
+		LIBPIXI_ERROR(-result, "Failed to set FIFO trigger level of UART 0x%02x", uart->address);
+	return result < 0 ? result : 0;
+}
+
+static int initUart (Uart* uart, uint address, uint baudRate, uint bufferSize)
+{
+	uart->address     = address;
+	uart->baudRate    = baudRate;
+	uart->status      = -1;
+	uart->prevStatus  = -1;
+	uart->operations  = 0;
+	uart->softErrors  = 0;
+	uart->fifoTrigger = 8;
+	uart->interruptId = NoInterruptPending;
+	uart->rxCount     = 0;
+	uart->txCount     = 0;
+	int result = pixi_ioBufferInit (&uart->txBuf, bufferSize);
+	if (result >= 0)
+	{
+		result = pixi_ioBufferInit (&uart->rxBuf, bufferSize);
+		if (result < 0)
+			pixi_ioBufferFree (&uart->txBuf);
+	}
+	if (result < 0)
+		LIBPIXI_ERROR(-result, "Failed to allocate buffers for UART at address 0x%02x", address);
+	return result;
+}
+
+void pixi_uartClose (Uart* uart)
+{
+	if (!uart)
+		return;
+	pixi_ioBufferFree (&uart->txBuf);
+	pixi_ioBufferFree (&uart->rxBuf);
+}
+
 int pixi_uartOpen (Uart* uart, uint address, uint baudRate)
+{
+	return pixi_uartOpen2 (uart, address, baudRate, IoBufferDefaultSize);
+}
+
+int pixi_uartOpen2 (Uart* uart, uint address, uint baudRate, uint bufferSize)
 {
 	LIBPIXI_PRECONDITION_NOT_NULL(uart);
-	uart->address    = address;
-	uart->baudRate   = baudRate;
-	uart->status     = -1;
-	uart->prevStatus = -1;
-	uart->operations = 0;
-	uart->softErrors = 0;
-	ioInit (&uart->txBuf);
-	ioInit (&uart->rxBuf);
-	int result = pixi_uartSetBaudRate (uart);
+	int result = initUart (uart, address, baudRate, bufferSize);
+	if (result < 0)
+		return result;
+	result = pixi_uartSetBaudRate (uart);
 	if (result < 0)
+	{
 		LIBPIXI_ERROR(-result, "Failed to set baud rate of UART at address 0x%02x", address);
+		pixi_uartClose (uart);
+		return result;
+	}
 
-	setUartReg (uart, FifoControlReg, RxFifoTriggerLevel1Byte | EnableFifos | RxFifoReset | TxFifoReset);
+	resetFifos (uart);
 	setUartReg (uart, LineControlReg, WordLength8);
-	setUartReg (uart, InterruptEnableReg, 0); // disable interrupts
 
 	return result;
 }
@@ -96,14 +173,9 @@ int pixi_uartOpen (Uart* uart, uint address, uint baudRate)
 int pixi_uartDebugOpen (Uart* uart, uint address, uint baudRate)
 {
 	LIBPIXI_PRECONDITION_NOT_NULL(uart);
-	uart->address    = address;
-	uart->baudRate   = baudRate;
-	uart->status     = -1;
-	uart->prevStatus = -1;
-	uart->operations = 0;
-	uart->softErrors = 0;
-	ioInit (&uart->txBuf);
-	ioInit (&uart->rxBuf);
+	int init = initUart (uart, address, baudRate, IoBufferDefaultSize);
+	if (init < 0)
+		return init;
 
 	uint result = 0;
 	LIBPIXI_LOG_INFO("Testing UART at address 0x%02x", uart->address);
@@ -135,9 +207,8 @@ int pixi_uartDebugOpen (Uart* uart, uint address, uint baudRate)
 		LIBPIXI_LOG_WARN("With divisor latch access disabled, same values from baud-rate registers");
 	}
 
-	setUartReg (uart, FifoControlReg, RxFifoTriggerLevel1Byte | EnableFifos | RxFifoReset | TxFifoReset);
+	resetFifos (uart);
 	setUartReg (uart, LineControlReg, WordLength8);
-	setUartReg (uart, InterruptEnableReg, 0); // disable interrupts
 	return result;
 }
 
@@ -154,83 +225,369 @@ static void checkErrors (const Uart* uart)
 	}
 }
 
+/// Number of receive FIFO bytes that may be read without checking the
+/// status first. The FIFO only empties when read, so whatever the last
+/// status showed is still there.
+static uint knownRxBytes (const Uart* uart)
+{
+	if ((uart->interruptId & (NoInterruptPending | InterruptIdMask)) == RxDataAvailableId)
+		return uart->fifoTrigger;
+	if (uart->status & DataReady)
+		return 1;
+	return 0;
+}
+
 int pixi_uartProcess (Uart* uarts, uint count)
 {
-	// Read all of the status registers
-	RegisterOp ops[count];
-	for (uint i = 0; i < count; i++)
-	{
-		ops[i].address = uarts[i].address + LineStatusReg;
-		ops[i].function = PixiSpiEnableRead16;
-	}
-	int result = pixi_multiRegisterOp (ops, count);
-	if (result < 0)
-	{
-		LIBPIXI_ERROR(-result, "Failed to read UART(s) status");
-		return result;
-	}
-	int operations = 0;
-	// Check the status bits and prepare for data read/write
-	RegisterOp data[count*2];
+	LIBPIXI_PRECONDITION_NOT_NULL(uarts);
+	LIBPIXI_PRECONDITION(count > 0 && count <= PixiUartCount);
+
+	// Per uart: receive reads (some checked by a preceding status read),
+	// transmit writes, then the interrupt id and line status
+	enum { MaxOpsPerUart = (2 * UartFifoDepth) + UartFifoDepth + 2 };
+	RegisterOp ops[count * MaxOpsPerUart];
+	uint first[count];
 	uint op = 0;
 	for (uint i = 0; i < count; i++)
 	{
 		Uart* ut = &uarts[i];
-		uint status = ops[i].value;
-		ut->prevStatus = ut->status;
-		ut->status     = status;
+		first[i] = op;
 		ut->operations = 0;
-		checkErrors (ut);
-		if ((status & DataReady) && ioSize (&ut->rxBuf) < (IoBufferSize - 1))
+		ut->softErrors = 0;
+		ut->rxCount    = 0;
+		ut->txCount    = 0;
+
+		uint space = ioSpace (&ut->rxBuf);
+		uint known = knownRxBytes (ut);
+		// More may have arrived since the status was read, up to a full
+		// FIFO; read the rest with a status check before each
+		uint checked = 0;
+		if (known > 0)
+			checked = UartFifoDepth - known;
+		if (known > space)
+			known = space;
+		if (checked > space - known)
+			checked = space - known;
+		if ((ut->status & DataReady) && space == 0)
+			ut->softErrors |= OverrunError;
+		for (uint k = 0; k < known; k++)
 		{
-//			LIBPIXI_LOG_DEBUG("Preparing to read a byte");
-			data[op].address  = ut->address + RxFifo;
-			data[op].function = PixiSpiEnableRead16;
+			ops[op].address  = ut->address + RxFifo;
+			ops[op].function = PixiSpiEnableRead16;
+			ops[op].userData = DataReady;
+			op++;
+		}
+		for (uint k = 0; k < checked; k++)
+		{
+			ops[op].address  = ut->address + LineStatusReg;
+			ops[op].function = PixiSpiEnableRead16;
+			ops[op].userData = LineStatusReg;
+			op++;
+			ops[op].address  = ut->address + RxFifo;
+			ops[op].function = PixiSpiEnableRead16;
+			ops[op].userData = ErrorInRxFifo; // valid if the preceding status has DataReady
 			op++;
-			ut->operations |= DataReady;
 		}
-		if (status & EmptyTxHoldingReg)
+
+		// With FIFOs enabled, EmptyTxHoldingReg means the whole FIFO is empty
+		if (ut->status & EmptyTxHoldingReg)
 		{
-			int value = ioPop (&ut->txBuf);
-			if (value >= 0)
+			byte tx[UartFifoDepth];
+			uint size = ioRead (&ut->txBuf, tx, sizeof (tx));
+			for (uint k = 0; k < size; k++)
 			{
-//				LIBPIXI_LOG_DEBUG("Writing byte 0x%02x", value);
-				data[op].address  = ut->address + TxFifo;
-				data[op].function = PixiSpiEnableWrite16;
-				data[op].value    = value;
+				ops[op].address  = ut->address + TxFifo;
+				ops[op].function = PixiSpiEnableWrite16;
+				ops[op].value    = tx[k];
+				ops[op].userData = EmptyTxHoldingReg;
 				op++;
-				ut->operations |= EmptyTxHoldingReg;
 			}
+			ut->txCount = size;
 		}
-		LIBPIXI_LOG_TRACE("Uart 0x%02x status=0x%02x operations=0x%02x", ut->address, status, ut->operations);
-		operations |= ut->operations;
+
+		ops[op].address  = ut->address + InterruptIdReg;
+		ops[op].function = PixiSpiEnableRead16;
+		ops[op].userData = InterruptIdReg;
+		op++;
+		ops[op].address  = ut->address + LineStatusReg;
+		ops[op].function = PixiSpiEnableRead16;
+		ops[op].userData = LineStatusReg;
+		op++;
 	}
-	if (op == 0)
-		return 0; // nothing to do
-	result = pixi_multiRegisterOp (data, count);
+
+	int result = pixi_multiRegisterOp (ops, op);
 	if (result < 0)
 	{
-		LIBPIXI_ERROR(-result, "Failed to read/write UART FIFO(s)");
+		LIBPIXI_ERROR(-result, "Failed to service UART FIFO(s)");
 		return result;
 	}
-	// Handle data reads
-	op = 0;
+
+	int operations = 0;
 	for (uint i = 0; i < count; i++)
 	{
 		Uart* ut = &uarts[i];
-		ut->softErrors = 0;
-		if (ut->operations & DataReady)
+		uint end = (i + 1 < count) ? first[i + 1] : op;
+		uint checkStatus = 0;
+		for (uint k = first[i]; k < end - 2; k++)
 		{
-			result = ioPush (&ut->rxBuf, data[op].value);
-			if (result < 0)
+			byte value = ops[k].value;
+			switch (ops[k].userData)
 			{
-				LIBPIXI_LOG_ERROR("Overflow in software buffer for UART 0x02%x", ut->address);
-				ut->softErrors |= OverrunError;
+			case LineStatusReg:
+				checkStatus = value;
+				break;
+			case ErrorInRxFifo:
+				if (!(checkStatus & DataReady))
+					break;
+				// fall through
+			case DataReady:
+				ioPush (&ut->rxBuf, value); // space was checked above
+				ut->rxCount++;
+				break;
 			}
-			op++;
 		}
-		if (ut->operations & EmptyTxHoldingReg)
-			op++;
+		ut->prevStatus  = ut->status;
+		ut->interruptId = ops[end - 2].value;
+		ut->status      = ops[end - 1].value;
+		checkErrors (ut);
+		if (ut->rxCount)
+			ut->operations |= DataReady;
+		if (ut->txCount)
+			ut->operations |= EmptyTxHoldingReg;
+		LIBPIXI_LOG_TRACE("Uart 0x%02x status=0x%02x iir=0x%02x rx=%u tx=%u",
+			ut->address, ut->status, ut->interruptId, ut->rxCount, ut->txCount);
+		operations |= ut->operations;
+	}
+	return operations;
+}
+
+
+/// Polling intervals are based on the fastest uart, 10 bits per character
+static void updateIntervals (UartService* service)
+{
+	uint baudRate = 1;
+	uint trigger  = UartFifoDepth;
+	for (uint i = 0; i < service->count; i++)
+	{
+		const Uart* ut = &service->uarts[i];
+		if (ut->baudRate > baudRate)
+			baudRate = ut->baudRate;
+		if (ut->fifoTrigger < trigger)
+			trigger = ut->fifoTrigger;
+	}
+	const int64 charNs = (int64) 10 * 1000000000 / baudRate;
+	service->minIntervalNs = trigger * charNs;
+	service->maxIntervalNs = UartFifoDepth * charNs;
+	if (service->intervalNs > service->maxIntervalNs)
+		service->intervalNs = service->maxIntervalNs;
+}
+
+int pixi_uartServiceInit (UartService* service, Uart* uarts, uint count, int interruptPin)
+{
+	LIBPIXI_PRECONDITION_NOT_NULL(service);
+	LIBPIXI_PRECONDITION_NOT_NULL(uarts);
+	LIBPIXI_PRECONDITION(count > 0 && count <= PixiUartCount);
+
+	memset (service, 0, sizeof (*service));
+	service->uarts  = uarts;
+	service->count  = count;
+	service->pinFd  = -1;
+	service->wakeFd = eventfd (0, EFD_NONBLOCK | EFD_CLOEXEC);
+	if (service->wakeFd < 0)
+	{
+		int err = errno;
+		LIBPIXI_ERRNO_ERROR("eventfd failed for UART service");
+		return -err;
+	}
+
+	updateIntervals (service);
+	service->intervalNs = service->maxIntervalNs;
+
+	if (interruptPin >= 0)
+	{
+		int fd = pixi_piGpioChipOpenPin (interruptPin);
+		int result = fd;
+		if (fd >= 0)
+			result = pixi_piGpioSysSetPinEdge (interruptPin, EdgeRising);
+		if (result < 0)
+		{
+			LIBPIXI_ERROR_WARN(-result, "Cannot use GPIO %d for UART interrupts, polling instead", interruptPin);
+			if (fd >= 0)
+				pixi_close (fd);
+		}
+		else
+		{
+			service->pinFd = fd;
+			for (uint i = 0; i < count; i++)
+				setUartReg (&uarts[i], InterruptEnableReg, EnableRxDataInterrupt | EnableLineStatusInterrupt);
+		}
+	}
+	LIBPIXI_LOG_DEBUG("UART service: %s, intervals %lld-%lldus",
+		service->pinFd >= 0 ? "interrupt driven" : "polling",
+		(long long) service->minIntervalNs / 1000, (long long) service->maxIntervalNs / 1000);
+	return 0;
+}
+
+void pixi_uartServiceClose (UartService* service)
+{
+	if (!service)
+		return;
+	if (service->pinFd >= 0)
+	{
+		for (uint i = 0; i < service->count; i++)
+			setUartReg (&service->uarts[i], InterruptEnableReg, EnableRxDataInterrupt);
+		pixi_close (service->pinFd);
+	}
+	if (service->wakeFd >= 0)
+		pixi_close (service->wakeFd);
+	service->pinFd  = -1;
+	service->wakeFd = -1;
+}
+
+void pixi_uartServiceWake (UartService* service)
+{
+	uint64 one = 1;
+	if (write (service->wakeFd, &one, sizeof (one)) < 0 && errno != EAGAIN)
+		LIBPIXI_ERRNO_ERROR("Failed to wake UART service");
+}
+
+/// Enable the transmit empty interrupt only for uarts with data to send,
+/// as it stays asserted while the FIFO is empty
+static void updateTxInterrupts (UartService* service)
+{
+	for (uint i = 0; i < service->count; i++)
+	{
+		Uart* ut = &service->uarts[i];
+		uint bit = 1 << i;
+		bool wanted = !ioIsEmpty (&ut->txBuf);
+		if (wanted == !!(service->txInterrupts & bit))
+			continue;
+		uint enable = EnableRxDataInterrupt | EnableLineStatusInterrupt;
+		if (wanted)
+			enable |= EnableTxEmptyInterrupt;
+		setUartReg (ut, InterruptEnableReg, enable);
+		service->txInterrupts ^= bit;
+	}
+}
+
+/// Whether a uart has a full batch of work, so the next cycle should
+/// happen straight away. A few received bytes are left for the next
+/// interval, so the FIFO can fill up and be read in one transfer.
+static bool needsService (const UartService* service)
+{
+	for (uint i = 0; i < service->count; i++)
+	{
+		const Uart* ut = &service->uarts[i];
+		if ((ut->status & EmptyTxHoldingReg) && !ioIsEmpty (&ut->txBuf))
+			return true;
+		if (ut->status & ErrorInRxFifo)
+			return true;
+		if (knownRxBytes (ut) >= ut->fifoTrigger && ioSpace (&ut->rxBuf))
+			return true;
+	}
+	return false;
+}
+
+static int waitForService (UartService* service)
+{
+	struct pollfd fds[2] = {
+		{.fd = service->wakeFd, .events = POLLIN, .revents = 0},
+		{.fd = service->pinFd,  .events = POLLPRI, .revents = 0}
+	};
+	uint fdCount = 1;
+	int64 timeoutNs = service->intervalNs;
+	if (service->pinFd >= 0)
+	{
+		updateTxInterrupts (service);
+		fdCount = 2;
+		// The interrupt is an edge: a safety net in case one is missed
+		timeoutNs = 100 * 1000000;
+	}
+	struct timespec timeout = {
+		.tv_sec  = timeoutNs / 1000000000,
+		.tv_nsec = timeoutNs % 1000000000
+	};
+	int result = ppoll (fds, fdCount, &timeout, NULL);
+	if (result < 0)
+	{
+		if (errno == EINTR)
+			return 0;
+		int err = errno;
+		LIBPIXI_ERRNO_ERROR("ppoll failed in UART service");
+		return -err;
+	}
+	if (fds[0].revents & POLLIN)
+	{
+		uint64 count;
+		if (read (service->wakeFd, &count, sizeof (count)) < 0 && errno != EAGAIN)
+			LIBPIXI_ERRNO_ERROR("Failed to clear UART service wake");
+	}
+	if (fdCount > 1 && (fds[1].revents & (POLLPRI | POLLERR)))
+	{
+		char value;
+		if (pread (service->pinFd, &value, 1, 0) < 0)
+			LIBPIXI_ERRNO_ERROR("Failed to read UART interrupt GPIO");
+	}
+	return 0;
+}
+
+int pixi_uartServiceSetBaudRate (UartService* service, uint index, uint baudRate)
+{
+	LIBPIXI_PRECONDITION_NOT_NULL(service);
+	LIBPIXI_PRECONDITION(index < service->count);
+	LIBPIXI_PRECONDITION(baudRate > 0 && pixi_uartGetBaudDivisor (baudRate) > 0);
+
+	__atomic_store_n (&service->newBaudRates[index], baudRate, __ATOMIC_RELEASE);
+	pixi_uartServiceWake (service);
+	return 0;
+}
+
+static void applyBaudRates (UartService* service)
+{
+	bool changed = false;
+	for (uint i = 0; i < service->count; i++)
+	{
+		uint baudRate = __atomic_exchange_n (&service->newBaudRates[i], 0, __ATOMIC_ACQUIRE);
+		if (baudRate == 0 || baudRate == service->uarts[i].baudRate)
+			continue;
+		service->uarts[i].baudRate = baudRate;
+		pixi_uartSetBaudRate (&service->uarts[i]);
+		changed = true;
+	}
+	if (changed)
+		updateIntervals (service);
+}
+
+int pixi_uartServiceCycle (UartService* service)
+{
+	LIBPIXI_PRECONDITION_NOT_NULL(service);
+	LIBPIXI_PRECONDITION(service->wakeFd >= 0);
+
+	applyBaudRates (service);
+
+	if (!needsService (service))
+	{
+		int result = waitForService (service);
+		if (result < 0)
+			return result;
+	}
+	int operations = pixi_uartProcess (service->uarts, service->count);
+	if (operations < 0)
+		return operations;
+	service->cycles++;
+
+	// Poll quickly while data is moving, backing off when idle
+	bool received = false;
+	for (uint i = 0; i < service->count; i++)
+		if (service->uarts[i].rxCount || (service->uarts[i].status & DataReady))
+			received = true;
+	if (received)
+		service->intervalNs = service->minIntervalNs;
+	else
+	{
+		service->intervalNs *= 2;
+		if (service->intervalNs > service->maxIntervalNs)
+			service->intervalNs = service->maxIntervalNs;
 	}
 	return operations;
 }
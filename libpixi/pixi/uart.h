@@ -22,6 +22,7 @@
 #define libpixi_pixi_uart_h__included
 
 
+#include <libpixi/util/io-buffer.h>
 #include <libpixi/util/log.h>
 
 LIBPIXI_BEGIN_DECLS
@@ -59,6 +60,33 @@ enum FifoControlBits
 	RxFifoTriggerLevel14Byte = 3<<6,
 };
 
+/// InterruptEnableReg values
+enum InterruptEnableBits
+{
+	EnableRxDataInterrupt      = 1<<0,
+	EnableTxEmptyInterrupt     = 1<<1,
+	EnableLineStatusInterrupt  = 1<<2,
+	EnableModemStatusInterrupt = 1<<3
+};
+
+/// InterruptIdReg values
+enum InterruptIdBits
+{
+	NoInterruptPending = 1<<0,
+	InterruptIdMask    = 7<<1,
+	RxDataAvailableId  = 2<<1, ///< receive FIFO has reached its trigger level
+	CharacterTimeoutId = 6<<1  ///< receive FIFO has data, but below the trigger level
+};
+
+enum
+{
+	UartFifoDepth = 16,
+
+	PixiUartCount    = 4,
+	PixiUartAddress  = 0x80, ///< register address of the first PiXi UART
+	PixiUartSpacing  = 0x08  ///< register address spacing of the PiXi UARTs
+};
+
 /// LineControlReg values
 enum LineControlBits
 {
@@ -87,114 +115,6 @@ enum LineStatusBits
 	ErrorInRxFifo     = 1<<7
 };
 
-enum
-{
-	IoBufferSize = 4096,
-	IoBufferMask = IoBufferSize - 1
-};
-
-///	A lock-free queue buffer.
-///	Note that the effective capacity is one less than IoBufferSize
-///	because writePos==readPos means size==0, not size=IoBufferSize.
-typedef struct IoBuffer
-{
-	byte  buffer[IoBufferSize];
-	/*volatile*/ uint  writePos;
-	/*volatile*/ uint  readPos;
-} IoBuffer;
-
-static inline void ioInit (IoBuffer* buf)
-{
-	buf->writePos = 0;
-	buf->readPos = 0;
-}
-
-static inline bool ioIsEmpty (IoBuffer* buf)
-{
-	return (buf->readPos == buf->writePos);
-}
-
-///	Return size of data in buffer
-static inline uint ioSize (IoBuffer* buf)
-{
-	uint readPos  = buf->readPos;
-	uint writePos = buf->writePos;
-	uint avail = writePos - readPos;
-	if (writePos < readPos)
-		avail += IoBufferSize;
-	return avail;
-}
-
-///	Return size of data in buffer that's available in
-///	in a single contiguous chunk
-static inline uint ioContiguousSize (IoBuffer* buf)
-{
-	uint readPos  = buf->readPos;
-	uint writePos = buf->writePos;
-	if (writePos > readPos)
-		return writePos - readPos;
-	return IoBufferSize - readPos;
-}
-
-///	Push a single byte to the buffer. Return 0 if successful,
-///	or a negative error value if out of space.
-static inline int ioPush (IoBuffer* buf, byte value)
-{
-	uint readPos      = buf->readPos;
-	uint writePos     = buf->writePos;
-	uint nextWritePos = (writePos + 1) % IoBufferSize;
-	LIBPIXI_PRECONDITION(nextWritePos < IoBufferSize);
-//	LIBPIXI_LOG_TRACE("push readPos=0x%02x, writePos=0x%02x nextWritePos=0x%02x", readPos, writePos, nextWritePos);
-	if (nextWritePos == readPos)
-		return -ENOBUFS;
-
-	buf->buffer[writePos] = value;
-	buf->writePos = nextWritePos;
-	return 0;
-}
-
-///	Pop a single byte from the buffer. Return the value if successful,
-///	or a negative error code if no data is available.
-static inline int ioPop (IoBuffer* buf)
-{
-	uint readPos = buf->readPos;
-	if (readPos == buf->writePos)
-		return -ENODATA;
-	byte value = buf->buffer[readPos];
-	readPos = (readPos + 1) & IoBufferMask;
-	buf->readPos = readPos;
-	return value;
-}
-
-static inline uint ioWrite (IoBuffer* buf, const void* data, uint size)
-{
-	// TODO: rewrite in optimal fashion
-	uint i;
-	const byte* bytes = (byte*) data;
-	for (i = 0; i < size; i++)
-	{
-		int result = ioPush (buf, bytes[i]);
-		if (result < 0)
-			return i;
-	}
-	return size;
-}
-
-static inline uint ioRead  (IoBuffer* buf, void* data, uint size)
-{
-	// TODO: rewrite in optimal fashion
-	uint i;
-	byte* bytes = (byte*) data;
-	for (i = 0; i < size; i++)
-	{
-		int value = ioPop (buf);
-		if (value < 0)
-			return i;
-		bytes[i] = value;
-	}
-	return size;
-}
-
 typedef struct Uart
 {
 	uint8     address;
@@ -203,20 +123,88 @@ typedef struct Uart
 	uint      prevStatus;
 	uint      operations; ///< LineStatusBits that were use in operation
 	uint      softErrors; ///< Bitmap of software errors, such as OverrunError;
+	uint      fifoTrigger;  ///< receive FIFO trigger level, in bytes
+	uint      interruptId;  ///< last InterruptIdReg value
+	uint      rxCount;      ///< bytes received by the last pixi_uartProcess
+	uint      txCount;      ///< bytes sent by the last pixi_uartProcess
 	IoBuffer  txBuf;
 	IoBuffer  rxBuf;
 	intptr    _reserved[4];
 } Uart;
 
-///	Open a UART at the given address, set the baud-rate and clear buffers.
+///	Open a UART at the given address, set the baud-rate and allocate
+///	buffers of IoBufferDefaultSize. When finished, call @ref pixi_uartClose.
 int pixi_uartOpen (Uart* uart, uint address, uint baudRate);
 
+///	As @ref pixi_uartOpen, with transmit and receive buffers of at least
+///	@c bufferSize bytes (rounded up to a power of two).
+int pixi_uartOpen2 (Uart* uart, uint address, uint baudRate, uint bufferSize);
+
+///	Free the buffers of a UART opened with @ref pixi_uartOpen or @ref pixi_uartDebugOpen.
+void pixi_uartClose (Uart* uart);
+
 ///	Open a UART at the given address, set the baud-rate and clear buffers.
 int pixi_uartDebugOpen (Uart* uart, uint address, uint baudRate);
 
-///	Get the status of @c count uarts, processing data read/write as requird.
+///	Set the receive FIFO trigger level of @c uart to 1, 4, 8 or 14 bytes
+///	(the default is 8). When the FIFO reaches the level, @ref pixi_uartProcess
+///	reads that many bytes without checking the status of each. Lower levels
+///	reduce latency, higher levels move more bytes per SPI message.
+///	@return 0 on success, -errno on error
+int pixi_uartSetFifoTrigger (Uart* uart, uint level);
+
+///	Service @c count uarts in one SPI message: fill each transmit FIFO
+///	from @c txBuf, drain each receive FIFO into @c rxBuf, then read the
+///	line status, which decides what the next call does. Call repeatedly.
+///	@return the union of the LineStatusBits in each uart's @c operations,
+///	or -errno on error
 int pixi_uartProcess (Uart* uarts, uint count);
 
+///	Service loop state for a set of uarts, see @ref pixi_uartServiceInit.
+typedef struct UartService
+{
+	Uart*   uarts;
+	uint    count;
+	int     pinFd;          ///< Pi GPIO carrying the PiXi UART interrupt, or -1 when polling
+	int     wakeFd;         ///< internal: eventfd signalled by pixi_uartServiceWake
+	int64   minIntervalNs;  ///< polling interval while busy: time to receive the trigger level
+	int64   maxIntervalNs;  ///< polling interval while idle: time to fill the receive FIFO
+	int64   intervalNs;     ///< current polling interval
+	uint    txInterrupts;   ///< internal: bitmap of uarts with the transmit interrupt enabled
+	uint    newBaudRates[PixiUartCount]; ///< internal: see pixi_uartServiceSetBaudRate
+	uint64  cycles;         ///< number of pixi_uartProcess calls
+	intptr  _reserved[2];
+} UartService;
+
+///	Prepare to service @c count opened uarts with @ref pixi_uartServiceCycle.
+///	If the PiXi UART interrupt is wired to a Pi GPIO, pass its number as
+///	@c interruptPin, and cycles wait for it; otherwise pass -1, and cycles
+///	poll at an interval scaled to the fastest baud rate and recent activity,
+///	from the time to receive the FIFO trigger level (while data is moving)
+///	up to the time to fill the FIFO (while idle). When finished, call
+///	@ref pixi_uartServiceClose.
+///	@return 0 on success, -errno on error
+int pixi_uartServiceInit (UartService* service, Uart* uarts, uint count, int interruptPin);
+
+///	Release the resources of @c service (but not its uarts).
+void pixi_uartServiceClose (UartService* service);
+
+///	Wait until the uarts need attention, then process them
+///	(see @ref pixi_uartProcess). Call in a loop.
+///	@return the union of the uarts' @c operations, or -errno on error
+int pixi_uartServiceCycle (UartService* service);
+
+///	Wake a waiting @ref pixi_uartServiceCycle, e.g. after adding data to a
+///	uart's @c txBuf or removing it from a full @c rxBuf. May be called from
+///	any thread.
+void pixi_uartServiceWake (UartService* service);
+
+///	Change the baud rate of uart @c index of @c service. The change is made
+///	by the next @ref pixi_uartServiceCycle, so that it doesn't interfere with
+///	processing. May be called from any thread.
+///	@return 0 on success, -errno on error
+int pixi_uartServiceSetBaudRate (UartService* service, uint index, uint baudRate);
+
 uint pixi_uartGetBaudDivisor (uint baudRate);
 
 int pixi_uartSetBaudRate (Uart* uart);
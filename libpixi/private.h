@@ -25,9 +25,42 @@
 #include <libpixi/common.h>
 #include <libpixi/version.h>
 #include <libpixi/pixi/gpio.h>
+#include <libpixi/util/log.h>
+#include <stdarg.h>
 
 void pixi_logInit (void);
 
+///	Set by @ref pixi_holdDevices: a device's first open takes an extra
+///	reference, dropped by the module's ReleaseHold function (libpixi.c)
+extern bool pixi_devicesHeld;
+void pixi_pixiReleaseHold (void);   // pixi/spi.c
+void pixi_adcReleaseHold (void);    // pixi/adc.c
+void pixi_i2cBusReleaseHold (void); // pi/i2c-bus.c
+
+struct timeval;
+
+enum
+{
+	LogNoError = -1 ///< errnum of an entry without an error suffix
+};
+
+///	Write a formatted entry to stderr and the log file (log.c)
+void pixi_logWriteEntry (LogLevel level, const char* file, int line, const char* text, const char* errorStr, const struct timeval* time, bool flush);
+
+///	Flush the log file, and fsync it if @c sync and it has been written (log.c)
+void pixi_logFlushFile (bool sync);
+
+///	Queue an entry for the asynchronous log writer (log-async.c)
+///	@return false if the writer isn't running, so the entry must be written directly
+bool pixi_logAsyncVPrintf (const LogContext* context, int errnum, const char* format, va_list args);
+
+///	Queue a deferred entry for the asynchronous log writer (log-async.c)
+///	@return false if the writer isn't running, so the entry must be written directly
+bool pixi_logAsyncDeferred (const LogFormat* format, const int* args);
+
+///	atexit handler for the writer started by LIBPIXI_LOG_ASYNC (log-async.c)
+void pixi_logAsyncStopAtExit (void);
+
 ///	Initialise GPIO library. Finds the board revision
 ///	and sets up the pin map.
 int pixi_piGpioInit (void);
@@ -32,13 +32,15 @@ extern LogLevel pixi_appLogLevel;
 
 /// Check if logging at @a level should be output.
 static inline bool pixi_isAppLogLevelEnabled (LogLevel level) {
-	return level >= pixi_appLogLevel;
+	return LIBPIXI_LOG_ENABLED(pixi_appLogLevel, level);
 }
 
 /// Wraps LIBPIXI_GENERAL_LOG with confLevel=pixi_appLogLevel
 #define APP_LOG(         level,         ...) LIBPIXI_GENERAL_LOG          (pixi_appLogLevel, level,         __VA_ARGS__)
 /// Wraps LIBPIXI_GENERAL_STRERROR_LOG with confLevel=pixi_appLogLevel
 #define APP_STRERROR_LOG(level, errnum, ...) LIBPIXI_GENERAL_STRERROR_LOG (pixi_appLogLevel, level, errnum, __VA_ARGS__)
+/// Wraps LIBPIXI_GENERAL_LOG_DEFERRED with confLevel=pixi_appLogLevel
+#define APP_LOG_DEFERRED(level,         ...) LIBPIXI_GENERAL_LOG_DEFERRED (pixi_appLogLevel, level,         __VA_ARGS__)
 
 /// Wraps APP_LOG with @c level=LogLevelTrace
 #define APP_LOG_TRACE(...) APP_LOG(LogLevelTrace  , __VA_ARGS__)
@@ -48,6 +50,10 @@ static inline bool pixi_isAppLogLevelEnabled (LogLevel level) {
 #define APP_LOG_ERROR(...) APP_LOG(LogLevelError  , __VA_ARGS__)
 #define APP_LOG_FATAL(...) APP_LOG(LogLevelFatal  , __VA_ARGS__)
 
+/// Wraps APP_LOG_DEFERRED with @c level=LogLevelTrace
+#define APP_LOG_DEFERRED_TRACE(...) APP_LOG_DEFERRED(LogLevelTrace, __VA_ARGS__)
+#define APP_LOG_DEFERRED_DEBUG(...) APP_LOG_DEFERRED(LogLevelDebug, __VA_ARGS__)
+
 /// Wraps APP_STRERROR_LOG with @c level=LogLevelTrace
 #define APP_ERROR_TRACE(errnum, ...) APP_STRERROR_LOG(LogLevelTrace, errnum, __VA_ARGS__)
 #define APP_ERROR_DEBUG(errnum, ...) APP_STRERROR_LOG(LogLevelDebug, errnum, __VA_ARGS__)
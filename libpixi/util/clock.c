@@ -0,0 +1,42 @@
+/*
+    pixi-tools: a set of software to interface with the Raspberry Pi
+    and PiXi-200 hardware
+    Copyright (C) 2014 Simon Cantrill
+
+    pixi-tools is free software; you can redistribute it and/or
+    modify it under the terms of the GNU Lesser General Public
+    License as published by the Free Software Foundation; either
+    version 2.1 of the License, or (at your option) any later version.
+
+    This library is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+    Lesser General Public License for more details.
+
+    You should have received a copy of the GNU Lesser General Public
+    License along with this library; if not, write to the Free Software
+    Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+*/
+
+#include <libpixi/util/clock.h>
+#include <errno.h>
+#include <time.h>
+
+int64 pixi_clockGetNs (void)
+{
+	struct timespec now;
+	clock_gettime (CLOCK_MONOTONIC, &now);
+	return (now.tv_sec * (int64) 1000000000) + now.tv_nsec;
+}
+
+int pixi_clockSleepUntilNs (int64 deadlineNs)
+{
+	struct timespec deadline;
+	deadline.tv_sec  = deadlineNs / 1000000000;
+	deadline.tv_nsec = deadlineNs % 1000000000;
+	int result;
+	do
+		result = clock_nanosleep (CLOCK_MONOTONIC, TIMER_ABSTIME, &deadline, NULL);
+	while (result == EINTR);
+	return -result;
+}
@@ -0,0 +1,46 @@
+/*
+    pixi-tools: a set of software to interface with the Raspberry Pi
+    and PiXi-200 hardware
+    Copyright (C) 2014 Simon Cantrill
+
+    pixi-tools is free software; you can redistribute it and/or
+    modify it under the terms of the GNU Lesser General Public
+    License as published by the Free Software Foundation; either
+    version 2.1 of the License, or (at your option) any later version.
+
+    This library is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+    Lesser General Public License for more details.
+
+    You should have received a copy of the GNU Lesser General Public
+    License along with this library; if not, write to the Free Software
+    Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+*/
+
+#ifndef libpixi_util_clock_h__included
+#define libpixi_util_clock_h__included
+
+
+#include <libpixi/common.h>
+
+LIBPIXI_BEGIN_DECLS
+
+///@defgroup util_clock libpixi clock utilities
+///@{
+
+///	Get the monotonic clock time in nanoseconds. The epoch is arbitrary,
+///	so the value is only useful for measuring intervals.
+int64 pixi_clockGetNs (void);
+
+///	Sleep until the monotonic clock reaches @c deadlineNs (as returned by
+///	@ref pixi_clockGetNs). Sleeping against an absolute deadline means
+///	periodic loops don't accumulate drift.
+///	@return 0 on success, -errno on error
+int pixi_clockSleepUntilNs (int64 deadlineNs);
+
+///@} defgroup
+
+LIBPIXI_END_DECLS
+
+#endif // !defined libpixi_util_clock_h__included
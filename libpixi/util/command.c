@@ -46,6 +46,22 @@ int pixi_addCommandGroup (CommandGroup* group)
 	return 0;
 }
 
+const Command* pixi_commandFind (const char* name)
+{
+	if (!name)
+		return NULL;
+	for (const CommandGroup* group = groups; group != NULL; group = group->nextGroup)
+	{
+		for (uint i = 0; i < group->count; i++)
+		{
+			const Command* cmd = group->commands[i];
+			if (0 == strcasecmp (name, cmd->name))
+				return cmd;
+		}
+	}
+	return NULL;
+}
+
 int pixi_commandUsageError (const Command* command)
 {
 	LIBPIXI_LOG_ERROR (command->usage, command->name);
@@ -159,17 +175,11 @@ int pixi_commandMain (int libpixiVersion, const ProgramInfo* info, int argc, cha
 //	if (result < 0)
 //		return 255;
 
-	for (const CommandGroup* group = groups; group != NULL; group = group->nextGroup)
+	const Command* cmd = pixi_commandFind (command);
+	if (cmd)
 	{
-		for (uint i = 0; i < group->count; i++)
-		{
-			const Command* cmd = group->commands[i];
-			if (0 == strcasecmp (command, cmd->name))
-			{
-				result = cmd->function (cmd, argc - 1, argv + 1);
-				return result < 0 ? 2 : 0;
-			}
-		}
+		result = cmd->function (cmd, argc - 1, argv + 1);
+		return result < 0 ? 2 : 0;
 	}
 	LIBPIXI_LOG_ERROR("Unknown command: %s", command);
 	return 1;
@@ -77,6 +77,10 @@ static inline int addCommandGroup (CommandGroup* group) {
 	return pixi_addCommandGroup (group);
 }
 
+///	Find a command in any group by name (not case sensitive)
+///	@return the command, or NULL if there is no such command
+const Command* pixi_commandFind (const char* name);
+
 ///	Invoke the command specified on the command line, or process --help/--version commands.
 ///	@param libpixiVersion   must pass LIBPIXI_VERSION_INT
 ///	@param info             description of this application (NULL is allowed)
@@ -0,0 +1,296 @@
+/*
+    pixi-tools: a set of software to interface with the Raspberry Pi
+    and PiXi-200 hardware
+    Copyright (C) 2014 Simon Cantrill
+
+    pixi-tools is free software; you can redistribute it and/or
+    modify it under the terms of the GNU Lesser General Public
+    License as published by the Free Software Foundation; either
+    version 2.1 of the License, or (at your option) any later version.
+
+    This library is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+    Lesser General Public License for more details.
+
+    You should have received a copy of the GNU Lesser General Public
+    License along with this library; if not, write to the Free Software
+    Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+*/
+
+#include <libpixi/util/filter.h>
+#include <libpixi/util/log.h>
+#include <math.h>
+#include <string.h>
+
+#if defined __ARM_NEON__ || defined __ARM_NEON
+#	include <arm_neon.h>
+#	define FILTER_NEON 1
+#else
+#	define FILTER_NEON 0
+#endif
+
+enum
+{
+	FilterInputBits = 12
+};
+
+static uint log2Exact (uint value)
+{
+	uint bits = 0;
+	while ((1u << bits) < value)
+		bits++;
+	return ((1u << bits) == value) ? bits : (uint) -1;
+}
+
+// Kernels: each has a NEON version that handles whole vectors,
+// with the scalar code mopping up the remainder.
+
+static uint32 sumSamples (const uint16* input, uint count)
+{
+	uint32 sum = 0;
+	uint i = 0;
+#if FILTER_NEON
+	uint32x4_t acc = vdupq_n_u32 (0);
+	for ( ; i + 8 <= count; i += 8)
+		acc = vpadalq_u16 (acc, vld1q_u16 (input + i));
+	uint64x2_t acc2 = vpaddlq_u32 (acc);
+	sum = (uint32) (vgetq_lane_u64 (acc2, 0) + vgetq_lane_u64 (acc2, 1));
+#endif
+	for ( ; i < count; i++)
+		sum += input[i];
+	return sum;
+}
+
+static int32 dotQ15 (const int16* taps, const int16* samples, uint count)
+{
+	int32 acc = 0;
+	uint i = 0;
+#if FILTER_NEON
+	int32x4_t acc4 = vdupq_n_s32 (0);
+	for ( ; i + 4 <= count; i += 4)
+		acc4 = vmlal_s16 (acc4, vld1_s16 (taps + i), vld1_s16 (samples + i));
+	int64x2_t acc2 = vpaddlq_s32 (acc4);
+	acc = (int32) (vgetq_lane_s64 (acc2, 0) + vgetq_lane_s64 (acc2, 1));
+#endif
+	for ( ; i < count; i++)
+		acc += (int32) taps[i] * samples[i];
+	return acc;
+}
+
+static void envelopeKernel (SampleEnvelope* envelope, const uint16* input, uint count)
+{
+	uint16 min = envelope->min;
+	uint16 max = envelope->max;
+	uint64 sum = envelope->sum;
+	uint i = 0;
+#if FILTER_NEON
+	if (count >= 8)
+	{
+		uint16x8_t vmin = vdupq_n_u16 (min);
+		uint16x8_t vmax = vdupq_n_u16 (max);
+		uint32x4_t vsum = vdupq_n_u32 (0);
+		for ( ; i + 8 <= count; i += 8)
+		{
+			uint16x8_t v = vld1q_u16 (input + i);
+			vmin = vminq_u16 (vmin, v);
+			vmax = vmaxq_u16 (vmax, v);
+			vsum = vpadalq_u16 (vsum, v);
+		}
+		uint16x4_t min4 = vpmin_u16 (vget_low_u16 (vmin), vget_high_u16 (vmin));
+		uint16x4_t max4 = vpmax_u16 (vget_low_u16 (vmax), vget_high_u16 (vmax));
+		min4 = vpmin_u16 (min4, min4);
+		max4 = vpmax_u16 (max4, max4);
+		min4 = vpmin_u16 (min4, min4);
+		max4 = vpmax_u16 (max4, max4);
+		min = vget_lane_u16 (min4, 0);
+		max = vget_lane_u16 (max4, 0);
+		uint64x2_t sum2 = vpaddlq_u32 (vsum);
+		sum += vgetq_lane_u64 (sum2, 0) + vgetq_lane_u64 (sum2, 1);
+	}
+#endif
+	for ( ; i < count; i++)
+	{
+		uint16 value = input[i];
+		if (value < min)
+			min = value;
+		if (value > max)
+			max = value;
+		sum += value;
+	}
+	envelope->min = min;
+	envelope->max = max;
+	envelope->sum = sum;
+	envelope->count += count;
+}
+
+int pixi_filterCicInit (CicFilter* filter, uint order, uint ratio, uint extraBits)
+{
+	LIBPIXI_PRECONDITION_NOT_NULL(filter);
+	LIBPIXI_PRECONDITION(order >= 1 && order <= FilterMaxCicOrder);
+	LIBPIXI_PRECONDITION(ratio >= 1);
+	LIBPIXI_PRECONDITION_MSG(log2Exact (ratio) != (uint) -1, "ratio must be a power of two");
+	LIBPIXI_PRECONDITION(extraBits <= 16 - FilterInputBits);
+
+	uint growth = order * log2Exact (ratio);
+	LIBPIXI_PRECONDITION_MSG(growth + FilterInputBits <= 32, "order and ratio overflow 32 bits");
+	LIBPIXI_PRECONDITION_MSG(extraBits <= growth, "not enough samples for the extra bits");
+
+	memset (filter, 0, sizeof (*filter));
+	filter->order = order;
+	filter->ratio = ratio;
+	filter->shift = growth - extraBits;
+	return 0;
+}
+
+int pixi_filterCicProcess (CicFilter* filter, const uint16* input, uint count, uint16* output)
+{
+	LIBPIXI_PRECONDITION_NOT_NULL(filter);
+	LIBPIXI_PRECONDITION(filter->order >= 1 && filter->order <= FilterMaxCicOrder);
+	LIBPIXI_PRECONDITION_NOT_NULL(input);
+	LIBPIXI_PRECONDITION_NOT_NULL(output);
+
+	uint produced = 0;
+	if (filter->order == 1)
+	{
+		// Boxcar: integrators[0] holds the partial sum of the current window
+		while (count > 0)
+		{
+			uint take = filter->ratio - filter->phase;
+			if (take > count)
+				take = count;
+			filter->integrators[0] += sumSamples (input, take);
+			filter->phase += take;
+			input += take;
+			count -= take;
+			if (filter->phase == filter->ratio)
+			{
+				output[produced++] = filter->integrators[0] >> filter->shift;
+				filter->integrators[0] = 0;
+				filter->phase = 0;
+			}
+		}
+		return produced;
+	}
+
+	// Unsigned wrap-around in the integrators is expected, and is
+	// cancelled out by the combs.
+	const uint order = filter->order;
+	uint32* integ = filter->integrators;
+	uint32* combs = filter->combs;
+	for (uint i = 0; i < count; i++)
+	{
+		integ[0] += input[i];
+		for (uint s = 1; s < order; s++)
+			integ[s] += integ[s-1];
+		if (++filter->phase < filter->ratio)
+			continue;
+
+		filter->phase = 0;
+		uint32 value = integ[order-1];
+		for (uint s = 0; s < order; s++)
+		{
+			uint32 previous = combs[s];
+			combs[s] = value;
+			value -= previous;
+		}
+		output[produced++] = value >> filter->shift;
+	}
+	return produced;
+}
+
+int pixi_filterFirInit (FirFilter* filter, const int16* taps, uint tapCount, uint decimation)
+{
+	LIBPIXI_PRECONDITION_NOT_NULL(filter);
+	LIBPIXI_PRECONDITION_NOT_NULL(taps);
+	LIBPIXI_PRECONDITION(tapCount >= 1 && tapCount <= FilterMaxFirTaps);
+	LIBPIXI_PRECONDITION(decimation >= 1);
+
+	memset (filter, 0, sizeof (*filter));
+	filter->tapCount   = tapCount;
+	filter->decimation = decimation;
+	// Reverse the taps, so that each output is a straight dot product
+	// over the sample window.
+	for (uint i = 0; i < tapCount; i++)
+		filter->taps[i] = taps[tapCount - 1 - i];
+	return 0;
+}
+
+int pixi_filterFirInitLowPass (FirFilter* filter, uint tapCount, double cutoff, uint decimation)
+{
+	LIBPIXI_PRECONDITION(tapCount >= 1 && tapCount <= FilterMaxFirTaps);
+	LIBPIXI_PRECONDITION(cutoff > 0 && cutoff < 0.5);
+
+	double coeffs[FilterMaxFirTaps];
+	double total = 0;
+	const double middle = (tapCount - 1) / 2.0;
+	for (uint i = 0; i < tapCount; i++)
+	{
+		double x = i - middle;
+		double sinc = (x == 0) ? 2 * cutoff : sin (2 * M_PI * cutoff * x) / (M_PI * x);
+		double window = (tapCount == 1) ? 1.0 : 0.54 - 0.46 * cos (2 * M_PI * i / (tapCount - 1));
+		coeffs[i] = sinc * window;
+		total += coeffs[i];
+	}
+	int16 taps[FilterMaxFirTaps];
+	for (uint i = 0; i < tapCount; i++)
+		taps[i] = lround (32767.0 * coeffs[i] / total);
+
+	return pixi_filterFirInit (filter, taps, tapCount, decimation);
+}
+
+int pixi_filterFirProcess (FirFilter* filter, const uint16* input, uint count, uint16* output)
+{
+	LIBPIXI_PRECONDITION_NOT_NULL(filter);
+	LIBPIXI_PRECONDITION(filter->tapCount >= 1 && filter->tapCount <= FilterMaxFirTaps);
+	LIBPIXI_PRECONDITION_NOT_NULL(input);
+	LIBPIXI_PRECONDITION_NOT_NULL(output);
+
+	// window holds the last tapCount-1 samples of the previous block,
+	// followed by up to FilterFirBlock new samples.
+	const uint history = filter->tapCount - 1;
+	int16* window = filter->window;
+	uint produced = 0;
+	while (count > 0)
+	{
+		uint block = count < FilterFirBlock ? count : FilterFirBlock;
+		for (uint i = 0; i < block; i++)
+			window[history + i] = input[i];
+
+		uint i = filter->phase;
+		for ( ; i < block; i += filter->decimation)
+		{
+			int32 acc = dotQ15 (filter->taps, window + i, filter->tapCount);
+			acc = (acc + (1 << 14)) >> 15;
+			if (acc < 0)
+				acc = 0;
+			else if (acc > 0xFFFF)
+				acc = 0xFFFF;
+			output[produced++] = acc;
+		}
+		filter->phase = i - block;
+
+		memmove (window, window + block, history * sizeof (*window));
+		input += block;
+		count -= block;
+	}
+	return produced;
+}
+
+void pixi_filterEnvelopeReset (SampleEnvelope* envelope)
+{
+	envelope->min   = 0xFFFF;
+	envelope->max   = 0;
+	envelope->count = 0;
+	envelope->sum   = 0;
+}
+
+void pixi_filterEnvelope (SampleEnvelope* envelope, const uint16* input, uint count)
+{
+	if (!envelope || !input)
+	{
+		LIBPIXI_PRECONDITION_FAILURE("envelope and input must not be NULL");
+		return;
+	}
+	envelopeKernel (envelope, input, count);
+}
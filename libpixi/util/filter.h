@@ -0,0 +1,120 @@
+/*
+    pixi-tools: a set of software to interface with the Raspberry Pi
+    and PiXi-200 hardware
+    Copyright (C) 2014 Simon Cantrill
+
+    pixi-tools is free software; you can redistribute it and/or
+    modify it under the terms of the GNU Lesser General Public
+    License as published by the Free Software Foundation; either
+    version 2.1 of the License, or (at your option) any later version.
+
+    This library is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+    Lesser General Public License for more details.
+
+    You should have received a copy of the GNU Lesser General Public
+    License along with this library; if not, write to the Free Software
+    Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+*/
+
+#ifndef libpixi_util_filter_h__included
+#define libpixi_util_filter_h__included
+
+
+#include <libpixi/common.h>
+
+LIBPIXI_BEGIN_DECLS
+
+///@defgroup util_filter libpixi sample filters
+/// Block based filters for streams of unsigned samples, such as those
+/// read using @ref pixi_adcReadChannels. Each filter keeps its state
+/// between calls, so a stream can be fed through in blocks of any size.
+/// The inner loops use NEON when the compiler targets it (e.g.
+/// -mfpu=neon), otherwise plain C.
+///@{
+
+enum
+{
+	FilterMaxCicOrder = 4,
+	FilterMaxFirTaps  = 64,
+	FilterFirBlock    = 64  ///< internal: samples processed per FIR pass
+};
+
+///	Cascaded integrator-comb decimator. An order 1 CIC filter is a
+///	boxcar average, which is the usual way to oversample an ADC
+///	channel: summing 4^n samples gives n extra bits of resolution.
+typedef struct CicFilter
+{
+	uint    order;      ///< number of integrator/comb stages
+	uint    ratio;      ///< decimation ratio (input samples per output sample)
+	uint    shift;      ///< right shift applied to each output
+	uint    phase;      ///< internal
+	uint32  integrators[FilterMaxCicOrder]; ///< internal
+	uint32  combs[FilterMaxCicOrder];       ///< internal
+	intptr  _reserved[2];
+} CicFilter;
+
+///	Initialise a CIC decimator for 12 bit input samples.
+///	@param order number of stages [1,FilterMaxCicOrder]
+///	@param ratio decimation ratio, a power of two
+///	@param extraBits bits of resolution to keep beyond the 12 input bits, at most 4
+///	@return 0 on success, -errno on error
+int pixi_filterCicInit (CicFilter* filter, uint order, uint ratio, uint extraBits);
+
+///	Feed @c count samples from @c input through @c filter.
+///	@c output must have room for (count / ratio) + 1 samples.
+///	@return number of samples written to @c output, or -errno on error
+int pixi_filterCicProcess (CicFilter* filter, const uint16* input, uint count, uint16* output);
+
+///	Finite impulse response filter with optional decimation.
+typedef struct FirFilter
+{
+	uint    tapCount;   ///< number of coefficients
+	uint    decimation; ///< input samples per output sample
+	uint    phase;      ///< internal
+	int16   taps[FilterMaxFirTaps];   ///< internal: Q15 coefficients, reversed
+	int16   window[FilterMaxFirTaps + FilterFirBlock]; ///< internal
+	intptr  _reserved[2];
+} FirFilter;
+
+///	Initialise a FIR filter with @c tapCount Q15 coefficients (32768 == 1.0).
+///	@return 0 on success, -errno on error
+int pixi_filterFirInit (FirFilter* filter, const int16* taps, uint tapCount, uint decimation);
+
+///	Initialise a windowed-sinc (Hamming) low-pass FIR filter with unity DC gain.
+///	@param cutoff cut-off frequency as a fraction of the input sample rate (0,0.5)
+///	@return 0 on success, -errno on error
+int pixi_filterFirInitLowPass (FirFilter* filter, uint tapCount, double cutoff, uint decimation);
+
+///	Feed @c count samples from @c input through @c filter. Input samples
+///	must be less than 32768, e.g. raw 12 bit ADC values.
+///	@c output must have room for (count / decimation) + 1 samples.
+///	@return number of samples written to @c output, or -errno on error
+int pixi_filterFirProcess (FirFilter* filter, const uint16* input, uint count, uint16* output);
+
+///	Running minimum, maximum and sum of a sample stream.
+typedef struct SampleEnvelope
+{
+	uint16  min;
+	uint16  max;
+	uint    count;
+	uint64  sum;
+} SampleEnvelope;
+
+///	Reset @c envelope ready for a new measurement period.
+void pixi_filterEnvelopeReset (SampleEnvelope* envelope);
+
+///	Add @c count samples from @c input to @c envelope.
+void pixi_filterEnvelope (SampleEnvelope* envelope, const uint16* input, uint count);
+
+///	Mean value of the samples added to @c envelope
+static inline double filterEnvelopeMean (const SampleEnvelope* envelope) {
+	return envelope->count ? (double) envelope->sum / envelope->count : 0.0;
+}
+
+///@} defgroup
+
+LIBPIXI_END_DECLS
+
+#endif // !defined libpixi_util_filter_h__included
@@ -0,0 +1,47 @@
+/*
+    pixi-tools: a set of software to interface with the Raspberry Pi
+    and PiXi-200 hardware
+    Copyright (C) 2014 Simon Cantrill
+
+    pixi-tools is free software; you can redistribute it and/or
+    modify it under the terms of the GNU Lesser General Public
+    License as published by the Free Software Foundation; either
+    version 2.1 of the License, or (at your option) any later version.
+
+    This library is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+    Lesser General Public License for more details.
+
+    You should have received a copy of the GNU Lesser General Public
+    License along with this library; if not, write to the Free Software
+    Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+*/
+#include <libpixi/util/io-buffer.h>
+#include <libpixi/util/log.h>
+#include <stdlib.h>
+
+
+int pixi_ioBufferInit (IoBuffer* buf, uint capacity)
+{
+	LIBPIXI_PRECONDITION_NOT_NULL(buf);
+	LIBPIXI_PRECONDITION(capacity > 0 && capacity <= 0x80000000u);
+
+	uint size = 1;
+	while (size < capacity)
+		size <<= 1;
+	memset (buf, 0, sizeof (*buf));
+	buf->buffer = malloc (size);
+	if (!buf->buffer)
+		return -ENOMEM;
+	buf->capacity = size;
+	return 0;
+}
+
+void pixi_ioBufferFree (IoBuffer* buf)
+{
+	if (!buf)
+		return;
+	free (buf->buffer);
+	memset (buf, 0, sizeof (*buf));
+}
@@ -0,0 +1,199 @@
+/*
+    pixi-tools: a set of software to interface with the Raspberry Pi
+    and PiXi-200 hardware
+    Copyright (C) 2014 Simon Cantrill
+
+    pixi-tools is free software; you can redistribute it and/or
+    modify it under the terms of the GNU Lesser General Public
+    License as published by the Free Software Foundation; either
+    version 2.1 of the License, or (at your option) any later version.
+
+    This library is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+    Lesser General Public License for more details.
+
+    You should have received a copy of the GNU Lesser General Public
+    License along with this library; if not, write to the Free Software
+    Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+*/
+#ifndef libpixi_util_io_buffer_h__included
+#define libpixi_util_io_buffer_h__included
+
+
+#include <libpixi/common.h>
+#include <errno.h>
+#include <string.h>
+
+LIBPIXI_BEGIN_DECLS
+
+///@defgroup util_io_buffer libpixi single-producer/single-consumer byte queue
+/// A lock-free ring buffer for passing bytes from one thread (the producer,
+/// which writes) to another (the consumer, which reads). The read and write
+/// positions are free running counters, published with acquire/release
+/// atomics, so the whole capacity is usable. Data is copied with at most
+/// two memcpy calls per transfer; the peek/commit functions give direct
+/// access to the buffer for zero-copy transfers.
+///@{
+
+enum
+{
+	IoBufferDefaultSize = 4096
+};
+
+typedef struct IoBuffer
+{
+	byte*   buffer;
+	uint    capacity;   ///< a power of two
+	uint    writePos;   ///< internal: only changed by the producer
+	uint    readPos;    ///< internal: only changed by the consumer
+	intptr  _reserved[2];
+} IoBuffer;
+
+///	Allocate a buffer of at least @c capacity bytes for @c buf,
+///	rounded up to a power of two. Call @ref pixi_ioBufferFree when finished.
+///	@return 0 on success, -errno on error
+int pixi_ioBufferInit (IoBuffer* buf, uint capacity);
+
+///	Free the memory allocated by @ref pixi_ioBufferInit
+void pixi_ioBufferFree (IoBuffer* buf);
+
+///	Discard the contents of @c buf. Must not be called while the
+///	producer or consumer is using it.
+static inline void ioClear (IoBuffer* buf)
+{
+	buf->writePos = 0;
+	buf->readPos = 0;
+}
+
+///	Return size of data in buffer
+static inline uint ioSize (const IoBuffer* buf)
+{
+	return __atomic_load_n (&buf->writePos, __ATOMIC_ACQUIRE) - __atomic_load_n (&buf->readPos, __ATOMIC_ACQUIRE);
+}
+
+static inline bool ioIsEmpty (const IoBuffer* buf)
+{
+	return ioSize (buf) == 0;
+}
+
+///	Return space available for writing (producer)
+static inline uint ioSpace (const IoBuffer* buf)
+{
+	return buf->capacity - (buf->writePos - __atomic_load_n (&buf->readPos, __ATOMIC_ACQUIRE));
+}
+
+///	Get a pointer to the data at the front of the buffer (consumer).
+///	@return the number of bytes available at @c *data, which is less than
+///	ioSize() when the data wraps around the end of the buffer
+static inline uint ioReadPeek (IoBuffer* buf, const byte** data)
+{
+	uint readPos  = buf->readPos;
+	uint avail    = __atomic_load_n (&buf->writePos, __ATOMIC_ACQUIRE) - readPos;
+	uint offset   = readPos & (buf->capacity - 1);
+	uint toEnd    = buf->capacity - offset;
+	*data = buf->buffer + offset;
+	return avail < toEnd ? avail : toEnd;
+}
+
+///	Remove @c size bytes from the front of the buffer (consumer), after
+///	they have been used via @ref ioReadPeek
+static inline void ioReadCommit (IoBuffer* buf, uint size)
+{
+	__atomic_store_n (&buf->readPos, buf->readPos + size, __ATOMIC_RELEASE);
+}
+
+///	Get a pointer to free space at the back of the buffer (producer).
+///	@return the number of bytes that may be written at @c *data, which is
+///	less than ioSpace() when the space wraps around the end of the buffer
+static inline uint ioWritePeek (IoBuffer* buf, byte** data)
+{
+	uint writePos = buf->writePos;
+	uint space    = buf->capacity - (writePos - __atomic_load_n (&buf->readPos, __ATOMIC_ACQUIRE));
+	uint offset   = writePos & (buf->capacity - 1);
+	uint toEnd    = buf->capacity - offset;
+	*data = buf->buffer + offset;
+	return space < toEnd ? space : toEnd;
+}
+
+///	Add @c size bytes, written via @ref ioWritePeek, to the back of the
+///	buffer (producer)
+static inline void ioWriteCommit (IoBuffer* buf, uint size)
+{
+	__atomic_store_n (&buf->writePos, buf->writePos + size, __ATOMIC_RELEASE);
+}
+
+///	Return size of data in buffer that's available in
+///	in a single contiguous chunk
+static inline uint ioContiguousSize (IoBuffer* buf)
+{
+	const byte* data;
+	return ioReadPeek (buf, &data);
+}
+
+///	Push a single byte to the buffer. Return 0 if successful,
+///	or a negative error value if out of space.
+static inline int ioPush (IoBuffer* buf, byte value)
+{
+	uint writePos = buf->writePos;
+	if (writePos - __atomic_load_n (&buf->readPos, __ATOMIC_ACQUIRE) == buf->capacity)
+		return -ENOBUFS;
+	buf->buffer[writePos & (buf->capacity - 1)] = value;
+	__atomic_store_n (&buf->writePos, writePos + 1, __ATOMIC_RELEASE);
+	return 0;
+}
+
+///	Pop a single byte from the buffer. Return the value if successful,
+///	or a negative error code if no data is available.
+static inline int ioPop (IoBuffer* buf)
+{
+	uint readPos = buf->readPos;
+	byte value;
+	if (readPos == __atomic_load_n (&buf->writePos, __ATOMIC_ACQUIRE))
+		return -ENODATA;
+	value = buf->buffer[readPos & (buf->capacity - 1)];
+	__atomic_store_n (&buf->readPos, readPos + 1, __ATOMIC_RELEASE);
+	return value;
+}
+
+///	Write up to @c size bytes from @c data to the buffer (producer).
+///	@return the number of bytes written
+static inline uint ioWrite (IoBuffer* buf, const void* data, uint size)
+{
+	uint writePos = buf->writePos;
+	uint space    = buf->capacity - (writePos - __atomic_load_n (&buf->readPos, __ATOMIC_ACQUIRE));
+	uint offset   = writePos & (buf->capacity - 1);
+	uint first    = buf->capacity - offset;
+	if (size > space)
+		size = space;
+	if (first > size)
+		first = size;
+	memcpy (buf->buffer + offset, data, first);
+	memcpy (buf->buffer, (const byte*) data + first, size - first);
+	__atomic_store_n (&buf->writePos, writePos + size, __ATOMIC_RELEASE);
+	return size;
+}
+
+///	Read up to @c size bytes from the buffer into @c data (consumer).
+///	@return the number of bytes read
+static inline uint ioRead (IoBuffer* buf, void* data, uint size)
+{
+	uint readPos = buf->readPos;
+	uint avail   = __atomic_load_n (&buf->writePos, __ATOMIC_ACQUIRE) - readPos;
+	uint offset  = readPos & (buf->capacity - 1);
+	uint first   = buf->capacity - offset;
+	if (size > avail)
+		size = avail;
+	if (first > size)
+		first = size;
+	memcpy (data, buf->buffer + offset, first);
+	memcpy ((byte*) data + first, buf->buffer, size - first);
+	__atomic_store_n (&buf->readPos, readPos + size, __ATOMIC_RELEASE);
+	return size;
+}
+
+///@} defgroup
+
+LIBPIXI_END_DECLS
+
+#endif // !defined libpixi_util_io_buffer_h__included
@@ -0,0 +1,435 @@
+/*
+    pixi-tools: a set of software to interface with the Raspberry Pi
+    and PiXi-200 hardware
+    Copyright (C) 2014 Simon Cantrill
+
+    pixi-tools is free software; you can redistribute it and/or
+    modify it under the terms of the GNU Lesser General Public
+    License as published by the Free Software Foundation; either
+    version 2.1 of the License, or (at your option) any later version.
+
+    This library is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+    Lesser General Public License for more details.
+
+    You should have received a copy of the GNU Lesser General Public
+    License along with this library; if not, write to the Free Software
+    Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+*/
+
+#include <libpixi/util/log-async.h>
+#include <libpixi/util/log.h>
+#include <errno.h>
+#include <poll.h>
+#include <pthread.h>
+#include <sched.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/eventfd.h>
+#include <sys/time.h>
+#include "../private.h"
+
+/// A queued message. The sequence number says whether the slot is free
+/// for the producer claiming position n (sequence == n) or holds the
+/// message for the consumer at position n (sequence == n + 1).
+/// A deferred entry has its arguments in @c args and is only formatted
+/// into @c text by the writer.
+typedef struct LogRecord
+{
+	uint64           sequence;
+	struct timeval   time;
+	const char*      file;
+	int              line;
+	LogLevel         level;
+	int              errnum;
+	const LogFormat* deferred;
+	int              args[LogDeferredArgs];
+	char             text[]; ///< nul terminated
+} LogRecord;
+
+enum
+{
+	TextSize = LogAsyncSlotSize - sizeof (LogRecord)
+};
+
+static struct
+{
+	byte*           slots;
+	uint            mask;
+	LogOverflow     overflow;
+	uint            fsyncIntervalMs;
+	uint64          enqueuePos; ///< next position to claim (producers)
+	uint64          dequeuePos; ///< next position to write (consumer)
+	int             wakeFd;
+	int             sleeping;   ///< consumer is waiting on wakeFd
+	bool            stopping;
+	bool            running;
+	uint            producers;  ///< threads between checking running and publishing
+	pthread_t       thread;
+	LogAsyncStats   stats;
+} logQueue = {.wakeFd = -1};
+
+static inline LogRecord* recordAt (uint64 pos)
+{
+	return (LogRecord*) (logQueue.slots + ((pos & logQueue.mask) * LogAsyncSlotSize));
+}
+
+static inline void countStat (uint64* counter)
+{
+	__atomic_fetch_add (counter, 1, __ATOMIC_RELAXED);
+}
+
+static void wakeWriter (void)
+{
+	// Pairs with the fence in writerThread, so that either the writer
+	// sees the new message or we see that it's going to sleep
+	__atomic_thread_fence (__ATOMIC_SEQ_CST);
+	if (__atomic_load_n (&logQueue.sleeping, __ATOMIC_RELAXED)
+		&& __atomic_exchange_n (&logQueue.sleeping, 0, __ATOMIC_ACQ_REL))
+	{
+		uint64 one = 1;
+		if (write (logQueue.wakeFd, &one, sizeof (one)) < 0)
+			perror ("Error waking log writer");
+	}
+}
+
+/// Claim a slot, waiting or dropping as the overflow policy says
+static LogRecord* claimRecord (LogLevel level, uint64* claimed)
+{
+	bool waited = false;
+	uint64 pos = __atomic_load_n (&logQueue.enqueuePos, __ATOMIC_RELAXED);
+	while (true)
+	{
+		LogRecord* record = recordAt (pos);
+		uint64 sequence = __atomic_load_n (&record->sequence, __ATOMIC_ACQUIRE);
+		int64 diff = (int64) (sequence - pos);
+		if (diff == 0)
+		{
+			if (__atomic_compare_exchange_n (&logQueue.enqueuePos, &pos, pos + 1, true, __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+			{
+				*claimed = pos;
+				if (waited)
+					countStat (&logQueue.stats.waits);
+				return record;
+			}
+		}
+		else if (diff < 0)
+		{
+			// Full
+			if (logQueue.overflow == LogOverflowDrop && level < LogLevelError)
+			{
+				countStat (&logQueue.stats.dropped);
+				return NULL;
+			}
+			waited = true;
+			wakeWriter();
+			sched_yield();
+			pos = __atomic_load_n (&logQueue.enqueuePos, __ATOMIC_RELAXED);
+		}
+		else
+			pos = __atomic_load_n (&logQueue.enqueuePos, __ATOMIC_RELAXED);
+	}
+}
+
+static inline void publishRecord (LogRecord* record, uint64 pos)
+{
+	__atomic_store_n (&record->sequence, pos + 1, __ATOMIC_RELEASE);
+	countStat (&logQueue.stats.queued);
+	wakeWriter();
+}
+
+/// Register the calling thread as a producer, if it should queue its
+/// message. Stop waits for producers to finish, so the queue stays valid
+/// until @ref endProduce.
+/// @return false if the message should be written directly
+static bool beginProduce (void)
+{
+	// Pairs with the store and load in stopQueue: either stop sees this
+	// producer, or this producer sees that the queue has stopped
+	__atomic_fetch_add (&logQueue.producers, 1, __ATOMIC_SEQ_CST);
+	if (!__atomic_load_n (&logQueue.running, __ATOMIC_SEQ_CST)
+		|| pthread_equal (pthread_self(), logQueue.thread)) // the writer mustn't wait on itself
+	{
+		__atomic_fetch_sub (&logQueue.producers, 1, __ATOMIC_SEQ_CST);
+		return false;
+	}
+	return true;
+}
+
+static inline void endProduce (void)
+{
+	__atomic_fetch_sub (&logQueue.producers, 1, __ATOMIC_SEQ_CST);
+}
+
+bool pixi_logAsyncVPrintf (const LogContext* context, int errnum, const char* format, va_list args)
+{
+	if (!beginProduce())
+		return false;
+
+	uint64 pos;
+	LogRecord* record = claimRecord (context->level, &pos);
+	if (!record)
+	{
+		endProduce();
+		return true;
+	}
+	gettimeofday (&record->time, NULL);
+	record->file   = context->file;
+	record->line   = context->line;
+	record->level  = context->level;
+	record->errnum = errnum;
+	record->deferred = NULL;
+	int count = vsnprintf (record->text, TextSize, format, args);
+	if (count >= (int) TextSize)
+		countStat (&logQueue.stats.truncated);
+	publishRecord (record, pos);
+	endProduce();
+
+	if (context->level >= LogLevelFatal)
+		pixi_logAsyncFlush(); // the program may be about to die
+	return true;
+}
+
+bool pixi_logAsyncDeferred (const LogFormat* format, const int* args)
+{
+	if (!beginProduce())
+		return false;
+
+	uint64 pos;
+	LogRecord* record = claimRecord (format->context.level, &pos);
+	if (!record)
+	{
+		endProduce();
+		return true;
+	}
+	gettimeofday (&record->time, NULL);
+	record->file     = format->context.file;
+	record->line     = format->context.line;
+	record->level    = format->context.level;
+	record->errnum   = LogNoError;
+	record->deferred = format;
+	memcpy (record->args, args, sizeof (record->args));
+	publishRecord (record, pos);
+	endProduce();
+
+	if (format->context.level >= LogLevelFatal)
+		pixi_logAsyncFlush();
+	return true;
+}
+
+/// Write the queued messages.
+/// @return the number written
+static uint drainQueue (void)
+{
+	uint count = 0;
+	while (true)
+	{
+		uint64 pos = logQueue.dequeuePos;
+		LogRecord* record = recordAt (pos);
+		if (__atomic_load_n (&record->sequence, __ATOMIC_ACQUIRE) != pos + 1)
+			break;
+
+		uint depth = __atomic_load_n (&logQueue.enqueuePos, __ATOMIC_RELAXED) - pos;
+		if (depth > logQueue.stats.maxDepth)
+			__atomic_store_n (&logQueue.stats.maxDepth, depth, __ATOMIC_RELAXED);
+
+		if (record->deferred)
+		{
+			const int* args = record->args;
+			int length = snprintf (record->text, TextSize, record->deferred->format, args[0], args[1], args[2], args[3]);
+			if (length >= (int) TextSize)
+				countStat (&logQueue.stats.truncated);
+		}
+		char errorBuf[256];
+		const char* errorStr = NULL;
+		if (record->errnum != LogNoError)
+			errorStr = strerror_r (record->errnum, errorBuf, sizeof (errorBuf));
+		pixi_logWriteEntry (record->level, record->file, record->line, record->text, errorStr, &record->time, false);
+
+		__atomic_store_n (&record->sequence, pos + logQueue.mask + 1, __ATOMIC_RELEASE);
+		__atomic_store_n (&logQueue.dequeuePos, pos + 1, __ATOMIC_RELEASE);
+		countStat (&logQueue.stats.written);
+		count++;
+	}
+	return count;
+}
+
+static void* writerThread (void* arg)
+{
+	LIBPIXI_UNUSED(arg);
+	int64 lastSyncMs = 0;
+	bool unsynced = false;
+	while (true)
+	{
+		if (drainQueue() > 0)
+		{
+			pixi_logFlushFile (false);
+			unsynced = true;
+		}
+		struct timespec now;
+		clock_gettime (CLOCK_MONOTONIC, &now);
+		int64 nowMs = (now.tv_sec * (int64) 1000) + (now.tv_nsec / 1000000);
+		int timeoutMs = -1;
+		if (unsynced && logQueue.fsyncIntervalMs)
+		{
+			int64 dueMs = lastSyncMs + logQueue.fsyncIntervalMs;
+			if (nowMs >= dueMs)
+			{
+				pixi_logFlushFile (true);
+				lastSyncMs = nowMs;
+				unsynced = false;
+			}
+			else
+				timeoutMs = dueMs - nowMs;
+		}
+		if (__atomic_load_n (&logQueue.stopping, __ATOMIC_ACQUIRE))
+		{
+			if (drainQueue() == 0)
+				break;
+			continue;
+		}
+
+		// Sleep, unless a message arrived while we were deciding to
+		__atomic_store_n (&logQueue.sleeping, 1, __ATOMIC_RELAXED);
+		__atomic_thread_fence (__ATOMIC_SEQ_CST);
+		LogRecord* next = recordAt (logQueue.dequeuePos);
+		if (__atomic_load_n (&next->sequence, __ATOMIC_ACQUIRE) == logQueue.dequeuePos + 1
+			|| __atomic_load_n (&logQueue.stopping, __ATOMIC_ACQUIRE))
+		{
+			__atomic_store_n (&logQueue.sleeping, 0, __ATOMIC_RELAXED);
+			continue;
+		}
+		struct pollfd pfd = {logQueue.wakeFd, POLLIN, 0};
+		if (poll (&pfd, 1, timeoutMs) > 0)
+		{
+			uint64 value;
+			if (read (logQueue.wakeFd, &value, sizeof (value)) < 0)
+				perror ("Error reading log writer wake event");
+		}
+		__atomic_store_n (&logQueue.sleeping, 0, __ATOMIC_RELAXED);
+	}
+	pixi_logFlushFile (logQueue.fsyncIntervalMs > 0);
+	return NULL;
+}
+
+int pixi_logAsyncStart (const LogAsyncConfig* config)
+{
+	LIBPIXI_PRECONDITION(!logQueue.running);
+
+	LogAsyncConfig defaults;
+	memset (&defaults, 0, sizeof (defaults));
+	if (!config)
+		config = &defaults;
+
+	uint slots = 2;
+	uint wanted = config->slots ? config->slots : LogAsyncDefaultSlots;
+	while (slots < wanted)
+		slots <<= 1;
+	byte* memory = malloc ((size_t) slots * LogAsyncSlotSize);
+	if (!memory)
+		return -ENOMEM;
+	int wakeFd = eventfd (0, EFD_CLOEXEC | EFD_NONBLOCK);
+	if (wakeFd < 0)
+	{
+		int err = errno;
+		free (memory);
+		LIBPIXI_ERROR(err, "Cannot create log writer event");
+		return -err;
+	}
+	pixi_logSetRotation (config->maxFileSize, config->keepFiles);
+
+	memset (&logQueue.stats, 0, sizeof (logQueue.stats));
+	logQueue.slots           = memory;
+	logQueue.mask            = slots - 1;
+	logQueue.overflow        = config->overflow;
+	logQueue.fsyncIntervalMs = config->fsyncIntervalMs;
+	logQueue.enqueuePos      = 0;
+	logQueue.dequeuePos      = 0;
+	logQueue.wakeFd          = wakeFd;
+	logQueue.sleeping        = 0;
+	logQueue.stopping        = false;
+	for (uint i = 0; i < slots; i++)
+		recordAt (i)->sequence = i;
+
+	int result = pthread_create (&logQueue.thread, NULL, writerThread, NULL);
+	if (result != 0)
+	{
+		close (wakeFd);
+		free (memory);
+		logQueue.slots  = NULL;
+		logQueue.wakeFd = -1;
+		LIBPIXI_ERROR(result, "Cannot start log writer thread");
+		return -result;
+	}
+	__atomic_store_n (&logQueue.running, true, __ATOMIC_RELEASE);
+	return 0;
+}
+
+/// Write the queued messages and stop the writer. With @c release, also
+/// free the queue; at exit other threads may still be running, so the
+/// queue is left alone.
+static int stopQueue (bool release)
+{
+	if (!__atomic_load_n (&logQueue.running, __ATOMIC_ACQUIRE))
+		return 0;
+
+	// New messages are written directly from now on. Wait for the threads
+	// already queueing a message, which may need the writer to make space.
+	__atomic_store_n (&logQueue.running, false, __ATOMIC_SEQ_CST);
+	while (__atomic_load_n (&logQueue.producers, __ATOMIC_SEQ_CST) > 0)
+	{
+		wakeWriter();
+		sched_yield();
+	}
+	__atomic_store_n (&logQueue.stopping, true, __ATOMIC_RELEASE);
+	__atomic_store_n (&logQueue.sleeping, 1, __ATOMIC_RELAXED);
+	wakeWriter();
+	pthread_join (logQueue.thread, NULL);
+	if (!release)
+		return 0;
+
+	close (logQueue.wakeFd);
+	free (logQueue.slots);
+	logQueue.slots  = NULL;
+	logQueue.wakeFd = -1;
+	return 0;
+}
+
+int pixi_logAsyncStop (void)
+{
+	return stopQueue (true);
+}
+
+void pixi_logAsyncStopAtExit (void)
+{
+	stopQueue (false);
+}
+
+void pixi_logAsyncFlush (void)
+{
+	if (!__atomic_load_n (&logQueue.running, __ATOMIC_ACQUIRE))
+		return;
+	uint64 target = __atomic_load_n (&logQueue.enqueuePos, __ATOMIC_ACQUIRE);
+	while (__atomic_load_n (&logQueue.dequeuePos, __ATOMIC_ACQUIRE) < target)
+	{
+		wakeWriter();
+		struct timespec pause = {0, 100000};
+		nanosleep (&pause, NULL);
+	}
+}
+
+void pixi_logAsyncGetStats (LogAsyncStats* stats)
+{
+	if (!stats)
+		return;
+	stats->queued    = __atomic_load_n (&logQueue.stats.queued   , __ATOMIC_RELAXED);
+	stats->written   = __atomic_load_n (&logQueue.stats.written  , __ATOMIC_RELAXED);
+	stats->dropped   = __atomic_load_n (&logQueue.stats.dropped  , __ATOMIC_RELAXED);
+	stats->waits     = __atomic_load_n (&logQueue.stats.waits    , __ATOMIC_RELAXED);
+	stats->truncated = __atomic_load_n (&logQueue.stats.truncated, __ATOMIC_RELAXED);
+	stats->maxDepth  = __atomic_load_n (&logQueue.stats.maxDepth , __ATOMIC_RELAXED);
+}
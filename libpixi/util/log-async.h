@@ -0,0 +1,94 @@
+/*
+    pixi-tools: a set of software to interface with the Raspberry Pi
+    and PiXi-200 hardware
+    Copyright (C) 2014 Simon Cantrill
+
+    pixi-tools is free software; you can redistribute it and/or
+    modify it under the terms of the GNU Lesser General Public
+    License as published by the Free Software Foundation; either
+    version 2.1 of the License, or (at your option) any later version.
+
+    This library is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+    Lesser General Public License for more details.
+
+    You should have received a copy of the GNU Lesser General Public
+    License along with this library; if not, write to the Free Software
+    Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+*/
+
+#ifndef libpixi_util_log_async_h__included
+#define libpixi_util_log_async_h__included
+
+
+#include <libpixi/common.h>
+
+LIBPIXI_BEGIN_DECLS
+
+///@addtogroup util_log
+/// In asynchronous mode, logging threads only format their message into
+/// a slot of a lock-free multi-producer queue. A background thread adds
+/// the time and error text, writes to stderr and the log file, rotates
+/// the file and fsyncs it in batches. Only messages from the
+/// @c _LOG_DEFERRED macros are also formatted by the background thread;
+/// the others are formatted by the thread that logs them, as their
+/// arguments may not outlive the call. Messages logged by the background
+/// thread itself are written directly.
+///@{
+
+///	What to do with a message when the queue is full
+typedef enum LogOverflow
+{
+	LogOverflowDrop  = 0, ///< drop messages below LogLevelError (counted); errors wait for space
+	LogOverflowBlock = 1  ///< wait for space
+} LogOverflow;
+
+enum
+{
+	LogAsyncDefaultSlots = 1024,
+	LogAsyncSlotSize     = 512  ///< bytes per queued message, including its header
+};
+
+typedef struct LogAsyncConfig
+{
+	uint        slots;          ///< queue capacity in messages, rounded up to a power of two; 0 for LogAsyncDefaultSlots
+	LogOverflow overflow;
+	long        maxFileSize;    ///< see @ref pixi_logSetRotation; 0 for the default
+	uint        keepFiles;      ///< see @ref pixi_logSetRotation; 0 for the default
+	uint        fsyncIntervalMs; ///< fsync the log file at most this often after writes; 0 to never fsync
+	intptr      _reserved[2];
+} LogAsyncConfig;
+
+typedef struct LogAsyncStats
+{
+	uint64  queued;    ///< messages queued
+	uint64  written;   ///< messages written by the background thread
+	uint64  dropped;   ///< messages dropped because the queue was full
+	uint64  waits;     ///< messages that waited for queue space
+	uint64  truncated; ///< messages too long for a queue slot
+	uint    maxDepth;  ///< most messages in the queue at once
+} LogAsyncStats;
+
+///	Start asynchronous logging, with @c config or the defaults if NULL.
+///	Messages longer than a slot are truncated.
+///	@return 0 on success, -errno on error
+int pixi_logAsyncStart (const LogAsyncConfig* config);
+
+///	Write any queued messages, stop the background thread and return to
+///	synchronous logging. Threads already queueing a message are waited
+///	for; later messages are written directly.
+///	@return 0 on success, -errno on error
+int pixi_logAsyncStop (void);
+
+///	Wait until the messages queued so far have been written.
+void pixi_logAsyncFlush (void);
+
+///	Get a snapshot of the asynchronous logging counters.
+void pixi_logAsyncGetStats (LogAsyncStats* stats);
+
+///@} defgroup
+
+LIBPIXI_END_DECLS
+
+#endif // !defined libpixi_util_log_async_h__included
@@ -19,15 +19,18 @@
 */
 
 #include <libpixi/util/log.h>
+#include <libpixi/util/log-async.h>
 #include <libpixi/util/string.h>
 #include <ctype.h>
 #include <errno.h>
+#include <pthread.h>
 #include <stdio.h>
 #include <stdarg.h>
 #include <stdlib.h>
 #include <string.h>
 #include <strings.h>
 #include <unistd.h>
+#include <sys/time.h>
 #include "../private.h"
 
 LogLevel pixi_logLevel = LogLevelInfo;
@@ -46,10 +49,13 @@ static const char AnsiGreen[]   = "\033[0;33m";
 
 static const char* levelColors[LogLevelOff+1];
 
-static const long  maxLogSize   = 10 * 1024 * 1024;
+static long        maxLogSize   = LogDefaultMaxFileSize;
+static uint        keepLogFiles = 1;
 static const char* logFilename  = NULL;
 static FILE*       logFile      = NULL;
 static long        logSize      =  0;
+static bool        logUnsynced  = false; ///< written since the last fsync
+static pthread_mutex_t logFileMutex = PTHREAD_MUTEX_INITIALIZER;
 
 static const char* getLevelColor (LogLevel level)
 {
@@ -77,9 +83,9 @@ static bool useAnsiColors (void)
 	return result;
 }
 
+/// Called with logFileMutex held, except during initialisation
 static void openLogFile (void)
 {
-	// TODO: locking for multi-threading
 	if (logFile)
 		fclose (logFile);
 	logFile = fopen (logFilename, "a");
@@ -91,24 +97,42 @@ static void openLogFile (void)
 	logSize = ftell (logFile);
 }
 
+/// Rename name.(n-1) to name.n ... name to name.1, and start a new file.
+/// Called with logFileMutex held.
 static void rotateLogFile (void)
 {
 	char oldName[1024];
-	int count = snprintf (oldName, sizeof (oldName), "%s.1", logFilename);
-	if (count >= (int) sizeof (oldName))
+	char newName[1024];
+	for (uint n = keepLogFiles; n > 0; n--)
 	{
-		perror ("Error formatting log rotation filename");
-		return;
-	}
-	int result = rename (logFilename, oldName);
-	if (result < 0)
-	{
-		perror ("Error performing log rotation rename");
-		return;
+		int count = snprintf (newName, sizeof (newName), "%s.%u", logFilename, n);
+		if (n > 1)
+			snprintf (oldName, sizeof (oldName), "%s.%u", logFilename, n - 1);
+		else
+			snprintf (oldName, sizeof (oldName), "%s", logFilename);
+		if (count >= (int) sizeof (newName))
+		{
+			perror ("Error formatting log rotation filename");
+			return;
+		}
+		int result = rename (oldName, newName);
+		if (result < 0 && (n == 1 || errno != ENOENT))
+		{
+			perror ("Error performing log rotation rename");
+			return;
+		}
 	}
 	openLogFile();
 }
 
+void pixi_logSetRotation (long maxFileSize, uint keepFiles)
+{
+	pthread_mutex_lock (&logFileMutex);
+	maxLogSize   = maxFileSize > 0 ? maxFileSize : LogDefaultMaxFileSize;
+	keepLogFiles = keepFiles > 0 ? keepFiles : 1;
+	pthread_mutex_unlock (&logFileMutex);
+}
+
 
 static const char* getAppLogLevelEnv (void)
 {
@@ -153,6 +177,13 @@ void pixi_logInit (void)
 	logFilename = getenv ("LIBPIXI_LOG_FILE");
 	if (logFilename)
 		openLogFile();
+
+	const char* async = getenv ("LIBPIXI_LOG_ASYNC");
+	if (async && 0 == strcasecmp (async, "yes"))
+	{
+		if (pixi_logAsyncStart (NULL) == 0)
+			atexit (pixi_logAsyncStopAtExit);
+	}
 }
 
 LogLevel pixi_strToLogLevel (const char* levelStr, LogLevel defaultLevel)
@@ -186,24 +217,21 @@ const char* pixi_logLevelToStr (LogLevel level)
 	}
 }
 
-static void logVPrintf (const LogContext* context, const char* errorStr, const char* format, va_list formatArgs)
+void pixi_logWriteEntry (LogLevel level, const char* file, int line, const char* text, const char* errorStr, const struct timeval* time, bool flush)
 {
-	char buffer[2048] = "";
-	int count = vsnprintf (buffer, sizeof (buffer), format, formatArgs);
-	if (count >= (int) sizeof (buffer))
-		fprintf (stderr, "Error: log entry is too long for format string [%s]\n", format);
-
-	const char* file = "";
-	char line[18] = "";
-	if (pixi_logFileContext && context->file)
+	const char* lineStr = "";
+	char lineBuf[18] = "";
+	if (pixi_logFileContext && file)
 	{
-		file = context->file;
-		snprintf (line, sizeof (line), ":%d: ", context->line);
+		snprintf (lineBuf, sizeof (lineBuf), ":%d: ", line);
+		lineStr = lineBuf;
 	}
+	else
+		file = "";
 
 	const char* prog = program_invocation_short_name;
-	const char* lev  = pixi_logLevelToStr (context->level);
-	const char* startColor = getLevelColor (context->level);
+	const char* lev  = pixi_logLevelToStr (level);
+	const char* startColor = getLevelColor (level);
 	const char* endColor   = "";
 	if (startColor)
 		endColor = levelColors[LogLevelOff];
@@ -217,38 +245,80 @@ static void logVPrintf (const LogContext* context, const char* errorStr, const c
 
 	fprintf (stderr, "%s%s%s%s: %s: %s%s%s%s\n",
 		file,
-		line,
+		lineStr,
 		startColor,
 		prog,
 		lev,
-		buffer,
+		text,
 		errorColon,
 		errorStr,
 		endColor
 		);
+	if (!logFile)
+		return;
+
+	pthread_mutex_lock (&logFileMutex);
 	if (logFile)
 	{
 		if (logSize > maxLogSize)
 			rotateLogFile();
 		char timeStr[40] = "";
-		pixi_formatCurTime (timeStr, sizeof (timeStr));
-		int written = fprintf (logFile, "%s %s%s%s: %s%s%s\n",
+		pixi_formatTimeval (time, timeStr, sizeof (timeStr));
+		int written = logFile ? fprintf (logFile, "%s %s%s%s: %s%s%s\n",
 			timeStr,
 			file,
-			line,
+			lineStr,
 			lev,
-			buffer,
+			text,
 			errorColon,
 			errorStr
-			);
+			) : 0;
 		if (written < 0)
 			perror ("Error writing to log file");
 		else
 		{
-			fflush (logFile);
+			if (flush)
+				fflush (logFile);
 			logSize += written;
+			logUnsynced = true;
 		}
 	}
+	pthread_mutex_unlock (&logFileMutex);
+}
+
+void pixi_logFlushFile (bool sync)
+{
+	pthread_mutex_lock (&logFileMutex);
+	if (logFile)
+	{
+		fflush (logFile);
+		if (sync && logUnsynced)
+		{
+			fsync (fileno (logFile));
+			logUnsynced = false;
+		}
+	}
+	pthread_mutex_unlock (&logFileMutex);
+}
+
+static void logVPrintf (const LogContext* context, int errnum, const char* format, va_list formatArgs)
+{
+	if (pixi_logAsyncVPrintf (context, errnum, format, formatArgs))
+		return;
+
+	char buffer[2048] = "";
+	int count = vsnprintf (buffer, sizeof (buffer), format, formatArgs);
+	if (count >= (int) sizeof (buffer))
+		fprintf (stderr, "Error: log entry is too long for format string [%s]\n", format);
+
+	char errorBuf[256];
+	const char* errorStr = NULL;
+	if (errnum != LogNoError)
+		errorStr = strerror_r (errnum, errorBuf, sizeof (errorBuf));
+
+	struct timeval now;
+	gettimeofday (&now, NULL);
+	pixi_logWriteEntry (context->level, context->file, context->line, buffer, errorStr, &now, true);
 }
 
 void pixi_logPrint (const LogContext* context, const char* format, ...)
@@ -256,7 +326,7 @@ void pixi_logPrint (const LogContext* context, const char* format, ...)
 	va_list args;
 	va_start(args, format);
 
-	logVPrintf (context, NULL, format, args);
+	logVPrintf (context, LogNoError, format, args);
 
 	va_end(args);
 }
@@ -266,10 +336,25 @@ void pixi_logError (const LogContext* context, int errnum, const char* format, .
 	va_list args;
 	va_start(args, format);
 
-	char buffer[256];
-	char* errorStr = strerror_r (errnum, buffer, sizeof (buffer));
-
-	logVPrintf (context, errorStr, format, args);
+	logVPrintf (context, errnum, format, args);
 
 	va_end(args);
 }
+
+void pixi_logDeferred (const LogFormat* format, int arg0, int arg1, int arg2, int arg3)
+{
+	int args[LogDeferredArgs] = {arg0, arg1, arg2, arg3};
+	if (pixi_logAsyncDeferred (format, args))
+		return;
+
+	char buffer[2048] = "";
+	snprintf (buffer, sizeof (buffer), format->format, arg0, arg1, arg2, arg3);
+	struct timeval now;
+	gettimeofday (&now, NULL);
+	pixi_logWriteEntry (format->context.level, format->context.file, format->context.line, buffer, NULL, &now, true);
+}
+
+void pixi_logCheckFormat (const char* format, ...)
+{
+	LIBPIXI_UNUSED(format);
+}
@@ -56,6 +56,19 @@ LIBPIXI_BEGIN_DECLS
 /// to file, e.g. @c LIBPIXI_LOG_FILE=/tmp/pt.log. Log file lines additionally
 /// have a date-time prefix.
 ///
+/// Setting @c LIBPIXI_LOG_ASYNC=yes moves output, and the formatting of
+/// deferred messages, to a background thread (see @ref pixi_logAsyncStart).
+///
+/// Defining @c LIBPIXI_LOG_MIN_LEVEL when compiling, e.g.
+/// @c -DLIBPIXI_LOG_MIN_LEVEL=LogLevelInfo (or @c make @c LOG_MIN_LEVEL=Info
+/// for the pixi-tools build), removes the code for logging below that level
+/// from the compilation unit, whatever the run-time log level.
+///
+/// The @c _LOG_DEFERRED macros are for hot paths. They take only integer
+/// arguments, which are queued with a pointer to the static format and
+/// source location; with asynchronous logging the text is only formatted by
+/// the background thread.
+///
 ///@{
 
 typedef enum LogLevel
@@ -72,6 +85,11 @@ typedef enum LogLevel
 	LogLevelOff   =   0x100000
 } LogLevel;
 
+#ifndef LIBPIXI_LOG_MIN_LEVEL
+/// Log entries below this level are compiled out
+#	define LIBPIXI_LOG_MIN_LEVEL LogLevelAll
+#endif
+
 extern LogLevel pixi_logLevel;
 extern bool     pixi_logColors;
 extern bool     pixi_logFileContext;
@@ -89,22 +107,52 @@ typedef struct LogContext
 	intptr       _reserved[2];
 } LogContext;
 
+enum
+{
+	LogDefaultMaxFileSize = 10 * 1024 * 1024
+};
+
+///	The log file is rotated when it exceeds @c maxFileSize bytes, keeping
+///	@c keepFiles old files (name.1 is the newest). Pass 0 for the defaults
+///	(LogDefaultMaxFileSize, 1 file).
+void pixi_logSetRotation (long maxFileSize, uint keepFiles);
+
 LogLevel pixi_strToLogLevel (const char* levelStr, LogLevel defaultLevel);
 const char* pixi_logLevelToStr (LogLevel level);
 
 void pixi_logPrint (const LogContext* context, const char* format, ...) LIBPIXI_PRINTF_ARG(2);
 void pixi_logError (const LogContext* context, int errnum, const char* format, ...) LIBPIXI_PRINTF_ARG(3);
 
+enum
+{
+	LogDeferredArgs = 4 ///< maximum arguments of a deferred log entry
+};
+
+///	The static part of a deferred log entry
+typedef struct LogFormat
+{
+	LogContext   context;
+	const char*  format; ///< printf format taking LogDeferredArgs int arguments
+} LogFormat;
+
+void pixi_logDeferred (const LogFormat* format, int arg0, int arg1, int arg2, int arg3);
+///	Does nothing, but lets the compiler check a deferred log format
+void pixi_logCheckFormat (const char* format, ...) LIBPIXI_PRINTF_ARG(1);
+
+///	True if @c entryLevel is compiled in and at least @c confLevel
+#define LIBPIXI_LOG_ENABLED(confLevel, entryLevel) \
+	((entryLevel) >= LIBPIXI_LOG_MIN_LEVEL && LIBPIXI_UNLIKELY((entryLevel) >= (confLevel)))
+
 /// Check if logging at @a level should be output.
 static inline bool pixi_isLogLevelEnabled (LogLevel level) {
-	return level >= pixi_logLevel;
+	return LIBPIXI_LOG_ENABLED(pixi_logLevel, level);
 }
 
 /// Logs a format string to stderr. example:
 /// <pre>LIBPIXI_GENERAL_LOG(pixi_logLevel, LogLevelError, "Unexpected value for gpio file %s: %s", fname, buf);</pre>
 /// Don't use this directly, use one of the wrapper macros like LIBPIXI_LOG_ERROR.
 #define LIBPIXI_GENERAL_LOG(confLevel, entryLevel, ...) \
-	do {if ((entryLevel) >= confLevel) {\
+	do {if (LIBPIXI_LOG_ENABLED(confLevel, entryLevel)) {\
 		LogContext context = {entryLevel, __FILE__, __LINE__, {0, 0}};\
 		pixi_logPrint (&context, __VA_ARGS__);\
 	}} while (0)
@@ -112,15 +160,45 @@ static inline bool pixi_isLogLevelEnabled (LogLevel level) {
 /// <pre>LIBPIXI_GENERAL_STRERROR_LOG(pixi_logLevel, LogLevelError, errno, "Could not open file %", fname);</pre>
 /// Don't use this directly, use one of the wrapper macros like LIBPIXI_ERROR.
 #define LIBPIXI_GENERAL_STRERROR_LOG(confLevel, entryLevel, errnum, ...) \
-	do {if ((entryLevel) >= confLevel) {\
+	do {if (LIBPIXI_LOG_ENABLED(confLevel, entryLevel)) {\
 		LogContext context = {entryLevel, __FILE__, __LINE__, {0, 0}};\
 		pixi_logError (&context, errnum, __VA_ARGS__);\
 	}} while (0)
 
+/// Logs a format string and up to LogDeferredArgs int arguments, leaving
+/// the formatting to the log writer. Arguments of other types must be
+/// cast to int, so the format is checked against them; more arguments,
+/// or ones that aren't integers no wider than int (e.g. a string, which
+/// would be read after the caller has moved on), don't compile. example:
+/// <pre>LIBPIXI_GENERAL_LOG_DEFERRED(pixi_logLevel, LogLevelTrace, "register=0x%02x value=0x%04x", address, value);</pre>
+/// Don't use this directly, use one of the wrapper macros like LIBPIXI_LOG_DEFERRED_TRACE.
+#define LIBPIXI_GENERAL_LOG_DEFERRED(confLevel, entryLevel, ...) \
+	do {if (LIBPIXI_LOG_ENABLED(confLevel, entryLevel)) {\
+		LIBPIXI_LOG_DEFERRED_CALL_(entryLevel, __VA_ARGS__, 0, 0, 0, 0, 0);\
+		LIBPIXI_STATIC_ASSERT(LIBPIXI_LOG_DEFERRED_COUNT_(__VA_ARGS__) <= 1 + LogDeferredArgs, "too many deferred log arguments");\
+		if (0) pixi_logCheckFormat (__VA_ARGS__);\
+	}} while (0)
+#define LIBPIXI_LOG_DEFERRED_CALL_(entryLevel, ...) LIBPIXI_LOG_DEFERRED_CALL__(entryLevel, __VA_ARGS__)
+#define LIBPIXI_LOG_DEFERRED_CALL__(entryLevel, formatStr, arg0, arg1, arg2, arg3, ...) \
+	static const LogFormat logFormat = {{entryLevel, __FILE__, __LINE__, {0, 0}}, formatStr};\
+	LIBPIXI_LOG_DEFERRED_CHECK_ARG_(arg0);\
+	LIBPIXI_LOG_DEFERRED_CHECK_ARG_(arg1);\
+	LIBPIXI_LOG_DEFERRED_CHECK_ARG_(arg2);\
+	LIBPIXI_LOG_DEFERRED_CHECK_ARG_(arg3);\
+	pixi_logDeferred (&logFormat, (int) (arg0), (int) (arg1), (int) (arg2), (int) (arg3))
+/// % only compiles for integers, and promotes them to at least int
+#define LIBPIXI_LOG_DEFERRED_CHECK_ARG_(arg) \
+	LIBPIXI_STATIC_ASSERT(sizeof ((arg) % 1) <= sizeof (int), "deferred log arguments must be integers no wider than int")
+/// The number of arguments, up to 9
+#define LIBPIXI_LOG_DEFERRED_COUNT_(...) LIBPIXI_LOG_DEFERRED_COUNT__(__VA_ARGS__, 9, 8, 7, 6, 5, 4, 3, 2, 1, 0)
+#define LIBPIXI_LOG_DEFERRED_COUNT__(a1, a2, a3, a4, a5, a6, a7, a8, a9, count, ...) count
+
 /// Wraps LIBPIXI_GENERAL_LOG with confLevel=pixi_logLevel
 #define LIBPIXI_LOG(         level,         ...) LIBPIXI_GENERAL_LOG          (pixi_logLevel, level,         __VA_ARGS__)
 /// Wraps LIBPIXI_GENERAL_STRERROR_LOG with confLevel=pixi_logLevel
 #define LIBPIXI_STRERROR_LOG(level, errnum, ...) LIBPIXI_GENERAL_STRERROR_LOG (pixi_logLevel, level, errnum, __VA_ARGS__)
+/// Wraps LIBPIXI_GENERAL_LOG_DEFERRED with confLevel=pixi_logLevel
+#define LIBPIXI_LOG_DEFERRED(level,         ...) LIBPIXI_GENERAL_LOG_DEFERRED (pixi_logLevel, level,         __VA_ARGS__)
 
 /// Wraps LIBPIXI_LOG with @c level=LogLevelTrace
 #define LIBPIXI_LOG_TRACE(...) LIBPIXI_LOG(LogLevelTrace  , __VA_ARGS__)
@@ -130,6 +208,10 @@ static inline bool pixi_isLogLevelEnabled (LogLevel level) {
 #define LIBPIXI_LOG_ERROR(...) LIBPIXI_LOG(LogLevelError  , __VA_ARGS__)
 #define LIBPIXI_LOG_FATAL(...) LIBPIXI_LOG(LogLevelFatal  , __VA_ARGS__)
 
+/// Wraps LIBPIXI_LOG_DEFERRED with @c level=LogLevelTrace
+#define LIBPIXI_LOG_DEFERRED_TRACE(...) LIBPIXI_LOG_DEFERRED(LogLevelTrace, __VA_ARGS__)
+#define LIBPIXI_LOG_DEFERRED_DEBUG(...) LIBPIXI_LOG_DEFERRED(LogLevelDebug, __VA_ARGS__)
+
 /// Wraps LIBPIXI_STRERROR_LOG with @c level=LogLevelTrace
 #define LIBPIXI_ERROR_TRACE(errnum, ...) LIBPIXI_STRERROR_LOG(LogLevelTrace, errnum, __VA_ARGS__)
 #define LIBPIXI_ERROR_DEBUG(errnum, ...) LIBPIXI_STRERROR_LOG(LogLevelDebug, errnum, __VA_ARGS__)
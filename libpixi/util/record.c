@@ -0,0 +1,409 @@
+/*
+    pixi-tools: a set of software to interface with the Raspberry Pi
+    and PiXi-200 hardware
+    Copyright (C) 2014 Simon Cantrill
+
+    pixi-tools is free software; you can redistribute it and/or
+    modify it under the terms of the GNU Lesser General Public
+    License as published by the Free Software Foundation; either
+    version 2.1 of the License, or (at your option) any later version.
+
+    This library is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+    Lesser General Public License for more details.
+
+    You should have received a copy of the GNU Lesser General Public
+    License along with this library; if not, write to the Free Software
+    Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+*/
+
+#include <libpixi/util/record.h>
+#include <libpixi/util/file.h>
+#include <libpixi/util/log.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+static size_t chunkSize (uint frameCount, uint channelCount)
+{
+	size_t size = sizeof (RecordChunkHeader) + (frameCount * sizeof (uint16) * (1 + channelCount));
+	return (size + 7) & ~(size_t) 7;
+}
+
+/// Write out the buffer. With O_DIRECT only whole blocks can be written,
+/// so unless this is the final flush any partial block is kept.
+static int flushBuffer (RecordWriter* writer, bool final)
+{
+	size_t count = writer->buffered;
+	if (writer->flags & RecordDirectIo)
+	{
+		const size_t align = RecordHeaderAlign;
+		if (final)
+		{
+			size_t padded = (count + align - 1) & ~(align - 1);
+			memset (writer->buffer + count, 0, padded - count);
+			count = padded;
+		}
+		else
+			count &= ~(align - 1);
+	}
+	if (count == 0)
+		return 0;
+
+	ssize_t result = pixi_write (writer->fd, writer->buffer, count);
+	if (result < 0)
+		return result;
+	if ((size_t) result != count)
+		return -EIO;
+
+	if (count < writer->buffered)
+		memmove (writer->buffer, writer->buffer + count, writer->buffered - count);
+	writer->buffered = count < writer->buffered ? writer->buffered - count : 0;
+	return 0;
+}
+
+static int flushChunk (RecordWriter* writer)
+{
+	uint frames = writer->frames;
+	if (frames == 0)
+		return 0;
+
+	size_t size = chunkSize (frames, writer->channelCount);
+	if (writer->buffered + size > (size_t) RecordBufferSize)
+	{
+		int result = flushBuffer (writer, false);
+		if (result < 0)
+			return result;
+	}
+
+	uint8* out = writer->buffer + writer->buffered;
+	RecordChunkHeader header;
+	memset (&header, 0, sizeof (header));
+	header.magic      = RecordChunkMagic;
+	header.frameCount = frames;
+	header.size       = size;
+	header.firstTime  = writer->firstTime;
+	memcpy (out, &header, sizeof (header));
+	out += sizeof (header);
+
+	memcpy (out, writer->deltas, frames * sizeof (uint16));
+	out += frames * sizeof (uint16);
+	for (uint c = 0; c < writer->channelCount; c++)
+	{
+		memcpy (out, writer->columns + ((size_t) c * writer->chunkFrames), frames * sizeof (uint16));
+		out += frames * sizeof (uint16);
+	}
+	memset (out, 0, writer->buffer + writer->buffered + size - out);
+
+	writer->buffered += size;
+	writer->fileSize += size;
+	writer->frames = 0;
+	return 0;
+}
+
+int pixi_recordCreate (RecordWriter* writer, const char* filename, const RecordChannel* channels, uint channelCount, uint timebaseNs, uint flags)
+{
+	LIBPIXI_PRECONDITION_NOT_NULL(writer);
+	LIBPIXI_PRECONDITION_NOT_NULL(filename);
+	LIBPIXI_PRECONDITION_NOT_NULL(channels);
+	LIBPIXI_PRECONDITION(channelCount > 0 && channelCount <= RecordMaxChannels);
+	LIBPIXI_PRECONDITION(timebaseNs > 0);
+	// These structures are the file format
+	LIBPIXI_STATIC_ASSERT(sizeof (RecordHeader)      == 64, "RecordHeader size");
+	LIBPIXI_STATIC_ASSERT(sizeof (RecordChannel)     == 48, "RecordChannel size");
+	LIBPIXI_STATIC_ASSERT(sizeof (RecordChunkHeader) == 24, "RecordChunkHeader size");
+
+	memset (writer, 0, sizeof (*writer));
+	writer->fd = -1;
+	writer->channelCount = channelCount;
+	writer->chunkFrames  = RecordChunkFrames;
+
+	bool toStdout = 0 == strcmp (filename, "-");
+	if (toStdout)
+	{
+		flags &= ~RecordDirectIo;
+		writer->fd = STDOUT_FILENO;
+	}
+	else
+	{
+		int openFlags = O_WRONLY | O_CREAT | O_TRUNC;
+		if (flags & RecordDirectIo)
+		{
+			writer->fd = pixi_open (filename, openFlags | O_DIRECT, 0644);
+			if (writer->fd == -EINVAL)
+			{
+				LIBPIXI_LOG_WARN("O_DIRECT not supported for %s, using buffered writes", filename);
+				flags &= ~RecordDirectIo;
+			}
+		}
+		if (writer->fd < 0 && !(flags & RecordDirectIo))
+			writer->fd = pixi_open (filename, openFlags, 0644);
+		if (writer->fd < 0)
+			return writer->fd;
+	}
+	writer->flags = flags;
+
+	void* buffer = NULL;
+	if (0 != posix_memalign (&buffer, RecordHeaderAlign, RecordBufferSize))
+		buffer = NULL;
+	writer->buffer  = buffer;
+	writer->deltas  = malloc (writer->chunkFrames * sizeof (uint16));
+	writer->columns = malloc ((size_t) writer->chunkFrames * channelCount * sizeof (uint16));
+	if (!writer->buffer || !writer->deltas || !writer->columns)
+	{
+		LIBPIXI_ERROR(ENOMEM, "Could not allocate recording buffers");
+		free (writer->buffer);
+		free (writer->deltas);
+		free (writer->columns);
+		if (!toStdout)
+			pixi_close (writer->fd);
+		writer->fd = -1;
+		return -ENOMEM;
+	}
+
+	struct timespec now;
+	clock_gettime (CLOCK_REALTIME, &now);
+
+	memset (writer->buffer, 0, RecordHeaderAlign);
+	RecordHeader header;
+	memset (&header, 0, sizeof (header));
+	memcpy (header.magic, RecordMagic, sizeof (RecordMagic));
+	header.version      = RecordVersion;
+	header.byteOrder    = RecordByteOrder;
+	header.headerSize   = RecordHeaderAlign;
+	header.channelCount = channelCount;
+	header.chunkFrames  = writer->chunkFrames;
+	header.timebaseNs   = timebaseNs;
+	header.startTime    = (now.tv_sec * (int64) 1000000000) + now.tv_nsec;
+	memcpy (writer->buffer, &header, sizeof (header));
+	memcpy (writer->buffer + sizeof (header), channels, channelCount * sizeof (RecordChannel));
+	writer->buffered = RecordHeaderAlign;
+	writer->fileSize = RecordHeaderAlign;
+
+	return 0;
+}
+
+int pixi_recordWrite (RecordWriter* writer, int64 timestamp, const uint16* samples)
+{
+	LIBPIXI_PRECONDITION_NOT_NULL(writer);
+	LIBPIXI_PRECONDITION(writer->fd >= 0);
+	LIBPIXI_PRECONDITION_NOT_NULL(samples);
+
+	int result = 0;
+	if (writer->frames > 0)
+	{
+		if (timestamp < writer->lastTime)
+		{
+			LIBPIXI_LOG_ERROR("Recording timestamp went backwards (%lld < %lld)", (long long) timestamp, (long long) writer->lastTime);
+			return -EINVAL;
+		}
+		if (timestamp - writer->lastTime > RecordMaxDelta)
+			result = flushChunk (writer);
+	}
+	if (result < 0)
+		return result;
+
+	uint frame = writer->frames;
+	if (frame == 0)
+		writer->firstTime = timestamp;
+	writer->deltas[frame] = frame ? timestamp - writer->lastTime : 0;
+	for (uint c = 0; c < writer->channelCount; c++)
+		writer->columns[((size_t) c * writer->chunkFrames) + frame] = samples[c];
+
+	writer->lastTime = timestamp;
+	writer->frames++;
+	writer->frameCount++;
+	if (writer->frames == writer->chunkFrames)
+		return flushChunk (writer);
+	return 0;
+}
+
+int pixi_recordClose (RecordWriter* writer)
+{
+	LIBPIXI_PRECONDITION_NOT_NULL(writer);
+	LIBPIXI_PRECONDITION(writer->fd >= 0);
+
+	int result = flushChunk (writer);
+	if (result >= 0)
+		result = flushBuffer (writer, true);
+	if (result >= 0 && (writer->flags & RecordDirectIo))
+	{
+		// The last block was padded, so trim the file to its real size
+		if (0 != ftruncate (writer->fd, writer->fileSize))
+		{
+			result = -errno;
+			LIBPIXI_ERRNO_ERROR("Could not truncate recording");
+		}
+	}
+	if (writer->fd != STDOUT_FILENO)
+	{
+		int closeResult = pixi_close (writer->fd);
+		if (result >= 0)
+			result = closeResult;
+	}
+	free (writer->buffer);
+	free (writer->deltas);
+	free (writer->columns);
+	writer->buffer  = NULL;
+	writer->deltas  = NULL;
+	writer->columns = NULL;
+	writer->fd = -1;
+	return result;
+}
+
+/// Check the chunk at @c offset, returning its size or 0 if it's not valid
+static size_t checkChunk (const RecordReader* reader, size_t offset)
+{
+	if (offset + sizeof (RecordChunkHeader) > reader->size)
+		return 0;
+	const RecordChunkHeader* chunk = (const RecordChunkHeader*) (reader->data + offset);
+	if (chunk->magic != RecordChunkMagic
+		|| chunk->frameCount == 0
+		|| chunk->frameCount > reader->header->chunkFrames
+		|| chunk->size < chunkSize (chunk->frameCount, reader->header->channelCount)
+		|| chunk->size > reader->size - offset)
+		return 0;
+	return chunk->size;
+}
+
+int pixi_recordMap (RecordReader* reader, const char* filename)
+{
+	LIBPIXI_PRECONDITION_NOT_NULL(reader);
+	LIBPIXI_PRECONDITION_NOT_NULL(filename);
+
+	memset (reader, 0, sizeof (*reader));
+	int fd = pixi_open (filename, O_RDONLY, 0);
+	if (fd < 0)
+		return fd;
+
+	struct stat st;
+	if (0 != fstat (fd, &st))
+	{
+		int result = -errno;
+		LIBPIXI_ERRNO_ERROR("Could not stat %s", filename);
+		pixi_close (fd);
+		return result;
+	}
+	if ((uint64) st.st_size > SIZE_MAX)
+	{
+		LIBPIXI_LOG_ERROR("%s is too large to map", filename);
+		pixi_close (fd);
+		return -EFBIG;
+	}
+	if ((size_t) st.st_size < sizeof (RecordHeader))
+	{
+		LIBPIXI_LOG_ERROR("%s is not a recording", filename);
+		pixi_close (fd);
+		return -EINVAL;
+	}
+	void* data = mmap (NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+	int result = data == MAP_FAILED ? -errno : 0;
+	pixi_close (fd);
+	if (result < 0)
+	{
+		LIBPIXI_ERROR(-result, "Could not map %s", filename);
+		return result;
+	}
+	reader->data = data;
+	reader->size = st.st_size;
+
+	const RecordHeader* header = (const RecordHeader*) data;
+	if (0 != memcmp (header->magic, RecordMagic, sizeof (RecordMagic))
+		|| header->byteOrder != RecordByteOrder
+		|| header->version != RecordVersion
+		|| header->channelCount == 0
+		|| header->channelCount > RecordMaxChannels
+		|| header->headerSize < sizeof (RecordHeader) + (header->channelCount * sizeof (RecordChannel))
+		|| header->headerSize > reader->size)
+	{
+		LIBPIXI_LOG_ERROR("%s is not a supported recording", filename);
+		pixi_recordUnmap (reader);
+		return -EINVAL;
+	}
+	reader->header   = header;
+	reader->channels = (const RecordChannel*) (reader->data + sizeof (RecordHeader));
+
+	// Index the chunks, stopping at anything that doesn't look like one,
+	// such as the end of a recording that wasn't closed
+	uint count = 0;
+	size_t offset = header->headerSize;
+	for (size_t size; (size = checkChunk (reader, offset)) != 0; offset += size)
+		count++;
+	if (offset != reader->size)
+		LIBPIXI_LOG_WARN("%s: ignoring %zu bytes after the last complete chunk", filename, reader->size - offset);
+
+	reader->chunkOffsets = malloc ((count + 1) * sizeof (uint64));
+	reader->chunkTimes   = malloc ((count + 1) * sizeof (int64));
+	if (!reader->chunkOffsets || !reader->chunkTimes)
+	{
+		pixi_recordUnmap (reader);
+		return -ENOMEM;
+	}
+	offset = header->headerSize;
+	for (uint i = 0; i < count; i++)
+	{
+		const RecordChunkHeader* chunk = (const RecordChunkHeader*) (reader->data + offset);
+		reader->chunkOffsets[i] = offset;
+		reader->chunkTimes[i]   = chunk->firstTime;
+		reader->frameCount     += chunk->frameCount;
+		offset += chunk->size;
+	}
+	reader->chunkCount = count;
+	LIBPIXI_LOG_DEBUG("Mapped recording %s: %u channels, %u chunks, %llu frames",
+		filename, header->channelCount, count, (unsigned long long) reader->frameCount);
+	return 0;
+}
+
+void pixi_recordUnmap (RecordReader* reader)
+{
+	if (!reader)
+		return;
+	if (reader->data)
+		munmap ((void*) reader->data, reader->size);
+	free (reader->chunkOffsets);
+	free (reader->chunkTimes);
+	memset (reader, 0, sizeof (*reader));
+}
+
+int pixi_recordGetChunk (const RecordReader* reader, uint index, RecordChunk* chunk)
+{
+	LIBPIXI_PRECONDITION_NOT_NULL(reader);
+	LIBPIXI_PRECONDITION_NOT_NULL(chunk);
+	LIBPIXI_PRECONDITION(index < reader->chunkCount);
+
+	const uint8* data = reader->data + reader->chunkOffsets[index];
+	const RecordChunkHeader* header = (const RecordChunkHeader*) data;
+	chunk->frameCount = header->frameCount;
+	chunk->firstTime  = header->firstTime;
+	chunk->deltas     = (const uint16*) (data + sizeof (RecordChunkHeader));
+	chunk->columns    = chunk->deltas + header->frameCount;
+	return 0;
+}
+
+int pixi_recordSeek (const RecordReader* reader, int64 timestamp)
+{
+	LIBPIXI_PRECONDITION_NOT_NULL(reader);
+
+	if (reader->chunkCount == 0)
+		return -ENOENT;
+
+	// Last chunk starting at or before timestamp
+	uint low = 0;
+	uint high = reader->chunkCount;
+	while (high - low > 1)
+	{
+		uint mid = low + ((high - low) / 2);
+		if (reader->chunkTimes[mid] <= timestamp)
+			low = mid;
+		else
+			high = mid;
+	}
+	return low;
+}
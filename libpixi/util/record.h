@@ -0,0 +1,218 @@
+/*
+    pixi-tools: a set of software to interface with the Raspberry Pi
+    and PiXi-200 hardware
+    Copyright (C) 2014 Simon Cantrill
+
+    pixi-tools is free software; you can redistribute it and/or
+    modify it under the terms of the GNU Lesser General Public
+    License as published by the Free Software Foundation; either
+    version 2.1 of the License, or (at your option) any later version.
+
+    This library is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+    Lesser General Public License for more details.
+
+    You should have received a copy of the GNU Lesser General Public
+    License along with this library; if not, write to the Free Software
+    Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+*/
+
+#ifndef libpixi_util_record_h__included
+#define libpixi_util_record_h__included
+
+
+#include <libpixi/common.h>
+#include <stddef.h>
+
+LIBPIXI_BEGIN_DECLS
+
+///@defgroup util_record libpixi binary recording format
+/// A compact format for recording sample streams (ADC, MPU, GPIO, ...).
+///
+/// A recording starts with a RecordHeader followed by one RecordChannel
+/// descriptor per channel, padded to RecordHeaderAlign bytes. After that
+/// come chunks, each holding up to RecordHeader.chunkFrames frames: a
+/// RecordChunkHeader, one uint16 timestamp delta per frame, then one
+/// column of 16 bit samples per channel. Timestamps are in units of
+/// RecordHeader.timebaseNs; the first frame in a chunk is at
+/// RecordChunkHeader.firstTime and each delta is relative to the previous
+/// frame. Everything is in host byte order, which is checked using
+/// RecordHeader.byteOrder.
+///
+/// Recordings are written using a large buffer (optionally with O_DIRECT)
+/// and read by mapping the file into memory, so they can be replayed or
+/// searched without being parsed.
+///@{
+
+#define RecordMagic      "PIXIREC"
+#define RecordChunkMagic 0x4b4e4843 ///< "CHNK"
+
+enum
+{
+	RecordVersion      = 1,
+	RecordByteOrder    = 0x0102,
+	RecordHeaderAlign  = 4096,  ///< header size and O_DIRECT write granularity
+	RecordChunkFrames  = 1024,  ///< default frames per chunk
+	RecordBufferSize   = 0x40000, ///< size of the writer's output buffer
+	RecordMaxChannels  = 64,
+	RecordMaxDelta     = 0xffff ///< larger gaps between frames start a new chunk
+};
+
+///	Where the samples in a channel came from.
+typedef enum RecordSource
+{
+	RecordSourceOther    = 0,
+	RecordSourceAdc      = 1,
+	RecordSourceMpuAccel = 2,
+	RecordSourceMpuGyro  = 3,
+	RecordSourceMpuTemp  = 4,
+	RecordSourceMpuMag   = 5,
+	RecordSourceGpio     = 6,
+	RecordSourceRegister = 7,
+	RecordSourceDac      = 8
+} RecordSource;
+
+///	Sample types
+typedef enum RecordType
+{
+	RecordUint16 = 0,
+	RecordInt16  = 1
+} RecordType;
+
+///	Writer flags
+enum RecordFlags
+{
+	RecordDirectIo = 0x01 ///< write the file using O_DIRECT
+};
+
+///	Fixed size start of a recording file.
+typedef struct RecordHeader
+{
+	char    magic[8];     ///< RecordMagic
+	uint16  version;      ///< RecordVersion
+	uint16  byteOrder;    ///< RecordByteOrder
+	uint32  headerSize;   ///< offset of the first chunk
+	uint32  channelCount; ///< number of RecordChannel descriptors following the header
+	uint32  chunkFrames;  ///< maximum frames per chunk
+	uint32  timebaseNs;   ///< timestamp unit in nanoseconds
+	uint32  _reserved1;
+	int64   startTime;    ///< wall clock time (ns since the Unix epoch) the recording was created
+	uint32  _reserved2[6];
+} RecordHeader;
+
+///	Description of one channel. A physical value is (sample * scale) + offset.
+typedef struct RecordChannel
+{
+	char    name[16];     ///< e.g. "adc0", "accel-x"
+	char    unit[8];      ///< unit of the physical value, e.g. "V", "g"
+	uint16  source;       ///< RecordSource
+	uint16  index;        ///< channel/pin/register number within the source
+	uint16  type;         ///< RecordType
+	uint16  _reserved1;
+	float   scale;
+	float   offset;
+	uint32  _reserved2[2];
+} RecordChannel;
+
+///	Start of each chunk of frames.
+typedef struct RecordChunkHeader
+{
+	uint32  magic;        ///< RecordChunkMagic
+	uint32  frameCount;   ///< number of frames in the chunk
+	uint32  size;         ///< total size of the chunk in bytes, including this header
+	uint32  _reserved;
+	int64   firstTime;    ///< timestamp of the first frame
+} RecordChunkHeader;
+
+///	Writes a recording. Frames are gathered into chunks and written out
+///	through a RecordBufferSize buffer.
+typedef struct RecordWriter
+{
+	int     fd;
+	uint    flags;
+	uint    channelCount;
+	uint    chunkFrames;
+	uint    frames;       ///< frames in the current chunk
+	int64   firstTime;    ///< timestamp of the first frame in the current chunk
+	int64   lastTime;     ///< timestamp of the last frame written
+	uint16* deltas;       ///< internal: current chunk's timestamp deltas
+	uint16* columns;      ///< internal: current chunk's samples, one column per channel
+	uint8*  buffer;       ///< internal: output buffer
+	size_t  buffered;     ///< bytes in @c buffer
+	uint64  fileSize;     ///< bytes written to the file, excluding padding
+	uint64  frameCount;   ///< total frames written
+	intptr  _reserved[2];
+} RecordWriter;
+
+///	Create a recording.
+///	@param filename file to create, or "-" for stdout
+///	@param channels array of @c channelCount channel descriptors
+///	@param timebaseNs unit of the timestamps passed to pixi_recordWrite, in nanoseconds
+///	@param flags combination of RecordFlags
+///	@return 0 on success, -errno on error
+int pixi_recordCreate (RecordWriter* writer, const char* filename, const RecordChannel* channels, uint channelCount, uint timebaseNs, uint flags);
+
+///	Add one frame (one sample per channel) at @c timestamp, which must
+///	not be earlier than the previous frame.
+///	@return 0 on success, -errno on error
+int pixi_recordWrite (RecordWriter* writer, int64 timestamp, const uint16* samples);
+
+///	Flush buffered frames and close the recording.
+///	@return 0 on success, -errno on error
+int pixi_recordClose (RecordWriter* writer);
+
+///	Read access to one chunk of a mapped recording.
+typedef struct RecordChunk
+{
+	uint          frameCount;
+	int64         firstTime;
+	const uint16* deltas;  ///< timestamp deltas, @c frameCount values
+	const uint16* columns; ///< samples, @c frameCount values per channel
+} RecordChunk;
+
+///	A recording mapped into memory.
+typedef struct RecordReader
+{
+	const uint8*         data;
+	size_t               size;
+	const RecordHeader*  header;
+	const RecordChannel* channels;
+	uint                 chunkCount;
+	uint64*              chunkOffsets; ///< internal
+	int64*               chunkTimes;   ///< internal: first timestamp of each chunk
+	uint64               frameCount;   ///< total frames in the recording
+	intptr               _reserved[2];
+} RecordReader;
+
+///	Map a recording into memory and index its chunks.
+///	@return 0 on success, -errno on error
+int pixi_recordMap (RecordReader* reader, const char* filename);
+
+///	Unmap a recording mapped with pixi_recordMap.
+void pixi_recordUnmap (RecordReader* reader);
+
+///	Get chunk number @c index of a recording.
+///	@return 0 on success, -errno on error
+int pixi_recordGetChunk (const RecordReader* reader, uint index, RecordChunk* chunk);
+
+///	Find the chunk containing @c timestamp.
+///	@return chunk index, or -errno on error
+int pixi_recordSeek (const RecordReader* reader, int64 timestamp);
+
+///	Get the samples of @c channel from @c chunk.
+static inline const uint16* recordChunkColumn (const RecordChunk* chunk, uint channel) {
+	return chunk->columns + ((size_t) channel * chunk->frameCount);
+}
+
+///	Convert a raw sample from @c channel to a physical value.
+static inline double recordChannelValue (const RecordChannel* channel, uint16 sample) {
+	double value = channel->type == RecordInt16 ? (double) (int16) sample : (double) sample;
+	return (value * channel->scale) + channel->offset;
+}
+
+///@} defgroup
+
+LIBPIXI_END_DECLS
+
+#endif // !defined libpixi_util_record_h__included
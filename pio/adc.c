@@ -24,6 +24,7 @@
 #include "common.h"
 #include "log.h"
 #include <stdio.h>
+#include <stdlib.h>
 
 static int adcReadFn (const Command* command, uint argc, char* argv[])
 {
@@ -32,8 +33,10 @@ static int adcReadFn (const Command* command, uint argc, char* argv[])
 
 	uint adcChannel = pixi_parseLong (argv[1]);
 
-	adcOpenOrDie();
-	int result = adcRead (adcChannel);
+	int result = adcOpen();
+	if (result < 0)
+		return result;
+	result = adcRead (adcChannel);
 	adcClose();
 	if (result < 0)
 	{
@@ -52,11 +55,136 @@ static Command adcReadCmd =
 	.function    = adcReadFn
 };
 
+static int adcOversampleFn (const Command* command, uint argc, char* argv[])
+{
+	if (argc != 3)
+		return commandUsageError (command);
+
+	uint adcChannel = pixi_parseLong (argv[1]);
+	uint extraBits  = pixi_parseLong (argv[2]);
+
+	int result = adcOpen();
+	if (result < 0)
+		return result;
+	result = pixi_adcReadOversampled (adcChannel, extraBits);
+	adcClose();
+	if (result < 0)
+	{
+		PIO_ERROR(-result, "ADC oversampled read failed");
+		return result;
+	}
+
+	printf ("%u\n", result);
+	return 0;
+}
+static Command adcOversampleCmd =
+{
+	.name        = "adc-oversample",
+	.description = "read an ADC channel with extra bits of resolution",
+	.usage       = "usage: %s CHANNEL EXTRA-BITS(0-4)",
+	.function    = adcOversampleFn
+};
+
+static int parseTriggerMode (const char* mode)
+{
+	if (0 == strcasecmp (mode, "above"  )) return AdcTriggerAbove;
+	if (0 == strcasecmp (mode, "below"  )) return AdcTriggerBelow;
+	if (0 == strcasecmp (mode, "rising" )) return AdcTriggerRising;
+	if (0 == strcasecmp (mode, "falling")) return AdcTriggerFalling;
+	return -EINVAL;
+}
+
+static int adcCapture (const uint* channels, uint channelCount, AdcTriggerMode mode, uint threshold, uint hysteresis, uint pre, uint post)
+{
+	AdcCapture capture;
+	int result = pixi_adcCaptureInit (&capture, channels, channelCount, pre, post);
+	if (result < 0)
+	{
+		PIO_ERROR(-result, "Could not set up the ADC capture");
+		return result;
+	}
+	result = pixi_adcCaptureSetTrigger (&capture, 0, mode, threshold, hysteresis);
+	if (result < 0)
+	{
+		PIO_ERROR(-result, "Could not set the ADC capture trigger");
+		pixi_adcCaptureFree (&capture);
+		return result;
+	}
+
+	result = adcOpen();
+	if (result < 0)
+	{
+		PIO_ERROR(-result, "Could not open the ADC for capture");
+		pixi_adcCaptureFree (&capture);
+		return result;
+	}
+	result = pixi_adcCaptureRun (&capture, -1);
+	adcClose();
+
+	uint16* frames = malloc ((pre + post) * channelCount * sizeof (uint16));
+	if (result > 0 && frames)
+	{
+		uint trigger = 0;
+		result = pixi_adcCaptureGet (&capture, frames, pre + post, &trigger);
+		printf ("# frame-period-ns=%u trigger-frame=%u\n", capture.framePeriodNs, trigger);
+		for (int f = 0; f < result; f++)
+		{
+			printf ("%d", f - (int) trigger);
+			for (uint c = 0; c < channelCount; c++)
+				printf (" %u", frames[(f * channelCount) + c]);
+			printf ("\n");
+		}
+	}
+	else if (!frames)
+		result = -ENOMEM;
+	free (frames);
+	pixi_adcCaptureFree (&capture);
+	if (result < 0)
+		PIO_ERROR(-result, "ADC capture failed");
+	return result;
+}
+
+static int adcCaptureFn (const Command* command, uint argc, char* argv[])
+{
+	if (argc < 4 || argc > 7)
+		return commandUsageError (command);
+
+	uint channels[PixiAdcMaxChannels];
+	uint channelCount = 0;
+	char* save = NULL;
+	for (char* tok = strtok_r (argv[1], ",", &save); tok; tok = strtok_r (NULL, ",", &save))
+	{
+		if (channelCount == PixiAdcMaxChannels)
+			return commandUsageError (command);
+		channels[channelCount++] = pixi_parseLong (tok);
+	}
+	int mode = parseTriggerMode (argv[2]);
+	if (channelCount == 0 || mode < 0)
+		return commandUsageError (command);
+
+	uint threshold  = pixi_parseLong (argv[3]);
+	uint hysteresis = argc > 4 ? pixi_parseLong (argv[4]) : 0;
+	uint pre        = argc > 5 ? pixi_parseLong (argv[5]) : 1000;
+	uint post       = argc > 6 ? pixi_parseLong (argv[6]) : 1000;
+
+	return adcCapture (channels, channelCount, mode, threshold, hysteresis, pre, post);
+}
+static Command adcCaptureCmd =
+{
+	.name        = "adc-capture",
+	.description = "capture ADC channels around a trigger event",
+	.usage       = "usage: %s CHANNEL[,CHANNEL...] above|below|rising|falling THRESHOLD [HYSTERESIS [PRE-FRAMES [POST-FRAMES]]]\n"
+	               "    The first channel is the trigger channel. Prints one line per frame,\n"
+	               "    starting with the frame number relative to the trigger.",
+	.function    = adcCaptureFn
+};
+
 static int adcMonitor (void)
 {
-	adcOpenOrDie();
+	int result = adcOpen();
+	if (result < 0)
+		return result;
 
-	int result = 0;
 	while (true)
 	{
 		printf ("\r");
@@ -99,6 +227,8 @@ static Command adcMonitorCmd =
 static const Command* commands[] =
 {
 	&adcReadCmd,
+	&adcOversampleCmd,
+	&adcCaptureCmd,
 	&adcMonitorCmd,
 };
 
@@ -0,0 +1,269 @@
+/*
+    pixi-tools: a set of software to interface with the Raspberry Pi
+    and PiXi-200 hardware
+    Copyright (C) 2014 Simon Cantrill
+
+    pixi-tools is free software; you can redistribute it and/or
+    modify it under the terms of the GNU Lesser General Public
+    License as published by the Free Software Foundation; either
+    version 2.1 of the License, or (at your option) any later version.
+
+    This library is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+    Lesser General Public License for more details.
+
+    You should have received a copy of the GNU Lesser General Public
+    License along with this library; if not, write to the Free Software
+    Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+*/
+
+#include <libpixi/libpixi.h>
+#include <libpixi/util/clock.h>
+#include <libpixi/util/string.h>
+#include "common.h"
+#include "log.h"
+#include <stdio.h>
+#include <string.h>
+#include <strings.h>
+#include <unistd.h>
+
+enum
+{
+	BatchMaxLine = 8192,
+	BatchMaxArgs = 1024,
+	BatchMaxDepth = 16 ///< most nested batch files, e.g. to stop one that runs itself
+};
+
+typedef struct BatchOptions
+{
+	bool  timing;    ///< print the time taken by each command
+	bool  keepGoing; ///< carry on after a failed command
+} BatchOptions;
+
+/// Commands that are being run (nested batch files)
+static uint batchDepth = 0;
+
+///	Split @c line in place into words separated by white space. A word
+///	can be quoted with ' or ", and # outside a word starts a comment.
+///	@return the word count, or -EINVAL on error
+static int splitLine (char* line, char* args[], uint maxArgs)
+{
+	uint count = 0;
+	char* in = line;
+	while (true)
+	{
+		while (*in == ' ' || *in == '\t' || *in == '\r' || *in == '\n')
+			in++;
+		if (*in == '\0' || *in == '#')
+			break;
+		if (count == maxArgs)
+		{
+			PIO_LOG_ERROR("More than %u arguments", maxArgs);
+			return -EINVAL;
+		}
+		char* out = in;
+		args[count++] = out;
+		while (*in && *in != ' ' && *in != '\t' && *in != '\r' && *in != '\n')
+		{
+			if (*in == '\'' || *in == '"')
+			{
+				char quote = *in++;
+				while (*in && *in != quote)
+					*out++ = *in++;
+				if (*in != quote)
+				{
+					PIO_LOG_ERROR("Unterminated %c quote", quote);
+					return -EINVAL;
+				}
+				in++;
+			}
+			else
+				*out++ = *in++;
+		}
+		bool end = (*in == '\0');
+		*out = '\0';
+		if (end)
+			break;
+		in++;
+	}
+	return count;
+}
+
+///	Run the commands read from @c input, one per line.
+///	@return 0 if all commands succeeded, otherwise the last failure
+static int runCommands (FILE* input, const char* name, const char* prompt, const BatchOptions* options)
+{
+	static char line[BatchMaxLine];
+	char* args[BatchMaxArgs];
+	int failure = 0;
+	uint lineNumber = 0;
+	uint commandCount = 0;
+	int64 totalNs = 0;
+
+	if (batchDepth == BatchMaxDepth)
+	{
+		PIO_LOG_ERROR("%s: batch files nested more than %u deep", name, BatchMaxDepth);
+		return -ELOOP;
+	}
+	if (batchDepth++ == 0)
+		pixi_holdDevices (true);
+	while (true)
+	{
+		if (prompt)
+		{
+			fputs (prompt, stdout);
+			fflush (stdout);
+		}
+		if (!fgets (line, sizeof (line), input))
+			break;
+		lineNumber++;
+		if (!strchr (line, '\n') && !feof (input))
+		{
+			PIO_LOG_ERROR("%s:%u: line is too long", name, lineNumber);
+			failure = -EINVAL;
+			break;
+		}
+
+		int argc = splitLine (line, args, BatchMaxArgs);
+		if (argc == 0)
+			continue;
+		int result = argc;
+		const Command* command = NULL;
+		if (argc > 0)
+		{
+			if (prompt && (0 == strcasecmp (args[0], "quit") || 0 == strcasecmp (args[0], "exit")))
+				break;
+			command = pixi_commandFind (args[0]);
+			if (!command)
+			{
+				PIO_LOG_ERROR("%s:%u: unknown command: %s", name, lineNumber, args[0]);
+				result = -EINVAL;
+			}
+		}
+		if (command)
+		{
+			int64 start = pixi_clockGetNs();
+			result = command->function (command, argc, args);
+			int64 elapsed = pixi_clockGetNs() - start;
+			fflush (stdout);
+			commandCount++;
+			totalNs += elapsed;
+			if (options->timing)
+				fprintf (stderr, "%s:%u: %s took %.3f ms\n", name, lineNumber, command->name, elapsed / 1e6);
+			if (result < 0)
+				PIO_LOG_ERROR("%s:%u: %s failed", name, lineNumber, command->name);
+		}
+		if (result < 0)
+		{
+			failure = result;
+			if (!options->keepGoing)
+				break;
+		}
+	}
+	if (--batchDepth == 0)
+		pixi_holdDevices (false);
+
+	if (options->timing)
+		fprintf (stderr, "%s: %u commands took %.3f ms\n", name, commandCount, totalNs / 1e6);
+	return failure;
+}
+
+///	Parse the leading options of the batch/shell commands.
+///	@return the index of the first non-option argument, or -EINVAL
+static int parseOptions (const Command* command, uint argc, char* argv[], BatchOptions* options)
+{
+	uint i = 1;
+	for (; i < argc && argv[i][0] == '-' && argv[i][1]; i++)
+	{
+		if (0 == strcmp (argv[i], "-t"))
+			options->timing = true;
+		else if (0 == strcmp (argv[i], "-k"))
+			options->keepGoing = true;
+		else
+			return commandUsageError (command);
+	}
+	return i;
+}
+
+static int batchFn (const Command* command, uint argc, char* argv[])
+{
+	BatchOptions options = {false, false};
+	int first = parseOptions (command, argc, argv, &options);
+	if (first < 0)
+		return first;
+	if (argc > (uint) first + 1)
+		return commandUsageError (command);
+
+	const char* filename = (argc > (uint) first) ? argv[first] : "-";
+	if (0 == strcmp (filename, "-"))
+		return runCommands (stdin, "stdin", NULL, &options);
+
+	FILE* input = fopen (filename, "r");
+	if (!input)
+	{
+		int err = errno;
+		PIO_ERROR(err, "Could not open %s", filename);
+		return -err;
+	}
+	int result = runCommands (input, filename, NULL, &options);
+	fclose (input);
+	return result;
+}
+static Command batchCmd =
+{
+	.name        = "batch",
+	.description = "run commands from a file or stdin, keeping devices open",
+	.usage       = "usage: %s [-t] [-k] [FILE]\n"
+	               "    Runs one command per line from FILE, or stdin if FILE is absent or -.\n"
+	               "    Words can be quoted with ' or \", and # starts a comment.\n"
+	               "    The PiXi, ADC and i2c devices are opened when first used and kept open.\n"
+	               "    -t  print the time taken by each command\n"
+	               "    -k  keep going after a command fails",
+	.function    = batchFn
+};
+
+static int shellFn (const Command* command, uint argc, char* argv[])
+{
+	BatchOptions options = {false, true};
+	int first = parseOptions (command, argc, argv, &options);
+	if (first < 0)
+		return first;
+	if (argc != (uint) first)
+		return commandUsageError (command);
+
+	const char* prompt = isatty (STDIN_FILENO) ? "pio> " : NULL;
+	runCommands (stdin, "shell", prompt, &options);
+	if (prompt)
+		printf ("\n");
+	return 0;
+}
+static Command shellCmd =
+{
+	.name        = "shell",
+	.description = "run commands interactively, keeping devices open",
+	.usage       = "usage: %s [-t]\n"
+	               "    Reads commands from stdin as for batch, until quit, exit or end of file.\n"
+	               "    -t  print the time taken by each command",
+	.function    = shellFn
+};
+
+
+static const Command* commands[] =
+{
+	&batchCmd,
+	&shellCmd,
+};
+
+static CommandGroup batchGroup =
+{
+	.name      = "batch",
+	.count     = ARRAY_COUNT(commands),
+	.commands  = commands,
+	.nextGroup = NULL
+};
+
+static void PIO_CONSTRUCTOR (1990) initGroup (void)
+{
+	addCommandGroup (&batchGroup);
+}
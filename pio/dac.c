@@ -19,8 +19,13 @@
 */
 
 #include <libpixi/pixi/dac.h>
+#include <libpixi/pixi/dac-player.h>
 #include <libpixi/util/string.h>
+#include <errno.h>
 #include <stdio.h>
+#include <stdlib.h>
+#include <strings.h>
+#include <unistd.h>
 #include "common.h"
 #include "log.h"
 
@@ -60,9 +65,209 @@ static Command dacWriteCmd =
 };
 
 
+static int parseLatchMode (const char* mode)
+{
+	if (0 == strcasecmp (mode, "immediate")) return PixiDacLatchImmediate;
+	if (0 == strcasecmp (mode, "together" )) return PixiDacLatchTogether;
+	return -EINVAL;
+}
+
+static int dacWriteChannelsFn (const Command* command, uint argc, char* argv[])
+{
+	if (argc != 1 + PixiDacChannels && argc != 2 + PixiDacChannels)
+		return commandUsageError (command);
+
+	uint16 values[PixiDacChannels];
+	for (uint i = 0; i < PixiDacChannels; i++)
+		values[i] = pixi_parseLong (argv[1 + i]);
+	int mode = argc > 1 + PixiDacChannels ? parseLatchMode (argv[1 + PixiDacChannels]) : PixiDacLatchImmediate;
+	if (mode < 0)
+		return commandUsageError (command);
+
+	int result = pixi_dacOpen();
+	if (result < 0)
+		return result;
+	pixi_dacSetLatchMode (mode);
+	result = pixi_dacWriteChannels (values);
+	pixi_dacClose();
+
+	return result;
+}
+
+static Command dacWriteChannelsCmd =
+{
+	.name        = "dac-write-channels",
+	.description = "Write values to all DAC channels in one i2c transfer",
+	.usage       = "usage: %s VALUE0 VALUE1 VALUE2 VALUE3 [immediate|together]\n"
+	               "    With 'together', all outputs change at the same moment.",
+	.function    = dacWriteChannelsFn
+};
+
+
+static int parseWaveform (const char* shape)
+{
+	if (0 == strcasecmp (shape, "sine"    )) return DacWaveSine;
+	if (0 == strcasecmp (shape, "triangle")) return DacWaveTriangle;
+	if (0 == strcasecmp (shape, "square"  )) return DacWaveSquare;
+	if (0 == strcasecmp (shape, "sawtooth")) return DacWaveSawtooth;
+	return -EINVAL;
+}
+
+static void printPlayerStats (DacPlayer* player)
+{
+	DacPlayerStats stats;
+	pixi_dacPlayerGetStats (player, &stats);
+	printf ("frames=%llu underruns=%llu deadline-misses=%llu max-lateness-us=%lld\n",
+		(unsigned long long) stats.frames,
+		(unsigned long long) stats.underruns,
+		(unsigned long long) stats.deadlineMisses,
+		(long long) stats.maxLatenessNs / 1000);
+}
+
+static int dacPlay (uint channel, DacWaveform shape, double frequency, uint rate, double seconds, uint amplitude, uint offset)
+{
+	uint16 table[DacPlayerMaxWavetable];
+	uint length = DacPlayerMaxWavetable;
+	DacPlayer player;
+	pixi_dacPlayerInit (&player, rate);
+	player.priority = 50;
+	int result = pixi_dacWaveGenerate (table, length, shape, amplitude, offset);
+	if (result >= 0)
+		result = pixi_dacPlayerSetWave (&player, channel, table, length, frequency);
+	if (result >= 0)
+		result = pixi_dacOpen();
+	if (result < 0)
+	{
+		pixi_dacPlayerFree (&player);
+		return result;
+	}
+
+	result = pixi_dacPlayerStart (&player);
+	if (result >= 0)
+	{
+		usleep (seconds * 1000000);
+		result = pixi_dacPlayerStop (&player);
+		printPlayerStats (&player);
+	}
+	pixi_dacClose();
+	pixi_dacPlayerFree (&player);
+	return result;
+}
+
+static int dacPlayFn (const Command* command, uint argc, char* argv[])
+{
+	if (argc < 4 || argc > 8)
+		return commandUsageError (command);
+
+	uint channel     = pixi_parseLong (argv[1]);
+	int shape        = parseWaveform (argv[2]);
+	double frequency = atof (argv[3]);
+	uint rate        = argc > 4 ? pixi_parseLong (argv[4]) : 1000;
+	double seconds   = argc > 5 ? atof (argv[5]) : 10;
+	uint amplitude   = argc > 6 ? pixi_parseLong (argv[6]) : 2047;
+	uint offset      = argc > 7 ? pixi_parseLong (argv[7]) : 2048;
+	if (channel >= PixiDacChannels || shape < 0 || rate == 0)
+		return commandUsageError (command);
+
+	return dacPlay (channel, shape, frequency, rate, seconds, amplitude, offset);
+}
+
+static Command dacPlayCmd =
+{
+	.name        = "dac-play",
+	.description = "play a waveform on a DAC channel",
+	.usage       = "usage: %s CHANNEL sine|triangle|square|sawtooth FREQUENCY [RATE [SECONDS [AMPLITUDE [OFFSET]]]]\n"
+	               "    RATE is in DAC updates per second (default 1000), AMPLITUDE and OFFSET in DAC units.",
+	.function    = dacPlayFn
+};
+
+static int dacStream (uint rate)
+{
+	DacPlayer player;
+	pixi_dacPlayerInit (&player, rate);
+	player.priority = 50;
+	int result = pixi_dacOpen();
+	if (result < 0)
+		return result;
+
+	uint16 frames[DacPlayerBlockFrames * PixiDacChannels];
+	uint count = 0;
+	bool started = false;
+	uint values[PixiDacChannels];
+	while (result >= 0)
+	{
+		bool eof = 4 != scanf ("%u %u %u %u", &values[0], &values[1], &values[2], &values[3]);
+		if (!eof)
+		{
+			for (uint c = 0; c < PixiDacChannels; c++)
+				frames[(count * PixiDacChannels) + c] = values[c] > 4095 ? 4095 : values[c];
+			count++;
+		}
+		if (count == DacPlayerBlockFrames || (eof && count > 0))
+		{
+			// Queue the whole block, waiting for the player to free buffers
+			for (uint queued = 0; queued < count && result >= 0; )
+			{
+				result = pixi_dacPlayerQueue (&player, frames + (queued * PixiDacChannels), count - queued, -1);
+				if (result > 0)
+					queued += result;
+				else if (result == 0)
+					result = -EPIPE; // playback has stopped
+				if (result >= 0 && !started)
+				{
+					result = pixi_dacPlayerStart (&player);
+					started = result >= 0;
+				}
+			}
+			count = 0;
+		}
+		if (eof)
+			break;
+	}
+	if (started)
+	{
+		// Wait for the queued frames to be played
+		int drainResult = pixi_dacPlayerDrain (&player, -1);
+		if (result >= 0)
+			result = drainResult;
+		int stopResult = pixi_dacPlayerStop (&player);
+		if (result >= 0)
+			result = stopResult;
+		printPlayerStats (&player);
+	}
+	pixi_dacClose();
+	pixi_dacPlayerFree (&player);
+	return result;
+}
+
+static int dacStreamFn (const Command* command, uint argc, char* argv[])
+{
+	if (argc != 2)
+		return commandUsageError (command);
+
+	uint rate = pixi_parseLong (argv[1]);
+	if (rate == 0)
+		return commandUsageError (command);
+
+	return dacStream (rate);
+}
+
+static Command dacStreamCmd =
+{
+	.name        = "dac-stream",
+	.description = "play frames of DAC values read from stdin",
+	.usage       = "usage: %s RATE\n"
+	               "    Reads lines of four values (one per channel), and plays them at RATE frames per second.",
+	.function    = dacStreamFn
+};
+
+
 static const Command* commands[] =
 {
 	&dacWriteCmd,
+	&dacWriteChannelsCmd,
+	&dacPlayCmd,
+	&dacStreamCmd,
 };
 
 
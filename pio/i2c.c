@@ -19,6 +19,7 @@
 */
 
 #include <libpixi/pi/i2c.h>
+#include <libpixi/pi/i2c-bus.h>
 #include <libpixi/util/file.h>
 #include <libpixi/util/string.h>
 #include <stdio.h>
@@ -48,7 +49,7 @@ static int i2cTransfer (const Command* command, uint argc, char* argv[])
 	}
 
 	I2cDevice dev = I2C_DEVICE_INIT;
-	int result = pixi_i2cOpen2 (channel, address, &dev);
+	int result = pixi_i2cBusOpen (channel, address, &dev);
 	if (result < 0)
 	{
 		PIO_ERROR(-result, "Couldn't open flash I2C channel");
@@ -78,7 +79,7 @@ static int i2cTransfer (const Command* command, uint argc, char* argv[])
 		PIO_LOG_FATAL("Failed to allocate buffers of size %u and %u", rxSize, txSize);
 		result = -ENOMEM;
 	}
-	pixi_i2cClose (&dev);
+	pixi_i2cBusClose (&dev);
 
 	free (tx);
 	free (rx);
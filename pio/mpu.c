@@ -19,10 +19,16 @@
 */
 
 #include <libpixi/pixi/mpu.h>
+#include <libpixi/pixi/mpu-attitude.h>
+#include <libpixi/pixi/mpu-calibration.h>
+#include <libpixi/util/clock.h>
 #include <libpixi/util/file.h>
 #include <libpixi/util/io.h>
 #include <libpixi/util/string.h>
+#include <math.h>
 #include <stdio.h>
+#include <stdlib.h>
+#include <strings.h>
 #include "common.h"
 #include "log.h"
 
@@ -40,7 +46,10 @@ static int mpuOpenInit (void)
 	int result = pixi_mpuOpen();
 	if (result < 0)
 		return result;
-	return mpuInit();
+	result = mpuInit();
+	if (result < 0)
+		pixi_mpuClose();
+	return result;
 }
 
 static int mpuMagOpenInit (void)
@@ -321,6 +330,503 @@ static Command mpuMonitorMotionCmd =
 };
 
 
+static int mpuStreamMotion (double seconds, uint divider, uint dlpf)
+{
+	int result = mpuOpenInit();
+	if (result < 0)
+		return result;
+
+	result = pixi_mpuConfigureFifo (MpuFifoMotion, divider, dlpf);
+	if (result < 0)
+	{
+		pixi_mpuClose();
+		return result;
+	}
+
+	// Read when the FIFO is about half full
+	MpuMotion motions[MpuFifoSize / sizeof (MpuMotion)];
+	const double rate = (dlpf == 0 ? 8000.0 : 1000.0) / (1 + divider);
+	const useconds_t pause = 1e6 * (ARRAY_COUNT(motions) / 2) / rate;
+	uint64 samples = 0;
+	uint overflows = 0;
+	uint reads = 0;
+	int64 start = pixi_clockGetNs();
+	int64 end = start + (int64) (seconds * 1e9);
+	for (int64 now = start; now < end; now = pixi_clockGetNs())
+	{
+		result = pixi_mpuReadFifo (motions, ARRAY_COUNT(motions));
+		reads++;
+		if (result == -EOVERFLOW)
+		{
+			overflows++;
+			continue;
+		}
+		if (result < 0)
+			break;
+		for (int i = 0; i < result; i++)
+		{
+			const MpuMotion* m = &motions[i];
+			printf ("%d %d %d %d %d %d %d\n",
+				m->accel.x, m->accel.y, m->accel.z, m->temp, m->gyro.x, m->gyro.y, m->gyro.z);
+		}
+		samples += result;
+		usleep (pause);
+	}
+	double elapsed = (pixi_clockGetNs() - start) / 1e9;
+	fprintf (stderr, "%llu samples in %.3fs (%.1f/s), %u FIFO reads, %u overflows\n",
+		(unsigned long long) samples, elapsed, samples / elapsed, reads, overflows);
+
+	pixi_mpuDisableFifo();
+	pixi_mpuClose();
+
+	return result < 0 ? result : 0;
+}
+
+static int mpuStreamMotionFn (const Command* command, uint argc, char* argv[])
+{
+	if (argc < 2 || argc > 4)
+		return commandUsageError (command);
+
+	double seconds = atof (argv[1]);
+	uint divider   = argc > 2 ? pixi_parseLong (argv[2]) : 0;
+	uint dlpf      = argc > 3 ? pixi_parseLong (argv[3]) : 1;
+	if (seconds <= 0 || divider > 255 || dlpf > 6)
+		return commandUsageError (command);
+
+	return mpuStreamMotion (seconds, divider, dlpf);
+}
+static Command mpuStreamMotionCmd =
+{
+	.name        = "mpu-stream-motion",
+	.description = "Stream every MPU motion sample using the FIFO",
+	.usage       = "usage: %s SECONDS [RATE-DIVIDER [DLPF]]\n"
+	               "    Prints raw accel x,y,z, temperature and gyro x,y,z for each sample.\n"
+	               "    The sample rate is 1kHz / (1 + RATE-DIVIDER) (8kHz when DLPF is 0).",
+	.function    = mpuStreamMotionFn
+};
+
+
+static int mpuSampleMotion (uint pin, double seconds, uint divider)
+{
+	int pinFd = pixi_mpuOpenInterruptPin (pin);
+	if (pinFd < 0)
+		return pinFd;
+
+	int result = mpuOpenInit();
+	if (result < 0)
+	{
+		pixi_close (pinFd);
+		return result;
+	}
+	result = pixi_mpuWriteRegisterMasked (MpuConfig, 1, 0x07); // DLPF on, so 1kHz base rate
+	if (result >= 0)
+		result = pixi_mpuWriteRegister (MpuSampleRateDivider, divider);
+	if (result >= 0)
+		result = pixi_mpuEnableInterrupt (MpuIntDataReady);
+	if (result < 0)
+	{
+		PIO_ERROR(-result, "Could not set up the MPU data ready interrupt");
+		pixi_mpuClose();
+		pixi_close (pinFd);
+		return result;
+	}
+
+	MpuMotion m;
+	uint64 samples = 0;
+	uint timeouts = 0;
+	int64 timestamp = 0;
+	int64 start = pixi_clockGetNs();
+	int64 end = start + (int64) (seconds * 1e9);
+	while (timestamp < end)
+	{
+		result = pixi_mpuWaitMotion (pinFd, 100, &m, &timestamp);
+		if (result < 0)
+			break;
+		if (result == 0)
+		{
+			timeouts++;
+			timestamp = pixi_clockGetNs();
+			continue;
+		}
+		printf ("%.6f %d %d %d %d %d %d %d\n", (timestamp - start) / 1e9,
+			m.accel.x, m.accel.y, m.accel.z, m.temp, m.gyro.x, m.gyro.y, m.gyro.z);
+		samples++;
+	}
+	double elapsed = (pixi_clockGetNs() - start) / 1e9;
+	fprintf (stderr, "%llu samples in %.3fs (%.1f/s), %u timeouts\n",
+		(unsigned long long) samples, elapsed, samples / elapsed, timeouts);
+
+	pixi_mpuEnableInterrupt (0);
+	pixi_mpuClose();
+	pixi_close (pinFd);
+
+	return result < 0 ? result : 0;
+}
+
+static int mpuSampleMotionFn (const Command* command, uint argc, char* argv[])
+{
+	if (argc < 3 || argc > 4)
+		return commandUsageError (command);
+
+	uint pin       = pixi_parseLong (argv[1]);
+	double seconds = atof (argv[2]);
+	uint divider   = argc > 3 ? pixi_parseLong (argv[3]) : 9;
+	if (seconds <= 0 || divider > 255)
+		return commandUsageError (command);
+
+	return mpuSampleMotion (pin, seconds, divider);
+}
+static Command mpuSampleMotionCmd =
+{
+	.name        = "mpu-sample-motion",
+	.description = "Read MPU motion on each data-ready interrupt",
+	.usage       = "usage: %s PI-GPIO-PIN SECONDS [RATE-DIVIDER]\n"
+	               "    PI-GPIO-PIN is the Pi GPIO connected to the MPU INT pin.\n"
+	               "    Prints the interrupt time then raw accel x,y,z, temperature and gyro x,y,z.\n"
+	               "    The sample rate is 1kHz / (1 + RATE-DIVIDER); the default is 100Hz.",
+	.function    = mpuSampleMotionFn
+};
+
+
+static int mpuReadAll (void)
+{
+	int result = mpuOpenInit();
+	if (result < 0)
+		return result;
+
+	result = pixi_mpuEnableAuxMag();
+	if (result >= 0)
+	{
+		// Give the magnetometer time for a first measurement
+		usleep (20 * 1000);
+		MpuMotion m;
+		MpuAxes mag;
+		result = pixi_mpuReadMotionMag (&m, &mag);
+		if (result >= 0)
+			printf ("%d %d %d %d %d %d %d %d %d %d\n",
+				m.accel.x, m.accel.y, m.accel.z, m.temp, m.gyro.x, m.gyro.y, m.gyro.z,
+				mag.x, mag.y, mag.z);
+		pixi_mpuDisableAuxMag();
+	}
+	pixi_mpuClose();
+
+	return result;
+}
+
+static int mpuReadAllFn (const Command* command, uint argc, char* argv[])
+{
+	LIBPIXI_UNUSED(argv);
+	if (argc != 1)
+		return commandUsageError (command);
+
+	return mpuReadAll();
+}
+static Command mpuReadAllCmd =
+{
+	.name        = "mpu-read-all",
+	.description = "Read MPU motion and magnetometer values in one burst",
+	.usage       = "usage: %s\n"
+	               "    Prints raw accel x,y,z, temperature, gyro x,y,z and magnetometer x,y,z.",
+	.function    = mpuReadAllFn
+};
+
+
+static int mpuAttitude (double seconds, AttitudeAlgorithm algorithm, uint divider)
+{
+	int result = mpuOpenInit();
+	if (result < 0)
+		return result;
+
+	int accelScale = pixi_mpuGetAccelScale();
+	int gyroScale  = pixi_mpuGetGyroScale();
+	if (accelScale < 0 || gyroScale < 0)
+	{
+		pixi_mpuClose();
+		return accelScale < 0 ? accelScale : gyroScale;
+	}
+	MpuAttitude attitude;
+	pixi_attitudeInit (&attitude, algorithm, accelScale, gyroScale);
+
+	// Motion samples come from the FIFO at a known rate; the magnetometer
+	// is read alongside, through the auxiliary i2c master
+	result = pixi_mpuConfigureFifo (MpuFifoMotion, divider, 1);
+	if (result >= 0)
+		result = pixi_mpuEnableAuxMag();
+	if (result < 0)
+	{
+		pixi_mpuClose();
+		return result;
+	}
+
+	MpuMotion motions[MpuFifoSize / sizeof (MpuMotion)];
+	const double rate = 1000.0 / (1 + divider);
+	const int64 period = 1e9 / rate;
+	const useconds_t pause = 1e6 * (ARRAY_COUNT(motions) / 2) / rate;
+	int64 sampleTime = 0;
+	uint overflows = 0;
+	int64 start = pixi_clockGetNs();
+	int64 end = start + (int64) (seconds * 1e9);
+	for (int64 now = start; now < end; now = pixi_clockGetNs())
+	{
+		usleep (pause);
+		MpuMotion latest;
+		MpuAxes mag;
+		result = pixi_mpuReadMotionMag (&latest, &mag);
+		if (result >= 0)
+			result = pixi_mpuReadFifo (motions, ARRAY_COUNT(motions));
+		if (result == -EOVERFLOW)
+		{
+			overflows++;
+			continue;
+		}
+		if (result < 0)
+			break;
+		for (int i = 0; i < result; i++)
+		{
+			pixi_attitudeUpdate (&attitude, &motions[i], &mag, sampleTime);
+			sampleTime += period;
+		}
+		EulerAngles angles;
+		pixi_attitudeGetEuler (&attitude, &angles);
+		const double degrees = 180.0 / M_PI;
+		printf ("%.3f %8.3f %8.3f %8.3f  %.5f %.5f %.5f %.5f\n", sampleTime / 1e9,
+			angles.roll * degrees, angles.pitch * degrees, angles.yaw * degrees,
+			attitude.q.w, attitude.q.x, attitude.q.y, attitude.q.z);
+		fflush (stdout);
+	}
+	if (overflows)
+		fprintf (stderr, "%u FIFO overflows\n", overflows);
+
+	pixi_mpuDisableAuxMag();
+	pixi_mpuDisableFifo();
+	pixi_mpuClose();
+
+	return result < 0 ? result : 0;
+}
+
+static int mpuAttitudeFn (const Command* command, uint argc, char* argv[])
+{
+	if (argc < 2 || argc > 4)
+		return commandUsageError (command);
+
+	double seconds = atof (argv[1]);
+	int algorithm  = AttitudeMadgwick;
+	if (argc > 2)
+	{
+		if (0 == strcasecmp (argv[2], "mahony"))
+			algorithm = AttitudeMahony;
+		else if (0 != strcasecmp (argv[2], "madgwick"))
+			return commandUsageError (command);
+	}
+	uint divider = argc > 3 ? pixi_parseLong (argv[3]) : 0;
+	if (seconds <= 0 || divider > 255)
+		return commandUsageError (command);
+
+	return mpuAttitude (seconds, algorithm, divider);
+}
+static Command mpuAttitudeCmd =
+{
+	.name        = "mpu-attitude",
+	.description = "Stream MPU orientation from sensor fusion",
+	.usage       = "usage: %s SECONDS [madgwick|mahony [RATE-DIVIDER]]\n"
+	               "    Fuses every sample (1kHz / (1 + RATE-DIVIDER)), printing the time, roll,\n"
+	               "    pitch and yaw (degrees) and the orientation quaternion after each FIFO read.",
+	.function    = mpuAttitudeFn
+};
+
+
+/// Capture about @c seconds of raw 100Hz motion samples from the FIFO.
+/// On success, the caller must free (*motions).
+static int mpuCaptureMotion (double seconds, MpuMotion** motions)
+{
+	const uint divider = 9;
+	const double rate = 1000.0 / (1 + divider);
+	const uint capacity = (uint) (seconds * rate) + MpuFifoSize / sizeof (MpuMotion);
+	MpuMotion* samples = malloc (capacity * sizeof (MpuMotion));
+	if (!samples)
+		return -ENOMEM;
+
+	int result = pixi_mpuConfigureFifo (MpuFifoMotion, divider, 1);
+	if (result < 0)
+	{
+		free (samples);
+		return result;
+	}
+	uint count = 0;
+	int64 end = pixi_clockGetNs() + (int64) (seconds * 1e9);
+	while (pixi_clockGetNs() < end && count < capacity)
+	{
+		usleep (100 * 1000);
+		result = pixi_mpuReadFifo (samples + count, capacity - count);
+		if (result == -EOVERFLOW)
+			continue;
+		if (result < 0)
+			break;
+		count += result;
+		fprintf (stderr, "\r%u samples", count);
+	}
+	fprintf (stderr, "\n");
+	pixi_mpuDisableFifo();
+
+	if (result < 0 && result != -EOVERFLOW)
+	{
+		free (samples);
+		return result;
+	}
+	*motions = samples;
+	return count;
+}
+
+/// Capture about @c seconds of raw magnetometer samples at 50Hz.
+/// On success, the caller must free (*axes).
+static int mpuCaptureMag (double seconds, MpuAxes** axes)
+{
+	const uint capacity = (uint) (seconds * 50) + 1;
+	MpuAxes* samples = malloc (capacity * sizeof (MpuAxes));
+	if (!samples)
+		return -ENOMEM;
+
+	int result = pixi_mpuEnableAuxMag();
+	if (result < 0)
+	{
+		free (samples);
+		return result;
+	}
+	uint count = 0;
+	int64 end = pixi_clockGetNs() + (int64) (seconds * 1e9);
+	while (pixi_clockGetNs() < end && count < capacity)
+	{
+		usleep (20 * 1000);
+		MpuMotion motion;
+		result = pixi_mpuReadMotionMag (&motion, &samples[count]);
+		if (result < 0)
+			break;
+		count++;
+		if (count % 50 == 0)
+			fprintf (stderr, "\r%u samples", count);
+	}
+	fprintf (stderr, "\n");
+	pixi_mpuDisableAuxMag();
+
+	if (result < 0)
+	{
+		free (samples);
+		return result;
+	}
+	*axes = samples;
+	return count;
+}
+
+static int mpuCalibrate (uint sensor, const char* filename, double seconds)
+{
+	MpuCalibration calibration;
+	int result = pixi_mpuLoadCalibration (filename, &calibration);
+	if (result == -ENOENT)
+		pixi_mpuCalibrationReset (&calibration);
+	else if (result < 0)
+		return result;
+
+	result = mpuOpenInit();
+	if (result < 0)
+		return result;
+	// Estimate from raw values
+	pixi_mpuSetCalibration (NULL);
+
+	MpuCorrection* correction = NULL;
+	if (sensor == MpuCalibrateGyro)
+	{
+		fprintf (stderr, "Keep the PiXi still for %.0f seconds\n", seconds);
+		correction = &calibration.gyro;
+		MpuMotion* motions = NULL;
+		result = mpuCaptureMotion (seconds, &motions);
+		if (result > 0)
+			result = pixi_mpuEstimateGyroBias (motions, result, correction);
+		else if (result == 0)
+			result = -ENODATA;
+		free (motions);
+	}
+	else if (sensor == MpuCalibrateAccel)
+	{
+		fprintf (stderr, "Slowly turn the PiXi to face every direction for %.0f seconds\n", seconds);
+		correction = &calibration.accel;
+		result = pixi_mpuGetAccelScale();
+		if (result > 0)
+		{
+			const float oneG = 32768.0f / result;
+			MpuMotion* motions = NULL;
+			result = mpuCaptureMotion (seconds, &motions);
+			if (result >= 0)
+				result = pixi_mpuFitEllipsoid (&motions->accel.x, result, sizeof (MpuMotion) / sizeof (int16), oneG, correction);
+			free (motions);
+		}
+	}
+	else
+	{
+		fprintf (stderr, "Slowly turn the PiXi to face every direction for %.0f seconds,\n"
+			"away from magnetic objects\n", seconds);
+		correction = &calibration.mag;
+		MpuAxes* axes = NULL;
+		result = mpuCaptureMag (seconds, &axes);
+		if (result >= 0)
+			result = pixi_mpuFitEllipsoid (&axes->x, result, sizeof (MpuAxes) / sizeof (int16), 0, correction);
+		free (axes);
+	}
+	pixi_mpuClose();
+	if (result < 0)
+		return result;
+
+	calibration.sensors |= sensor;
+	const float* m = correction->matrix;
+	printf ("matrix: %9.5f %9.5f %9.5f\n        %9.5f %9.5f %9.5f\n        %9.5f %9.5f %9.5f\n",
+		m[0], m[1], m[2], m[3], m[4], m[5], m[6], m[7], m[8]);
+	printf ("offset: %9.2f %9.2f %9.2f\n", correction->offset[0], correction->offset[1], correction->offset[2]);
+	return pixi_mpuSaveCalibration (filename, &calibration);
+}
+
+static int mpuCalibrateFn (const Command* command, uint argc, char* argv[])
+{
+	if (argc < 3 || argc > 4)
+		return commandUsageError (command);
+
+	uint sensor;
+	double seconds;
+	if (0 == strcasecmp (argv[1], "gyro"))
+	{
+		sensor  = MpuCalibrateGyro;
+		seconds = 5;
+	}
+	else if (0 == strcasecmp (argv[1], "accel"))
+	{
+		sensor  = MpuCalibrateAccel;
+		seconds = 60;
+	}
+	else if (0 == strcasecmp (argv[1], "mag"))
+	{
+		sensor  = MpuCalibrateMag;
+		seconds = 60;
+	}
+	else
+		return commandUsageError (command);
+	if (argc > 3)
+		seconds = atof (argv[3]);
+	if (seconds <= 0)
+		return commandUsageError (command);
+
+	return mpuCalibrate (sensor, argv[2], seconds);
+}
+static Command mpuCalibrateCmd =
+{
+	.name        = "mpu-calibrate",
+	.description = "Calibrate an MPU sensor and save the correction",
+	.usage       = "usage: %s gyro|accel|mag FILE [SECONDS]\n"
+	               "    gyro estimates the bias while the PiXi is still (default 5 seconds).\n"
+	               "    accel and mag fit an ellipsoid while the PiXi is turned to face every\n"
+	               "    direction (default 60 seconds). The correction is stored in FILE, keeping\n"
+	               "    those for other sensors. Set LIBPIXI_MPU_CALIBRATION=FILE to apply it.",
+	.function    = mpuCalibrateFn
+};
+
+
 static int mpuMonitorMag (void)
 {
 	int result = mpuMagOpenInit();
@@ -333,9 +839,14 @@ static int mpuMonitorMag (void)
 	if (result < 0)
 		APP_ERROR(-result, "Failed to read magnetometer adjustment values");
 
-	double x = mpuMagGetScale (adjust.x);
-	double y = mpuMagGetScale (adjust.y);
-	double z = mpuMagGetScale (adjust.z);
+	// Use continuous mode when the magnetometer supports it
+	pixi_mpuMagSetMode (MpuMagContinuous8HzMode | MpuMag16BitOutput);
+
+	// After the mode change, which determines the sensitivity
+	const double lsb = pixi_mpuMagMicroTeslaPerLsb();
+	double x = lsb * mpuMagGetScale (adjust.x);
+	double y = lsb * mpuMagGetScale (adjust.y);
+	double z = lsb * mpuMagGetScale (adjust.z);
 
 	const char* format = "\r[%8.3f %8.3f %8.3f]uT";
 	if (pixi_isLocaleEncodingUtf8())
@@ -354,6 +865,7 @@ static int mpuMonitorMag (void)
 	}
 	printf ("\n");
 
+	pixi_mpuMagSetMode (MpuMagPowerDownMode);
 	pixi_mpuClose();
 
 	return result;
@@ -745,6 +1257,10 @@ static const Command* commands[] =
 	&mpuSetGyroScaleCmd,
 	&mpuMonitorTempCmd,
 	&mpuMonitorMotionCmd,
+	&mpuStreamMotionCmd,
+	&mpuSampleMotionCmd,
+	&mpuAttitudeCmd,
+	&mpuCalibrateCmd,
 	&mpuMonitorMagCmd,
 	&mpuReadTempCmd,
 	&mpuReadAccCmd,
@@ -756,6 +1272,7 @@ static const Command* commands[] =
 	&mpuReadGyroYCmd,
 	&mpuReadGyroZCmd,
 	&mpuReadMagCmd,
+	&mpuReadAllCmd,
 	&mpuReadMagXCmd,
 	&mpuReadMagYCmd,
 	&mpuReadMagZCmd,
@@ -0,0 +1,626 @@
+/*
+    pixi-tools: a set of software to interface with the Raspberry Pi
+    and PiXi-200 hardware
+    Copyright (C) 2014 Simon Cantrill
+
+    pixi-tools is free software; you can redistribute it and/or
+    modify it under the terms of the GNU Lesser General Public
+    License as published by the Free Software Foundation; either
+    version 2.1 of the License, or (at your option) any later version.
+
+    This library is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+    Lesser General Public License for more details.
+
+    You should have received a copy of the GNU Lesser General Public
+    License along with this library; if not, write to the Free Software
+    Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+*/
+
+#include <libpixi/pi/gpio.h>
+#include <libpixi/pixi/adc.h>
+#include <libpixi/pixi/mpu.h>
+#include <libpixi/pixi/simple.h>
+#include <libpixi/util/clock.h>
+#include <libpixi/util/record.h>
+#include <libpixi/util/string.h>
+#include "common.h"
+#include "log.h"
+#include <errno.h>
+#include <limits.h>
+#include <signal.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+
+/// Where a recorded channel is read from on each tick
+typedef enum SourceKind
+{
+	SourceAdc,
+	SourceRegister,
+	SourceMpu,
+	SourceGpio
+} SourceKind;
+
+enum
+{
+	MpuFields = sizeof (MpuMotion) / sizeof (int16)
+};
+
+typedef struct RecordSources
+{
+	uint           count;
+	RecordChannel  channels[RecordMaxChannels];
+	SourceKind     kinds[RecordMaxChannels];
+	uint           slots[RecordMaxChannels]; ///< index into the per-bus results below
+	uint           adcCount;
+	uint           adcChannels[PixiAdcMaxChannels];
+	uint           registerCount;
+	RegisterOp     registerOps[RecordMaxChannels];
+	bool           mpu;
+	uint           gpioCount;
+	uint           gpioPins[RecordMaxChannels];
+	bool           pixiOpen;
+	bool           adcOpen;
+	bool           gpioMapped;
+	bool           mpuOpen;
+} RecordSources;
+
+static volatile sig_atomic_t stopRecording = 0;
+
+static void onStopSignal (int signal)
+{
+	LIBPIXI_UNUSED(signal);
+	stopRecording = 1;
+}
+
+static RecordChannel* addChannel (RecordSources* sources, SourceKind kind, uint slot, RecordSource source, uint index, const char* unit)
+{
+	if (sources->count == RecordMaxChannels)
+	{
+		PIO_LOG_ERROR("Too many channels (the maximum is %u)", RecordMaxChannels);
+		return NULL;
+	}
+	uint c = sources->count++;
+	RecordChannel* channel = &sources->channels[c];
+	memset (channel, 0, sizeof (*channel));
+	sources->kinds[c]  = kind;
+	sources->slots[c]  = slot;
+	channel->source = source;
+	channel->index  = index;
+	channel->type   = RecordUint16;
+	channel->scale  = 1;
+	pixi_strCopy (unit, channel->unit, sizeof (channel->unit));
+	return channel;
+}
+
+static int addMpuChannels (RecordSources* sources, const char* what)
+{
+	static const char* const names[MpuFields] = {
+		"accel-x", "accel-y", "accel-z", "temp", "gyro-x", "gyro-y", "gyro-z"
+	};
+	uint first, last;
+	if      (0 == strcasecmp (what, "accel" )) first = 0, last = 2;
+	else if (0 == strcasecmp (what, "temp"  )) first = 3, last = 3;
+	else if (0 == strcasecmp (what, "gyro"  )) first = 4, last = 6;
+	else if (0 == strcasecmp (what, "motion")) first = 0, last = 6;
+	else
+	{
+		PIO_LOG_ERROR("Unknown MPU source: %s", what);
+		return -EINVAL;
+	}
+	for (uint field = first; field <= last; field++)
+	{
+		RecordSource source = field < 3 ? RecordSourceMpuAccel : field == 3 ? RecordSourceMpuTemp : RecordSourceMpuGyro;
+		const char* unit = field < 3 ? "g" : field == 3 ? "C" : "dps";
+		RecordChannel* channel = addChannel (sources, SourceMpu, field, source, field, unit);
+		if (!channel)
+			return -EINVAL;
+		pixi_strCopy (names[field], channel->name, sizeof (channel->name));
+		channel->type = RecordInt16;
+		if (field == 3)
+		{
+			// see mpuTemperatureToDegrees
+			channel->scale  = 1 / 340.0;
+			channel->offset = 35.0;
+		}
+	}
+	sources->mpu = true;
+	return 0;
+}
+
+static bool isKind (const char* spec, size_t length, const char* kind)
+{
+	return length == strlen (kind) && 0 == strncasecmp (spec, kind, length);
+}
+
+///	Add a source: adc:N (or just N), reg:ADDRESS, mpu:accel|gyro|temp|motion or gpio:PIN
+static int addSource (RecordSources* sources, const char* spec)
+{
+	const char* colon = strchr (spec, ':');
+	const char* arg = colon ? colon + 1 : spec;
+	size_t kindLength = colon ? (size_t) (colon - spec) : 0;
+	if (colon && *arg == '\0')
+		return -EINVAL;
+
+	if (!colon || isKind (spec, kindLength, "adc"))
+	{
+		uint index = pixi_parseLong (arg);
+		if (index >= PixiAdcMaxChannels || sources->adcCount == PixiAdcMaxChannels)
+		{
+			PIO_LOG_ERROR("Invalid ADC source: %s", spec);
+			return -EINVAL;
+		}
+		RecordChannel* channel = addChannel (sources, SourceAdc, sources->adcCount, RecordSourceAdc, index, "V");
+		if (!channel)
+			return -EINVAL;
+		snprintf (channel->name, sizeof (channel->name), "adc%u", index);
+		channel->scale = 3.3f / 4096;
+		sources->adcChannels[sources->adcCount++] = index;
+	}
+	else if (isKind (spec, kindLength, "reg"))
+	{
+		uint address = pixi_parseLong (arg);
+		if (address > 0xff)
+		{
+			PIO_LOG_ERROR("Invalid register source: %s", spec);
+			return -EINVAL;
+		}
+		RecordChannel* channel = addChannel (sources, SourceRegister, sources->registerCount, RecordSourceRegister, address, "");
+		if (!channel)
+			return -EINVAL;
+		snprintf (channel->name, sizeof (channel->name), "reg-0x%02x", address);
+		RegisterOp* op = &sources->registerOps[sources->registerCount++];
+		op->address  = address;
+		op->function = PixiSpiEnableRead16;
+		op->value    = 0;
+	}
+	else if (isKind (spec, kindLength, "mpu"))
+		return addMpuChannels (sources, arg);
+	else if (isKind (spec, kindLength, "gpio"))
+	{
+		// The map masks the pin to 6 bits, and has -1 for unconnected pins
+		uint pin = pixi_parseLong (arg);
+		uint chipPin = pin < 64 ? pixi_piGpioMapWiringPiToChip (pin) : UINT_MAX;
+		if (chipPin >= GpioNumPins)
+		{
+			PIO_LOG_ERROR("Invalid gpio source (not a wiringPi pin on this board): %s", spec);
+			return -EINVAL;
+		}
+		RecordChannel* channel = addChannel (sources, SourceGpio, sources->gpioCount, RecordSourceGpio, pin, "");
+		if (!channel)
+			return -EINVAL;
+		snprintf (channel->name, sizeof (channel->name), "gpio%u", pin);
+		sources->gpioPins[sources->gpioCount++] = chipPin;
+	}
+	else
+	{
+		PIO_LOG_ERROR("Unknown source: %s", spec);
+		return -EINVAL;
+	}
+	return 0;
+}
+
+///	Parse a comma separated list of sources, adding them to @c sources
+static int parseSources (char* list, RecordSources* sources)
+{
+	char* save = NULL;
+	for (char* tok = strtok_r (list, ",", &save); tok; tok = strtok_r (NULL, ",", &save))
+	{
+		int result = addSource (sources, tok);
+		if (result < 0)
+			return result;
+	}
+	return 0;
+}
+
+static int openSources (RecordSources* sources)
+{
+	if (sources->registerCount)
+	{
+		int result = pixi_openPixi();
+		if (result < 0)
+			return result;
+		sources->pixiOpen = true;
+	}
+	if (sources->adcCount)
+	{
+		int result = adcOpen();
+		if (result < 0)
+			return result;
+		sources->adcOpen = true;
+	}
+	if (sources->gpioCount)
+	{
+		int result = pixi_piGpioMapRegisters();
+		if (result < 0)
+		{
+			PIO_ERROR(-result, "Could not map the GPIO registers");
+			return result;
+		}
+		sources->gpioMapped = true;
+	}
+	if (sources->mpu)
+	{
+		int result = pixi_mpuOpen();
+		sources->mpuOpen = (result >= 0);
+		if (result >= 0)
+			result = pixi_mpuWriteRegister (MpuPowerManagement1, 0); // wake up, as for the mpu commands
+		int accelScale = result < 0 ? result : pixi_mpuGetAccelScale();
+		int gyroScale  = accelScale < 0 ? accelScale : pixi_mpuGetGyroScale();
+		if (gyroScale < 0)
+		{
+			PIO_ERROR(-gyroScale, "Could not set up the MPU");
+			return gyroScale;
+		}
+		for (uint c = 0; c < sources->count; c++)
+		{
+			RecordChannel* channel = &sources->channels[c];
+			if (channel->source == RecordSourceMpuAccel)
+				channel->scale = accelScale / 32768.0;
+			else if (channel->source == RecordSourceMpuGyro)
+				channel->scale = gyroScale / 32768.0;
+		}
+	}
+	return 0;
+}
+
+static void closeSources (RecordSources* sources)
+{
+	if (sources->mpuOpen)
+		pixi_mpuClose();
+	if (sources->gpioMapped)
+		pixi_piGpioUnmapRegisters();
+	if (sources->adcOpen)
+		adcClose();
+	if (sources->pixiOpen)
+		pixiClose();
+	sources->mpuOpen    = false;
+	sources->gpioMapped = false;
+	sources->adcOpen    = false;
+	sources->pixiOpen   = false;
+}
+
+///	Read every source once, with one transaction per bus
+static int readSources (RecordSources* sources, uint16* samples)
+{
+	uint16 adcValues[PixiAdcMaxChannels];
+	if (sources->adcCount)
+	{
+		int result = pixi_adcReadChannels (sources->adcChannels, sources->adcCount, adcValues);
+		if (result < 0)
+		{
+			PIO_ERROR(-result, "ADC read failed");
+			return result;
+		}
+	}
+	if (sources->registerCount)
+	{
+		int result = pixi_multiRegisterOp (sources->registerOps, sources->registerCount);
+		if (result < 0)
+		{
+			PIO_ERROR(-result, "Register read failed");
+			return result;
+		}
+	}
+	int16 mpuValues[MpuFields];
+	if (sources->mpu)
+	{
+		MpuMotion motion;
+		int result = pixi_mpuReadMotion (&motion);
+		if (result < 0)
+		{
+			PIO_ERROR(-result, "MPU read failed");
+			return result;
+		}
+		memcpy (mpuValues, &motion, sizeof (mpuValues));
+	}
+	for (uint c = 0; c < sources->count; c++)
+	{
+		uint slot = sources->slots[c];
+		switch (sources->kinds[c])
+		{
+		case SourceAdc     : samples[c] = adcValues[slot]; break;
+		case SourceRegister: samples[c] = sources->registerOps[slot].value; break;
+		case SourceMpu     : samples[c] = (uint16) mpuValues[slot]; break;
+		case SourceGpio    :
+		{
+			int value = pixi_piGpioChipReadPin (sources->gpioPins[slot]);
+			if (value < 0)
+			{
+				PIO_ERROR(-value, "GPIO read failed");
+				return value;
+			}
+			samples[c] = value;
+			break;
+		}
+		}
+	}
+	return 0;
+}
+
+typedef enum RecordFormat
+{
+	FormatBinary,
+	FormatCsv
+} RecordFormat;
+
+///	Output for either format
+typedef struct RecordOutput
+{
+	RecordFormat  format;
+	RecordWriter  writer;
+	FILE*         csv;
+	uint          timebaseNs;
+} RecordOutput;
+
+static int outputOpen (RecordOutput* output, const char* filename, const RecordSources* sources)
+{
+	if (output->format == FormatBinary)
+		return pixi_recordCreate (&output->writer, filename, sources->channels, sources->count, output->timebaseNs, RecordDirectIo);
+
+	output->csv = 0 == strcmp (filename, "-") ? stdout : fopen (filename, "w");
+	if (!output->csv)
+		return -errno;
+	setvbuf (output->csv, NULL, _IOFBF, RecordBufferSize);
+	fprintf (output->csv, "time");
+	for (uint c = 0; c < sources->count; c++)
+		fprintf (output->csv, ",%.*s", (int) sizeof (sources->channels[c].name), sources->channels[c].name);
+	fprintf (output->csv, "\n");
+	return 0;
+}
+
+static int outputWrite (RecordOutput* output, const RecordSources* sources, int64 elapsedNs, const uint16* samples)
+{
+	if (output->format == FormatBinary)
+		return pixi_recordWrite (&output->writer, elapsedNs / output->timebaseNs, samples);
+
+	fprintf (output->csv, "%.6f", elapsedNs / 1e9);
+	for (uint c = 0; c < sources->count; c++)
+	{
+		if (sources->channels[c].type == RecordInt16)
+			fprintf (output->csv, ",%d", (int16) samples[c]);
+		else
+			fprintf (output->csv, ",%u", samples[c]);
+	}
+	return fputc ('\n', output->csv) == EOF ? -EIO : 0;
+}
+
+static int outputClose (RecordOutput* output)
+{
+	if (output->format == FormatBinary)
+		return pixi_recordClose (&output->writer);
+
+	int result = fflush (output->csv) == 0 ? 0 : -errno;
+	if (output->csv != stdout)
+		fclose (output->csv);
+	output->csv = NULL;
+	return result;
+}
+
+static int recordSources (const char* filename, RecordFormat format, double rate, double seconds, RecordSources* sources)
+{
+	int64 periodNs = 1e9 / rate;
+	RecordOutput output;
+	memset (&output, 0, sizeof (output));
+	output.format     = format;
+	output.timebaseNs = periodNs <= 50000000 ? 1000 : 1000000;
+
+	int result = openSources (sources);
+	if (result < 0)
+	{
+		closeSources (sources);
+		return result;
+	}
+	result = outputOpen (&output, filename, sources);
+	if (result < 0)
+	{
+		PIO_ERROR(-result, "Could not create recording %s", filename);
+		closeSources (sources);
+		return result;
+	}
+
+	struct sigaction action, oldInt, oldTerm;
+	memset (&action, 0, sizeof (action));
+	action.sa_handler = onStopSignal;
+	stopRecording = 0;
+	sigaction (SIGINT , &action, &oldInt);
+	sigaction (SIGTERM, &action, &oldTerm);
+
+	// Ticks that are a whole period late are dropped, rather than
+	// being read in a burst to catch up
+	uint64 ticks = seconds > 0 ? (uint64) (seconds * rate) : UINT64_MAX;
+	uint64 frames  = 0;
+	uint64 dropped = 0;
+	uint64 late    = 0;
+	int64 start = pixi_clockGetNs();
+	int64 deadline = start;
+	for (uint64 tick = 0; tick < ticks && !stopRecording; tick++)
+	{
+		uint16 samples[RecordMaxChannels];
+		result = readSources (sources, samples);
+		if (result < 0)
+			break;
+		int64 now = pixi_clockGetNs();
+		result = outputWrite (&output, sources, now - start, samples);
+		if (result < 0)
+			break;
+		frames++;
+
+		deadline += periodNs;
+		now = pixi_clockGetNs();
+		if (now > deadline)
+		{
+			uint64 missed = (now - deadline) / periodNs;
+			if (missed)
+			{
+				dropped  += missed;
+				tick     += missed;
+				deadline += missed * periodNs;
+			}
+			else
+				late++;
+		}
+		else
+			pixi_clockSleepUntilNs (deadline);
+	}
+	double elapsed = (pixi_clockGetNs() - start) / 1e9;
+
+	sigaction (SIGINT , &oldInt , NULL);
+	sigaction (SIGTERM, &oldTerm, NULL);
+	closeSources (sources);
+
+	int closeResult = outputClose (&output);
+	if (result >= 0)
+		result = closeResult;
+	if (result < 0)
+	{
+		PIO_ERROR(-result, "Recording to %s failed", filename);
+		return result;
+	}
+	// Keep stdout for the samples when it is the recording
+	FILE* report = 0 == strcmp (filename, "-") ? stderr : stdout;
+	fprintf (report, "recorded %llu frames in %.3f s (%.1f Hz of %.1f Hz, %llu dropped, %llu late) to %s\n",
+		(unsigned long long) frames, elapsed, elapsed > 0 ? frames / elapsed : 0.0, rate,
+		(unsigned long long) dropped, (unsigned long long) late, filename);
+	return 0;
+}
+
+static int recordFn (const Command* command, uint argc, char* argv[])
+{
+	RecordFormat format = FormatBinary;
+	uint arg = 1;
+	if (argc > 2 && 0 == strcmp (argv[1], "-f"))
+	{
+		if (0 == strcasecmp (argv[2], "csv"))
+			format = FormatCsv;
+		else if (0 != strcasecmp (argv[2], "binary"))
+			return commandUsageError (command);
+		arg = 3;
+	}
+	if (argc < arg + 4)
+		return commandUsageError (command);
+
+	const char* filename = argv[arg];
+	double rate    = atof (argv[arg + 1]);
+	double seconds = atof (argv[arg + 2]);
+	// The sample period is in whole nanoseconds, so at most 1 GHz
+	if (!(rate > 0 && rate <= 1e9) || !(seconds >= 0))
+		return commandUsageError (command);
+
+	static RecordSources sources;
+	memset (&sources, 0, sizeof (sources));
+	for (uint i = arg + 3; i < argc; i++)
+	{
+		if (parseSources (argv[i], &sources) < 0)
+			return commandUsageError (command);
+	}
+	if (sources.count == 0)
+		return commandUsageError (command);
+
+	return recordSources (filename, format, rate, seconds, &sources);
+}
+static Command recordCmd =
+{
+	.name        = "record",
+	.description = "record ADC, register, MPU and GPIO sources to a binary or CSV file",
+	.usage       = "usage: %s [-f binary|csv] FILE RATE-HZ SECONDS SOURCE[,SOURCE...]...\n"
+	               "    Reads every SOURCE on each tick, one transaction per device, and writes\n"
+	               "    timestamped frames to FILE (- for stdout). SECONDS of 0 records until interrupted.\n"
+	               "    Sources: adc:CHANNEL (or just CHANNEL), reg:ADDRESS, gpio:PIN (wiringPi numbering),\n"
+	               "    mpu:accel, mpu:gyro, mpu:temp, mpu:motion (all three).\n"
+	               "    Use record-dump to read a binary file.",
+	.function    = recordFn
+};
+
+static int recordDump (const char* filename, double startSeconds, double seconds)
+{
+	RecordReader reader;
+	int result = pixi_recordMap (&reader, filename);
+	if (result < 0)
+	{
+		PIO_ERROR(-result, "Could not open recording %s", filename);
+		return result;
+	}
+
+	const RecordHeader* header = reader.header;
+	double timebase = header->timebaseNs / 1e9;
+	printf ("# start-time=%.9f timebase-ns=%u chunks=%u frames=%llu\n",
+		header->startTime / 1e9, header->timebaseNs, reader.chunkCount, (unsigned long long) reader.frameCount);
+	printf ("# time");
+	for (uint c = 0; c < header->channelCount; c++)
+		printf (" %.*s", (int) sizeof (reader.channels[c].name), reader.channels[c].name);
+	printf ("\n");
+
+	int64 first = reader.chunkTimes ? reader.chunkTimes[0] : 0;
+	int64 from  = first + (int64) (startSeconds / timebase);
+	int64 to    = seconds > 0 ? from + (int64) (seconds / timebase) : INT64_MAX;
+	int index = pixi_recordSeek (&reader, from);
+	for (uint i = index < 0 ? reader.chunkCount : (uint) index; i < reader.chunkCount; i++)
+	{
+		RecordChunk chunk;
+		pixi_recordGetChunk (&reader, i, &chunk);
+		if (chunk.firstTime > to)
+			break;
+		int64 time = chunk.firstTime;
+		for (uint f = 0; f < chunk.frameCount; f++)
+		{
+			time += chunk.deltas[f];
+			if (time < from || time > to)
+				continue;
+			printf ("%.6f", (time - first) * timebase);
+			for (uint c = 0; c < header->channelCount; c++)
+			{
+				uint16 sample = recordChunkColumn (&chunk, c)[f];
+				if (reader.channels[c].type == RecordInt16)
+					printf (" %d", (int16) sample);
+				else
+					printf (" %u", sample);
+			}
+			printf ("\n");
+		}
+	}
+	pixi_recordUnmap (&reader);
+	return 0;
+}
+
+static int recordDumpFn (const Command* command, uint argc, char* argv[])
+{
+	if (argc < 2 || argc > 4)
+		return commandUsageError (command);
+
+	double startSeconds = argc > 2 ? atof (argv[2]) : 0;
+	double seconds      = argc > 3 ? atof (argv[3]) : 0;
+	return recordDump (argv[1], startSeconds, seconds);
+}
+static Command recordDumpCmd =
+{
+	.name        = "record-dump",
+	.description = "print the frames in a binary recording file",
+	.usage       = "usage: %s FILE [START-SECONDS [SECONDS]]\n"
+	               "    Prints one line per frame: the time since the first frame, then the raw samples.",
+	.function    = recordDumpFn
+};
+
+
+static const Command* commands[] =
+{
+	&recordCmd,
+	&recordDumpCmd,
+};
+
+static CommandGroup recordGroup =
+{
+	.name      = "record",
+	.count     = ARRAY_COUNT(commands),
+	.commands  = commands,
+	.nextGroup = NULL
+};
+
+static void PIO_CONSTRUCTOR (1920) initGroup (void)
+{
+	addCommandGroup (&recordGroup);
+}
@@ -92,14 +92,16 @@ static Command spiTransferCmd =
 
 static int spiSetGet (bool writeMode, uint address, uint data)
 {
-	pixiOpenOrDie();
+	int result = pixi_openPixi();
+	if (result < 0)
+		return result;
 
 	RegisterOp op = {
 		.address  = address,
 		.function = (writeMode ? PixiSpiEnableWrite16 : PixiSpiEnableRead16),
 		.value    = data
 	};
-	int result = multiRegisterOp (&op, 1);
+	result = multiRegisterOp (&op, 1);
 	if (result < 0)
 		PIO_ERROR(-result, "SPI read-write failed");
 
@@ -151,9 +153,10 @@ static Command spiGetCmd =
 
 static int monitorSpi (uint address)
 {
-	pixiOpenOrDie();
+	int result = pixi_openPixi();
+	if (result < 0)
+		return result;
 
-	int result = 0;
 	uint previous = -1;
 	uint changes = 0;
 	while (true)
@@ -203,14 +206,15 @@ static Command spiMonitorCmd =
 
 static int scanSpi (uint low, uint high, uint sleepUs)
 {
-	pixiOpenOrDie();
+	int result = pixi_openPixi();
+	if (result < 0)
+		return result;
 
 	const uint count = high - low + 1;
 	uint memory[count];
 	memset (memory, 0, count * sizeof (uint));
 	uint iterations = 0;
 	uint changes    = 0;
-	int result = 0;
 
 	while (true)
 	{
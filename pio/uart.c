@@ -20,10 +20,15 @@
 
 #include <libpixi/pixi/simple.h>
 #include <libpixi/pixi/uart.h>
+#include <libpixi/util/clock.h>
 #include <libpixi/util/string.h>
 #include "common.h"
 #include "log.h"
+#include <pthread.h>
+#include <sched.h>
+#include <signal.h>
 #include <stdio.h>
+#include <stdlib.h>
 #include <sys/time.h>
 
 static inline int setUartReg (Uart* uart, UartRegister reg, uint8 value)
@@ -35,46 +40,13 @@ static inline int getUartReg (Uart* uart, UartRegister reg)
 	return registerRead (uart->address + reg);
 }
 
-static uint getStatusReg (Uart* uart)
+static int handleUart (Uart* uart)
 {
-	uint status = getUartReg (uart, LineStatusReg);
-	if (status != uart->prevStatus)
-	{
-//		PIO_LOG_INFO("Status-reg: 0x%02x", status);
-		uart->prevStatus = status;
-		PIO_LOG_TRACE("Uart 0x%2x status register=0x%02x", uart->address, status);
-//		if (status & DataReady        ) PIO_LOG_TRACE("   DataReady: at least one character in receive FIFO");
-//		if (status & EmptyTxHoldingReg) PIO_LOG_TRACE("   EmptyTxHoldingReg: transmitter FIFO is empty");
-//		if (status & EmptyTxReg       ) PIO_LOG_TRACE("   EmptyTxReg: transmitter FIFO and shift register is empty");
-		if (status & OverrunError     ) PIO_LOG_ERROR("   OverrunError: receive FIFO was full, received character lost");
-		if (status & ParityError      ) PIO_LOG_ERROR("   ParityError: top character in FIFO was received with a parity error");
-		if (status & FramingError     ) PIO_LOG_ERROR("   FramingError: top character in FIFO was received without a valid stop bit");
-		if (status & BreakInterrupt   ) PIO_LOG_WARN ("   BreakInterrupt: a break condition has been reached");
-		if (status & ErrorInRxFifo    ) PIO_LOG_DEBUG("   ErrorInRxFifo: at least one error in receiver FIFO");
-	}
-
-	return status;
-}
-
-static void handleUart (Uart* uart)
-{
-	uint status;
-	do
-	{
-		status = getStatusReg (uart);
-		if ((status & DataReady) && ioSize (&uart->rxBuf) < (IoBufferSize - 1))
-		{
-			byte value = getUartReg (uart, RxFifo);
-			ioPush (&uart->rxBuf, value);
-		}
-		if (status & EmptyTxHoldingReg)
-		{
-			int value = ioPop (&uart->txBuf);
-			if (value >= 0)
-				setUartReg (uart, TxFifo, value);
-		}
-	} while (((status & DataReady) && ioSize (&uart->rxBuf) < (IoBufferSize - 1))
-		|| ((status & EmptyTxHoldingReg) && !ioIsEmpty (&uart->txBuf)));
+	// Keep going while bytes are moving
+	int result;
+	while ((result = pixi_uartProcess (uart, 1)) > 0)
+		;
+	return result;
 }
 
 static ssize_t uartWrite (Uart* uart, const void* buffer, size_t size)
@@ -93,6 +65,14 @@ static ssize_t uartRead (Uart* uart, void* buffer, size_t size)
 
 static const char printableChars[] = " 0123456789ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz,./<>?;:'@#~][}{=-+_`!\"$^&*()";
 
+static volatile sig_atomic_t stopMonitor = 0;
+
+static void onStopSignal (int signal)
+{
+	LIBPIXI_UNUSED(signal);
+	stopMonitor = 1;
+}
+
 
 static int uartReadWriteMonitorFn (const Command* command, uint argc, char* argv[])
 {
@@ -103,15 +83,35 @@ static int uartReadWriteMonitorFn (const Command* command, uint argc, char* argv
 	uint address  = pixi_parseLong (argv[1]);
 	uint baudRate = pixi_parseLong (argv[2]);
 
-	pixiOpenOrDie();
-	pixi_uartOpen (&uart, address, baudRate);
+	int result = pixi_openPixi();
+	if (result < 0)
+		return result;
+	result = pixi_uartOpen (&uart, address, baudRate);
+	if (result < 0)
+	{
+		PIO_ERROR(-result, "Could not open UART at 0x%02x", address);
+		pixiClose();
+		return result;
+	}
+
+	struct sigaction action, oldInt, oldTerm;
+	memset (&action, 0, sizeof (action));
+	action.sa_handler = onStopSignal;
+	stopMonitor = 0;
+	sigaction (SIGINT , &action, &oldInt);
+	sigaction (SIGTERM, &action, &oldTerm);
 
 	const char* msg = "Starting read-write-loop\r\n";
 	uartWrite (&uart, msg, strlen (msg));
 
-	while (true)
+	while (!stopMonitor)
 	{
-		handleUart (&uart);
+		result = handleUart (&uart);
+		if (result < 0)
+		{
+			PIO_ERROR(-result, "UART processing failed");
+			break;
+		}
 		char buf[100];
 		ssize_t count = uartRead (&uart, buf, sizeof (buf));
 		if (count > 0)
@@ -131,14 +131,18 @@ static int uartReadWriteMonitorFn (const Command* command, uint argc, char* argv
 		else
 			usleep (40);
 	}
+	sigaction (SIGINT , &oldInt , NULL);
+	sigaction (SIGTERM, &oldTerm, NULL);
+	pixi_uartClose (&uart);
 	pixiClose();
-	return 0;
+	return result < 0 ? result : 0;
 }
 static Command uartReadWriteMonitorCmd =
 {
 	.name        = "uart-rw-monitor",
 	.description = "read writing from a UART, writing back a description of input",
-	.usage       = "usage: %s UART BAUDRATE",
+	.usage       = "usage: %s UART BAUDRATE\n"
+	               "    Runs until interrupted (e.g. Ctrl-C).",
 	.function    = uartReadWriteMonitorFn
 };
 
@@ -196,7 +200,9 @@ static int uartTestFn (const Command* command, uint argc, char* argv[])
 	if (argc < 3 || argc > 6)
 		return commandUsageError (command);
 
-	pixiOpenOrDie();
+	int opened = pixi_openPixi();
+	if (opened < 0)
+		return opened;
 
 	uint count = argc - 2;
 	Uart uarts[4];
@@ -213,6 +219,8 @@ static int uartTestFn (const Command* command, uint argc, char* argv[])
 	}
 
 	testWrite (uarts, count);
+	for (uint i = 0; i < count; i++)
+		pixi_uartClose (&uarts[i]);
 	pixiClose();
 	return result ? -EIO : 0;
 }
@@ -224,10 +232,193 @@ static Command uartTestCmd =
 	.function    = uartTestFn
 };
 
+
+// The byte at a time IoBuffer that predates io-buffer.h, kept for comparison
+enum
+{
+	LegacySize = 4096
+};
+typedef struct LegacyBuffer
+{
+	byte  buffer[LegacySize];
+	uint  writePos;
+	uint  readPos;
+} LegacyBuffer;
+
+static int legacyPush (LegacyBuffer* buf, byte value)
+{
+	uint nextWritePos = (buf->writePos + 1) % LegacySize;
+	if (nextWritePos == buf->readPos)
+		return -ENOBUFS;
+	buf->buffer[buf->writePos] = value;
+	buf->writePos = nextWritePos;
+	return 0;
+}
+
+static int legacyPop (LegacyBuffer* buf)
+{
+	uint readPos = buf->readPos;
+	if (readPos == buf->writePos)
+		return -ENODATA;
+	byte value = buf->buffer[readPos];
+	buf->readPos = (readPos + 1) % LegacySize;
+	return value;
+}
+
+static uint legacyWrite (LegacyBuffer* buf, const byte* data, uint size)
+{
+	for (uint i = 0; i < size; i++)
+		if (legacyPush (buf, data[i]) < 0)
+			return i;
+	return size;
+}
+
+static uint legacyRead (LegacyBuffer* buf, byte* data, uint size)
+{
+	for (uint i = 0; i < size; i++)
+	{
+		int value = legacyPop (buf);
+		if (value < 0)
+			return i;
+		data[i] = value;
+	}
+	return size;
+}
+
+typedef struct BenchTransfer
+{
+	IoBuffer*  buf;
+	uint64     total;
+	uint       chunk;
+	uint64     errors;
+} BenchTransfer;
+
+static void* benchConsumer (void* arg)
+{
+	BenchTransfer* transfer = arg;
+	byte data[4096];
+	byte expected = 0;
+	for (uint64 received = 0; received < transfer->total; )
+	{
+		uint count = ioRead (transfer->buf, data, transfer->chunk);
+		if (count == 0)
+			sched_yield(); // in case there's only one CPU
+		for (uint i = 0; i < count; i++)
+			if (data[i] != expected++)
+				transfer->errors++;
+		received += count;
+	}
+	return NULL;
+}
+
+static double megabytesPerSecond (uint64 bytes, int64 startNs)
+{
+	return (bytes / 1e6) / ((pixi_clockGetNs() - startNs) / 1e9);
+}
+
+static int ioBufferBenchFn (const Command* command, uint argc, char* argv[])
+{
+	if (argc > 3)
+		return commandUsageError (command);
+	uint megabytes = argc > 1 ? pixi_parseLong (argv[1]) : 64;
+	uint chunk     = argc > 2 ? pixi_parseLong (argv[2]) : 64;
+	if (megabytes == 0 || chunk == 0 || chunk > 4096)
+		return commandUsageError (command);
+
+	const uint64 total = (uint64) megabytes << 20;
+	byte in[4096];
+	byte out[4096];
+	for (uint i = 0; i < sizeof (in); i++)
+		in[i] = i;
+
+	// Single thread: write a chunk, read it back
+	LegacyBuffer* legacy = calloc (1, sizeof (LegacyBuffer));
+	if (!legacy)
+		return -ENOMEM;
+	int64 start = pixi_clockGetNs();
+	uint64 sum = 0;
+	for (uint64 done = 0; done < total; done += chunk)
+	{
+		legacyWrite (legacy, in, chunk);
+		sum += legacyRead (legacy, out, chunk);
+	}
+	printf ("byte at a time    %8.1f MB/s\n", megabytesPerSecond (sum, start));
+	free (legacy);
+
+	IoBuffer buf;
+	int result = pixi_ioBufferInit (&buf, IoBufferDefaultSize);
+	if (result < 0)
+		return result;
+	start = pixi_clockGetNs();
+	sum = 0;
+	for (uint64 done = 0; done < total; done += chunk)
+	{
+		ioWrite (&buf, in, chunk);
+		sum += ioRead (&buf, out, chunk);
+	}
+	printf ("memcpy            %8.1f MB/s\n", megabytesPerSecond (sum, start));
+
+	start = pixi_clockGetNs();
+	sum = 0;
+	for (uint64 done = 0; done < total; done += chunk)
+	{
+		byte* space;
+		uint n = ioWritePeek (&buf, &space);
+		n = n < chunk ? n : chunk;
+		memcpy (space, in, n);
+		ioWriteCommit (&buf, n);
+		const byte* data;
+		n = ioReadPeek (&buf, &data);
+		memcpy (out, data, n);
+		ioReadCommit (&buf, n);
+		sum += n;
+	}
+	printf ("peek/commit       %8.1f MB/s\n", megabytesPerSecond (sum, start));
+
+	// Producer and consumer threads
+	ioClear (&buf);
+	BenchTransfer transfer = {&buf, total, chunk, 0};
+	pthread_t consumer;
+	start = pixi_clockGetNs();
+	if (pthread_create (&consumer, NULL, benchConsumer, &transfer) != 0)
+	{
+		pixi_ioBufferFree (&buf);
+		return -EAGAIN;
+	}
+	byte next = 0;
+	byte pattern[4096 + 256];
+	for (uint i = 0; i < sizeof (pattern); i++)
+		pattern[i] = i;
+	for (uint64 sent = 0; sent < total; )
+	{
+		uint size = total - sent < chunk ? total - sent : chunk;
+		uint count = ioWrite (&buf, pattern + next, size);
+		if (count == 0)
+			sched_yield();
+		next += count;
+		sent += count;
+	}
+	pthread_join (consumer, NULL);
+	printf ("two threads       %8.1f MB/s (%llu errors)\n", megabytesPerSecond (total, start),
+		(unsigned long long) transfer.errors);
+
+	pixi_ioBufferFree (&buf);
+	return transfer.errors ? -EIO : 0;
+}
+static Command ioBufferBenchCmd =
+{
+	.name        = "io-buffer-bench",
+	.description = "benchmark the UART software buffers",
+	.usage       = "usage: %s [MEGABYTES [CHUNK-SIZE]]\n"
+	               "    Times byte at a time and bulk transfers through a 4KiB buffer.",
+	.function    = ioBufferBenchFn
+};
+
 static const Command* commands[] =
 {
 	&uartReadWriteMonitorCmd,
 	&uartTestCmd,
+	&ioBufferBenchCmd,
 };
 
 static CommandGroup pixiUartGroup =
@@ -25,9 +25,14 @@
 #include <libpixi/pixi/simple.h>
 #include <locale.h>
 #include <unistd.h>
+#include <poll.h>
+#include <climits>
+#include <sys/ioctl.h>
+#include <asm/termbits.h> // kernel struct termios, as passed through TCGETS/TCSETS
 #include <algorithm>
 #include <cstdio>
 #include <cstring>
+#include <map>
 #include <thread>
 #include <mutex>
 #include <condition_variable>
@@ -45,6 +50,44 @@ namespace { // anon
 
 cuse_lowlevel_ops uartOps;
 
+const char printableChars[] = " 0123456789ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz,./<>?;:'@#~][}{=-+_`!\"$^&*()";
+
+struct BaudSpeed
+{
+	tcflag_t speed;
+	uint     baudRate;
+};
+const BaudSpeed baudSpeeds[] =
+{
+	{B300,       300},
+	{B600,       600},
+	{B1200,     1200},
+	{B2400,     2400},
+	{B4800,     4800},
+	{B9600,     9600},
+	{B19200,   19200},
+	{B38400,   38400},
+	{B57600,   57600},
+	{B115200, 115200},
+	{B230400, 230400}
+};
+
+uint speedToBaudRate (tcflag_t cflag)
+{
+	for (const BaudSpeed& bs: baudSpeeds)
+		if (bs.speed == (cflag & CBAUD))
+			return bs.baudRate;
+	return 0;
+}
+
+tcflag_t baudRateToSpeed (uint baudRate)
+{
+	for (const BaudSpeed& bs: baudSpeeds)
+		if (bs.baudRate == baudRate)
+			return bs.speed;
+	return B0;
+}
+
 
 class UartDev
 {
@@ -53,25 +96,31 @@ class UartDev
 
 public:
 	UartDev() :
-		m_devNum (-1),
-		m_uart   (0)
+		m_devNum  (-1),
+		m_uart    (0),
+		m_service (0)
 	{
 		m_name[0] = 0;
+		memset (&m_termios, 0, sizeof (m_termios));
+		m_termios.c_cflag = CS8 | CREAD | CLOCAL;
 	}
 	~UartDev()
 	{
 		if (m_thread.joinable())
 			m_thread.join();
+		for (auto& pending: m_pollHandles)
+			fuse_pollhandle_destroy (pending.second);
 	}
 
 	const char* name() const {
 		return m_name;
 	}
 
-	int start (uint devNum, Uart* uart)
+	int start (uint devNum, Uart* uart, UartService* service)
 	{
-		m_devNum = devNum;
-		m_uart   = uart;
+		m_devNum  = devNum;
+		m_uart    = uart;
+		m_service = service;
 		snprintf (m_name, sizeof (m_name), "ttyPIXI%u", devNum);
 
 		const char* args[] = {"pixi-uart", "-f", 0}; // "-f": foreground (don't fork)
@@ -108,27 +157,41 @@ public:
 		});
 		return 0;
 	}
-	uint read (char* data, uint size, int flags)
+	/// Reply to @c req with up to @c size bytes, straight from the receive buffer
+	void read (fuse_req_t req, uint size, int flags)
 	{
 		APP_LOG_DEBUG("read of size %u, available=%u", size, ioSize (&m_uart->rxBuf));
 
 		mutex_lock lock (m_mutex);
-		if (flags & O_NONBLOCK)
+		while (ioIsEmpty (&m_uart->rxBuf))
 		{
-			uint count = ioRead (&m_uart->rxBuf, data, size);
-			APP_LOG_DEBUG("non-block read, count=%u", count);
-			return count;
-		}
-
-		while (true)
-		{
-			uint count = ioRead (&m_uart->rxBuf, data, size);
-			APP_LOG_DEBUG("partial read, count=%u", count);
-			if (count > 0)
-				return count;
+			if (flags & O_NONBLOCK)
+			{
+				fuse_reply_err (req, EAGAIN);
+				return;
+			}
 			m_condition.wait (lock);
 		}
-		return 0; // unreachable
+
+		// The data may wrap around the end of the buffer, giving two regions
+		IoBuffer* buf = &m_uart->rxBuf;
+		bool full = (ioSpace (buf) == 0);
+		uint count = std::min (ioSize (buf), size);
+		const byte* data;
+		uint first = std::min (ioReadPeek (buf, &data), count);
+		iovec iov[2] = {
+			{const_cast<byte*> (data), first},
+			{buf->buffer, count - first}
+		};
+		int iovCount = (count > first) ? 2 : 1;
+		APP_LOG_DEBUG("read data = %u", count);
+		if (pixi_isAppLogLevelEnabled (LogLevelDebug))
+			logData ("read", iov, iovCount);
+
+		fuse_reply_iov (req, iov, iovCount);
+		ioReadCommit (buf, count);
+		if (full)
+			pixi_uartServiceWake (m_service);
 	}
 	uint write (const char* data, uint size, int flags)
 	{
@@ -139,6 +202,8 @@ public:
 		{
 			uint count = ioWrite (&m_uart->txBuf, data, size);
 			APP_LOG_DEBUG("non-block write, count=%u", count);
+			if (count > 0)
+				pixi_uartServiceWake (m_service);
 			return count;
 		}
 
@@ -147,6 +212,8 @@ public:
 		{
 			uint count = ioWrite (&m_uart->txBuf, data, remain);
 			APP_LOG_DEBUG("partial write, count=%u", count);
+			if (count > 0)
+				pixi_uartServiceWake (m_service);
 			if (count == remain)
 				return size;
 			data   += count;
@@ -156,6 +223,60 @@ public:
 		return size; // unreachable
 	}
 
+	/// Terminal settings, with the speed of the uart
+	termios getTermios()
+	{
+		mutex_lock lock (m_mutex);
+		termios result = m_termios;
+		result.c_cflag = (result.c_cflag & ~CBAUD) | baudRateToSpeed (m_uart->baudRate);
+		return result;
+	}
+	/// Only the speed is acted upon, other settings are just remembered
+	int setTermios (const termios& settings)
+	{
+		uint baudRate = speedToBaudRate (settings.c_cflag);
+		if (baudRate == 0 || pixi_uartGetBaudDivisor (baudRate) == 0)
+			return -EINVAL;
+		int result = pixi_uartServiceSetBaudRate (m_service, m_devNum, baudRate);
+		if (result < 0)
+			return result;
+		mutex_lock lock (m_mutex);
+		m_termios = settings;
+		APP_LOG_INFO("%s: baud rate %u", name(), baudRate);
+		return 0;
+	}
+
+	/// Reply to a poll request, keeping @c handle for a later notification.
+	/// Only the latest handle of each open file (@c fileId) is kept.
+	void poll (fuse_req_t req, fuse_pollhandle* handle, uint64 fileId)
+	{
+		mutex_lock lock (m_mutex);
+		if (handle)
+		{
+			fuse_pollhandle*& pending = m_pollHandles[fileId];
+			if (pending)
+				fuse_pollhandle_destroy (pending);
+			pending = handle;
+		}
+		uint events = 0;
+		if (!ioIsEmpty (&m_uart->rxBuf))
+			events |= POLLIN | POLLRDNORM;
+		if (ioSpace (&m_uart->txBuf) > 0)
+			events |= POLLOUT | POLLWRNORM;
+		fuse_reply_poll (req, events);
+	}
+
+	/// Forget an open file that has been closed
+	void release (uint64 fileId)
+	{
+		mutex_lock lock (m_mutex);
+		auto pending = m_pollHandles.find (fileId);
+		if (pending == m_pollHandles.end())
+			return;
+		fuse_pollhandle_destroy (pending->second);
+		m_pollHandles.erase (pending);
+	}
+
 	void process() {
 		if ((m_uart->operations & DataReady)
 			|| (m_uart->operations & EmptyTxHoldingReg))
@@ -163,37 +284,83 @@ public:
 			mutex_lock lock (m_mutex);
 			APP_LOG_DEBUG("notify_all because 0x%02x", m_uart->operations);
 			m_condition.notify_all();
+			notifyPoll();
 		}
 	}
 
 private:
+	/// Wake pollers; each handle is good for a single notification
+	void notifyPoll()
+	{
+		for (auto& pending: m_pollHandles)
+		{
+			fuse_lowlevel_notify_poll (pending.second);
+			fuse_pollhandle_destroy (pending.second);
+		}
+		m_pollHandles.clear();
+	}
+
+	void logData (const char* what, const iovec* iov, int iovCount)
+	{
+		char printable[1 + (UartFifoDepth * 3)];
+		for (int i = 0; i < iovCount; i++)
+		{
+			const char* data = static_cast<const char*> (iov[i].iov_base);
+			for (size_t offset = 0; offset < iov[i].iov_len; offset += UartFifoDepth)
+			{
+				uint size = std::min<size_t> (UartFifoDepth, iov[i].iov_len - offset);
+				pixi_hexEncode (data + offset, size, printable, sizeof (printable), '%', printableChars);
+				APP_LOG_DEBUG("%s: [%s]", what, printable);
+			}
+		}
+	}
+
 	mutex               m_mutex;
 	condition_variable  m_condition;
 
 	uint        m_devNum;
 	char        m_name[12];
+	termios     m_termios;
+	std::map<uint64, fuse_pollhandle*> m_pollHandles; ///< by open file
 	Uart*       m_uart;
+	UartService* m_service;
 	thread      m_thread;
 };
 
 
+/// An open file, whose address identifies it to its device
+struct UartFile
+{
+	UartDev* dev;
+};
+
+
 } // namespace (anon)
 
 inline UartDev& uartDev (const fuse_file_info* fileInfo)
 {
-	return *reinterpret_cast<UartDev*> (fileInfo->fh);
+	return *reinterpret_cast<UartFile*> (fileInfo->fh)->dev;
 }
 
 static void uart_open (fuse_req_t req, struct fuse_file_info* fi)
 {
 	UartDev* dev = reinterpret_cast<UartDev*> (fuse_req_userdata (req));
 	APP_LOG_INFO("open: dev=%s flags=%x ", dev->name(), fi->flags);
-	fi->fh = (ulong) dev;
+	UartFile* file = new UartFile;
+	file->dev = dev;
+	fi->fh = (ulong) file;
 	fi->nonseekable = true;
 	fuse_reply_open (req, fi);
 }
 
-static const char printableChars[] = " 0123456789ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz,./<>?;:'@#~][}{=-+_`!\"$^&*()";
+static void uart_release (fuse_req_t req, struct fuse_file_info* fi)
+{
+	UartFile* file = reinterpret_cast<UartFile*> (fi->fh);
+	APP_LOG_INFO("release: dev=%s", file->dev->name());
+	file->dev->release (fi->fh);
+	delete file;
+	fuse_reply_err (req, 0);
+}
 
 static void uart_read (fuse_req_t req, size_t size, off_t off, struct fuse_file_info* fi)
 {
@@ -201,18 +368,7 @@ static void uart_read (fuse_req_t req, size_t size, off_t off, struct fuse_file_
 	fi->nonseekable = true;
 
 	UartDev& dev = uartDev (fi);
-
-	char buffer[4096];
-	uint count = dev.read (buffer, std::min (sizeof (buffer), size), fi->flags);
-	APP_LOG_INFO("read data = %u", count);
-
-	char printable[1+(sizeof(buffer)*3)];
-	pixi_hexEncode (buffer, count, printable, sizeof (printable), '%', printableChars);
-	APP_LOG_DEBUG("read: [%s]", printable);
-	if (count == 0)
-		fuse_reply_err (req, EAGAIN);
-	else
-		fuse_reply_buf (req, buffer, count);
+	dev.read (req, std::min<size_t> (size, UINT_MAX), fi->flags);
 }
 
 static void uart_write (fuse_req_t req, const char *buf, size_t size, off_t off, struct fuse_file_info* fi)
@@ -230,6 +386,12 @@ static void uart_write (fuse_req_t req, const char *buf, size_t size, off_t off,
 		fuse_reply_write (req, count);
 }
 
+static void uart_poll (fuse_req_t req, struct fuse_file_info* fi, struct fuse_pollhandle* ph)
+{
+	UartDev& dev = uartDev (fi);
+	dev.poll (req, ph, fi->fh);
+}
+
 static void uart_ioctl (
 	fuse_req_t req,
 	int cmd,
@@ -243,6 +405,42 @@ static void uart_ioctl (
 	UartDev& dev = uartDev (fi);
 	APP_LOG_INFO("ioctl %s cmd=%d arg=%p flags=%xu in_bufsz=%zu out_bufsz=%zu", dev.name(), cmd, arg, flags, in_bufsz, out_bufsz);
 	fi->nonseekable = true;
+
+	switch (cmd)
+	{
+	case TCGETS:
+		if (out_bufsz < sizeof (termios))
+		{
+			// Ask the kernel to retry with the caller's termios mapped out
+			iovec iov = {arg, sizeof (termios)};
+			fuse_reply_ioctl_retry (req, NULL, 0, &iov, 1);
+			return;
+		}
+		{
+			termios settings = dev.getTermios();
+			fuse_reply_ioctl (req, 0, &settings, sizeof (settings));
+		}
+		return;
+	case TCSETS:
+	case TCSETSW:
+	case TCSETSF:
+		if (in_bufsz < sizeof (termios))
+		{
+			iovec iov = {arg, sizeof (termios)};
+			fuse_reply_ioctl_retry (req, &iov, 1, NULL, 0);
+			return;
+		}
+		{
+			termios settings;
+			memcpy (&settings, in_buf, sizeof (settings));
+			int result = dev.setTermios (settings);
+			if (result < 0)
+				fuse_reply_err (req, -result);
+			else
+				fuse_reply_ioctl (req, 0, NULL, 0);
+		}
+		return;
+	}
 	fuse_reply_ioctl(req, 0, NULL, 0);
 }
 
@@ -253,30 +451,44 @@ int main (int argc, char* argv[])
 	uint rate = 38400;
 	if (argc > 1)
 		rate = pixi_parseLong (argv[1]);
+	int interruptPin = -1; // Pi GPIO wired to the PiXi UART interrupt, if any
+	if (argc > 2)
+		interruptPin = pixi_parseLong (argv[2]);
 
 	uartOps.open     = uart_open;
 	uartOps.read     = uart_read;
 	uartOps.write    = uart_write;
 	uartOps.ioctl    = uart_ioctl;
-/*	uartOps.release  =;
-	uartOps.poll     =;
-*/
+	uartOps.poll     = uart_poll;
+	uartOps.release  = uart_release;
 	pixiOpenOrDie();
 
 
-	Uart uarts[4];
-	int result = pixi_uartDebugOpen (&uarts[0], 0x80, rate);
+	Uart uarts[PixiUartCount];
+	for (uint i = 0; i < PixiUartCount; i++)
+	{
+		int result = pixi_uartOpen (&uarts[i], PixiUartAddress + i * PixiUartSpacing, rate);
+		if (result < 0)
+		{
+			APP_LOG_FATAL("Could not open PiXi uart %u", i);
+			return 255;
+		}
+	}
+
+	// One service sweeps all the uarts in a single SPI message per cycle
+	UartService service;
+	int result = pixi_uartServiceInit (&service, uarts, PixiUartCount, interruptPin);
 	if (result < 0)
 	{
-		APP_LOG_FATAL("Could not open PiXi uart");
+		APP_LOG_FATAL("Could not start PiXi uart service");
 		return 255;
 	}
 
-	UartDev devs[4];
+	UartDev devs[PixiUartCount];
 	uint index = 0;
 	for (UartDev& dev: devs)
 	{
-		int result = dev.start (index, &uarts[0]);
+		int result = dev.start (index, &uarts[index], &service);
 		if (result < 0)
 			return result;
 		index++;
@@ -284,9 +496,10 @@ int main (int argc, char* argv[])
 
 	while (true)
 	{
-		int result = pixi_uartProcess (uarts, 1);
+		int result = pixi_uartServiceCycle (&service);
 		if (result < 0)
 			return result;
-		devs[0].process();
+		for (UartDev& dev: devs)
+			dev.process();
 	}
 }
@@ -21,18 +21,117 @@
 //	A PiXi simulator
 //	Overrides some functions in libpixi - it's intended to be built as a
 //	shared library and loaded using LD_PRELOAD.
+//	If PIXISIM_ADC_RECORDING names a recording (see libpixi/util/record.h),
+//	ADC reads replay its adc channels in real time, looping at the end.
 
 #include <libpixi/libpixi.h>
+#include <libpixi/pixi/adc.h>
 #include <libpixi/pixi/spi.h>
+#include <libpixi/util/clock.h>
 #include <libpixi/util/file.h>
 #include <libpixi/util/log.h>
+#include <libpixi/util/record.h>
 #include <fcntl.h>
+#include <stdlib.h>
 #include <string.h>
 #include <unistd.h>
 
 static uint16 registers[256];
 static uint16 version[3] = {0x1213, 0x0007, 0x1031};
 
+static int adcFd = -1;
+static RecordReader adcRecording;
+static int adcColumns[PixiAdcMaxChannels]; ///< recording channel for each ADC channel, or -1
+static RecordChunk adcChunk;
+static uint adcChunkIndex;
+static uint adcFrame;
+static int64 adcFrameTime;  ///< timestamp of adcFrame, in the recording's timebase
+static int64 adcReplayStart; ///< pixi_clockGetNs() at the start of the replay
+
+static void openAdcRecording (void)
+{
+	const char* filename = getenv ("PIXISIM_ADC_RECORDING");
+	if (!filename || adcRecording.data)
+		return;
+	for (uint i = 0; i < PixiAdcMaxChannels; i++)
+		adcColumns[i] = -1;
+	if (pixi_recordMap (&adcRecording, filename) < 0 || adcRecording.chunkCount == 0)
+	{
+		LIBPIXI_LOG_ERROR("Cannot replay ADC recording %s", filename);
+		pixi_recordUnmap (&adcRecording);
+		return;
+	}
+	for (uint c = 0; c < adcRecording.header->channelCount; c++)
+	{
+		const RecordChannel* channel = &adcRecording.channels[c];
+		if (channel->source == RecordSourceAdc && channel->index < PixiAdcMaxChannels)
+			adcColumns[channel->index] = c;
+	}
+	adcReplayStart = 0;
+}
+
+/// Step through the recording to the frame due at the current time
+static void advanceAdcRecording (void)
+{
+	int64 now = pixi_clockGetNs();
+	if (adcReplayStart == 0)
+	{
+		adcReplayStart = now;
+		adcChunkIndex = 0;
+		adcFrame = 0;
+		pixi_recordGetChunk (&adcRecording, 0, &adcChunk);
+		adcFrameTime = adcChunk.firstTime;
+	}
+	int64 due = adcRecording.chunkTimes[0] + ((now - adcReplayStart) / adcRecording.header->timebaseNs);
+	while (true)
+	{
+		uint next = adcFrame + 1;
+		if (next < adcChunk.frameCount)
+		{
+			int64 time = adcFrameTime + adcChunk.deltas[next];
+			if (time > due)
+				break;
+			adcFrame = next;
+			adcFrameTime = time;
+		}
+		else if (adcChunkIndex + 1 < adcRecording.chunkCount)
+		{
+			if (adcRecording.chunkTimes[adcChunkIndex + 1] > due)
+				break;
+			pixi_recordGetChunk (&adcRecording, ++adcChunkIndex, &adcChunk);
+			adcFrame = 0;
+			adcFrameTime = adcChunk.firstTime;
+		}
+		else
+		{
+			adcReplayStart = 0; // Loop
+			break;
+		}
+	}
+}
+
+static uint16 adcSample (uint channel)
+{
+	int column = adcColumns[channel & (PixiAdcMaxChannels - 1)];
+	if (column < 0)
+		return 0;
+	return recordChunkColumn (&adcChunk, column)[adcFrame];
+}
+
+/// Simulate an ADC128S022: each 2-byte request is answered in the following 2 bytes
+static void simulateAdc (const uint8* tx, uint8* rx, size_t size)
+{
+	if (adcRecording.data)
+		advanceAdcRecording();
+	memset (rx, 0, size);
+	for (size_t i = 2; i + 1 < size; i += 2)
+	{
+		uint16 value = adcRecording.data ? adcSample (tx[i-2] >> 3) : 0;
+		rx[i]   = value >> 8;
+		rx[i+1] = value;
+	}
+}
+
 int pixi_getPiBoardVersion (void)
 {
 	return 2;
@@ -57,6 +156,11 @@ int pixi_spiOpen (uint channel, uint speed, SpiDevice* device)
 
 	if (registers[0] == 0)
 		memcpy (registers, version, sizeof (version));
+	if (channel == PixiAdcSpiChannel)
+	{
+		adcFd = fd;
+		openAdcRecording();
+	}
 
 	return 0;
 }
@@ -69,6 +173,12 @@ int pixi_spiReadWrite (SpiDevice* device, const void* outputBuffer, void* inputB
 	LIBPIXI_PRECONDITION_NOT_NULL(inputBuffer);
 	LIBPIXI_PRECONDITION(bufferSize > 0);
 
+	if (device->fd == adcFd)
+	{
+		simulateAdc (outputBuffer, inputBuffer, bufferSize);
+		return 0;
+	}
+
 	const uint8* command = (uint8*) outputBuffer;
 	uint8 address  = command[0];
 	uint8 function = command[1];
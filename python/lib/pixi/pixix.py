@@ -19,24 +19,25 @@
 from __future__ import print_function
 from pixitools import pi, pixi
 from os import getenv, strerror
-from time import sleep
 import logging
 
 log = logging.getLogger(__name__)
 info = log.info
 debug = log.debug
 
-def pause():
-	sleep (0.1)
-
 LcdLineLen = 40
 
 class Lcd (object):
 	def __init__(self, filename = None):
 		self.filename = filename # persistent state, since we cannot read from the panel
 		pixi.lcdEnable()
+		self.frame = pixi.LcdFrameBuffer()
+		pixi.lcdFrameInit (self.frame)
 		self.lines = [' ' * LcdLineLen, ' ' * LcdLineLen]
+		self.cursor = (0, 0)
 		self.loadState()
+		# The panel contents are unknown, so the first flush redraws all of this
+		pixi.lcdFrameSetText (self.frame, '\n'.join (self.lines))
 
 	def __del__(self):
 		self.close()
@@ -61,26 +62,35 @@ class Lcd (object):
 
 	def write (self, text):
 #		info ("Writing panel text [%s]", text)
-		pixi.lcdWriteStr (text)
-		pause()
+		# Through the frame, so it keeps track of what the panel shows
+		x, y = self.cursor
+		count = pixi.lcdFrameWrite (self.frame, x, y, text)
+		if count > 0:
+			line = self.lines[y]
+			self.lines[y] = (line[:x] + text[:count] + line[x + count:])[:LcdLineLen]
+			self.cursor = (x + count, y)
+		pixi.lcdFrameFlush (self.frame)
+		self.saveState()
 
 	def flush (self):
 		pass
 
 	def clear (self):
 		pixi.lcdClear()
-		pause()
+		pixi.lcdFrameSetText (self.frame, '')
+		pixi.lcdFrameInvalidate (self.frame)
+		self.lines = [' ' * LcdLineLen, ' ' * LcdLineLen]
+		self.cursor = (0, 0)
 
 	def setCursorPos (self, x, y):
-		pixi.lcdSetCursorPos (x, y)
-		pause()
+		# Applied by the next write, which positions each changed run itself.
+		# Masked as pixi.lcdSetCursorPos does, so any row is valid.
+		self.cursor = (x & 0x3F, y & 1)
 
 	def setBrightness (self, brightness):
 		pixi.lcdSetBrightness (brightness)
-		pause()
 
 	def setText (self, text):
-		# TODO: only send changes, instead of everything
 		lines = text.split('\n')
 		if len (lines) == 0:
 			lines = ['','']
@@ -108,12 +118,19 @@ class Lcd (object):
 		self.writeBuffer()
 
 	def writeBuffer (self):
-		lines = self.lines
-		self.setCursorPos (0, 0)
-		self.write (lines[0] + lines[1])
+		# Only the characters that changed are sent to the panel. The
+		# library paces its writes to the panel, so there's no need to wait.
+		pixi.lcdFrameSetText (self.frame, '\n'.join (self.lines))
+		pixi.lcdFrameFlush (self.frame)
 		self.saveState()
 
 ServoA1 = 0x40
 ServoA2 = 0x41
 ServoB1 = 0x46
 ServoB2 = 0x47
+
+# PWM channels of the servo outputs, for pixi.servoMove
+ServoChannelA1 = 0
+ServoChannelA2 = 1
+ServoChannelB1 = 6
+ServoChannelB2 = 7
@@ -1,6 +1,6 @@
 from __future__ import print_function
 
-from pixitools.pixi import gpioWritePin, pwmWritePin
+from pixitools.pixi import gpioWritePin, pwmWriteChannels, Uint16Array, PixiPwmCount
 import logging
 
 log = logging.getLogger(__name__)
@@ -16,6 +16,7 @@ pwmBr = 4
 pwmFr = 5
 pwmBl = 6
 pwmFl = 7
+motorPwmMask = (1 << pwmBr) | (1 << pwmFr) | (1 << pwmBl) | (1 << pwmFl)
 
 motorEnabled = False
 
@@ -25,9 +26,15 @@ def enableMotor (enable = True):
 	global motorEnabled
 	motorEnabled = enable
 
-def pwmSet (pin, value):
-#	print ('pwmWritePin', pin, hex (value))
-	pwmWritePin (pin, value)
+def pwmSetMotors (fl, bl, fr, br):
+	"Update all four motors in a single SPI message"
+#	print ('pwmWriteChannels', hex (fl), hex (bl), hex (fr), hex (br))
+	values = Uint16Array (PixiPwmCount)
+	values[pwmFl] = fl
+	values[pwmBl] = bl
+	values[pwmFr] = fr
+	values[pwmBr] = br
+	pwmWriteChannels (motorPwmMask, values)
 
 motorFlags = [0, 0x8000] # forward, reverse
 
@@ -40,10 +47,7 @@ def moveRover (leftSide, rightSide, speed):
 	fr = pwm + motorFlags[    rightSide]
 	br = pwm + motorFlags[not rightSide]
 
-	pwmSet (pwmFr, fr)
-	pwmSet (pwmBl, bl)
-	pwmSet (pwmBr, br)
-	pwmSet (pwmFl, fl) # Must write to this pin last!
+	pwmSetMotors (fl, bl, fr, br)
 
 def moveRoverX (speedL, speedR):
 	pwmL = (abs(speedL) * 1023 / 100) & 0x000003ff
@@ -55,10 +59,7 @@ def moveRoverX (speedL, speedR):
 	fr = pwmR + motorFlags[speedR < 0]
 	br = pwmR + motorFlags[speedR > 0]
 
-	pwmSet (pwmFr, fr)
-	pwmSet (pwmBl, bl)
-	pwmSet (pwmBr, br)
-	pwmSet (pwmFl, fl) # Must write to this pin last!
+	pwmSetMotors (fl, bl, fr, br)
 
 def moveForward  (speed):
 	moveRover (forwards, forwards, speed)
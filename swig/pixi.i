@@ -31,18 +31,29 @@
 #include <libpixi/pixi/spi.h>
 #include <libpixi/pixi/lcd.h>
 #include <libpixi/pixi/mpu.h>
+#include <libpixi/pixi/mpu-attitude.h>
+#include <libpixi/pixi/mpu-calibration.h>
 #include <libpixi/pixi/pwm.h>
+#include <libpixi/pixi/pwm-motion.h>
+#include <libpixi/pixi/servo.h>
 #include <libpixi/pixi/fpga.h>
 #include <libpixi/pixi/registers.h>
 %}
 %include <stdint.i>
+%include <carrays.i>
 %include <libpixi/common.h>
+%array_class(uint16, Uint16Array); // e.g. for pwmWriteChannels
+%array_class(int, IntArray); // e.g. for pwmMotionMoveTo
 %include <libpixi/pixi/adc.h>
 %include <libpixi/pixi/gpio.h>
 %include <libpixi/pixi/spi.h>
 %include <libpixi/pixi/lcd.h>
 %include <libpixi/pixi/mpu.h>
+%include <libpixi/pixi/mpu-attitude.h>
+%include <libpixi/pixi/mpu-calibration.h>
 %include <libpixi/pixi/pwm.h>
+%include <libpixi/pixi/pwm-motion.h>
+%include <libpixi/pixi/servo.h>
 %include <libpixi/pixi/fpga.h>
 %include <libpixi/pixi/registers.h>
 